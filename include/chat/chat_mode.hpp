@@ -1,9 +1,13 @@
 #pragma once
 
 #include "models/model_loader.hpp"
+#include "models/semantic_cache.hpp"
+#include "tools/tool_executor.hpp"
+#include "tools/workspace_index.hpp"
 #include <string>
 #include <vector>
 #include <atomic>
+#include <mutex>
 
 
 namespace zweek {
@@ -21,6 +25,12 @@ struct Message {
   std::string content;
 };
 
+// File kept in every prompt (see ChatMode::Pin)
+struct PinnedFile {
+  std::string path; // Absolute
+  std::string content;
+};
+
 // Chat mode handler
 class ChatMode {
 public:
@@ -30,6 +40,24 @@ public:
   // Load chat model (TinyLlama-Chat)
   bool LoadModel(const std::string &model_path);
 
+  // Load the model and pre-decode the fixed system prompt. Safe to call
+  // from a background thread; Chat waits for it.
+  bool Warmup();
+
+  // Re-run the hardware autotuner for the chat model
+  std::string Retune();
+
+  // Reproducible sampling; identical questions replay cached answers
+  void SetDeterminism(models::DeterminismMode mode) {
+    model_loader_.SetDeterminism(mode);
+  }
+  models::DeterminismMode GetDeterminism() const {
+    return model_loader_.GetDeterminism();
+  }
+
+  // Context and KV cache summary of the loaded model
+  std::string DescribeModel() { return model_loader_.Describe(); }
+
   // Unload to free memory
   void UnloadModel();
   
@@ -38,12 +66,41 @@ public:
     history_manager_ = history_mgr; 
   }
 
-  // Chat with context
+  // Paths named in messages resolve against its working directory (the
+  // one /cd changes), not the process's
+  void SetToolExecutor(tools::ToolExecutor* tool_executor) {
+    tool_executor_ = tool_executor;
+  }
+
+  // Chat with workspace snippets included in the user turn
   std::string Chat(const std::string &user_message,
-                   const std::vector<std::string> &context_files,
+                   const std::vector<tools::Snippet> &context,
                    std::function<void(const std::string &)> stream_callback,
                    std::atomic<bool>* interrupt_flag = nullptr);
 
+  // Speculatively decode the prompt for a new turn while the router is
+  // still classifying it. Returns false if cancelled or the model is missing.
+  bool PrefillTurn(const std::string &user_message,
+                   const std::vector<tools::Snippet> &context,
+                   std::atomic<bool>* cancel_flag);
+
+  // Roll back KV cells written by PrefillTurn when the turn was not a chat
+  void DiscardPrefill();
+
+  // Pin a file: keep it in every prompt, right after the system prompt.
+  // That prefix is prefilled once and saved as a KV snapshot, so later
+  // questions about the file start generating without decoding it again,
+  // even after a restart. Returns a one-line report.
+  std::string Pin(const std::string &path, const std::string &content);
+  bool Unpin(const std::string &path);
+  void UnpinAll();
+  std::vector<std::string> GetPinnedFiles() const;
+
+  // New contents of a pinned file (ignored if it isn't pinned); the prefix
+  // is rebuilt on the next turn. A file that no longer fits the pinned
+  // token limit is unpinned; the returned report says so ("" otherwise).
+  std::string UpdatePinned(const std::string &path, const std::string &content);
+
   // Get conversation history
   const std::vector<Message> &GetHistory() const { return history_; }
 
@@ -54,10 +111,34 @@ public:
   void LoadSessionHistory();
 
 private:
+  // Load the default chat model unless already loaded
+  bool EnsureModelLoaded();
+
+  // System block with the pinned files: the prefix every prompt starts with
+  std::string SystemPrompt() const;
+
+  // Bring the pinned prefix into the KV cache, restoring its snapshot if
+  // something else replaced it. Does nothing without pinned files.
+  bool PreparePinnedPrefix(std::atomic<bool>* interrupt_flag);
+
+  // Full ChatML prompt for the next turn (system with pinned files, recent
+  // history, context snippets, message)
+  std::string BuildPrompt(const std::string &user_message,
+                          const std::vector<tools::Snippet> &context) const;
+
+  // Append a finished turn to memory and the session log
+  void RecordTurn(const std::string &user_message, const std::string &response);
+
   bool model_loaded_ = false;
+  std::mutex load_mutex_;
+  size_t prefill_mark_ = 0; // Cached tokens reused by the speculative prefill
   std::vector<Message> history_;
+  std::vector<PinnedFile> pinned_;
+  mutable std::mutex pin_mutex_; // pinned_ is also updated by the file watcher
   models::ModelLoader model_loader_;
+  models::SemanticCache semantic_cache_; // Answers to similar earlier questions
   history::HistoryManager* history_manager_ = nullptr;
+  tools::ToolExecutor* tool_executor_ = nullptr;
 };
 
 } // namespace chat
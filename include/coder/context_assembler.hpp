@@ -0,0 +1,65 @@
+#pragma once
+
+#include "tools/tool_executor.hpp"
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace zweek {
+namespace coder {
+
+// A coder prompt split for fill-in-the-middle: the model writes the
+// replacement for region_text between prefix and suffix
+struct AssembledContext {
+  std::string prefix;      // Ranked context, the target file up to the region, the instruction
+  std::string suffix;      // The target file after the region
+  std::string path;        // Target file ("" if no file could be read)
+  uint32_t first_line = 0; // Region being rewritten (1-based, inclusive)
+  uint32_t last_line = 0;
+  std::string region_text; // Its current contents
+  size_t n_tokens = 0;     // Counted tokens of prefix and suffix
+};
+
+// Builds the coder's context from file paths within a token budget. Files
+// are read through the ToolExecutor and cut into line chunks. The first
+// path is the edit target: its chunk most relevant to the instruction
+// becomes the region to rewrite, and the code right around it is kept
+// first. Chunks of the other files fill the rest of the budget in order of
+// relevance. Token counts are cached by chunk content, so unchanged files
+// cost nothing to measure again.
+class ContextAssembler {
+public:
+  // Tokens text encodes to; 0 if unknown (a byte estimate is used then)
+  using TokenCounter = std::function<size_t(const std::string &)>;
+
+  explicit ContextAssembler(TokenCounter count_tokens = nullptr);
+
+  // Files are read through tools (nothing is assembled without one)
+  void SetToolExecutor(tools::ToolExecutor *tools) { tools_ = tools; }
+
+  AssembledContext Assemble(const std::string &instruction,
+                            const std::vector<std::string> &paths, size_t token_budget);
+
+private:
+  struct Chunk {
+    size_t file = 0;      // Index into the paths
+    uint32_t first_line = 0;
+    uint32_t last_line = 0;
+    std::string text;
+    size_t n_tokens = 0;
+    double priority = 0.0;
+  };
+
+  size_t CountTokens(const std::string &text);
+
+  tools::ToolExecutor *tools_ = nullptr;
+  TokenCounter count_tokens_;
+  std::unordered_map<uint64_t, size_t> token_counts_; // Content hash -> tokens
+  std::mutex mutex_;
+};
+
+} // namespace coder
+} // namespace zweek
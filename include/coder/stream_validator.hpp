@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace zweek {
+namespace coder {
+
+// Incremental C/C++ lexer over model output as it streams in. Tracks
+// brackets, braces and parentheses outside comments and literals, and
+// reports output that can no longer turn into valid code: mismatched or
+// stray closers, a literal or comment running far past any sane length,
+// runaway nesting, or text stuck repeating itself. Fenced ``` blocks and
+// both halves of an edit block are validated separately, and text between
+// fenced blocks is treated as prose, so explanations around the code don't
+// trip it.
+class StreamValidator {
+public:
+  // Feed the next piece of output; false once it is malformed
+  bool Feed(const std::string &piece);
+
+  bool IsMalformed() const { return malformed_; }
+  const std::string &Reason() const { return reason_; }
+  size_t BytesSeen() const { return n_bytes_; }
+
+  void Reset();
+
+private:
+  enum class State { Code, LineComment, BlockComment, String, Char, RawDelimiter, RawString, Prose };
+
+  void FeedChar(char c);
+  void EndLine();
+  void Open(char c);
+  void Close(char c);
+  bool IsRepeating() const;
+  void Fail(std::string reason);
+  void ResetBlock(State state);
+
+  State state_ = State::Code;
+  bool in_fence_ = false;
+  std::vector<char> brackets_; // Open ( [ {, innermost last
+  int stray_closers_ = 0;      // Closers seen with nothing open (partial snippets)
+  std::vector<std::vector<char>> conditionals_; // brackets_ at each open #if
+
+  char prev_ = 0;  // Last two characters, for two-character tokens
+  char prev2_ = 0; // and raw string prefixes
+  size_t literal_bytes_ = 0;
+  int literal_lines_ = 0;
+  std::string raw_delimiter_;
+  std::string raw_end_; // Tail of a raw string, matched against ")delim\""
+
+  std::string line_;    // Current line, for fences and edit markers
+  std::string recent_;  // Recent output, for repetition checks
+  size_t since_check_ = 0;
+  size_t n_bytes_ = 0;
+
+  bool malformed_ = false;
+  std::string reason_;
+};
+
+} // namespace coder
+} // namespace zweek
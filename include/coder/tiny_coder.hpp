@@ -4,6 +4,7 @@
 #include <vector>
 #include <functional>
 #include <atomic>
+#include "coder/context_assembler.hpp"
 #include "models/model_loader.hpp"
 
 namespace zweek {
@@ -18,25 +19,73 @@ struct CodeEdit {
 
 class TinyCoder {
 public:
+  // Candidates sampled side by side by GenerateCandidates
+  static constexpr int MAX_CANDIDATES = 3;
+
   TinyCoder();
   ~TinyCoder();
 
+  // Files named in requests are read through tool_executor
+  void SetToolExecutor(tools::ToolExecutor *tool_executor) {
+    assembler_.SetToolExecutor(tool_executor);
+  }
+
   // Load the tiny coder model (StarCoder)
   bool LoadModel(const std::string &model_path);
   void UnloadModel();
 
-  // Generate code edits based on a plan and file context
+  // Generate code edits based on a plan and the files it concerns (paths;
+  // the first is the edit target). The prompt is a fill-in-the-middle
+  // split around the target region, within a token budget. Output is
+  // validated as it streams: malformed output stops generation early and
+  // is retried once; if that fails too, no edits are returned and
+  // GetLastError() says why, so the caller can escalate.
   std::vector<CodeEdit> GenerateEdits(const std::string &instruction,
                                       const std::vector<std::string> &files,
                                       std::function<void(const std::string &)> stream_callback,
                                       std::atomic<bool>* interrupt_flag = nullptr);
 
+  // Best-of-N: sample up to n_candidates answers in one batched pass that
+  // decodes the prompt once. Each is validated as it streams and malformed
+  // ones stop early. on_candidate(i, edits) runs as each well-formed
+  // candidate finishes, so the caller can check it while the others are
+  // still generating; setting stop_flag ends the rest. Returns how many
+  // candidates were delivered (GetLastError() explains zero).
+  int GenerateCandidates(const std::string &instruction,
+                         const std::vector<std::string> &files, int n_candidates,
+                         std::function<void(int, std::vector<CodeEdit>)> on_candidate,
+                         std::atomic<bool>* interrupt_flag = nullptr,
+                         std::atomic<bool>* stop_flag = nullptr);
+
+  const std::string &GetLastError() const { return last_error_; }
+
+  // Edit blocks in model output:
+  //   File: <path>
+  //   <<<<<<< ORIGINAL
+  //   <exact lines to replace>
+  //   =======
+  //   <replacement>
+  //   >>>>>>> UPDATED
+  // Prose before a block becomes its explanation.
+  static std::vector<CodeEdit> ParseEdits(const std::string &response);
+
 private:
   zweek::models::ModelLoader model_loader_;
   bool model_loaded_ = false;
+  std::string last_error_;
+
+  ContextAssembler assembler_;
+  AssembledContext context_; // Of the last prompt: where a FIM answer goes
 
+  bool EnsureLoaded();
+
+  // Fill-in-the-middle prompt for the instruction, or an edit-block
+  // prompt when none of the files can be read
   std::string ConstructPrompt(const std::string &instruction,
                               const std::vector<std::string> &files);
+
+  // Edit blocks in the answer, or else the answer as the region's new text
+  std::vector<CodeEdit> EditsFrom(const std::string &response) const;
 };
 
 } // namespace coder
@@ -51,6 +51,23 @@ public:
   void SetDirectoryChangeCallback(std::function<void(const std::string&)> callback) {
     directory_change_callback_ = callback;
   }
+
+  // Set callback that re-runs the hardware autotuner and returns a report
+  void SetTuneCallback(std::function<std::string()> callback) {
+    tune_callback_ = callback;
+  }
+
+  // Set callback that describes the loaded models (context, KV memory)
+  void SetModelsCallback(std::function<std::string()> callback) {
+    models_callback_ = callback;
+  }
+
+  // Set callback that searches the working directory (pattern, regex,
+  // ignore_case) and returns the formatted matches
+  void SetSearchCallback(
+      std::function<std::string(const std::string&, bool, bool)> callback) {
+    search_callback_ = callback;
+  }
   
   // Get list of available commands for autocomplete
   std::vector<std::string> GetAvailableCommands() const;
@@ -62,6 +79,9 @@ private:
   chat::ChatMode* chat_mode_ = nullptr;
   tools::ToolExecutor* tool_executor_ = nullptr;
   std::function<void(const std::string&)> directory_change_callback_;
+  std::function<std::string()> tune_callback_;
+  std::function<std::string()> models_callback_;
+  std::function<std::string(const std::string&, bool, bool)> search_callback_;
   std::vector<std::string> cached_sessions_;
 };
 
@@ -56,6 +56,10 @@ public:
   std::string RestoreFile(const std::string& file_path, int version = -1);
   std::vector<FileSnapshot> GetFileHistory(const std::string& file_path);
 
+  // Unified diff between two snapshots of a file (versions as in
+  // RestoreFile, -1 = most recent); a missing version diffs as empty
+  std::string DiffSnapshots(const std::string& file_path, int from_version, int to_version = -1);
+
   // Query operations
   std::vector<Operation> GetRecentOperations(int limit = 50);
   std::vector<Operation> GetOperationsByType(const std::string& operation_type, int limit = 50);
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <optional>
+#include <string>
+#include <vector>
+
+// Forward declare llama.cpp types
+struct llama_model;
+
+namespace zweek {
+namespace models {
+
+// Per-model execution settings chosen by the autotuner
+struct TuneSettings {
+  int n_threads = 4;       // Threads for token generation
+  int n_threads_batch = 4; // Threads for prompt processing
+  int n_batch = 512;       // Logical batch size
+  int n_ubatch = 512;      // Physical (micro) batch size
+};
+
+// First-run hardware autotuner. Runs a short prefill and decode
+// microbenchmark per model and caches the fastest settings in
+// ~/.zweek/tuning.json, keyed by CPU model and model hash.
+class Autotuner {
+public:
+  // Cached settings for this model on this machine, tuning on first use
+  static TuneSettings GetSettings(const std::string &model_path,
+                                  llama_model *model);
+
+  // Run the benchmark (ignoring the cache) and store the result
+  static TuneSettings Tune(const std::string &model_path, llama_model *model);
+
+  // Cached settings only
+  static std::optional<TuneSettings> Lookup(const std::string &model_path);
+
+  // Conservative settings when tuning is impossible
+  static TuneSettings Defaults();
+
+  // One-line summary for status output
+  static std::string Describe(const TuneSettings &settings);
+
+  // CPU brand string plus logical core count
+  static std::string GetCpuModel();
+
+  static std::string GetCachePath();
+
+private:
+  static std::string CacheKey(const std::string &model_path);
+  static void Store(const std::string &model_path, const TuneSettings &settings);
+  static std::vector<int> ThreadCandidates(int max_threads);
+};
+
+} // namespace models
+} // namespace zweek
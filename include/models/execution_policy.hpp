@@ -0,0 +1,43 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+// Forward declare ggml types
+struct ggml_threadpool;
+
+namespace zweek {
+namespace models {
+
+// Where and how inference threads run. By default llama's workers are kept
+// off one core (reserved for the TUI and tool work) and run at low
+// scheduling priority so the interface stays responsive during generation.
+//
+// Override the CPU set with ZWEEK_INFERENCE_CPUS, e.g. "2-7,10".
+struct ExecutionPolicy {
+  std::vector<int> inference_cpus; // Logical CPUs inference may use
+  bool low_priority = true;        // Run inference below the UI thread
+
+  // Policy for this process (environment parsed once)
+  static const ExecutionPolicy &Get();
+
+  // Number of inference threads that fit the CPU set
+  int MaxThreads() const;
+
+  // Clamp a requested thread count to the CPU set
+  int ClampThreads(int n_threads) const;
+
+  // Create a ggml thread pool with n_threads workers confined to the CPU
+  // set. Free with ggml_threadpool_free. Returns nullptr on failure.
+  ggml_threadpool *CreateThreadPool(int n_threads) const;
+
+  // Human-readable summary, e.g. "CPUs 1-7, low priority"
+  std::string Describe() const;
+
+  // Parse "0-3,6,8-9" into a CPU list (invalid parts are ignored, CPUs past
+  // GGML_MAX_N_THREADS dropped)
+  static std::vector<int> ParseCpuList(const std::string &spec);
+};
+
+} // namespace models
+} // namespace zweek
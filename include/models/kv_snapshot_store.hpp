@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace zweek {
+namespace models {
+
+// Saved KV cache states of prompt prefixes (the chat system prompt with
+// pinned files), so a prefix is decoded once per model and restored from
+// disk afterwards. One file per prefix, named by its key. Each holds the
+// prefix's full KV cells, so only the MAX_SNAPSHOTS most recently used are
+// kept.
+class KvSnapshotStore {
+public:
+  static constexpr size_t MAX_SNAPSHOTS = 8;
+
+  explicit KvSnapshotStore(const std::string &directory);
+
+  // Process-wide store in ~/.zweek/cache/kv
+  static KvSnapshotStore &Instance();
+
+  // Key for a prefix: its tokens, the model file hash and the KV cache
+  // layout (element types) the cells were written with
+  static uint64_t MakeKey(const std::vector<int32_t> &tokens, uint64_t model_hash,
+                          uint64_t layout_hash);
+
+  std::string PathFor(uint64_t key) const;
+  bool Contains(uint64_t key) const;
+
+  // Mark a snapshot as just used, so pruning keeps it
+  void Touch(uint64_t key);
+
+  // Delete all but the MAX_SNAPSHOTS most recently used snapshots
+  void Prune();
+
+private:
+  std::string directory_;
+  std::mutex mutex_;
+};
+
+} // namespace models
+} // namespace zweek
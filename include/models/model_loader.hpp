@@ -1,18 +1,54 @@
 #pragma once
 
+#include "models/autotuner.hpp"
 #include <string>
 #include <vector>
 #include <functional>
 #include <atomic>
+#include <cstdint>
+#include <mutex>
 
 // Forward declare llama.cpp types
 struct llama_model;
 struct llama_context;
 struct llama_sampler;
+struct ggml_threadpool;
 
 namespace zweek {
 namespace models {
 
+// Element type of the KV cache
+enum class KvCacheType {
+  F16,  // llama.cpp default
+  Q8_0, // ~half the memory of F16, negligible quality loss
+  Q4_0  // ~quarter of F16
+};
+
+// Per-model context configuration
+struct ContextOptions {
+  int n_ctx = 512;     // Initial context size
+  int n_ctx_max = 0;   // Grow on demand up to this size (0 = fixed at n_ctx)
+  KvCacheType type_k = KvCacheType::F16;
+  KvCacheType type_v = KvCacheType::F16;
+  bool flash_attn = false; // Forced on for a quantized V cache (llama.cpp requirement)
+  bool embeddings = false; // Embedding model: use Embed() instead of Infer()
+  int n_parallel = 1;      // Candidates InferCandidates() can decode side by side
+};
+
+// How PrefillSnapshot brought a prefix into the KV cache
+struct PrefixPrefill {
+  size_t n_tokens = 0;   // Prefix length
+  size_t n_decoded = 0;  // Tokens decoded (0 if already cached or restored)
+  bool restored = false; // Cells were loaded from a saved snapshot
+};
+
+// Sampling reproducibility
+enum class DeterminismMode {
+  Off,       // Random seed (default)
+  FixedSeed, // Same sampler chain, fixed seed reset before every request
+  Greedy     // Always pick the most likely token
+};
+
 // Model loader with GBNF and resident support
 class ModelLoader {
 public:
@@ -21,9 +57,11 @@ public:
 
   // Load model and keep it resident (never unload automatically)
   bool LoadResident(const std::string &model_path, int n_ctx = 512);
+  bool LoadResident(const std::string &model_path, const ContextOptions &options);
 
   // Load model temporarily
   bool Load(const std::string &model_path, int n_ctx = 512);
+  bool Load(const std::string &model_path, const ContextOptions &options);
 
   // Run inference with optional GBNF grammar and interrupt flag
   std::string Infer(const std::string &prompt, const std::string &grammar,
@@ -31,6 +69,62 @@ public:
                     std::function<void(const std::string &)> stream_callback,
                     std::atomic<bool>* interrupt_flag = nullptr);
 
+  // Sample up to n_candidates (capped by ContextOptions::n_parallel)
+  // continuations of prompt side by side. The prompt is decoded once into
+  // sequence 0 and shared with one sequence per candidate; each step then
+  // decodes the next token of every live candidate in a single batch, each
+  // with its own sampler. on_piece(i, piece) streams candidate i and
+  // returns false to stop it. on_finished(i, text) runs for each candidate
+  // that ends on its own (end of generation or max_tokens), not for stopped
+  // ones. Returns every candidate's text.
+  std::vector<std::string> InferCandidates(
+      const std::string &prompt, int n_candidates, int max_tokens,
+      std::function<bool(int, const std::string &)> on_piece,
+      std::function<void(int, const std::string &)> on_finished,
+      std::atomic<bool>* interrupt_flag = nullptr);
+
+  // Decode a prompt prefix into the KV cache ahead of time. A later Infer()
+  // whose prompt starts with the same text only decodes the remainder.
+  // Checks interrupt_flag between batches; returns false if interrupted.
+  // n_reused receives how many leading tokens were already cached.
+  bool Prefill(const std::string &prefix,
+               std::atomic<bool>* interrupt_flag = nullptr,
+               size_t* n_reused = nullptr);
+
+  // Make the KV cache start with prefix (e.g. a system prompt carrying
+  // pinned files). What isn't already cached is restored from a snapshot
+  // saved for this prefix, model and cache layout, or else decoded once and
+  // saved as one, so the prefix is only ever decoded once per model. Later
+  // prompts starting with it decode just the rest. Returns false if
+  // interrupted or the prefix doesn't fit the context.
+  bool PrefillSnapshot(const std::string &prefix,
+                       std::atomic<bool>* interrupt_flag = nullptr,
+                       PrefixPrefill* prefill = nullptr);
+
+  // Pooled, L2-normalized sentence embedding of text (embedding models
+  // only). Input beyond the context size is truncated.
+  bool Embed(const std::string &text, std::vector<float> &embedding);
+
+  // Tokens text encodes to with the loaded vocabulary (0 if none is loaded).
+  // Served from the token cache for text seen before.
+  size_t CountTokens(const std::string &text);
+
+  // Drop KV cells beyond the first n_tokens (rollback after speculation)
+  void TruncateCache(size_t n_tokens);
+
+  // Return an elastic context to its initial size, e.g. after the
+  // conversation was cleared. Cached tokens are kept if they still fit.
+  void ShrinkContext();
+
+  // Switch sampling mode. Deterministic modes also enable the on-disk
+  // response cache: identical requests replay the stored answer.
+  void SetDeterminism(DeterminismMode mode);
+  DeterminismMode GetDeterminism() const { return determinism_; }
+
+  // Re-run the hardware autotuner for the loaded model and rebuild the
+  // context with the new settings. Returns a summary for display.
+  std::string Retune();
+
   // Unload model (only if not resident)
   void Unload();
 
@@ -40,12 +134,102 @@ public:
   // Check if model is resident
   bool IsResident() const { return is_resident_; }
 
+  // Estimated KV cache size of the loaded model for the given cache types
+  size_t GetKvCacheBytes(KvCacheType type_k, KvCacheType type_v);
+
+  // Context size, KV memory (vs. an F16 cache) and attention kernel
+  std::string Describe();
+
+  static const char *KvCacheTypeName(KvCacheType type);
+
 private:
   llama_model *model_ = nullptr;
   llama_context *ctx_ = nullptr;
   llama_sampler *sampler_ = nullptr;
+  ggml_threadpool *threadpool_ = nullptr;       // Generation workers
+  ggml_threadpool *threadpool_batch_ = nullptr; // Prompt processing workers
   bool is_resident_ = false;
   int n_ctx_ = 512;
+  ContextOptions options_;
+  DeterminismMode determinism_ = DeterminismMode::Off;
+  uint64_t model_hash_ = 0;
+  std::string model_path_;
+  TuneSettings tune_settings_;
+
+  // Vocabulary identity, part of token cache keys
+  uint64_t vocab_hash_ = 0;
+
+  // Special tokens by first byte, longest first; prompts are split into
+  // segments in front of them (see Tokenize)
+  struct SpecialToken {
+    std::string text;
+    bool cut = true; // False if llama.cpp strips whitespace to its left
+  };
+  std::vector<std::vector<SpecialToken>> special_tokens_;
+  size_t max_special_length_ = 0;
+  bool segmentable_ = false; // Segments tokenize exactly like the whole
+
+  // Tokens currently held in the KV cache (sequence 0), used to skip
+  // re-decoding the shared prefix of consecutive prompts
+  std::vector<int32_t> cached_tokens_;
+
+  // Serializes loading and inference on this context
+  std::mutex mutex_;
+
+  // Create ctx_ for model_ with n_ctx_, options_ and tune_settings_, running on
+  // thread pools confined by the ExecutionPolicy (caller holds mutex_)
+  bool CreateContext();
+
+  // Free ctx_ and its thread pools (caller holds mutex_)
+  void FreeContext();
+
+  // Make room for n_tokens cells, growing an elastic context geometrically
+  // (up to n_ctx_max) and migrating the cached sequence into it. Returns
+  // false if n_tokens exceeds the cap (caller holds mutex_).
+  bool EnsureContextCapacity(size_t n_tokens);
+
+  // Recreate the context with new_n_ctx cells, carrying over the cached
+  // sequence state (caller holds mutex_)
+  bool ResizeContext(int new_n_ctx);
+
+  // (Re)build sampler_ for determinism_ (caller holds mutex_)
+  void BuildSampler();
+
+  // New sampler chain for determinism_ with the given seed
+  llama_sampler *NewSampler(uint32_t seed) const;
+
+  // Hash of the sampler configuration, part of the response cache key
+  uint64_t SamplerHash() const;
+
+  // Free sampler, context and model (caller holds mutex_)
+  void FreeModel();
+
+  // Hash the vocabulary and index its special tokens (caller holds mutex_)
+  void LoadVocabInfo();
+
+  // Start offsets of the segments Tokenize splits text into
+  std::vector<size_t> SegmentText(const std::string &text) const;
+
+  // Length of the special token matching at text[pos] that llama.cpp is
+  // sure to split out, or 0
+  size_t CutAt(const std::string &text, size_t pos) const;
+
+  // Tokenize text with the model vocabulary. The text is cut into segments
+  // in front of special tokens, where llama.cpp splits it anyway, so each
+  // segment (a system prompt, a history message, file context) tokenizes
+  // on its own to exactly its share of the whole. Segments come from the
+  // token cache when seen before; the rest are tokenized in parallel.
+  std::vector<int32_t> Tokenize(const std::string &text, bool add_special = true);
+
+  // Bring the KV cache in line with tokens, decoding only what is not
+  // already cached. Leaves logits for the last token.
+  bool DecodePrompt(const std::vector<int32_t> &tokens,
+                    std::atomic<bool>* interrupt_flag = nullptr,
+                    size_t* n_reused = nullptr);
+
+  // Replace sequence 0 with the snapshot at path if it holds exactly
+  // tokens; on failure the cache is left empty (caller holds mutex_)
+  bool RestoreSnapshot(const std::string &path, const std::vector<int32_t> &tokens);
 
   // Internal inference
   std::string RunInference(const std::string &prompt,
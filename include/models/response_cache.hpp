@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace zweek {
+namespace models {
+
+// On-disk cache of complete model responses for deterministic requests.
+// Records are appended to a single log file; an in-memory index maps each
+// key to its record so lookups read only the matching response. Several
+// instances may share the log: appends happen under a lock file, and a
+// lookup checks the record header before using its bytes.
+//
+// Record layout: magic (u32) | key (u64) | length (u32) | response bytes
+class ResponseCache {
+public:
+  explicit ResponseCache(const std::string &path);
+
+  // Process-wide cache in ~/.zweek/cache/responses.log
+  static ResponseCache &Instance();
+
+  // Key for a request: final prompt tokens, model file hash, sampler
+  // configuration, grammar and generation limit
+  static uint64_t MakeKey(const std::vector<int32_t> &tokens,
+                          uint64_t model_hash, uint64_t sampler_hash,
+                          const std::string &grammar, int max_tokens);
+
+  bool Lookup(uint64_t key, std::string &response);
+  void Store(uint64_t key, const std::string &response);
+
+  size_t Size();
+
+private:
+  struct Entry {
+    uint64_t offset; // Start of the response bytes
+    uint32_t length;
+  };
+
+  // Index records appended since end_offset_ (by any instance), stopping
+  // at a torn trailing record; starts over if the log was replaced
+  void LoadIndex();
+
+  std::string path_;
+  std::unordered_map<uint64_t, Entry> index_;
+  uint64_t end_offset_ = 0; // End of the last complete record
+  std::mutex mutex_;
+};
+
+} // namespace models
+} // namespace zweek
@@ -0,0 +1,83 @@
+#pragma once
+
+#include "models/model_loader.hpp"
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace zweek {
+namespace models {
+
+// Answers to earlier questions, matched by meaning instead of exact text.
+// Questions are embedded with a small embedding model and kept as a
+// row-major float16 matrix that is scanned with SIMD cosine similarity.
+// A hit also requires every file the answer was based on to be unchanged.
+//
+// Entries persist in ~/.zweek/cache/semantic.bin:
+//   header: magic (u32) | dim (u32) | embedding model hash (u64)
+//   record: magic (u32) | file count (u32) | answer length (u32) |
+//           embedding (f16 x dim) | files (path length u32, path, hash u64)
+//           | answer bytes
+class SemanticCache {
+public:
+  SemanticCache();
+
+  // Load the embedding model and stored entries. Returns false if the
+  // embedding model is missing, which disables the cache.
+  bool EnsureLoaded();
+
+  // Stored answer for a question similar to this one whose files still
+  // have the recorded contents
+  bool Lookup(const std::string &question, const std::vector<std::string> &files,
+              std::string &answer);
+
+  // Remember an answer and the contents of the files it was based on
+  void Store(const std::string &question, const std::vector<std::string> &files,
+             const std::string &answer);
+
+  size_t Size();
+
+  // Dot products of a normalized query with n_rows normalized float16
+  // rows (i.e. cosine similarities)
+  static void Similarities(const float *query, const uint16_t *rows,
+                           size_t n_rows, size_t dim, float *scores);
+
+private:
+  struct FileStamp {
+    std::string path;
+    uint64_t hash;
+  };
+
+  struct Entry {
+    std::vector<FileStamp> files;
+    std::string answer;
+  };
+
+  // Normalized embedding, or false for questions too short to match safely
+  bool EmbedQuestion(const std::string &question, std::vector<float> &embedding);
+
+  static std::string EncodeRecord(const std::vector<uint16_t> &row,
+                                  const Entry &entry);
+
+  // Caller holds mutex_
+  void LoadEntries();
+  bool AppendRecord(const std::vector<uint16_t> &row, const Entry &entry);
+  void Compact();
+
+  ModelLoader embedder_;
+  std::mutex load_mutex_;
+  bool load_attempted_ = false;
+  bool available_ = false;
+  uint64_t model_hash_ = 0;
+
+  std::string path_;
+  size_t dim_ = 0;
+  std::vector<uint16_t> matrix_; // entries_.size() rows of dim_ float16
+  std::vector<Entry> entries_;
+  uint64_t end_offset_ = 0;      // End of the last complete record
+  std::mutex mutex_;
+};
+
+} // namespace models
+} // namespace zweek
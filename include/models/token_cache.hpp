@@ -0,0 +1,64 @@
+#pragma once
+
+#include "util/mapped_file.hpp"
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace zweek {
+namespace models {
+
+// On-disk cache of token ids for prompt segments (the system prompt,
+// history messages, file context), so a long prompt is assembled from
+// stored arrays instead of being tokenized again. Records are appended to a
+// single log that is memory-mapped for lookups; an in-memory index maps
+// each key to its tokens. The log starts over once it outgrows its cap.
+// Several instances may share the log: appends happen under a lock file,
+// a restart replaces the file instead of truncating it, and a lookup
+// checks the record header before using its tokens.
+//
+// Log layout: magic (u32) | generation (u64) | records
+// Record layout: magic (u32) | key (u64) | count (u32) | token ids (i32 each)
+class TokenCache {
+public:
+  explicit TokenCache(const std::string &path);
+
+  // Process-wide cache in ~/.zweek/cache/tokens.log
+  static TokenCache &Instance();
+
+  // Key for a segment: its text, the vocabulary it was tokenized with and
+  // whether special tokens (BOS) were added
+  static uint64_t MakeKey(const std::string &text, uint64_t vocab_hash, bool add_special);
+
+  bool Lookup(uint64_t key, std::vector<int32_t> &tokens);
+  void Store(uint64_t key, const std::vector<int32_t> &tokens);
+
+  size_t Size();
+
+private:
+  struct Entry {
+    uint64_t offset; // Start of the token ids
+    uint32_t count;
+  };
+
+  // Index records appended since end_offset_ (by any instance), stopping
+  // at a torn trailing record; starts over for a new log generation
+  // (caller holds mutex_)
+  void LoadIndex();
+
+  // Replace the log with an empty one of a new generation (caller holds
+  // mutex_ and the file lock)
+  bool StartLog();
+
+  std::string path_;
+  util::MappedFile mapping_; // Remapped when a lookup lands past its end
+  std::unordered_map<uint64_t, Entry> index_;
+  uint64_t generation_ = 0; // Of the indexed log; 0 if there is none
+  uint64_t end_offset_ = 0; // End of the last complete record
+  std::mutex mutex_;
+};
+
+} // namespace models
+} // namespace zweek
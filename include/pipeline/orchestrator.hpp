@@ -1,13 +1,19 @@
 #pragma once
 
 #include "chat/chat_mode.hpp"
+#include "coder/tiny_coder.hpp"
 #include "commands/command_handler.hpp"
 #include "history/history_manager.hpp"
 #include "pipeline/router.hpp"
+#include "tools/compiler_check.hpp"
+#include "tools/search_engine.hpp"
 #include "tools/tool_executor.hpp"
+#include "tools/workspace_index.hpp"
+#include "util/thread_pool.hpp"
 #include <functional>
 #include <string>
 #include <atomic>
+#include <mutex>
 
 
 namespace zweek {
@@ -19,20 +25,25 @@ public:
   Orchestrator();
   ~Orchestrator();
 
-  // Main entry point - processes user request
-  void ProcessRequest(const std::string &user_request);
+  // Main entry point - processes user request. cancel_flag is the
+  // per-request cancellation token polled during inference.
+  void ProcessRequest(const std::string &user_request,
+                      std::atomic<bool>* cancel_flag = nullptr);
 
   // Set working directory
   void SetWorkingDirectory(const std::string &path);
 
+  // Load the router and chat models in the background and pre-decode their
+  // fixed prompt prefixes. Requests arriving meanwhile only wait for the
+  // model they actually use.
+  void StartWarmup();
+
   // Set callbacks for UI updates
   void SetProgressCallback(std::function<void(const std::string &)> callback);
   void SetResponseCallback(std::function<void(const std::string &)> callback);
   void SetStreamCallback(std::function<void(const std::string &)> callback);
   void SetDirectoryUpdateCallback(std::function<void(const std::string &)> callback);
-  
-  // Set interrupt flag for cancellation
-  void SetInterruptFlag(std::atomic<bool>* flag) { interrupt_flag_ = flag; }
+  void SetStatusCallback(std::function<void(const std::string &)> callback);
   
   // Get history manager for external use
   history::HistoryManager* GetHistoryManager() { return &history_manager_; }
@@ -40,26 +51,69 @@ public:
   // Get command handler for external use
   commands::CommandHandler* GetCommandHandler() { return &command_handler_; }
 
+  // The code pipeline's passing candidate waits for approval, unless
+  // auto-apply (the TUI's Auto mode) writes it right away
+  void SetAutoApply(bool auto_apply) { auto_apply_ = auto_apply; }
+
+  // Write or drop the edits waiting for approval. Returns what happened,
+  // "" if nothing was pending. Thread-safe.
+  std::string AcceptPendingEdits();
+  std::string RejectPendingEdits();
+
 private:
+  // A coder candidate after checking: the files it rewrites, or why it
+  // was rejected
+  struct CandidateCheck {
+    bool ok = false;
+    std::vector<std::pair<std::string, std::string>> files; // Path, new content
+    std::string error;
+  };
+
   // Workflow handlers
-  void RunCodePipeline(const std::string &request);
-  void RunChatMode(const std::string &request);
-  void RunToolMode(const std::string &request);
+  void RunCodePipeline(const std::string &request,
+                       const std::vector<tools::Snippet> &context,
+                       std::atomic<bool>* cancel_flag);
+  void RunChatMode(const std::string &request,
+                   const std::vector<tools::Snippet> &context,
+                   std::atomic<bool>* cancel_flag);
+  void RunToolMode(const std::string &request, std::atomic<bool>* cancel_flag);
+
+  // Apply a candidate's edits in memory and syntax-check the C++ files
+  // they produce (thread-safe; runs on thread_pool_)
+  CandidateCheck CheckCandidate(const std::vector<coder::CodeEdit> &edits);
+
+  // Path relative to the working directory made absolute
+  std::string ResolvePath(const std::string &path) const;
+
+  // Edits waiting for approval, by absolute path so a /cd doesn't move them
+  std::vector<std::pair<std::string, std::string>> pending_edits_;
+  std::mutex pending_mutex_;
+  std::atomic<bool> auto_apply_{false};
 
   Router router_;
   chat::ChatMode chat_mode_;
+  coder::TinyCoder coder_;
   commands::CommandHandler command_handler_;
   history::HistoryManager history_manager_;
   tools::ToolExecutor tool_executor_;
+  tools::CompilerCheck compiler_check_;   // Uses the project's compile_commands.json
+  tools::WorkspaceIndex workspace_index_; // Rooted at the working directory
+  tools::FileWatcher file_watcher_;       // Feeds workspace_index_; stops first
+  tools::SearchEngine search_engine_;     // TOOL workflow and /grep
 
   // Callbacks
   std::function<void(const std::string &)> progress_callback_;
   std::function<void(const std::string &)> response_callback_;
   std::function<void(const std::string &)> stream_callback_;
   std::function<void(const std::string &)> directory_update_callback_;
-  
-  // Interrupt flag
-  std::atomic<bool>* interrupt_flag_ = nullptr;
+  std::function<void(const std::string &)> status_callback_;
+
+  // Warm-up progress
+  std::atomic<int> warmup_done_{0};
+
+  // Background workers; declared last so pending tasks finish before the
+  // models they reference are destroyed
+  util::ThreadPool thread_pool_{2};
 };
 
 } // namespace pipeline
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace zweek {
+namespace pipeline {
+
+// Scheduling priority; higher runs first, FIFO within a priority
+enum class RequestPriority {
+  Normal, // Model work (chat, code generation)
+  High    // Slash commands and deterministic tools
+};
+
+// Per-request cancellation flag, shared between the scheduler and the
+// inference code that polls it
+using CancelToken = std::shared_ptr<std::atomic<bool>>;
+
+// Owns the single inference worker. Requests are queued (bounded),
+// executed one at a time so they never share model contexts concurrently,
+// and can be cancelled individually.
+class RequestScheduler {
+public:
+  using Handler =
+      std::function<void(const std::string &request, std::atomic<bool> *cancel_flag)>;
+
+  explicit RequestScheduler(Handler handler, size_t max_queued = 8);
+
+  // Calls Shutdown()
+  ~RequestScheduler();
+
+  RequestScheduler(const RequestScheduler &) = delete;
+  RequestScheduler &operator=(const RequestScheduler &) = delete;
+
+  // Queue a request. Returns false if the queue is full or shutting down.
+  bool Submit(const std::string &request, RequestPriority priority);
+
+  // Cancel the running request; queued ones still run
+  void CancelCurrent();
+
+  // Cancel the running request and drop everything queued
+  void CancelAll();
+
+  // Stop accepting work, cancel everything and join the worker
+  void Shutdown();
+
+  // Requests waiting behind the running one
+  size_t QueuedCount();
+
+  // True while a request is executing
+  bool IsBusy() const { return busy_.load(); }
+
+  // Commands ("/...") jump ahead of model work
+  static RequestPriority PriorityFor(const std::string &request);
+
+private:
+  struct Job {
+    std::string request;
+    RequestPriority priority;
+    uint64_t sequence;
+    CancelToken cancel;
+  };
+
+  // Priority queue ordering: higher priority first, then submission order
+  struct JobOrder {
+    bool operator()(const Job &a, const Job &b) const {
+      if (a.priority != b.priority) {
+        return a.priority < b.priority;
+      }
+      return a.sequence > b.sequence;
+    }
+  };
+
+  void WorkerLoop();
+
+  Handler handler_;
+  size_t max_queued_;
+
+  std::priority_queue<Job, std::vector<Job>, JobOrder> queue_;
+  CancelToken current_cancel_;
+  uint64_t next_sequence_ = 0;
+  bool stopping_ = false;
+  std::atomic<bool> busy_{false};
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::thread worker_;
+};
+
+} // namespace pipeline
+} // namespace zweek
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "models/model_loader.hpp"
+#include <mutex>
 #include <string>
 
 
@@ -37,11 +38,25 @@ public:
   // Load the router model (SmolLM-135M) as resident
   bool LoadModel(const std::string &model_path);
 
+  // Load the model and pre-decode the fixed classification prompt prefix.
+  // Safe to call from a background thread; ClassifyIntent waits for it.
+  bool Warmup();
+
+  // Re-run the hardware autotuner for the router model
+  std::string Retune();
+
+  // Context and KV cache summary of the loaded model
+  std::string DescribeModel() { return model_loader_.Describe(); }
+
   // Unload to free memory
   void UnloadModel();
 
 private:
+  // Load the default router model unless already loaded
+  bool EnsureModelLoaded();
+
   bool model_loaded_ = false;
+  std::mutex load_mutex_;
   models::ModelLoader model_loader_;
 };
 
@@ -0,0 +1,75 @@
+#pragma once
+
+#include "tools/file_watcher.hpp"
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace zweek {
+namespace tools {
+
+// How one translation unit is compiled, reduced to what a syntax check
+// needs (no -c, -o or dependency-file options). Paths in the flags are
+// absolute, so the check doesn't have to run in the entry's directory.
+struct CompileCommand {
+  std::string file; // Absolute, normalized
+  std::vector<std::string> flags;
+};
+
+// The project's compile_commands.json plus a reverse include graph, to
+// answer "which translation units does editing this file affect". Each
+// file's #include lines are parsed once and resolved against the unit's
+// own include path (includer's directory, -iquote, -I; system headers are
+// not followed). Changed files are re-parsed lazily after ApplyChanges.
+class CompileDatabase {
+public:
+  // Load compile_commands.json from project_dir or its build/ directory
+  bool Load(const std::string &project_dir);
+  bool IsLoaded();
+  size_t Size();
+
+  // Command for a translation unit; false if it isn't one
+  bool Find(const std::string &file, CompileCommand &out);
+
+  // Units whose compilation reads path (the unit itself, or any that
+  // include it directly or indirectly)
+  std::vector<CompileCommand> AffectedUnits(const std::string &path);
+
+  // FileWatcher listener
+  void ApplyChanges(const ChangeBatch &batch);
+
+  // "#include <name>" or "#include "name"": returns '<' or '"' and sets
+  // name, or returns 0 for any other line
+  static char ParseIncludeLine(const std::string &line, std::string &name);
+
+  // Split a shell command line (quotes and backslash escapes)
+  static std::vector<std::string> SplitCommand(const std::string &command);
+
+private:
+  struct Include {
+    std::string name;
+    bool system;
+  };
+
+  bool LoadLocked(const std::string &project_dir);
+  const std::vector<Include> &IncludesOf(const std::string &file);
+  std::string Resolve(const std::string &includer, const Include &include,
+                      const std::vector<std::string> &quote_dirs,
+                      const std::vector<std::string> &dirs);
+  void BuildGraphLocked();
+
+  std::string project_dir_;
+  std::string database_path_;
+  std::vector<CompileCommand> units_;
+  std::unordered_map<std::string, size_t> unit_index_; // File -> units_ index
+
+  std::unordered_map<std::string, std::vector<Include>> parsed_;
+  std::unordered_map<std::string, std::string> resolved_; // Lookup key -> file ("" if none)
+  std::unordered_map<std::string, std::vector<size_t>> includers_; // File -> units reading it
+  bool graph_valid_ = false;
+  std::mutex mutex_;
+};
+
+} // namespace tools
+} // namespace zweek
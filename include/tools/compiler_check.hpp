@@ -1,11 +1,44 @@
 #pragma once
 
+#include "tools/compile_database.hpp"
+#include "util/thread_pool.hpp"
+#include <cstdint>
+#include <future>
+#include <list>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
 namespace zweek {
 namespace tools {
 
-// Compiler-based code validation (replaces Gatekeeper model)
+// Files an edit would write, checked in place of their versions on disk
+// (absolute path, new contents)
+using StagedFiles = std::vector<std::pair<std::string, std::string>>;
+
+struct CheckResult {
+  bool ok = false;
+  std::string errors;  // Compiler diagnostics (or why no compiler ran)
+  bool cached = false; // Served from the result cache
+};
+
+// Compiler-based code validation (replaces Gatekeeper model). Uses the
+// system clang++ or g++ (CXX overrides) in -fsyntax-only mode, cl.exe /Zs
+// on Windows. Checks run in parallel on a pool, each in a private temp
+// directory, so concurrent checks never share file names. Results are
+// cached by a hash of the code, the flags, the compiler and the contents
+// of every project header the code includes, so rechecking unchanged code
+// is free. A set of system headers seen twice gets a precompiled header,
+// which later checks with the same includes load instead of reparsing.
+// With a compile_commands.json loaded, project files are checked with
+// their real flags, and an edit rechecks only the units it affects.
+// Checks may stage a set of edited files: copies of them in the work
+// directory are searched ahead of the include directories they replace,
+// so a header and the source using it are checked together before either
+// is written.
 class CompilerCheck {
 public:
   CompilerCheck();
@@ -20,11 +53,93 @@ public:
   // Check specific file
   bool CheckFile(const std::string &filepath);
 
+  // Thread-safe variants. Code snippets resolve quoted includes against
+  // include_dir and the -I flags, staged files first.
+  CheckResult Check(const std::string &code, const std::vector<std::string> &flags = {},
+                    const std::string &include_dir = ".", const StagedFiles &staged = {});
+  CheckResult CheckPath(const std::string &filepath, const std::vector<std::string> &flags = {});
+
+  // Queue a check on the worker pool
+  std::future<CheckResult> CheckAsync(std::string code, std::vector<std::string> flags = {},
+                                      std::string include_dir = ".");
+
+  // Check several snippets in parallel; results in input order
+  std::vector<CheckResult> CheckAll(const std::vector<std::string> &codes,
+                                    const std::vector<std::string> &flags = {});
+
+  // Use the project's compile_commands.json (or build/compile_commands.json)
+  bool LoadCompileDatabase(const std::string &project_dir);
+  CompileDatabase &GetCompileDatabase() { return database_; }
+
+  // After editing path, check every unit that reads it, in parallel with
+  // each unit's own flags. Without a database entry, a source file is
+  // checked on its own and a header yields no results. With staged files,
+  // the units see those instead of the files on disk.
+  std::vector<std::pair<std::string, CheckResult>>
+  CheckAffected(const std::string &path, const StagedFiles &staged = {});
+
+  // FileWatcher listener: keeps the include graph current
+  void ApplyChanges(const ChangeBatch &batch) { database_.ApplyChanges(batch); }
+
+  bool HasCompiler() const { return !compiler_.empty(); }
+  const std::string &CompilerPath() const { return compiler_; }
+
 private:
+  enum class Kind { Gcc, Clang, Msvc };
+
+  struct Job {
+    std::string source;  // File to compile; empty for a snippet
+    std::string code;    // The snippet
+    std::vector<std::string> flags;
+    std::string include_dir;
+    StagedFiles staged;
+  };
+
+  struct PchState {
+    int seen = 0;
+    bool building = false;
+    bool ready = false;
+    bool failed = false;
+    std::string header; // Path passed to -include / -include-pch
+  };
+
+  CheckResult Run(Job job);
+  CheckResult Compile(const Job &job, const std::string &work_dir);
+
+  // Write the job's staged files under work_dir and add the include flags
+  // that put them ahead of the originals; false if they can't be written
+  bool StageFiles(const Job &job, const std::string &work_dir,
+                  std::vector<std::string> &args) const;
+
+  // Cache key: code, flags, compiler and the project headers it pulls in
+  uint64_t Fingerprint(const Job &job, const std::string &text) const;
+
+  // Precompiled header for the code's system includes, once worth building
+  std::string PrecompiledHeaderFor(const std::string &text, const std::vector<std::string> &flags);
+
+  std::string AcquireWorkDir();
+  void ReleaseWorkDir(std::string dir);
+
+  std::vector<std::string> BaseArgs(const std::vector<std::string> &flags) const;
+
   std::string errors_;
+  CompileDatabase database_;
+
+  std::string compiler_;
+  Kind kind_ = Kind::Gcc;
+  uint64_t compiler_id_ = 0; // Path, size and mtime of the binary
+  std::string root_dir_;     // Private temp root holding work dirs and PCHs
+
+  std::mutex mutex_;
+  std::vector<std::string> free_work_dirs_;
+  size_t n_work_dirs_ = 0;
+  std::unordered_map<uint64_t, CheckResult> results_;
+  std::list<uint64_t> result_order_; // Oldest first, for eviction
+  std::unordered_map<uint64_t, std::shared_future<CheckResult>> in_flight_;
+  std::unordered_map<uint64_t, PchState> pch_;
 
-  // Run MSVC syntax-only check
-  bool RunSyntaxCheck(const std::string &filepath);
+  // Reset first in the destructor, so no check outlives the state above
+  std::unique_ptr<util::ThreadPool> pool_;
 };
 
 } // namespace tools
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace zweek {
+namespace tools {
+
+// One hunk of a unified diff. Starts are 1-based as printed in the header
+// ("@@ -old_start,old_count +new_start,new_count @@"); an empty side
+// starts at the line before it.
+struct DiffHunk {
+  size_t old_start = 0;
+  size_t old_count = 0;
+  size_t new_start = 0;
+  size_t new_count = 0;
+  std::vector<std::string> lines; // ' ', '-' or '+' then the line, no newline
+};
+
+// Line diff (plan-mode review, GetDiff, history snapshots). Lines are
+// hashed a word at a time and interned to integer ids, so the algorithms
+// compare ids only. Histogram diff anchors on the rarest lines shared by
+// both sides, which keeps moved blocks and brace-only lines from producing
+// the interleaved hunks plain Myers gives; regions where every shared line
+// is too common fall back to linear-space Myers O(ND).
+class DiffEngine {
+public:
+  static constexpr size_t DEFAULT_CONTEXT = 3;
+
+  // Hunks turning old_text into new_text; empty if they are equal
+  static std::vector<DiffHunk> Diff(std::string_view old_text, std::string_view new_text,
+                                    size_t context = DEFAULT_CONTEXT);
+
+  // "--- old_label" / "+++ new_label" followed by the hunks; "" if equal
+  static std::string Unified(const std::string &old_label, const std::string &new_label,
+                             std::string_view old_text, std::string_view new_text,
+                             size_t context = DEFAULT_CONTEXT);
+};
+
+} // namespace tools
+} // namespace zweek
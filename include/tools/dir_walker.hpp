@@ -0,0 +1,91 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace zweek {
+namespace tools {
+
+// A file or directory found by a walk
+struct WalkEntry {
+  std::string path; // Relative to the walk root, '/'-separated
+  uint64_t size = 0;
+  int64_t mtime = 0; // std::filesystem::file_time_type ticks
+  bool is_directory = false;
+};
+
+struct WalkOptions {
+  bool recursive = true;
+  bool respect_ignore_files = true; // .gitignore, .ignore and .git/info/exclude
+  bool skip_binary = true;          // By extension, then a NUL in the first block
+  bool include_directories = false; // Also report directories (not only files)
+  uintmax_t max_file_bytes = 0;     // 0 = no limit
+  size_t n_threads = 0;             // 0 = hardware concurrency, at most 8
+};
+
+// Recursive directory walker shared by the tools that scan the workspace
+// (index, search, /ls -r). Directories are spread over worker threads that
+// each keep a local stack and steal from the others when they run dry, so
+// one deep subtree doesn't serialize the walk.
+//
+// Listings are cached per directory and reused while the directory's mtime
+// (and its ignore files) are unchanged, so repeated walks only stat files
+// instead of re-reading directories, ignore rules and binary probes.
+// Symlinked directories are not followed.
+class DirWalker {
+public:
+  // Called for each entry; return false to stop the walk early. Calls are
+  // serialized but come from worker threads, in no particular order.
+  using Visitor = std::function<bool(const WalkEntry &)>;
+
+  explicit DirWalker(WalkOptions options = {});
+  ~DirWalker();
+
+  DirWalker(const DirWalker &) = delete;
+  DirWalker &operator=(const DirWalker &) = delete;
+
+  // Stream the entries under root to visitor as they are found
+  void Walk(const std::string &root, const Visitor &visitor,
+            const std::atomic<bool> *cancel = nullptr);
+
+  // All entries under root, sorted by path
+  std::vector<WalkEntry> Collect(const std::string &root,
+                                 const std::atomic<bool> *cancel = nullptr);
+
+  // Drop cached listings
+  void ClearCache();
+
+  // Build output, dependency and hidden directories, which are never walked
+  // (or watched, or indexed) whether or not an ignore file lists them
+  static bool IsSkippedDirectory(const std::string &path);
+
+  // Extensions of formats that are never text (.o, .png, .gguf, ...)
+  static bool HasBinaryExtension(const std::string &path);
+
+private:
+  struct Listing;
+  struct IgnoreRules;
+  struct Task;
+  class Queues;
+
+  // Cached listing for dir, re-read when stale
+  std::shared_ptr<const Listing> GetListing(const std::string &dir);
+
+  // List one directory: report its entries, queue its subdirectories
+  bool VisitDirectory(const Task &task, Queues &queues, size_t worker,
+                      const Visitor &visitor, std::mutex &visitor_mutex);
+
+  WalkOptions options_;
+
+  std::unordered_map<std::string, std::shared_ptr<const Listing>> cache_;
+  std::mutex cache_mutex_;
+};
+
+} // namespace tools
+} // namespace zweek
@@ -0,0 +1,88 @@
+#pragma once
+
+#include "tools/file_watcher.hpp"
+#include "util/mapped_file.hpp"
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+namespace zweek {
+namespace tools {
+
+// Contents of a file as of one read. Large files stay memory-mapped, small
+// ones are copied; either way Text() is valid for as long as the handle is
+// held, even after the cache evicts or replaces the entry.
+class CachedFile {
+public:
+  std::string_view Text() const { return text_; }
+  uint64_t Size() const { return text_.size(); }
+
+private:
+  friend class FileCache;
+
+  util::MappedFile mapping_;
+  std::string copy_;
+  std::string_view text_;
+
+  // Identity the contents were read under
+  uint64_t device_ = 0;
+  uint64_t inode_ = 0;
+  int64_t mtime_ = 0;
+};
+
+using FileHandle = std::shared_ptr<const CachedFile>;
+
+// Read-through cache of file contents shared by the tools (ReadFile, diffs,
+// compile checks, context assembly). Every Get re-stats the file and reuses
+// the entry only if device, inode, mtime and size all still match, so an
+// edit or an atomic-rename save is never served stale. Entries are evicted
+// least-recently-used once the cached bytes exceed the budget; a
+// FileWatcher can drop changed files early through ApplyChanges.
+//
+// A mapped file truncated in place by another process can still fault on
+// access, as with any mmap reader; editors and git replace files instead.
+class FileCache {
+public:
+  explicit FileCache(size_t byte_budget = DEFAULT_BYTE_BUDGET);
+
+  // Contents of path, or null if it can't be read
+  FileHandle Get(const std::string &path);
+
+  // Drop one path (after writing it), or everything
+  void Invalidate(const std::string &path);
+  void Clear();
+
+  // FileWatcher listener
+  void ApplyChanges(const ChangeBatch &batch);
+
+  size_t Bytes();
+  size_t Count();
+
+  static constexpr size_t DEFAULT_BYTE_BUDGET = 128u << 20;
+
+private:
+  struct Entry {
+    FileHandle file;
+    std::list<std::string>::iterator lru; // Position in lru_
+  };
+
+  static std::string Key(const std::string &path);
+
+  // Read path from disk; null on failure
+  static std::shared_ptr<CachedFile> Load(const std::string &path, uint64_t size);
+
+  void EraseLocked(std::unordered_map<std::string, Entry>::iterator it);
+
+  size_t byte_budget_;
+  size_t bytes_ = 0;
+  std::unordered_map<std::string, Entry> entries_;
+  std::list<std::string> lru_; // Most recently used first
+  std::mutex mutex_;
+};
+
+} // namespace tools
+} // namespace zweek
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace zweek {
+namespace tools {
+
+// Debounced set of changes under the watched root (absolute paths)
+struct ChangeBatch {
+  std::vector<std::string> modified; // Created or written
+  std::vector<std::string> removed;  // Deleted or moved away (files or directories)
+  bool overflow = false;             // Events were lost: assume anything changed
+};
+
+// Watches the directory tree under a root and publishes change batches to
+// subscribers (workspace index, file caches). Uses inotify on Linux and
+// falls back to periodic mtime scans elsewhere, or when inotify is
+// unavailable or out of watches. Build output and hidden directories are
+// not watched. Listeners run on the watcher thread.
+class FileWatcher {
+public:
+  using Listener = std::function<void(const ChangeBatch &)>;
+
+  FileWatcher();
+  ~FileWatcher(); // Stops the watcher thread
+
+  FileWatcher(const FileWatcher &) = delete;
+  FileWatcher &operator=(const FileWatcher &) = delete;
+
+  // Watch a new root (stops watching the previous one)
+  void Start(const std::string &root);
+  void Stop();
+
+  // Returns an id for Unsubscribe
+  size_t Subscribe(Listener listener);
+  void Unsubscribe(size_t id);
+
+  // True while inotify (rather than polling) is in use
+  bool IsNative() const { return native_; }
+
+private:
+  void Run(const std::string &root);
+
+  // Event loop; returns false if inotify can't be used for this tree
+  bool RunInotify(const std::string &root);
+
+  // Fallback: compare mtimes and sizes every scan interval
+  void RunPolling(const std::string &root);
+
+  void Publish(const ChangeBatch &batch);
+
+  // Sleep for up to ms, returning early (true) when stopping
+  bool WaitForStop(int ms);
+
+  std::thread thread_;
+  std::atomic<bool> stopping_{false};
+  std::atomic<bool> native_{false};
+  std::mutex stop_mutex_;
+  std::condition_variable stop_cv_;
+  int wake_fd_ = -1; // eventfd that interrupts poll() on Stop (Linux)
+
+  std::map<size_t, Listener> listeners_;
+  size_t next_listener_id_ = 1;
+  std::mutex listeners_mutex_;
+};
+
+} // namespace tools
+} // namespace zweek
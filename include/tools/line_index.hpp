@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace zweek {
+namespace tools {
+
+// Sparse line-start index of a file: the byte offset of every
+// LINES_PER_CHECKPOINT-th line. A line is found by seeking to the nearest
+// checkpoint and scanning at most that many lines, so the index stays a
+// small fraction of the file and ranged reads touch only the bytes they
+// return. Built by streaming the file in fixed-size chunks with a SIMD
+// newline count, so peak memory does not depend on the file size.
+class LineIndex {
+public:
+  static constexpr uint32_t LINES_PER_CHECKPOINT = 128;
+
+  // Index a file; null if it can't be read
+  static std::shared_ptr<const LineIndex> Build(const std::string &path);
+
+  // Byte window [begin, end) of lines first..last (1-based, inclusive,
+  // clamped to the file). The window ends after last's newline.
+  bool LineRange(const std::string &path, uint32_t first, uint32_t last,
+                 uint64_t &begin, uint64_t &end) const;
+
+  uint64_t LineCount() const { return line_count_; }
+
+  // Identity of the indexed file, for cache validation
+  uint64_t FileSize() const { return size_; }
+  int64_t FileMTime() const { return mtime_; }
+
+  // Number of '\n' bytes (SSE2 where available)
+  static size_t CountNewlines(const char *data, size_t size);
+
+private:
+  std::vector<uint64_t> checkpoints_; // Start of lines 1, 1 + N, 1 + 2N, ...
+  uint64_t line_count_ = 0;
+  uint64_t size_ = 0;
+  int64_t mtime_ = 0;
+};
+
+// Up to length bytes of a file from offset (short at end of file)
+bool ReadFileRange(const std::string &path, uint64_t offset, size_t length,
+                   std::string &out);
+
+// Read a file chunk_bytes at a time, reusing one buffer; the visitor
+// returns false to stop. False if the file can't be opened.
+bool ForEachFileChunk(const std::string &path, size_t chunk_bytes,
+                      const std::function<bool(std::string_view)> &visitor);
+
+} // namespace tools
+} // namespace zweek
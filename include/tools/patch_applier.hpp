@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace zweek {
+namespace tools {
+
+// Replace original_snippet with new_content (a coder::CodeEdit without the
+// file and explanation)
+struct SnippetEdit {
+  std::string original_snippet;
+  std::string new_content;
+};
+
+enum class PatchStatus {
+  Applied,      // Snippet found verbatim (up to whitespace)
+  AppliedFuzzy, // Found within the edit-distance bound
+  NotFound,
+  Ambiguous,    // Equally good matches in more than one place
+  Conflict,     // Overlaps an edit applied earlier in the batch
+};
+
+struct PatchOutcome {
+  PatchStatus status = PatchStatus::NotFound;
+  size_t begin = 0;    // Replaced byte range in the original text
+  size_t end = 0;
+  size_t distance = 0; // Edits between the snippet and the matched text
+};
+
+struct PatchResult {
+  std::string text;                   // Input with every applied edit
+  std::vector<PatchOutcome> outcomes; // One per edit, in input order
+  size_t n_applied = 0;
+
+  bool AllApplied() const { return n_applied == outcomes.size(); }
+};
+
+struct PatchOptions {
+  double max_error_rate = 0.1; // Fuzzy bound, as a fraction of the snippet
+  size_t max_distance = 64;    // Absolute cap on that bound
+  bool reindent = true;        // Shift new_content to the matched indentation
+};
+
+// Applies model-written snippet edits to a text. Small models copy the
+// snippet with whitespace drift and the odd changed character, so matching
+// runs on whitespace-collapsed text: one rolling-hash pass over the target
+// finds candidate positions for every edit at once (several anchors per
+// snippet, so a typo near the start doesn't hide the match), each candidate
+// is checked exactly, and only if none matches is a banded edit distance
+// run around the candidates. All edits are then spliced in a single pass,
+// so a batch costs time linear in the text no matter how many edits.
+class PatchApplier {
+public:
+  static PatchResult Apply(std::string_view text, const std::vector<SnippetEdit> &edits,
+                           const PatchOptions &options = PatchOptions());
+
+  static const char *StatusName(PatchStatus status);
+};
+
+} // namespace tools
+} // namespace zweek
@@ -0,0 +1,82 @@
+#pragma once
+
+#include "tools/dir_walker.hpp"
+#include "util/thread_pool.hpp"
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace zweek {
+namespace tools {
+
+struct SearchOptions {
+  bool regex = false;       // ECMAScript regex instead of a literal
+  bool ignore_case = false;
+  size_t max_matches = 2000; // The search stops once this many lines matched
+};
+
+struct LineMatch {
+  uint32_t line = 0; // 1-based
+  std::string text;  // The matching line, trimmed to a display length
+};
+
+// Matches in one file
+struct FileMatches {
+  std::string path; // Relative to the search root
+  int64_t mtime = 0;
+  std::vector<LineMatch> lines;
+};
+
+struct SearchResult {
+  std::vector<FileMatches> files; // Ranked: path hits first, then most recent
+  size_t n_matches = 0;
+  size_t n_files_searched = 0;
+  bool truncated = false; // Stopped at max_matches
+  double elapsed_ms = 0.0;
+  std::string error; // Invalid regex
+};
+
+// Deterministic code search (the TOOL workflow and /grep). Files come from
+// the parallel DirWalker, so ignore rules and binary detection are shared
+// with the index, and are searched on a thread pool while the walk is still
+// running. Literals are found with an SSE2 first/last-byte prefilter (memchr
+// elsewhere); a regex is only run on lines that contain its longest
+// required literal, when it has one. Large files are memory-mapped.
+class SearchEngine {
+public:
+  // Called as each file finishes, in completion order (serialized)
+  using FileCallback = std::function<void(const FileMatches &)>;
+
+  SearchEngine();
+
+  SearchResult Search(const std::string &root, const std::string &pattern,
+                      const SearchOptions &options,
+                      const FileCallback &on_file = nullptr,
+                      const std::atomic<bool> *cancel = nullptr);
+
+  // Turn a natural-language request ("find all TODOs", "where is
+  // 'LoadModel' called") into a pattern. Quoted text is searched literally,
+  // /.../ as a regex, otherwise the remaining keywords (plural stripped) as
+  // alternatives. Smart case: case-insensitive unless the pattern has
+  // uppercase. Returns an empty pattern if nothing searchable is left.
+  static std::string PatternFromRequest(const std::string &request,
+                                        SearchOptions &options);
+
+  // Longest literal every match of a regex must contain ("" if none)
+  static std::string RequiredLiteral(const std::string &regex);
+
+  // "path" followed by "  line: text" rows
+  static std::string FormatMatches(const FileMatches &file);
+
+  // "N matches in M files (x ms)", noting truncation and errors
+  static std::string Summary(const SearchResult &result);
+
+private:
+  DirWalker walker_;
+  util::ThreadPool pool_;
+};
+
+} // namespace tools
+} // namespace zweek
@@ -1,6 +1,17 @@
 #pragma once
 
+#include "tools/dir_walker.hpp"
+#include "tools/file_cache.hpp"
+#include "tools/line_index.hpp"
+#include "tools/patch_applier.hpp"
+#include "tools/write_transaction.hpp"
+#include <functional>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
 namespace zweek {
@@ -22,14 +33,67 @@ public:
 
   // File operations
   std::string ReadFile(const std::string &path);
+
+  // Zero-copy read through the file cache; null if unreadable
+  FileHandle ReadFileShared(const std::string &path);
   bool WriteFile(const std::string &path, const std::string &content);
+
+  // Write several files atomically as one WriteTransaction: all of them
+  // land or none do. The reason for a failure goes to error if given.
+  bool WriteFiles(const std::vector<std::pair<std::string, std::string>> &files,
+                  std::string *error = nullptr);
+
+  // Receives the previous contents of every file a write replaces
+  // (HistoryManager snapshots)
+  void SetSnapshotCallback(WriteTransaction::SnapshotCallback callback) {
+    snapshot_callback_ = std::move(callback);
+  }
   std::vector<std::string> ListDir(const std::string &path);
+
+  // Files under path at any depth (relative, sorted), leaving out ignored,
+  // binary and build output files. Repeated listings reuse the walk cache.
+  std::vector<std::string> ListDirRecursive(const std::string &path);
   
-  // Diff generation
+  // Ranged reads that work on files of any size. Small files are served
+  // from the file cache; larger ones through a cached LineIndex, reading
+  // only the requested window from disk.
+  // Lines first..last (1-based, inclusive, clamped), newlines included
+  std::string ReadLines(const std::string &path, uint32_t first, uint32_t last);
+  // Up to length bytes from offset (capped at MAX_RANGE_BYTES)
+  std::string ReadBytes(const std::string &path, uint64_t offset, size_t length);
+  uint64_t CountLines(const std::string &path);
+
+  // Visit a file in STREAM_CHUNK_BYTES chunks without loading it whole; the
+  // visitor returns false to stop. False if the file can't be opened.
+  bool StreamFile(const std::string &path,
+                  const std::function<bool(std::string_view)> &visitor);
+
+  static constexpr size_t MAX_RANGE_BYTES = 16u << 20;
+  static constexpr size_t STREAM_CHUNK_BYTES = 1u << 20;
+
+  // Apply snippet edits to a file in one pass and write it back if any
+  // applied; per-edit outcomes are in the result
+  PatchResult ApplyEdits(const std::string &path, const std::vector<SnippetEdit> &edits);
+
+  // Cache behind ReadFile (FileWatcher listener target)
+  FileCache &GetFileCache() { return file_cache_; }
+
+  // Unified diff (3 lines of context) of the file on disk against
+  // new_content; "" if they are equal
   std::string GetDiff(const std::string &path, const std::string &new_content);
 
 private:
   std::string working_dir_ = ".";
+  DirWalker walker_;
+  FileCache file_cache_;
+  WriteTransaction::SnapshotCallback snapshot_callback_;
+
+  // Line indexes of large files by resolved path, validated by size and mtime
+  std::unordered_map<std::string, std::shared_ptr<const LineIndex>> line_indexes_;
+  std::mutex line_index_mutex_;
+
+  // Index for a large file, built on first use; null if unreadable
+  std::shared_ptr<const LineIndex> GetLineIndex(const std::string &full_path);
   
   // Helper to resolve path relative to working dir
   std::string ResolvePath(const std::string &path);
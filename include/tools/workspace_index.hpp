@@ -0,0 +1,113 @@
+#pragma once
+
+#include "tools/dir_walker.hpp"
+#include "tools/file_watcher.hpp"
+#include "util/mapped_file.hpp"
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace zweek {
+namespace tools {
+
+// A piece of a workspace file returned by a search
+struct Snippet {
+  std::string path; // Absolute
+  uint32_t start_line = 0; // 1-based, inclusive
+  uint32_t end_line = 0;
+  float score = 0.0f;
+  std::string text;
+};
+
+// Retrieval index over the text files under a workspace root. Files are
+// split into fixed line windows ("chunks") and ranked with BM25 over
+// identifier terms: whole identifiers plus their camelCase/snake_case parts.
+// A trigram table over the term vocabulary lets partial identifiers
+// ("tokeniz") match the terms that contain them.
+//
+// The index is written once to ~/.zweek/index/<root hash>.idx and then
+// memory-mapped, so reopening a workspace only maps the file. Lookups
+// binary-search the mapped term table and touch only the postings of the
+// query terms.
+//
+// Changes after the build go into a small in-memory overlay: changed files
+// are re-indexed individually and hide (tombstone) their entries in the
+// mapped index. The overlay is fed by a FileWatcher via ApplyChanges, by a
+// one-time stat pass after reopening (edits made while not running), and by
+// the freshness check on search results. A full rebuild only happens when
+// the overlay grows large or events were lost.
+class WorkspaceIndex {
+public:
+  WorkspaceIndex();
+  ~WorkspaceIndex(); // Cancels and joins a running build
+
+  WorkspaceIndex(const WorkspaceIndex &) = delete;
+  WorkspaceIndex &operator=(const WorkspaceIndex &) = delete;
+
+  // Switch to a workspace: maps its index, or builds one in the background
+  void SetRoot(const std::string &root);
+
+  // Best chunks for a query, highest score first, whose estimated token
+  // count fits the budget. Empty until the first build finishes.
+  std::vector<Snippet> Search(const std::string &query, size_t token_budget);
+
+  // Rebuild from scratch in the background (queued if a build is running)
+  void Rebuild();
+
+  // Re-index changed files into the overlay (FileWatcher listener)
+  void ApplyChanges(const ChangeBatch &batch);
+
+  bool IsReady();
+  size_t FileCount();
+  size_t ChunkCount();
+
+  // Called from the build thread when indexing starts and finishes
+  void SetStatusCallback(std::function<void(const std::string &)> callback);
+
+  // Terms a piece of text is indexed under (lowercase identifiers and their
+  // parts, stopwords dropped)
+  static std::vector<std::string> Tokenize(const std::string &text);
+
+private:
+  struct Snapshot;
+  struct Overlay;
+
+  // Map the index file for root_; false if missing, stale format or torn.
+  // Overlay entries up to prune_generation are covered by the new index.
+  bool OpenSnapshot(uint64_t prune_generation = 0);
+
+  // Build thread body: walk, chunk and tokenize in parallel, write, map
+  void BuildIndex(const std::string &root, const std::string &index_path);
+
+  // Stat pass over the tree against a reopened index
+  void Reconcile(const std::string &root);
+
+  // Run a full build (or a reconcile) on the build thread
+  void StartBuild(bool full = true);
+  void StopBuild();
+
+  std::string IndexPathFor(const std::string &root) const;
+
+  std::string root_;
+  std::string index_path_;
+  std::shared_ptr<const Snapshot> snapshot_; // Swapped whole; readers copy it
+  std::shared_ptr<const Overlay> overlay_;   // Copy-on-write, like snapshot_
+  uint64_t generation_ = 0;                  // Stamps overlay entries
+  DirWalker walker_;                         // Keeps listings between walks
+  std::function<void(const std::string &)> status_callback_;
+  std::mutex mutex_;
+
+  std::thread build_thread_;
+  std::mutex build_mutex_; // Guards build_thread_
+  std::atomic<bool> building_{false};
+  std::atomic<bool> cancel_build_{false};
+  std::atomic<bool> rebuild_pending_{false};
+};
+
+} // namespace tools
+} // namespace zweek
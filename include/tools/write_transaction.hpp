@@ -0,0 +1,56 @@
+#pragma once
+
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace zweek {
+namespace tools {
+
+// A set of file writes that land together or not at all. Commit writes
+// every file to a temp file beside it, flushes them as one batch (all
+// writebacks are started before any is waited on), renames them into place
+// and flushes each parent directory once. Any failure removes the temp
+// files and restores whatever was already renamed, so a multi-file edit is
+// never left half applied.
+class WriteTransaction {
+public:
+  // Called once per file after a successful commit, with the contents it
+  // replaced (files that didn't exist are skipped)
+  using SnapshotCallback =
+      std::function<void(const std::string &path, const std::string &original)>;
+
+  // Queue content for path; staging a path again replaces its content
+  void Stage(const std::string &path, std::string content);
+
+  bool Empty() const { return files_.empty(); }
+  std::vector<std::string> Paths() const;
+
+  // Apply everything; on failure nothing on disk has changed and Error()
+  // says why. The transaction is empty afterwards either way.
+  bool Commit(const SnapshotCallback &snapshot = nullptr);
+
+  const std::string &Error() const { return error_; }
+
+private:
+  struct StagedFile {
+    std::string path;   // As staged (reported to the snapshot callback)
+    std::string target; // path with symlinks resolved: the file replaced
+    std::string content;
+    std::string original;
+    bool existed = false;
+    unsigned mode = 0;      // Permission bits to keep
+    std::string temp_path;
+    int fd = -1;
+    bool renamed = false;
+  };
+
+  bool WriteTemp(StagedFile &file);
+  void RollBack();
+
+  std::vector<StagedFile> files_;
+  std::string error_;
+};
+
+} // namespace tools
+} // namespace zweek
@@ -46,7 +46,6 @@ struct TUIState {
   int scroll_position = 0; // For manual scrolling (-1 = sticky bottom)
   std::vector<std::string> command_history; // Previous submitted commands
   int history_index = -1; // Current position in history (-1 = not browsing)
-  std::atomic<bool> interrupt_inference_{false}; // Set to true to interrupt model
   
   // Thinking section support
   std::string current_thinking;  // Buffer for thinking content
@@ -79,6 +78,9 @@ public:
   void AppendToLastMessage(const std::string &chunk);
   void SetCurrentDirectory(const std::string &path);
 
+  // Update the status bar text (thread-safe)
+  void SetStatus(const std::string &status);
+
   // Mode switching
   void SetMode(Mode mode);
   Mode GetMode() const { return state_.current_mode; }
@@ -89,13 +91,14 @@ public:
   void SetOnReject(std::function<void()> callback);
   void SetOnModify(std::function<void()> callback);
   void SetOnModeSwitch(std::function<void(Mode)> callback);
+  void SetOnInterrupt(std::function<void()> callback);
   
   // Set command handler for autocomplete
   void SetCommandHandler(zweek::commands::CommandHandler* cmd_handler) {
     command_handler_ = cmd_handler;
   }
   
-  // Access to state (for interrupt flag)
+  // Access to state (for spinner animation)
   TUIState& GetState() { return state_; }
 
 private:
@@ -116,6 +119,7 @@ private:
   std::function<void()> on_reject_;
   std::function<void()> on_modify_;
   std::function<void(Mode)> on_mode_switch_;
+  std::function<void()> on_interrupt_;
   
   // Command handler for autocomplete
   zweek::commands::CommandHandler* command_handler_ = nullptr;
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <string>
+
+namespace zweek {
+namespace util {
+
+// Exclusive advisory lock shared by every process that uses the same lock
+// file, held for the object's lifetime. Guards append-only cache logs that
+// several zweek instances write at once. Blocks until the lock is free;
+// IsLocked() is false if the lock file couldn't be opened.
+class FileLock {
+public:
+  explicit FileLock(const std::string &path);
+  ~FileLock();
+
+  FileLock(const FileLock &) = delete;
+  FileLock &operator=(const FileLock &) = delete;
+
+  bool IsLocked() const { return locked_; }
+
+private:
+  bool locked_ = false;
+#ifdef _WIN32
+  void *handle_ = nullptr;
+#else
+  int fd_ = -1;
+#endif
+};
+
+} // namespace util
+} // namespace zweek
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace zweek {
+namespace util {
+
+constexpr uint64_t HASH_SEED = 0xcbf29ce484222325ULL;
+
+// 64-bit FNV-1a. Pass a previous result as seed to hash incrementally.
+uint64_t HashBytes(const void *data, size_t size, uint64_t seed = HASH_SEED);
+
+inline uint64_t HashString(const std::string &text, uint64_t seed = HASH_SEED) {
+  return HashBytes(text.data(), text.size(), seed);
+}
+
+// Fold a value into a running hash
+inline uint64_t HashCombine(uint64_t seed, uint64_t value) {
+  return HashBytes(&value, sizeof(value), seed);
+}
+
+// Identify a large file (e.g. a GGUF model) without reading all of it:
+// hashes the size plus the first, middle and last megabyte. Returns 0 if
+// the file can't be read.
+uint64_t HashFileSampled(const std::string &path);
+
+// Hash of the whole file contents, for detecting edits to source files.
+// Returns 0 if the file can't be read.
+uint64_t HashFile(const std::string &path);
+
+// Fixed-width lowercase hex, for cache keys and file names
+std::string ToHex(uint64_t value);
+
+} // namespace util
+} // namespace zweek
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+namespace zweek {
+namespace util {
+
+// Read-only memory mapping of a whole file. Empty files map to a null
+// pointer with size 0 and still count as open.
+class MappedFile {
+public:
+  MappedFile() = default;
+  ~MappedFile();
+
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+  MappedFile(MappedFile &&other) noexcept;
+  MappedFile &operator=(MappedFile &&other) noexcept;
+
+  bool Open(const std::string &path);
+  void Close();
+
+  bool IsOpen() const { return open_; }
+  const char *Data() const { return data_; }
+  size_t Size() const { return size_; }
+
+private:
+  const char *data_ = nullptr;
+  size_t size_ = 0;
+  bool open_ = false;
+#ifdef _WIN32
+  void *file_ = nullptr;
+  void *mapping_ = nullptr;
+#endif
+};
+
+} // namespace util
+} // namespace zweek
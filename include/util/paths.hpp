@@ -0,0 +1,16 @@
+#pragma once
+
+#include <string>
+
+namespace zweek {
+namespace util {
+
+// Per-user data directory (~/.zweek, %USERPROFILE%\.zweek on Windows).
+// Falls back to "." if the home directory is unknown.
+std::string GetZweekDirectory();
+
+// Subdirectory of the data directory, created if missing
+std::string GetZweekSubdirectory(const std::string &name);
+
+} // namespace util
+} // namespace zweek
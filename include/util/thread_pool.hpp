@@ -0,0 +1,54 @@
+#pragma once
+
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace zweek {
+namespace util {
+
+// Fixed-size pool of worker threads for background work (model warm-up,
+// indexing, parallel tokenization). Tasks run in FIFO order.
+class ThreadPool {
+public:
+  // n_threads == 0 picks std::thread::hardware_concurrency()
+  explicit ThreadPool(size_t n_threads = 0);
+
+  // Finishes queued tasks, then joins the workers
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  // Queue a task and get a future for its result
+  template <typename F>
+  auto Submit(F &&task) -> std::future<std::invoke_result_t<std::decay_t<F>>> {
+    using Result = std::invoke_result_t<std::decay_t<F>>;
+    auto packaged = std::make_shared<std::packaged_task<Result()>>(
+        std::forward<F>(task));
+    std::future<Result> future = packaged->get_future();
+    Enqueue([packaged]() { (*packaged)(); });
+    return future;
+  }
+
+  size_t Size() const { return workers_.size(); }
+
+private:
+  void Enqueue(std::function<void()> job);
+  void WorkerLoop();
+
+  std::vector<std::thread> workers_;
+  std::queue<std::function<void()>> jobs_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  bool stopping_ = false;
+};
+
+} // namespace util
+} // namespace zweek
@@ -1,19 +1,135 @@
 #include "chat/chat_mode.hpp"
 #include "history/history_manager.hpp"
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <filesystem>
 #include <fstream>
+#include <limits>
 
 namespace zweek {
 namespace chat {
 
+namespace {
+constexpr const char *CHAT_MODEL_PATH = "models/Qwen3-0.6B-Q8_0.gguf";
+
+// ChatML system block that starts every prompt; pinned files go in it
+constexpr const char *CHAT_SYSTEM_INSTRUCTION = "You are a helpful coding assistant.";
+
+// Pinned files may take up to half of the largest chat context
+constexpr size_t MAX_PINNED_TOKENS = 4096;
+
+std::string BuildSystemPrompt(const std::vector<PinnedFile> &pinned) {
+  std::string prompt = std::string("<|im_start|>system\n") + CHAT_SYSTEM_INSTRUCTION;
+  if (!pinned.empty()) {
+    prompt += "\n\nPinned files:\n";
+    for (const auto &file : pinned) {
+      prompt += "// " + file.path + "\n```\n" + file.content;
+      if (!file.content.empty() && file.content.back() != '\n') {
+        prompt += "\n";
+      }
+      prompt += "```\n";
+    }
+  }
+  return prompt + "<|im_end|>\n";
+}
+
+// Files an answer depends on: the context snippets' files plus any word in
+// the message that names an existing file ("what does src/main.cpp do?").
+// Relative paths are taken from working_dir.
+std::vector<std::string> ReferencedFiles(const std::string &message,
+                                         const std::vector<tools::Snippet> &context,
+                                         const std::string &working_dir) {
+  namespace fs = std::filesystem;
+  std::vector<std::string> files;
+  auto add = [&](const std::string &candidate) {
+    if (candidate.empty()) {
+      return;
+    }
+    std::error_code ec;
+    fs::path path = fs::path(working_dir) / candidate; // Absolute candidates stay as they are
+    if (!fs::is_regular_file(path, ec)) {
+      return;
+    }
+    std::string normal = fs::absolute(path, ec).lexically_normal().string();
+    if (!ec && std::find(files.begin(), files.end(), normal) == files.end()) {
+      files.push_back(normal);
+    }
+  };
+
+  for (const auto &snippet : context) {
+    add(snippet.path);
+  }
+
+  std::string word;
+  for (size_t i = 0; i <= message.size(); ++i) {
+    char c = i < message.size() ? message[i] : ' ';
+    if (!std::isspace(static_cast<unsigned char>(c))) {
+      word += c;
+      continue;
+    }
+    // Strip quoting and sentence punctuation around the path
+    size_t begin = word.find_first_not_of("`'\"([");
+    size_t end = word.find_last_not_of("`'\")],.:;?!");
+    if (begin != std::string::npos && end != std::string::npos && end >= begin &&
+        word.find('.', begin) != std::string::npos) {
+      add(word.substr(begin, end - begin + 1));
+    }
+    word.clear();
+  }
+
+  std::sort(files.begin(), files.end());
+  return files;
+}
+} // namespace
+
 ChatMode::ChatMode() {}
 ChatMode::~ChatMode() { UnloadModel(); }
 
 bool ChatMode::LoadModel(const std::string &model_path) {
-  model_loaded_ = model_loader_.Load(model_path, 2048);
+  // A q8_0 KV cache takes ~0.53x the bytes of f16 per cell, so the
+  // budget that used to hold 2048 cells now holds about 4096. The context
+  // starts small and grows with the conversation, so the 8192 cap (twice
+  // the old peak memory) is only paid for by conversations that long.
+  models::ContextOptions options;
+  options.n_ctx = 1024;
+  options.n_ctx_max = 8192;
+  options.type_k = models::KvCacheType::Q8_0;
+  options.type_v = models::KvCacheType::Q8_0;
+  options.flash_attn = true;
+
+  model_loaded_ = model_loader_.Load(model_path, options);
+  return model_loaded_;
+}
+
+bool ChatMode::EnsureModelLoaded() {
+  std::lock_guard<std::mutex> lock(load_mutex_);
+  if (!model_loaded_) {
+    LoadModel(CHAT_MODEL_PATH);
+  }
   return model_loaded_;
 }
 
+bool ChatMode::Warmup() {
+  if (!EnsureModelLoaded()) {
+    return false;
+  }
+  bool ready = model_loader_.Prefill(SystemPrompt());
+
+  // Optional; loads the embedding model so the first lookup isn't slow
+  semantic_cache_.EnsureLoaded();
+  return ready;
+}
+
+std::string ChatMode::Retune() {
+  if (!EnsureModelLoaded()) {
+    return "model not available";
+  }
+  return model_loader_.Retune();
+}
+
 void ChatMode::UnloadModel() {
+  std::lock_guard<std::mutex> lock(load_mutex_);
   model_loader_.Unload();
   model_loaded_ = false;
 }
@@ -23,6 +139,125 @@ void ChatMode::ClearHistory() {
   if (history_manager_) {
     history_manager_->ClearChatHistory();
   }
+
+  // Give back the KV memory the old conversation grew into
+  model_loader_.ShrinkContext();
+}
+
+std::string ChatMode::Pin(const std::string &path, const std::string &content) {
+  if (!EnsureModelLoaded()) {
+    return "Error: Chat model not loaded";
+  }
+
+  std::string prefix;
+  {
+    std::lock_guard<std::mutex> lock(pin_mutex_);
+    std::vector<PinnedFile> pinned = pinned_;
+    auto it = std::find_if(pinned.begin(), pinned.end(),
+                           [&](const PinnedFile &file) { return file.path == path; });
+    if (it != pinned.end()) {
+      it->content = content;
+    } else {
+      pinned.push_back({path, content});
+    }
+
+    prefix = BuildSystemPrompt(pinned);
+    size_t n_tokens = model_loader_.CountTokens(prefix);
+    if (n_tokens > MAX_PINNED_TOKENS) {
+      return "Error: Pinned files would take " + std::to_string(n_tokens) +
+             " tokens (limit " + std::to_string(MAX_PINNED_TOKENS) + ")";
+    }
+    pinned_ = std::move(pinned);
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  models::PrefixPrefill prefill;
+  if (!model_loader_.PrefillSnapshot(prefix, nullptr, &prefill)) {
+    return "Error: Could not prefill " + path;
+  }
+  auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - start)
+                .count();
+
+  std::string how = prefill.restored       ? "restored from snapshot"
+                    : prefill.n_decoded > 0 ? "prefilled in " + std::to_string(ms) + " ms"
+                                            : "already cached";
+  return "Pinned " + path + " (" + std::to_string(prefill.n_tokens) +
+         " tokens with the system prompt, " + how + ")";
+}
+
+bool ChatMode::Unpin(const std::string &path) {
+  std::lock_guard<std::mutex> lock(pin_mutex_);
+  auto it = std::find_if(pinned_.begin(), pinned_.end(),
+                         [&](const PinnedFile &file) { return file.path == path; });
+  if (it == pinned_.end()) {
+    return false;
+  }
+  pinned_.erase(it);
+  return true;
+}
+
+void ChatMode::UnpinAll() {
+  std::lock_guard<std::mutex> lock(pin_mutex_);
+  pinned_.clear();
+}
+
+std::vector<std::string> ChatMode::GetPinnedFiles() const {
+  std::lock_guard<std::mutex> lock(pin_mutex_);
+  std::vector<std::string> paths;
+  for (const auto &file : pinned_) {
+    paths.push_back(file.path);
+  }
+  return paths;
+}
+
+std::string ChatMode::UpdatePinned(const std::string &path, const std::string &content) {
+  std::vector<PinnedFile> pinned;
+  {
+    std::lock_guard<std::mutex> lock(pin_mutex_);
+    pinned = pinned_;
+  }
+  auto it = std::find_if(pinned.begin(), pinned.end(),
+                         [&](const PinnedFile &file) { return file.path == path; });
+  if (it == pinned.end()) {
+    return "";
+  }
+  it->content = content;
+
+  // Counted outside the lock: it waits for a generation in progress. A
+  // file that grew past the cap Pin enforces is unpinned rather than left
+  // to crowd out the conversation.
+  size_t n_tokens = model_loader_.CountTokens(BuildSystemPrompt(pinned));
+  const bool too_large = n_tokens > MAX_PINNED_TOKENS;
+
+  std::lock_guard<std::mutex> lock(pin_mutex_);
+  auto current = std::find_if(pinned_.begin(), pinned_.end(),
+                              [&](const PinnedFile &file) { return file.path == path; });
+  if (current == pinned_.end()) {
+    return "";
+  }
+  if (too_large) {
+    pinned_.erase(current);
+    return "Unpinned " + path + ": pinned files would take " + std::to_string(n_tokens) +
+           " tokens (limit " + std::to_string(MAX_PINNED_TOKENS) + ")";
+  }
+  current->content = content;
+  return "";
+}
+
+std::string ChatMode::SystemPrompt() const {
+  std::lock_guard<std::mutex> lock(pin_mutex_);
+  return BuildSystemPrompt(pinned_);
+}
+
+bool ChatMode::PreparePinnedPrefix(std::atomic<bool>* interrupt_flag) {
+  {
+    std::lock_guard<std::mutex> lock(pin_mutex_);
+    if (pinned_.empty()) {
+      return true;
+    }
+  }
+  return model_loader_.PrefillSnapshot(SystemPrompt(), interrupt_flag);
 }
 
 void ChatMode::LoadSessionHistory() {
@@ -38,23 +273,10 @@ void ChatMode::LoadSessionHistory() {
   }
 }
 
-std::string ChatMode::Chat(const std::string &user_message,
-                           const std::vector<std::string> &context_files,
-                           std::function<void(const std::string &)> stream_callback,
-                           std::atomic<bool>* interrupt_flag) {
-  if (!model_loaded_) {
-    LoadModel("models/Qwen3-0.6B-Q8_0.gguf");
-  }
-
-  if (!model_loaded_) {
-    return "Error: Chat model not loaded";
-  }
-
-  // Use ChatML format for Qwen3 with thinking trigger
+std::string ChatMode::BuildPrompt(const std::string &user_message,
+                                  const std::vector<tools::Snippet> &context) const {
   // Use ChatML format for Qwen3 with thinking trigger
-  std::string prompt = 
-    "<|im_start|>system\n"
-    "You are a helpful coding assistant.<|im_end|>\n";
+  std::string prompt = SystemPrompt();
 
   // Add history (last 10 messages to fit context)
   int start_idx = std::max(0, (int)history_.size() - 10);
@@ -63,11 +285,81 @@ std::string ChatMode::Chat(const std::string &user_message,
               history_[i].content + "<|im_end|>\n";
   }
 
-  // Add current user message and trigger thinking
-  prompt += "<|im_start|>user\n" + 
-            user_message + "<|im_end|>\n" +
+  // Add retrieved code, current user message and trigger thinking
+  prompt += "<|im_start|>user\n";
+  if (!context.empty()) {
+    prompt += "Relevant code from the workspace:\n";
+    for (const auto &snippet : context) {
+      prompt += "// " + snippet.path + ":" + std::to_string(snippet.start_line) +
+                "-" + std::to_string(snippet.end_line) + "\n```\n" + snippet.text;
+      if (!snippet.text.empty() && snippet.text.back() != '\n') {
+        prompt += "\n";
+      }
+      prompt += "```\n";
+    }
+    prompt += "\n";
+  }
+  prompt += user_message + "<|im_end|>\n" +
             "<|im_start|>assistant\n" +
             "<|im_start|>think\n";
+  return prompt;
+}
+
+bool ChatMode::PrefillTurn(const std::string &user_message,
+                           const std::vector<tools::Snippet> &context,
+                           std::atomic<bool>* cancel_flag) {
+  if (!EnsureModelLoaded()) {
+    return false;
+  }
+
+  // Nothing to discard unless the prefill actually touches the cache
+  prefill_mark_ = std::numeric_limits<size_t>::max();
+  if (!PreparePinnedPrefix(cancel_flag)) {
+    return false;
+  }
+  return model_loader_.Prefill(BuildPrompt(user_message, context), cancel_flag,
+                               &prefill_mark_);
+}
+
+void ChatMode::DiscardPrefill() {
+  // Cells up to the mark were shared with the previous turn; only the
+  // speculative tail is removed
+  model_loader_.TruncateCache(prefill_mark_);
+}
+
+std::string ChatMode::Chat(const std::string &user_message,
+                           const std::vector<tools::Snippet> &context,
+                           std::function<void(const std::string &)> stream_callback,
+                           std::atomic<bool>* interrupt_flag) {
+  // Waits for a running warm-up instead of loading a second time
+  if (!EnsureModelLoaded()) {
+    return "Error: Chat model not loaded";
+  }
+
+  // A near-identical question about unchanged files was answered before.
+  // Pinned files are part of every question. Only an opening question
+  // stands on its own: a follow-up ("explain that in more detail") means
+  // something else in every conversation, so it is neither looked up nor
+  // stored.
+  const bool first_turn = history_.empty();
+  std::vector<std::string> files = ReferencedFiles(
+      user_message, context, tool_executor_ ? tool_executor_->GetWorkingDirectory() : ".");
+  for (const auto &path : GetPinnedFiles()) {
+    if (std::find(files.begin(), files.end(), path) == files.end()) {
+      files.push_back(path);
+    }
+  }
+  std::sort(files.begin(), files.end());
+  std::string cached;
+  if (first_turn && semantic_cache_.Lookup(user_message, files, cached)) {
+    stream_callback(cached);
+    RecordTurn(user_message, cached);
+    return cached;
+  }
+
+  // A pinned prefix pushed out of the cache comes back from its snapshot
+  PreparePinnedPrefix(interrupt_flag);
+  std::string prompt = BuildPrompt(user_message, context);
 
   // Increased max tokens to 2048 to prevent cutoff
   // Wrap callback to detect stuck thinking
@@ -147,6 +439,18 @@ std::string ChatMode::Chat(const std::string &user_message,
     debug_log << "--------------------\n";
   }
 
+  // Only complete answers are reused
+  bool interrupted = interrupt_flag && interrupt_flag->load();
+  if (first_turn && !interrupted && !limit_exceeded) {
+    semantic_cache_.Store(user_message, files, response);
+  }
+
+  RecordTurn(user_message, response);
+  return response;
+}
+
+void ChatMode::RecordTurn(const std::string &user_message,
+                          const std::string &response) {
   // Update in-memory history
   history_.push_back({"user", user_message});
   history_.push_back({"assistant", response});
@@ -156,8 +460,6 @@ std::string ChatMode::Chat(const std::string &user_message,
     history_manager_->LogChatMessage("user", user_message);
     history_manager_->LogChatMessage("assistant", response);
   }
-
-  return response;
 }
 
 } // namespace chat
@@ -0,0 +1,260 @@
+#include "coder/context_assembler.hpp"
+#include "util/hash.hpp"
+#include <algorithm>
+#include <cctype>
+#include <unordered_set>
+
+namespace zweek {
+namespace coder {
+
+namespace {
+constexpr uint32_t CHUNK_LINES = 30;
+constexpr size_t BYTES_PER_TOKEN = 4; // Estimate when no count is available
+constexpr size_t MIN_TERM_LENGTH = 3;
+constexpr size_t MAX_CACHED_COUNTS = 1 << 16;
+
+// Target-file code next to the region outranks everything else; further
+// away it decays with the distance in chunks
+constexpr double TARGET_PRIORITY = 1000.0;
+// Other files: per instruction term the chunk contains, and a little for
+// chunks near the top (includes, declarations) when nothing matches
+constexpr double TERM_PRIORITY = 10.0;
+constexpr double HEAD_PRIORITY = 1.0;
+
+std::unordered_set<std::string> Terms(const std::string &text) {
+  std::unordered_set<std::string> terms;
+  std::string term;
+  for (size_t i = 0; i <= text.size(); ++i) {
+    unsigned char c = i < text.size() ? static_cast<unsigned char>(text[i]) : ' ';
+    if (std::isalnum(c) || c == '_') {
+      term += static_cast<char>(std::tolower(c));
+    } else {
+      if (term.size() >= MIN_TERM_LENGTH) {
+        terms.insert(term);
+      }
+      term.clear();
+    }
+  }
+  return terms;
+}
+
+size_t TermHits(const std::string &text, const std::unordered_set<std::string> &terms) {
+  if (terms.empty()) {
+    return 0;
+  }
+  size_t hits = 0;
+  for (const auto &term : Terms(text)) {
+    hits += terms.count(term);
+  }
+  return hits;
+}
+
+std::string Commented(const std::string &text) {
+  std::string out;
+  size_t start = 0;
+  while (start < text.size()) {
+    size_t end = text.find('\n', start);
+    end = end == std::string::npos ? text.size() : end + 1;
+    out += "// " + text.substr(start, end - start);
+    start = end;
+  }
+  if (!out.empty() && out.back() != '\n') {
+    out += '\n';
+  }
+  return out;
+}
+
+std::string OneLine(std::string text) {
+  std::replace(text.begin(), text.end(), '\n', ' ');
+  return text;
+}
+
+std::string EditNote(const std::string &instruction, const std::string &region) {
+  return "// Edit: " + OneLine(instruction) + "\n// Current code:\n" + Commented(region);
+}
+
+std::string FileHeader(const std::string &path, uint32_t first, uint32_t last) {
+  return "// File: " + path + " (lines " + std::to_string(first) + "-" + std::to_string(last) +
+         ")\n";
+}
+} // namespace
+
+ContextAssembler::ContextAssembler(TokenCounter count_tokens)
+    : count_tokens_(std::move(count_tokens)) {}
+
+size_t ContextAssembler::CountTokens(const std::string &text) {
+  if (text.empty()) {
+    return 0;
+  }
+  const uint64_t key = util::HashString(text);
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = token_counts_.find(key);
+    if (it != token_counts_.end()) {
+      return it->second;
+    }
+  }
+  size_t n = count_tokens_ ? count_tokens_(text) : 0;
+  if (n == 0) {
+    return text.size() / BYTES_PER_TOKEN + 1; // Not cached: the model may load later
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (token_counts_.size() >= MAX_CACHED_COUNTS) {
+    token_counts_.clear();
+  }
+  token_counts_[key] = n;
+  return n;
+}
+
+AssembledContext ContextAssembler::Assemble(const std::string &instruction,
+                                            const std::vector<std::string> &paths,
+                                            size_t token_budget) {
+  AssembledContext context;
+  if (!tools_) {
+    return context;
+  }
+  const std::unordered_set<std::string> terms = Terms(instruction);
+
+  // Line chunks of every readable file; the first readable one is the target
+  std::vector<Chunk> chunks;
+  size_t target = paths.size();
+  for (size_t f = 0; f < paths.size(); ++f) {
+    std::string text = tools_->ReadFile(paths[f]);
+    if (text.empty()) {
+      continue;
+    }
+    if (target == paths.size()) {
+      target = f;
+    }
+    size_t start = 0;
+    uint32_t line = 1;
+    while (start < text.size()) {
+      Chunk chunk;
+      chunk.file = f;
+      chunk.first_line = line;
+      size_t end = start;
+      for (uint32_t n = 0; n < CHUNK_LINES && end < text.size(); ++n) {
+        size_t newline = text.find('\n', end);
+        end = newline == std::string::npos ? text.size() : newline + 1;
+        ++line;
+      }
+      chunk.last_line = line - 1;
+      chunk.text = text.substr(start, end - start);
+      chunks.push_back(std::move(chunk));
+      start = end;
+    }
+  }
+  if (target == paths.size()) {
+    return context;
+  }
+
+  // The region: the target chunk sharing the most terms with the instruction
+  size_t region = chunks.size();
+  size_t best_hits = 0;
+  for (size_t i = 0; i < chunks.size(); ++i) {
+    if (chunks[i].file != target) {
+      continue;
+    }
+    size_t hits = TermHits(chunks[i].text, terms);
+    if (region == chunks.size() || hits > best_hits) {
+      region = i;
+      best_hits = hits;
+    }
+  }
+  Chunk region_chunk = chunks[region];
+  context.path = paths[target];
+
+  // Always included: the instruction and the code being replaced. A region
+  // that alone overruns the budget loses lines from its end, down to one.
+  const std::string target_header = "// File: " + context.path + "\n";
+  std::string edit_note = EditNote(instruction, region_chunk.text);
+  size_t used = CountTokens(target_header) + CountTokens(edit_note);
+  while (used > token_budget && region_chunk.last_line > region_chunk.first_line) {
+    size_t cut = region_chunk.text.rfind('\n', region_chunk.text.size() - 2);
+    region_chunk.text.resize(cut + 1);
+    region_chunk.last_line--;
+    edit_note = EditNote(instruction, region_chunk.text);
+    used = CountTokens(target_header) + CountTokens(edit_note);
+  }
+  context.first_line = region_chunk.first_line;
+  context.last_line = region_chunk.last_line;
+  context.region_text = region_chunk.text;
+
+  // Rank the rest
+  std::vector<size_t> order;
+  for (size_t i = 0; i < chunks.size(); ++i) {
+    if (i == region) {
+      continue;
+    }
+    Chunk &chunk = chunks[i];
+    if (chunk.file == target) {
+      size_t distance = i > region ? i - region : region - i;
+      chunk.priority = TARGET_PRIORITY / static_cast<double>(distance);
+      chunk.n_tokens = CountTokens(chunk.text);
+    } else {
+      size_t file_rank = chunk.file + 1;
+      size_t hits = TermHits(chunk.text, terms);
+      chunk.priority = (hits * TERM_PRIORITY + HEAD_PRIORITY / chunk.first_line) /
+                       static_cast<double>(file_rank);
+      chunk.n_tokens = CountTokens(chunk.text) +
+                       CountTokens(FileHeader(paths[chunk.file], chunk.first_line, chunk.last_line));
+    }
+    order.push_back(i);
+  }
+  std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+    return chunks[a].priority > chunks[b].priority;
+  });
+
+  // Greedy fill; a chunk too big to fit doesn't stop smaller ones
+  std::vector<bool> chosen(chunks.size(), false);
+  for (size_t i : order) {
+    if (used + chunks[i].n_tokens <= token_budget) {
+      used += chunks[i].n_tokens;
+      chosen[i] = true;
+    }
+  }
+  context.n_tokens = used;
+
+  // Other files first, in path order, then the target around the region.
+  // Chunks of a file are already in line order.
+  for (size_t i = 0; i < chunks.size(); ++i) {
+    if (chosen[i] && chunks[i].file != target) {
+      context.prefix += FileHeader(paths[chunks[i].file], chunks[i].first_line,
+                                   chunks[i].last_line) +
+                        chunks[i].text;
+      if (context.prefix.back() != '\n') {
+        context.prefix += '\n';
+      }
+    }
+  }
+  context.prefix += target_header;
+  uint32_t next_line = 1;
+  for (size_t i = 0; i < region; ++i) {
+    if (chosen[i] && chunks[i].file == target) {
+      if (chunks[i].first_line != next_line) {
+        context.prefix += "// ...\n";
+      }
+      context.prefix += chunks[i].text;
+      next_line = chunks[i].last_line + 1;
+    }
+  }
+  if (region_chunk.first_line != next_line) {
+    context.prefix += "// ...\n";
+  }
+  context.prefix += edit_note;
+
+  next_line = region_chunk.last_line + 1;
+  for (size_t i = region + 1; i < chunks.size() && chunks[i].file == target; ++i) {
+    if (chosen[i]) {
+      if (chunks[i].first_line != next_line) {
+        context.suffix += "// ...\n";
+      }
+      context.suffix += chunks[i].text;
+      next_line = chunks[i].last_line + 1;
+    }
+  }
+  return context;
+}
+
+} // namespace coder
+} // namespace zweek
@@ -0,0 +1,253 @@
+#include "coder/stream_validator.hpp"
+#include <cctype>
+#include <cstring>
+
+namespace zweek {
+namespace coder {
+
+namespace {
+// Limits past which output is treated as junk rather than unusual code
+constexpr size_t MAX_NESTING = 64;
+constexpr int MAX_STRAY_CLOSERS = 2; // An edit may start inside a block
+constexpr size_t MAX_STRING_BYTES = 1024;
+constexpr int MAX_STRING_LINES = 0; // Only a backslash-newline continues one
+constexpr size_t MAX_CHAR_BYTES = 16; // Longer is an apostrophe in prose
+constexpr size_t MAX_RAW_DELIMITER = 16;
+constexpr size_t MAX_RAW_STRING_BYTES = 8192;
+constexpr size_t MAX_COMMENT_BYTES = 8192;
+
+// Repetition: the last REPEAT_WINDOW bytes repeat with a period of at most
+// MAX_REPEAT_PERIOD (so at least three copies), checked every
+// REPEAT_CHECK_BYTES
+constexpr size_t REPEAT_WINDOW = 384;
+constexpr size_t MAX_REPEAT_PERIOD = 128;
+constexpr size_t REPEAT_CHECK_BYTES = 32;
+
+constexpr size_t FENCE_PREFIX = 16; // Line bytes kept to spot fences and markers
+
+bool IsIdentChar(char c) { return std::isalnum(static_cast<unsigned char>(c)) || c == '_'; }
+
+std::string Quote(char c) { return std::string("'") + c + "'"; }
+} // namespace
+
+void StreamValidator::Reset() { *this = StreamValidator(); }
+
+bool StreamValidator::Feed(const std::string &piece) {
+  if (malformed_) {
+    return false;
+  }
+  for (char c : piece) {
+    FeedChar(c);
+    if (malformed_) {
+      return false;
+    }
+  }
+  n_bytes_ += piece.size();
+
+  recent_ += piece;
+  if (recent_.size() > 2 * REPEAT_WINDOW) {
+    recent_.erase(0, recent_.size() - REPEAT_WINDOW);
+  }
+  since_check_ += piece.size();
+  if (since_check_ >= REPEAT_CHECK_BYTES) {
+    since_check_ = 0;
+    if (IsRepeating()) {
+      Fail("output is repeating itself");
+    }
+  }
+  return !malformed_;
+}
+
+void StreamValidator::FeedChar(char c) {
+  char next_prev = c;
+  switch (state_) {
+  case State::Prose:
+    break;
+
+  case State::Code:
+    if (prev_ == '/' && c == '/') {
+      state_ = State::LineComment;
+    } else if (prev_ == '/' && c == '*') {
+      state_ = State::BlockComment;
+      literal_bytes_ = 0;
+      next_prev = 0; // "/*/" doesn't close the comment
+    } else if (c == '"') {
+      literal_bytes_ = 0;
+      literal_lines_ = 0;
+      // R"delim(...)delim", also with u8, u, U and L prefixes
+      if (prev_ == 'R' && (!IsIdentChar(prev2_) || std::strchr("8uUL", prev2_))) {
+        state_ = State::RawDelimiter;
+        raw_delimiter_.clear();
+      } else {
+        state_ = State::String;
+      }
+    } else if (c == '\'') {
+      // After an identifier character it is a digit separator (1'000),
+      // unless that is a lone L, u or U prefix (L'x')
+      if (!IsIdentChar(prev_) || (std::strchr("LuU", prev_) && !IsIdentChar(prev2_))) {
+        state_ = State::Char;
+        literal_bytes_ = 0;
+      }
+    } else if (c == '(' || c == '[' || c == '{') {
+      Open(c);
+    } else if (c == ')' || c == ']' || c == '}') {
+      Close(c);
+    }
+    break;
+
+  case State::LineComment:
+    if (c == '\n') {
+      state_ = State::Code;
+    }
+    break;
+
+  case State::BlockComment:
+    if (prev_ == '*' && c == '/') {
+      state_ = State::Code;
+      next_prev = 0;
+    } else if (++literal_bytes_ > MAX_COMMENT_BYTES) {
+      Fail("unterminated comment");
+    }
+    break;
+
+  case State::String:
+    if (prev_ == '\\') {
+      next_prev = 0; // Escaped; "\\" must not escape the next character
+    } else if (c == '"') {
+      state_ = State::Code;
+    } else if (c == '\n' && ++literal_lines_ > MAX_STRING_LINES) {
+      Fail("unterminated string literal");
+    }
+    if (++literal_bytes_ > MAX_STRING_BYTES) {
+      Fail("unterminated string literal");
+    }
+    break;
+
+  case State::Char:
+    if (prev_ == '\\') {
+      next_prev = 0;
+    } else if (c == '\'' || c == '\n' || ++literal_bytes_ > MAX_CHAR_BYTES) {
+      state_ = State::Code;
+    }
+    break;
+
+  case State::RawDelimiter:
+    if (c == '(') {
+      state_ = State::RawString;
+      raw_end_.clear();
+      literal_bytes_ = 0;
+    } else if (raw_delimiter_.size() >= MAX_RAW_DELIMITER || c == ')' || c == '\\' || c == '"' ||
+               std::isspace(static_cast<unsigned char>(c))) {
+      state_ = State::Code; // Not a raw string after all
+    } else {
+      raw_delimiter_ += c;
+    }
+    break;
+
+  case State::RawString: {
+    raw_end_ += c;
+    const size_t end_size = raw_delimiter_.size() + 2;
+    if (raw_end_.size() > end_size) {
+      raw_end_.erase(0, raw_end_.size() - end_size);
+    }
+    if (raw_end_.size() == end_size && raw_end_.front() == ')' && raw_end_.back() == '"' &&
+        raw_end_.compare(1, raw_delimiter_.size(), raw_delimiter_) == 0) {
+      state_ = State::Code;
+      next_prev = 0;
+    } else if (++literal_bytes_ > MAX_RAW_STRING_BYTES) {
+      Fail("unterminated raw string literal");
+    }
+    break;
+  }
+  }
+
+  prev2_ = prev_;
+  prev_ = next_prev;
+  if (c == '\n') {
+    EndLine();
+  } else if (line_.size() < FENCE_PREFIX && !(line_.empty() && (c == ' ' || c == '\t'))) {
+    line_ += c;
+  }
+}
+
+void StreamValidator::EndLine() {
+  if (line_.compare(0, 3, "```") == 0) {
+    // Each fenced block is checked on its own; text between them is prose
+    in_fence_ = !in_fence_;
+    ResetBlock(in_fence_ ? State::Code : State::Prose);
+  } else if (line_.compare(0, 7, "<<<<<<<") == 0 || line_.compare(0, 7, "=======") == 0 ||
+             line_.compare(0, 7, ">>>>>>>") == 0) {
+    // Both halves of an edit block are snippets of their own
+    ResetBlock(State::Code);
+  } else if (!line_.empty() && line_[0] == '#' && state_ == State::Code) {
+    // Each branch of a conditional starts from the brackets open at its #if
+    size_t i = line_.find_first_not_of(" \t", 1);
+    std::string directive = i == std::string::npos ? "" : line_.substr(i);
+    if (directive.compare(0, 2, "if") == 0) {
+      conditionals_.push_back(brackets_);
+    } else if (directive.compare(0, 4, "else") == 0 || directive.compare(0, 4, "elif") == 0) {
+      if (!conditionals_.empty()) {
+        brackets_ = conditionals_.back();
+      }
+    } else if (directive.compare(0, 5, "endif") == 0 && !conditionals_.empty()) {
+      conditionals_.pop_back();
+    }
+  }
+  line_.clear();
+}
+
+void StreamValidator::ResetBlock(State state) {
+  state_ = state;
+  brackets_.clear();
+  conditionals_.clear();
+  stray_closers_ = 0;
+  prev_ = 0;
+  prev2_ = 0;
+  literal_bytes_ = 0;
+  literal_lines_ = 0;
+}
+
+void StreamValidator::Open(char c) {
+  brackets_.push_back(c);
+  if (brackets_.size() > MAX_NESTING) {
+    Fail("nesting deeper than " + std::to_string(MAX_NESTING));
+  }
+}
+
+void StreamValidator::Close(char c) {
+  const char expected = c == ')' ? '(' : c == ']' ? '[' : '{';
+  if (brackets_.empty()) {
+    if (++stray_closers_ > MAX_STRAY_CLOSERS) {
+      Fail("unbalanced " + Quote(c));
+    }
+    return;
+  }
+  if (brackets_.back() != expected) {
+    Fail(Quote(c) + " closes " + Quote(brackets_.back()));
+    return;
+  }
+  brackets_.pop_back();
+}
+
+bool StreamValidator::IsRepeating() const {
+  if (recent_.size() < REPEAT_WINDOW) {
+    return false;
+  }
+  const char *window = recent_.data() + recent_.size() - REPEAT_WINDOW;
+  for (size_t period = 1; period <= MAX_REPEAT_PERIOD; ++period) {
+    if (std::memcmp(window, window + period, REPEAT_WINDOW - period) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void StreamValidator::Fail(std::string reason) {
+  if (!malformed_) {
+    malformed_ = true;
+    reason_ = std::move(reason);
+  }
+}
+
+} // namespace coder
+} // namespace zweek
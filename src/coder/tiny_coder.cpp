@@ -1,4 +1,6 @@
 #include "coder/tiny_coder.hpp"
+#include "coder/stream_validator.hpp"
+#include <algorithm>
 #include <sstream>
 #include <iostream>
 #include <regex>
@@ -6,12 +8,40 @@
 namespace zweek {
 namespace coder {
 
-TinyCoder::TinyCoder() {}
+namespace {
+constexpr int MAX_EDIT_TOKENS = 2048;
+constexpr int MAX_GENERATION_ATTEMPTS = 2; // Retry malformed output once
+// Prompt share of the 4096-token context; the rest holds the answer (or
+// the side-by-side candidates)
+constexpr size_t PROMPT_TOKEN_BUDGET = 1536;
+const char *const DEFAULT_MODEL_PATH = "models/starcoder-tiny.gguf";
+
+bool StartsWith(const std::string &line, const char *prefix) {
+  return line.compare(0, std::char_traits<char>::length(prefix), prefix) == 0;
+}
+
+std::string Trim(const std::string &text) {
+  size_t begin = text.find_first_not_of(" \t\r\n");
+  if (begin == std::string::npos) {
+    return "";
+  }
+  size_t end = text.find_last_not_of(" \t\r\n");
+  return text.substr(begin, end - begin + 1);
+}
+} // namespace
+
+TinyCoder::TinyCoder()
+    : assembler_([this](const std::string &text) { return model_loader_.CountTokens(text); }) {}
 TinyCoder::~TinyCoder() { UnloadModel(); }
 
 bool TinyCoder::LoadModel(const std::string &model_path) {
-  // Use a smaller context for the tiny model if possible, or standard 2048
-  model_loaded_ = model_loader_.Load(model_path, 2048);
+  // Start with a small context and grow up to 4096 as prompts and
+  // side-by-side candidates require
+  models::ContextOptions options;
+  options.n_ctx = 512;
+  options.n_ctx_max = 4096;
+  options.n_parallel = MAX_CANDIDATES;
+  model_loaded_ = model_loader_.Load(model_path, options);
   return model_loaded_;
 }
 
@@ -20,63 +50,203 @@ void TinyCoder::UnloadModel() {
   model_loaded_ = false;
 }
 
+bool TinyCoder::EnsureLoaded() {
+  if (!model_loaded_) {
+    LoadModel(DEFAULT_MODEL_PATH);
+  }
+  if (!model_loaded_) {
+    last_error_ = "coder model not loaded";
+  }
+  return model_loaded_;
+}
+
 std::string TinyCoder::ConstructPrompt(const std::string &instruction,
                                        const std::vector<std::string> &files) {
-  std::stringstream ss;
-  ss << "<fim_prefix>";
-  
-  // Add file context
-  for (const auto &file : files) {
-    // In a real implementation, we'd read the file content here.
-    // For now, we assume the 'files' vector contains the content or we need a way to read it.
-    // Wait, the API signature takes vector<string> files. 
-    // Let's assume these are file PATHS and we need to read them, 
-    // OR they are file CONTENTS. 
-    // Given the complexity, let's assume the caller passes file CONTENTS or formatted context.
-    // Let's assume 'files' contains "Filename: ...\nContent: ..." strings for now.
-    ss << file << "\n\n";
+  // The model writes the target region's new text in place
+  context_ = assembler_.Assemble(instruction, files, PROMPT_TOKEN_BUDGET);
+  if (!context_.path.empty()) {
+    return "<fim_prefix>" + context_.prefix + "<fim_suffix>" + context_.suffix + "<fim_middle>";
   }
 
+  // Nothing to read (e.g. a new file): ask for edit blocks instead
+  std::stringstream ss;
+  ss << "<fim_prefix>";
   ss << "Instruction: " << instruction << "\n";
-  ss << "Output the code changes required to fulfill the instruction.\n";
+  ss << "Output the code changes required to fulfill the instruction, each as:\n"
+     << "File: <path>\n<<<<<<< ORIGINAL\n<exact lines to replace>\n=======\n"
+     << "<new lines>\n>>>>>>> UPDATED\n";
   ss << "<fim_suffix><fim_middle>";
   return ss.str();
 }
 
+std::vector<CodeEdit> TinyCoder::EditsFrom(const std::string &response) const {
+  std::vector<CodeEdit> edits = ParseEdits(response);
+  if (edits.empty() && !context_.path.empty() &&
+      response.find_first_not_of(" \t\r\n") != std::string::npos) {
+    CodeEdit edit;
+    edit.file_path = context_.path;
+    edit.original_snippet = context_.region_text;
+    edit.new_content = response;
+    if (edit.new_content.back() != '\n' && !edit.original_snippet.empty() &&
+        edit.original_snippet.back() == '\n') {
+      edit.new_content += '\n';
+    }
+    edit.explanation = "Rewrote lines " + std::to_string(context_.first_line) + "-" +
+                       std::to_string(context_.last_line);
+    edits.push_back(std::move(edit));
+  }
+  return edits;
+}
+
 std::vector<CodeEdit> TinyCoder::GenerateEdits(const std::string &instruction,
                                                const std::vector<std::string> &files,
                                                std::function<void(const std::string &)> stream_callback,
                                                std::atomic<bool>* interrupt_flag) {
-  if (!model_loaded_) {
-    LoadModel("models/starcoder-tiny.gguf");
-  }
-
-  if (!model_loaded_) {
+  last_error_.clear();
+  if (!EnsureLoaded()) {
     return {};
   }
 
   std::string prompt = ConstructPrompt(instruction, files);
   
-  // Run inference
-  std::string response = model_loader_.Infer(prompt, "", 2048, stream_callback, interrupt_flag);
+  // Run inference, stopping as soon as the output can't become valid code
+  std::string response;
+  for (int attempt = 0; attempt < MAX_GENERATION_ATTEMPTS; ++attempt) {
+    StreamValidator validator;
+    std::atomic<bool> stop{false};
+    auto on_piece = [&](const std::string &piece) {
+      if (stream_callback) {
+        stream_callback(piece);
+      }
+      if ((interrupt_flag && interrupt_flag->load()) || !validator.Feed(piece)) {
+        stop = true;
+      }
+    };
+    response = model_loader_.Infer(prompt, "", MAX_EDIT_TOKENS, on_piece, &stop);
 
-  // Parse response into CodeEdit objects
-  // This is a simplified parser. Real-world would need robust parsing of diffs/blocks.
-  std::vector<CodeEdit> edits;
-  
-  // Mock parsing for now - we'll assume the model outputs the whole file content or a clear block
-  // For this iteration, let's just wrap the whole response as one edit to the first file (if any)
-  if (!files.empty()) {
-      CodeEdit edit;
-      // Extract filename from the first file string if possible, or just use a placeholder
-      // Assuming the first string in 'files' has the filename.
-      // This is a bit hacky, but sufficient for the prototype.
-      edit.file_path = "generated_code.cpp"; 
-      edit.new_content = response;
-      edit.explanation = "Generated by TinyCoder";
-      edits.push_back(edit);
+    if (interrupt_flag && interrupt_flag->load()) {
+      return {};
+    }
+    if (!validator.IsMalformed()) {
+      last_error_.clear();
+      break;
+    }
+    last_error_ = "malformed output after " + std::to_string(validator.BytesSeen()) +
+                  " bytes (" + validator.Reason() + ")";
+    // A deterministic sampler would only repeat the same output
+    bool can_retry = attempt + 1 < MAX_GENERATION_ATTEMPTS &&
+                     model_loader_.GetDeterminism() == models::DeterminismMode::Off;
+    if (!can_retry) {
+      return {};
+    }
+    if (stream_callback) {
+      stream_callback("\n[" + last_error_ + ", retrying]\n");
+    }
   }
 
+  std::vector<CodeEdit> edits = EditsFrom(response);
+  if (edits.empty()) {
+    last_error_ = "no edits in output";
+  }
+  return edits;
+}
+
+int TinyCoder::GenerateCandidates(const std::string &instruction,
+                                  const std::vector<std::string> &files, int n_candidates,
+                                  std::function<void(int, std::vector<CodeEdit>)> on_candidate,
+                                  std::atomic<bool>* interrupt_flag,
+                                  std::atomic<bool>* stop_flag) {
+  last_error_.clear();
+  if (!EnsureLoaded()) {
+    return 0;
+  }
+
+  std::string prompt = ConstructPrompt(instruction, files);
+  std::vector<StreamValidator> validators(static_cast<size_t>(std::max(n_candidates, 1)));
+  int n_delivered = 0;
+  int n_empty = 0;
+
+  model_loader_.InferCandidates(
+      prompt, n_candidates, MAX_EDIT_TOKENS,
+      [&](int index, const std::string &piece) {
+        if ((interrupt_flag && interrupt_flag->load()) || (stop_flag && stop_flag->load())) {
+          return false;
+        }
+        return validators[index].Feed(piece);
+      },
+      [&](int index, const std::string &text) {
+        std::vector<CodeEdit> edits = EditsFrom(text);
+        if (edits.empty()) {
+          ++n_empty;
+          return;
+        }
+        ++n_delivered;
+        on_candidate(index, std::move(edits));
+      },
+      interrupt_flag);
+
+  if (n_delivered == 0) {
+    for (const auto &validator : validators) {
+      if (validator.IsMalformed()) {
+        last_error_ = "malformed output (" + validator.Reason() + ")";
+        break;
+      }
+    }
+    if (last_error_.empty() && n_empty > 0) {
+      last_error_ = "no edits in output";
+    }
+  }
+  return n_delivered;
+}
+
+std::vector<CodeEdit> TinyCoder::ParseEdits(const std::string &response) {
+  enum class Part { Between, Original, Updated };
+  std::vector<CodeEdit> edits;
+  CodeEdit edit;
+  std::string path;
+  std::string prose;
+  Part part = Part::Between;
+
+  std::stringstream lines(response);
+  std::string line;
+  while (std::getline(lines, line)) {
+    if (!line.empty() && line.back() == '\r') {
+      line.pop_back();
+    }
+    switch (part) {
+    case Part::Between:
+      if (StartsWith(line, "<<<<<<<")) {
+        edit = CodeEdit();
+        edit.file_path = path;
+        edit.explanation = Trim(prose);
+        prose.clear();
+        part = Part::Original;
+      } else if (StartsWith(line, "File:")) {
+        path = Trim(line.substr(5));
+      } else if (!StartsWith(line, "```")) {
+        prose += line + "\n";
+      }
+      break;
+    case Part::Original:
+      if (StartsWith(line, "=======")) {
+        part = Part::Updated;
+      } else {
+        edit.original_snippet += line + "\n";
+      }
+      break;
+    case Part::Updated:
+      if (StartsWith(line, ">>>>>>>")) {
+        // A block without a file can't be applied anywhere
+        if (!edit.file_path.empty()) {
+          edits.push_back(std::move(edit));
+        }
+        part = Part::Between;
+      } else {
+        edit.new_content += line + "\n";
+      }
+      break;
+    }
+  }
   return edits;
 }
 
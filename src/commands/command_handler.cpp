@@ -213,7 +213,7 @@ CommandResult CommandHandler::HandleCommand(const std::string &input) {
     return result;
   }
 
-  // Handle /ls [path]
+  // Handle /ls [-r] [path]
   if (cmd == "ls") {
     result.handled = true;
     if (!tool_executor_) {
@@ -221,21 +221,170 @@ CommandResult CommandHandler::HandleCommand(const std::string &input) {
       return result;
     }
 
-    std::string path = args.empty() ? "." : args;
-    auto files = tool_executor_->ListDir(path);
+    std::string path = args;
+    bool recursive = path == "-r" || path.rfind("-r ", 0) == 0;
+    if (recursive) {
+      path = path.substr(std::min<size_t>(path.size(), 3));
+    }
+    if (path.empty()) {
+      path = ".";
+    }
+
+    auto files = recursive ? tool_executor_->ListDirRecursive(path)
+                           : tool_executor_->ListDir(path);
     
     if (files.empty()) {
         result.response = "No files found in " + path;
     } else {
+        constexpr size_t MAX_LISTED_FILES = 500;
         std::string output = "Files in " + path + ":\n";
-        for (const auto& file : files) {
-            output += file + "\n";
+        for (size_t i = 0; i < files.size() && i < MAX_LISTED_FILES; ++i) {
+            output += files[i] + "\n";
+        }
+        if (files.size() > MAX_LISTED_FILES) {
+            output += "... and " + std::to_string(files.size() - MAX_LISTED_FILES) + " more\n";
         }
         result.response = output;
     }
     return result;
   }
 
+  // Handle /grep [-i] [-e] <pattern>
+  if (cmd == "grep") {
+    result.handled = true;
+    if (!search_callback_) {
+      result.response = "Error: Search not available.";
+      return result;
+    }
+
+    std::string pattern = args;
+    bool regex = false;
+    bool ignore_case = false;
+    while (pattern.size() >= 2 && pattern[0] == '-' &&
+           (pattern.size() == 2 || pattern[2] == ' ')) {
+      if (pattern[1] == 'e') {
+        regex = true;
+      } else if (pattern[1] == 'i') {
+        ignore_case = true;
+      } else {
+        break;
+      }
+      pattern = pattern.substr(std::min<size_t>(pattern.size(), 3));
+    }
+    if (pattern.empty()) {
+      result.response = "Usage: /grep [-i] [-e] <pattern>";
+      return result;
+    }
+    result.response = search_callback_(pattern, regex, ignore_case);
+    return result;
+  }
+
+  // Handle /models
+  if (cmd == "models") {
+    result.handled = true;
+    if (!models_callback_) {
+      result.response = "Error: Model information not available.";
+      return result;
+    }
+    result.response = models_callback_();
+    return result;
+  }
+
+  // Handle /tune
+  if (cmd == "tune") {
+    result.handled = true;
+    if (!tune_callback_) {
+      result.response = "Error: Autotuner not available.";
+      return result;
+    }
+    result.response = tune_callback_();
+    return result;
+  }
+
+  // Handle /pin [file] and /unpin [file|all]
+  if (cmd == "pin" || cmd == "unpin") {
+    result.handled = true;
+    if (!chat_mode_ || !tool_executor_) {
+      result.response = "Error: Chat mode not available.";
+      return result;
+    }
+
+    std::filesystem::path working_dir(tool_executor_->GetWorkingDirectory());
+    auto display = [&](const std::string &path) {
+      std::error_code ec;
+      std::filesystem::path relative = std::filesystem::relative(path, working_dir, ec);
+      return ec || relative.empty() || *relative.begin() == ".." ? path : relative.string();
+    };
+
+    if (args.empty() && cmd == "pin") {
+      auto pinned = chat_mode_->GetPinnedFiles();
+      if (pinned.empty()) {
+        result.response = "No pinned files. Usage: /pin <file>";
+      } else {
+        result.response = "Pinned files:\n";
+        for (const auto &path : pinned) {
+          result.response += "  " + display(path) + "\n";
+        }
+      }
+      return result;
+    }
+    if (cmd == "unpin" && (args.empty() || args == "all")) {
+      chat_mode_->UnpinAll();
+      result.response = "Unpinned all files";
+      return result;
+    }
+
+    std::filesystem::path target_path(args);
+    if (!target_path.is_absolute()) {
+      target_path = working_dir / target_path;
+    }
+    std::string path = target_path.lexically_normal().string();
+
+    if (cmd == "unpin") {
+      result.response = chat_mode_->Unpin(path) ? "Unpinned " + args
+                                                : "Error: Not pinned: " + args;
+      return result;
+    }
+
+    std::string content = tool_executor_->ReadFile(path);
+    if (content.empty()) {
+      result.response = "Error: Cannot read file: " + args;
+      return result;
+    }
+    result.response = chat_mode_->Pin(path, content);
+    return result;
+  }
+
+  // Handle /deterministic [greedy|seed|off]
+  if (cmd == "deterministic") {
+    result.handled = true;
+    if (!chat_mode_) {
+      result.response = "Error: Chat mode not available.";
+      return result;
+    }
+
+    using models::DeterminismMode;
+    if (args.empty()) {
+      DeterminismMode mode = chat_mode_->GetDeterminism();
+      result.response = std::string("Deterministic mode: ") +
+                        (mode == DeterminismMode::Greedy      ? "greedy"
+                         : mode == DeterminismMode::FixedSeed ? "seed"
+                                                              : "off");
+    } else if (args == "greedy" || args == "on") {
+      chat_mode_->SetDeterminism(DeterminismMode::Greedy);
+      result.response = "Deterministic mode: greedy (answers are cached)";
+    } else if (args == "seed") {
+      chat_mode_->SetDeterminism(DeterminismMode::FixedSeed);
+      result.response = "Deterministic mode: fixed seed (answers are cached)";
+    } else if (args == "off") {
+      chat_mode_->SetDeterminism(DeterminismMode::Off);
+      result.response = "Deterministic mode: off";
+    } else {
+      result.response = "Usage: /deterministic [greedy|seed|off]";
+    }
+    return result;
+  }
+
   return result;
 }
 
@@ -247,7 +396,13 @@ std::vector<std::string> CommandHandler::GetAvailableCommands() const {
     "load",
     "clear-history",
     "cd",
-    "ls"
+    "ls",
+    "grep",
+    "models",
+    "tune",
+    "pin",
+    "unpin",
+    "deterministic"
   };
 }
 
@@ -263,7 +418,13 @@ Available Commands:
   /load <id> - Load a previous session
   /clear-history - Clear current session history
   /cd <path> - Change working directory
-  /ls [path] - List files in directory (current if no path given)
+  /ls [-r] [path] - List files in directory (current if no path given; -r recurses, honouring .gitignore)
+  /grep [-i] [-e] <pattern> - Search files (-i ignore case, -e regex)
+  /models - Show loaded models, context size and KV cache memory
+  /tune - Re-run the hardware autotuner (threads, batch sizes)
+  /pin [file] - Keep a file in every chat prompt, prefilled once (lists pins without a file)
+  /unpin [file|all] - Stop pinning a file (all if none given)
+  /deterministic [greedy|seed|off] - Reproducible answers, cached on disk
 
 Tips:
   • Type code requests: "add error handling" or "refactor this function"
@@ -1,5 +1,6 @@
 #define NOMINMAX
 #include "history/history_manager.hpp"
+#include "tools/diff_engine.hpp"
 #include <algorithm>
 #include <sstream>
 #include <chrono>
@@ -113,6 +114,15 @@ std::string HistoryManager::RestoreFile(const std::string& file_path, int versio
   return "";
 }
 
+std::string HistoryManager::DiffSnapshots(const std::string& file_path, int from_version, int to_version) {
+  std::string from = RestoreFile(file_path, from_version);
+  std::string to = RestoreFile(file_path, to_version);
+  auto label = [&file_path](int version) {
+    return file_path + (version < 0 ? std::string(" (latest)") : " (v" + std::to_string(version) + ")");
+  };
+  return tools::DiffEngine::Unified(label(from_version), label(to_version), from, to);
+}
+
 std::vector<FileSnapshot> HistoryManager::GetFileHistory(const std::string& file_path) {
   std::vector<FileSnapshot> result;
   if (!initialized_) return result;
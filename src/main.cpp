@@ -1,4 +1,5 @@
 #include "pipeline/orchestrator.hpp"
+#include "pipeline/request_scheduler.hpp"
 #include "ui/tui.hpp"
 #include <chrono>
 #include <iostream>
@@ -59,28 +60,54 @@ int main(int argc, char **argv) {
   orchestrator.SetStreamCallback([&](const std::string &chunk) {
     tui.AppendToLastMessage(chunk);
   });
+
+  orchestrator.SetStatusCallback(
+      [&](const std::string &status) { tui.SetStatus(status); });
   
-  // Connect interrupt flag from TUI to orchestrator
-  orchestrator.SetInterruptFlag(&tui.GetState().interrupt_inference_);
+  // All requests run on the scheduler's single worker, one at a time, each
+  // with its own cancellation token
+  RequestScheduler scheduler([&](const std::string &request,
+                                 std::atomic<bool> *cancel_flag) {
+    tui.UpdateStage(PipelineStage::Planning, 0.1f);
+    orchestrator.ProcessRequest(request, cancel_flag);
+  });
 
   // Set up TUI callbacks
   tui.SetOnSubmit([&](const std::string &request) {
     std::cout << "Processing: " << request << std::endl;
-    
-    // Reset interrupt flag before starting new request
-    tui.GetState().interrupt_inference_.store(false);
-
-    // Run orchestrator in background thread
-    std::thread pipeline_thread([&, request]() {
-      tui.UpdateStage(PipelineStage::Planning, 0.1f);
-      orchestrator.ProcessRequest(request);
-    });
-    pipeline_thread.detach();
+
+    // Report through the status bar so a streaming answer is not disturbed
+    bool busy = scheduler.IsBusy();
+    if (!scheduler.Submit(request, RequestScheduler::PriorityFor(request))) {
+      tui.SetStatus("Too many pending requests, please wait");
+      return;
+    }
+    if (busy) {
+      tui.SetStatus("Queued: " + std::to_string(scheduler.QueuedCount()) +
+                    " pending");
+    }
   });
 
-  tui.SetOnAccept([]() { std::cout << "Changes accepted!" << std::endl; });
+  // ESC cancels only the request that is currently running
+  tui.SetOnInterrupt([&]() { scheduler.CancelCurrent(); });
+
+  // Code edits wait for y/n in Plan mode and are written at once in Auto
+  orchestrator.SetAutoApply(tui.GetMode() == Mode::Auto);
+  tui.SetOnModeSwitch([&](Mode mode) { orchestrator.SetAutoApply(mode == Mode::Auto); });
 
-  tui.SetOnReject([]() { std::cout << "Changes rejected!" << std::endl; });
+  tui.SetOnAccept([&]() {
+    std::string result = orchestrator.AcceptPendingEdits();
+    if (!result.empty()) {
+      tui.AddToHistory(result);
+    }
+  });
+
+  tui.SetOnReject([&]() {
+    std::string result = orchestrator.RejectPendingEdits();
+    if (!result.empty()) {
+      tui.AddToHistory(result);
+    }
+  });
 
   tui.SetOnModify(
       []() { std::cout << "Requesting modifications..." << std::endl; });
@@ -95,11 +122,17 @@ int main(int argc, char **argv) {
   });
   spinner_thread.detach();
 
+  // Load models in the background while the TUI starts up
+  orchestrator.StartWarmup();
+
   // Run the TUI
   tui.Run();
   
   running = false; // Stop spinner thread
 
+  // Cancel in-flight work and join the worker before tearing down models
+  scheduler.Shutdown();
+
   // Save history on exit
   if (history_mgr) {
     std::string save_path = history_mgr->GetDefaultHistoryPath();
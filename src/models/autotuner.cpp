@@ -0,0 +1,330 @@
+#include "models/autotuner.hpp"
+#include "models/execution_policy.hpp"
+#include "util/hash.hpp"
+#include "util/paths.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <thread>
+#include <llama.h>
+#include <nlohmann/json.hpp>
+
+#ifdef _WIN32
+#include <windows.h>
+#elif defined(__APPLE__)
+#include <sys/sysctl.h>
+#endif
+
+using json = nlohmann::json;
+
+namespace zweek {
+namespace models {
+
+namespace {
+
+// Benchmark sizes: long enough to be stable, short enough for first run
+constexpr int BENCH_PREFILL_TOKENS = 256;
+constexpr int BENCH_DECODE_PROMPT = 32;
+constexpr int BENCH_DECODE_TOKENS = 16;
+constexpr int BENCH_CTX = 512;
+const int UBATCH_CANDIDATES[] = {64, 128, 256, 512};
+
+// Serializes tuning (parallel benchmarks would skew each other) and cache I/O
+std::mutex tuner_mutex;
+
+using Clock = std::chrono::steady_clock;
+
+double SecondsSince(Clock::time_point start) {
+  return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+// Realistic token stream for the benchmark: tokenized code, repeated
+std::vector<llama_token> BenchmarkTokens(llama_model *model, size_t count) {
+  static const char *SAMPLE =
+      "int main(int argc, char **argv) {\n"
+      "  std::vector<std::string> args(argv, argv + argc);\n"
+      "  for (const auto &arg : args) { std::cout << arg << std::endl; }\n"
+      "  return 0;\n}\n";
+
+  const llama_vocab *vocab = llama_model_get_vocab(model);
+  std::vector<llama_token> sample(256);
+  int n = llama_tokenize(vocab, SAMPLE, static_cast<int32_t>(strlen(SAMPLE)),
+                         sample.data(), static_cast<int32_t>(sample.size()),
+                         false, false);
+  if (n <= 0) {
+    return {};
+  }
+  sample.resize(n);
+
+  std::vector<llama_token> tokens;
+  tokens.reserve(count);
+  while (tokens.size() < count) {
+    tokens.push_back(sample[tokens.size() % sample.size()]);
+  }
+  return tokens;
+}
+
+llama_context *CreateBenchContext(llama_model *model, int n_ubatch) {
+  llama_context_params params = llama_context_default_params();
+  params.n_ctx = BENCH_CTX;
+  params.n_batch = std::max(n_ubatch, BENCH_PREFILL_TOKENS);
+  params.n_ubatch = n_ubatch;
+  params.no_perf = true;
+  return llama_init_from_model(model, params);
+}
+
+// Prompt-processing throughput in tokens/s (0 on failure)
+double MeasurePrefill(llama_context *ctx, std::vector<llama_token> &tokens) {
+  llama_memory_clear(llama_get_memory(ctx), true);
+
+  auto start = Clock::now();
+  llama_batch batch =
+      llama_batch_get_one(tokens.data(), static_cast<int32_t>(tokens.size()));
+  if (llama_decode(ctx, batch) != 0) {
+    return 0.0;
+  }
+  return tokens.size() / SecondsSince(start);
+}
+
+// Single-token generation throughput in tokens/s (0 on failure)
+double MeasureDecode(llama_context *ctx, std::vector<llama_token> &tokens) {
+  llama_memory_clear(llama_get_memory(ctx), true);
+
+  llama_batch prompt = llama_batch_get_one(tokens.data(), BENCH_DECODE_PROMPT);
+  if (llama_decode(ctx, prompt) != 0) {
+    return 0.0;
+  }
+
+  auto start = Clock::now();
+  for (int i = 0; i < BENCH_DECODE_TOKENS; ++i) {
+    llama_batch batch =
+        llama_batch_get_one(&tokens[BENCH_DECODE_PROMPT + i], 1);
+    if (llama_decode(ctx, batch) != 0) {
+      return 0.0;
+    }
+  }
+  return BENCH_DECODE_TOKENS / SecondsSince(start);
+}
+
+json ToJson(const TuneSettings &settings) {
+  return {{"n_threads", settings.n_threads},
+          {"n_threads_batch", settings.n_threads_batch},
+          {"n_batch", settings.n_batch},
+          {"n_ubatch", settings.n_ubatch}};
+}
+
+json ReadCache(const std::string &path) {
+  std::ifstream in(path);
+  if (!in) {
+    return json::object();
+  }
+  try {
+    json j = json::parse(in);
+    return j.is_object() ? j : json::object();
+  } catch (const std::exception &) {
+    return json::object();
+  }
+}
+
+} // namespace
+
+TuneSettings Autotuner::GetSettings(const std::string &model_path,
+                                    llama_model *model) {
+  if (auto cached = Lookup(model_path)) {
+    return *cached;
+  }
+  return Tune(model_path, model);
+}
+
+TuneSettings Autotuner::Tune(const std::string &model_path, llama_model *model) {
+  std::lock_guard<std::mutex> lock(tuner_mutex);
+
+  TuneSettings best = Defaults();
+  std::vector<llama_token> tokens = BenchmarkTokens(model, BENCH_PREFILL_TOKENS);
+  if (tokens.size() < BENCH_DECODE_PROMPT + BENCH_DECODE_TOKENS) {
+    return best;
+  }
+
+  // Only sweep thread counts the execution policy would actually allow
+  std::vector<int> thread_counts =
+      ThreadCandidates(ExecutionPolicy::Get().MaxThreads());
+
+  // Pass 1: prompt-processing threads at the default micro batch
+  llama_context *ctx = CreateBenchContext(model, best.n_ubatch);
+  if (!ctx) {
+    return best;
+  }
+  MeasurePrefill(ctx, tokens); // Warm-up: page in weights, allocate buffers
+
+  double best_rate = 0.0;
+  for (int threads : thread_counts) {
+    llama_set_n_threads(ctx, threads, threads);
+    double rate = MeasurePrefill(ctx, tokens);
+    if (rate > best_rate) {
+      best_rate = rate;
+      best.n_threads_batch = threads;
+    }
+  }
+
+  // Pass 2: generation threads (memory bound, often fewer than batch)
+  best_rate = 0.0;
+  for (int threads : thread_counts) {
+    llama_set_n_threads(ctx, threads, best.n_threads_batch);
+    double rate = MeasureDecode(ctx, tokens);
+    if (rate > best_rate) {
+      best_rate = rate;
+      best.n_threads = threads;
+    }
+  }
+  llama_free(ctx);
+
+  // Pass 3: micro batch size with the chosen prompt threads
+  best_rate = 0.0;
+  for (int n_ubatch : UBATCH_CANDIDATES) {
+    llama_context *bench = CreateBenchContext(model, n_ubatch);
+    if (!bench) {
+      continue;
+    }
+    llama_set_n_threads(bench, best.n_threads, best.n_threads_batch);
+    MeasurePrefill(bench, tokens);
+    double rate = MeasurePrefill(bench, tokens);
+    if (rate > best_rate) {
+      best_rate = rate;
+      best.n_ubatch = n_ubatch;
+    }
+    llama_free(bench);
+  }
+  best.n_batch = std::max(best.n_ubatch, 512);
+
+  Store(model_path, best);
+  return best;
+}
+
+std::optional<TuneSettings> Autotuner::Lookup(const std::string &model_path) {
+  std::lock_guard<std::mutex> lock(tuner_mutex);
+
+  json cache = ReadCache(GetCachePath());
+  auto it = cache.find(CacheKey(model_path));
+  if (it == cache.end() || !it->is_object()) {
+    return std::nullopt;
+  }
+
+  TuneSettings settings = Defaults();
+  settings.n_threads = it->value("n_threads", settings.n_threads);
+  settings.n_threads_batch = it->value("n_threads_batch", settings.n_threads_batch);
+  settings.n_batch = it->value("n_batch", settings.n_batch);
+  settings.n_ubatch = it->value("n_ubatch", settings.n_ubatch);
+  return settings;
+}
+
+TuneSettings Autotuner::Defaults() {
+  TuneSettings settings;
+  int cores = static_cast<int>(std::thread::hardware_concurrency());
+  if (cores > 0) {
+    settings.n_threads = std::min(cores, 4);
+    settings.n_threads_batch = settings.n_threads;
+  }
+  return settings;
+}
+
+std::string Autotuner::Describe(const TuneSettings &settings) {
+  std::stringstream ss;
+  ss << settings.n_threads << " gen threads, " << settings.n_threads_batch
+     << " batch threads, batch " << settings.n_batch << ", ubatch "
+     << settings.n_ubatch;
+  return ss.str();
+}
+
+std::string Autotuner::GetCpuModel() {
+  std::string name;
+
+#ifdef _WIN32
+  char buffer[256];
+  DWORD size = sizeof(buffer);
+  if (RegGetValueA(HKEY_LOCAL_MACHINE,
+                   "HARDWARE\\DESCRIPTION\\System\\CentralProcessor\\0",
+                   "ProcessorNameString", RRF_RT_REG_SZ, nullptr, buffer,
+                   &size) == ERROR_SUCCESS) {
+    name = buffer;
+  }
+#elif defined(__APPLE__)
+  char buffer[256];
+  size_t size = sizeof(buffer);
+  if (sysctlbyname("machdep.cpu.brand_string", buffer, &size, nullptr, 0) == 0) {
+    name = buffer;
+  }
+#else
+  std::ifstream cpuinfo("/proc/cpuinfo");
+  std::string line;
+  while (std::getline(cpuinfo, line)) {
+    if (line.rfind("model name", 0) == 0 || line.rfind("Hardware", 0) == 0) {
+      size_t colon = line.find(':');
+      if (colon != std::string::npos) {
+        name = line.substr(colon + 1);
+        name.erase(0, name.find_first_not_of(" \t"));
+      }
+      break;
+    }
+  }
+#endif
+
+  if (name.empty()) {
+    name = "unknown-cpu";
+  }
+  return name + " x" + std::to_string(std::thread::hardware_concurrency());
+}
+
+std::string Autotuner::GetCachePath() {
+  return (std::filesystem::path(util::GetZweekDirectory()) / "tuning.json")
+      .string();
+}
+
+std::string Autotuner::CacheKey(const std::string &model_path) {
+  return GetCpuModel() + "|" + util::ToHex(util::HashFileSampled(model_path));
+}
+
+void Autotuner::Store(const std::string &model_path,
+                      const TuneSettings &settings) {
+  // Caller holds tuner_mutex
+  std::string path = GetCachePath();
+  json cache = ReadCache(path);
+  cache[CacheKey(model_path)] = ToJson(settings);
+
+  std::error_code ec;
+  std::filesystem::create_directories(std::filesystem::path(path).parent_path(), ec);
+
+  // Atomic write: write to temp file, then rename
+  std::string temp_path = path + ".tmp";
+  {
+    std::ofstream out(temp_path, std::ios::binary);
+    if (!out) {
+      return;
+    }
+    out << cache.dump(2);
+  }
+#ifdef _WIN32
+  std::remove(path.c_str());
+#endif
+  if (std::rename(temp_path.c_str(), path.c_str()) != 0) {
+    std::remove(temp_path.c_str());
+  }
+}
+
+std::vector<int> Autotuner::ThreadCandidates(int max_threads) {
+  std::set<int> candidates = {max_threads, std::max(1, max_threads / 2),
+                              std::max(1, max_threads - 1)};
+  for (int n : {1, 2, 4, 6, 8, 12, 16, 24, 32, 48, 64}) {
+    if (n <= max_threads) {
+      candidates.insert(n);
+    }
+  }
+  return {candidates.begin(), candidates.end()};
+}
+
+} // namespace models
+} // namespace zweek
@@ -0,0 +1,122 @@
+#include "models/execution_policy.hpp"
+#include <algorithm>
+#include <cstdlib>
+#include <sstream>
+#include <thread>
+#include <ggml-cpu.h>
+#include <llama.h>
+
+namespace zweek {
+namespace models {
+
+namespace {
+
+// Cores kept free of inference threads for the UI and tools
+constexpr int RESERVED_CORES = 1;
+
+ExecutionPolicy BuildPolicy() {
+  ExecutionPolicy policy;
+  int n_cpus = static_cast<int>(std::thread::hardware_concurrency());
+  if (n_cpus <= 0) {
+    n_cpus = 1;
+  }
+
+  const char *env = std::getenv("ZWEEK_INFERENCE_CPUS");
+  if (env && *env) {
+    for (int cpu : ExecutionPolicy::ParseCpuList(env)) {
+      if (cpu < n_cpus) {
+        policy.inference_cpus.push_back(cpu);
+      }
+    }
+  }
+
+  if (policy.inference_cpus.empty()) {
+    // Leave the first core(s) to the UI when there is anything to spare
+    int first = n_cpus > RESERVED_CORES ? RESERVED_CORES : 0;
+    for (int cpu = first; cpu < n_cpus && cpu < GGML_MAX_N_THREADS; ++cpu) {
+      policy.inference_cpus.push_back(cpu);
+    }
+  }
+  return policy;
+}
+
+} // namespace
+
+const ExecutionPolicy &ExecutionPolicy::Get() {
+  static const ExecutionPolicy policy = BuildPolicy();
+  return policy;
+}
+
+int ExecutionPolicy::MaxThreads() const {
+  return std::max(1, static_cast<int>(inference_cpus.size()));
+}
+
+int ExecutionPolicy::ClampThreads(int n_threads) const {
+  return std::max(1, std::min(n_threads, MaxThreads()));
+}
+
+ggml_threadpool *ExecutionPolicy::CreateThreadPool(int n_threads) const {
+  ggml_threadpool_params params = ggml_threadpool_params_default(ClampThreads(n_threads));
+
+  // Workers may float within the set; the OS balances them there
+  std::fill(std::begin(params.cpumask), std::end(params.cpumask), false);
+  for (int cpu : inference_cpus) {
+    params.cpumask[cpu] = true;
+  }
+  params.strict_cpu = false;
+  params.prio = low_priority ? GGML_SCHED_PRIO_LOW : GGML_SCHED_PRIO_NORMAL;
+
+  return ggml_threadpool_new(&params);
+}
+
+std::string ExecutionPolicy::Describe() const {
+  std::stringstream ss;
+  ss << "CPUs ";
+  for (size_t i = 0; i < inference_cpus.size(); ++i) {
+    // Collapse consecutive runs into ranges
+    size_t j = i;
+    while (j + 1 < inference_cpus.size() &&
+           inference_cpus[j + 1] == inference_cpus[j] + 1) {
+      j++;
+    }
+    if (i > 0) {
+      ss << ",";
+    }
+    ss << inference_cpus[i];
+    if (j > i) {
+      ss << "-" << inference_cpus[j];
+    }
+    i = j;
+  }
+  ss << (low_priority ? ", low priority" : ", normal priority");
+  return ss.str();
+}
+
+std::vector<int> ExecutionPolicy::ParseCpuList(const std::string &spec) {
+  std::vector<int> cpus;
+  std::stringstream ss(spec);
+  std::string part;
+  while (std::getline(ss, part, ',')) {
+    try {
+      // Ranges are clamped to the CPUs a threadpool can pin, so a huge one
+      // ("0-2000000000") costs nothing
+      size_t dash = part.find('-');
+      int first = std::stoi(part.substr(0, dash));
+      int last = dash == std::string::npos ? first : std::stoi(part.substr(dash + 1));
+      first = std::max(first, 0);
+      last = std::min(last, GGML_MAX_N_THREADS - 1);
+      for (int cpu = first; cpu <= last; ++cpu) {
+        cpus.push_back(cpu);
+      }
+    } catch (...) {
+      // Ignore malformed entries
+    }
+  }
+
+  std::sort(cpus.begin(), cpus.end());
+  cpus.erase(std::unique(cpus.begin(), cpus.end()), cpus.end());
+  return cpus;
+}
+
+} // namespace models
+} // namespace zweek
@@ -0,0 +1,70 @@
+#include "models/kv_snapshot_store.hpp"
+#include "util/hash.hpp"
+#include "util/paths.hpp"
+#include <algorithm>
+#include <filesystem>
+
+namespace zweek {
+namespace models {
+
+namespace fs = std::filesystem;
+
+namespace {
+constexpr const char *SNAPSHOT_EXTENSION = ".kv";
+} // namespace
+
+KvSnapshotStore::KvSnapshotStore(const std::string &directory) : directory_(directory) {}
+
+KvSnapshotStore &KvSnapshotStore::Instance() {
+  static KvSnapshotStore store(
+      (fs::path(util::GetZweekSubdirectory("cache")) / "kv").string());
+  return store;
+}
+
+uint64_t KvSnapshotStore::MakeKey(const std::vector<int32_t> &tokens, uint64_t model_hash,
+                                  uint64_t layout_hash) {
+  uint64_t key = util::HashBytes(tokens.data(), tokens.size() * sizeof(int32_t));
+  key = util::HashCombine(key, model_hash);
+  return util::HashCombine(key, layout_hash);
+}
+
+std::string KvSnapshotStore::PathFor(uint64_t key) const {
+  return (fs::path(directory_) / (util::ToHex(key) + SNAPSHOT_EXTENSION)).string();
+}
+
+bool KvSnapshotStore::Contains(uint64_t key) const {
+  std::error_code ec;
+  return fs::is_regular_file(PathFor(key), ec);
+}
+
+void KvSnapshotStore::Touch(uint64_t key) {
+  std::error_code ec;
+  fs::last_write_time(PathFor(key), fs::file_time_type::clock::now(), ec);
+}
+
+void KvSnapshotStore::Prune() {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  std::error_code ec;
+  fs::create_directories(directory_, ec);
+  std::vector<std::pair<fs::file_time_type, fs::path>> snapshots;
+  for (fs::directory_iterator it(directory_, ec), end; !ec && it != end; it.increment(ec)) {
+    if (it->path().extension() == SNAPSHOT_EXTENSION) {
+      std::error_code time_ec;
+      snapshots.emplace_back(it->last_write_time(time_ec), it->path());
+    }
+  }
+  if (snapshots.size() <= MAX_SNAPSHOTS) {
+    return;
+  }
+
+  // Newest first; everything past the limit goes
+  std::sort(snapshots.begin(), snapshots.end(),
+            [](const auto &a, const auto &b) { return a.first > b.first; });
+  for (size_t i = MAX_SNAPSHOTS; i < snapshots.size(); ++i) {
+    fs::remove(snapshots[i].second, ec);
+  }
+}
+
+} // namespace models
+} // namespace zweek
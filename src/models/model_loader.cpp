@@ -1,6 +1,18 @@
 #include "models/model_loader.hpp"
+#include "models/execution_policy.hpp"
+#include "models/kv_snapshot_store.hpp"
+#include "models/response_cache.hpp"
+#include "models/token_cache.hpp"
+#include "util/hash.hpp"
+#include "util/thread_pool.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
 #include <cstring>
 #include <iostream>
+#include <thread>
+#include <ggml-cpu.h>
 #include <llama.h>
 
 namespace zweek {
@@ -23,18 +35,128 @@ ModelLoader::~ModelLoader() {
   llama_backend_free();
 }
 
+namespace {
+
+// Sampler chain parameters
+constexpr int32_t SAMPLER_TOP_K = 40;
+constexpr float SAMPLER_TOP_P = 0.95f;
+constexpr int32_t SAMPLER_PENALTY_LAST_N = 64;
+constexpr float SAMPLER_PENALTY_REPEAT = 1.5f;
+constexpr float SAMPLER_TEMPERATURE = 0.7f;
+constexpr uint32_t SAMPLER_FIXED_SEED = 42;
+
+// Segments shorter than this are tokenized directly rather than cached
+constexpr size_t MIN_CACHED_SEGMENT_BYTES = 128;
+// A snapshot is only restored when it saves decoding at least this many
+// tokens; a shorter tail is cheaper to decode than to load
+constexpr size_t MIN_RESTORED_TOKENS = 64;
+
+// Uncached segments are tokenized side by side past this many bytes
+constexpr size_t PARALLEL_TOKENIZE_BYTES = 16 * 1024;
+
+// Workers for tokenizing the uncached segments of a long prompt
+util::ThreadPool &TokenizerPool() {
+  static util::ThreadPool pool(std::max<size_t>(1, std::thread::hardware_concurrency() / 2));
+  return pool;
+}
+
+// One llama_tokenize call; safe to run concurrently on the same vocabulary
+std::vector<llama_token> TokenizeText(const llama_vocab *vocab, const char *text, size_t size,
+                                      bool add_special) {
+  std::vector<llama_token> tokens(size + 16);
+  int n_tokens = llama_tokenize(vocab, text, static_cast<int32_t>(size), tokens.data(),
+                                static_cast<int32_t>(tokens.size()), add_special,
+                                true); // parse_special = true
+  if (n_tokens < 0) {
+    // Buffer too small: -n_tokens is the required size
+    tokens.resize(-n_tokens);
+    n_tokens = llama_tokenize(vocab, text, static_cast<int32_t>(size), tokens.data(),
+                              static_cast<int32_t>(tokens.size()), add_special, true);
+  }
+  tokens.resize(std::max(n_tokens, 0));
+  return tokens;
+}
+
+// Pieces used to replay a cached answer through the stream callback
+std::vector<std::string> SplitForReplay(const std::string &text) {
+  std::vector<std::string> pieces;
+  size_t start = 0;
+  for (size_t i = 1; i <= text.size(); ++i) {
+    if (i == text.size() || text[i] == ' ' || text[i] == '\n') {
+      pieces.push_back(text.substr(start, i - start));
+      start = i;
+    }
+  }
+  return pieces;
+}
+
+ggml_type ToGgmlType(KvCacheType type) {
+  switch (type) {
+  case KvCacheType::Q8_0:
+    return GGML_TYPE_Q8_0;
+  case KvCacheType::Q4_0:
+    return GGML_TYPE_Q4_0;
+  default:
+    return GGML_TYPE_F16;
+  }
+}
+
+// Integer value of "<architecture>.<key>" in the model's GGUF metadata,
+// or 0 if it is absent
+int64_t ArchMetadata(const llama_model *model, const std::string &key) {
+  char value[128];
+  if (llama_model_meta_val_str(model, "general.architecture", value, sizeof(value)) <= 0) {
+    return 0;
+  }
+  const std::string name = std::string(value) + "." + key;
+  if (llama_model_meta_val_str(model, name.c_str(), value, sizeof(value)) <= 0) {
+    return 0;
+  }
+  return std::strtoll(value, nullptr, 10);
+}
+
+std::string FormatMiB(size_t bytes) {
+  char buf[32];
+  snprintf(buf, sizeof(buf), "%.1f MiB", bytes / (1024.0 * 1024.0));
+  return buf;
+}
+
+} // namespace
+
 bool ModelLoader::LoadResident(const std::string &model_path, int n_ctx) {
   is_resident_ = true;
   return Load(model_path, n_ctx);
 }
 
+bool ModelLoader::LoadResident(const std::string &model_path,
+                               const ContextOptions &options) {
+  is_resident_ = true;
+  return Load(model_path, options);
+}
+
 bool ModelLoader::Load(const std::string &model_path, int n_ctx) {
+  ContextOptions options;
+  options.n_ctx = n_ctx;
+  return Load(model_path, options);
+}
+
+bool ModelLoader::Load(const std::string &model_path,
+                       const ContextOptions &options) {
+  std::lock_guard<std::mutex> lock(mutex_);
+
   // Unload existing model first
   if (model_ != nullptr) {
-    Unload();
+    FreeModel();
   }
 
-  n_ctx_ = n_ctx;
+  n_ctx_ = options.n_ctx;
+  options_ = options;
+  options_.n_ctx_max = std::max(options_.n_ctx_max, options_.n_ctx);
+
+  // llama.cpp only supports a quantized V cache with flash attention
+  if (options_.type_v != KvCacheType::F16) {
+    options_.flash_attn = true;
+  }
 
   // Load model
   llama_model_params model_params = llama_model_default_params();
@@ -45,87 +167,727 @@ bool ModelLoader::Load(const std::string &model_path, int n_ctx) {
     return false;
   }
 
-  // Create context
-  llama_context_params ctx_params = llama_context_default_params();
-  ctx_params.n_ctx = n_ctx;
-  ctx_params.n_batch = 512;
-  ctx_params.n_threads = 4; // Use 4 threads for old hardware
+  model_path_ = model_path;
 
-  ctx_ = llama_new_context_with_model(model_, ctx_params);
+  // Thread and batch settings for this CPU, benchmarked on first use.
+  // The benchmark measures generation, which embedding models don't do.
+  tune_settings_ = options_.embeddings ? Autotuner::Defaults()
+                                       : Autotuner::GetSettings(model_path, model_);
 
-  if (!ctx_) {
+  // Create context
+  if (!CreateContext()) {
     std::cerr << "Failed to create context" << std::endl;
     llama_free_model(model_);
     model_ = nullptr;
     return false;
   }
 
+  // Identifies the model in response cache keys
+  model_hash_ = util::HashFileSampled(model_path);
+  LoadVocabInfo();
+
   // Create sampler
+  BuildSampler();
+
+  // Model loaded successfully (silent - don't spam TUI)
+  return true;
+}
+
+void ModelLoader::BuildSampler() {
+  if (sampler_) {
+    llama_sampler_free(sampler_);
+    sampler_ = nullptr;
+  }
+  sampler_ = NewSampler(determinism_ == DeterminismMode::FixedSeed ? SAMPLER_FIXED_SEED
+                                                                   : LLAMA_DEFAULT_SEED);
+}
+
+llama_sampler *ModelLoader::NewSampler(uint32_t seed) const {
   auto sparams = llama_sampler_chain_default_params();
-  sampler_ = llama_sampler_chain_init(sparams);
+  llama_sampler *chain = llama_sampler_chain_init(sparams);
 
-  llama_sampler_chain_add(sampler_, llama_sampler_init_top_k(40));
-  llama_sampler_chain_add(sampler_, llama_sampler_init_top_p(0.95f, 1));
-  llama_sampler_chain_add(sampler_, 
-                          llama_sampler_init_penalties(64, 1.5f, 0.0f, 0.0f));
-  llama_sampler_chain_add(sampler_, llama_sampler_init_temp(0.7f));
-  llama_sampler_chain_add(sampler_,
-                          llama_sampler_init_dist(LLAMA_DEFAULT_SEED));
+  if (determinism_ == DeterminismMode::Greedy) {
+    llama_sampler_chain_add(chain, llama_sampler_init_greedy());
+    return chain;
+  }
 
-  // Model loaded successfully (silent - don't spam TUI)
+  llama_sampler_chain_add(chain, llama_sampler_init_top_k(SAMPLER_TOP_K));
+  llama_sampler_chain_add(chain, llama_sampler_init_top_p(SAMPLER_TOP_P, 1));
+  llama_sampler_chain_add(chain, 
+                          llama_sampler_init_penalties(SAMPLER_PENALTY_LAST_N,
+                                                       SAMPLER_PENALTY_REPEAT,
+                                                       0.0f, 0.0f));
+  llama_sampler_chain_add(chain, llama_sampler_init_temp(SAMPLER_TEMPERATURE));
+  llama_sampler_chain_add(chain, llama_sampler_init_dist(seed));
+  return chain;
+}
+
+uint64_t ModelLoader::SamplerHash() const {
+  uint64_t hash = util::HashCombine(util::HASH_SEED, static_cast<uint64_t>(determinism_));
+  if (determinism_ == DeterminismMode::FixedSeed) {
+    const float params[] = {static_cast<float>(SAMPLER_TOP_K), SAMPLER_TOP_P,
+                            static_cast<float>(SAMPLER_PENALTY_LAST_N),
+                            SAMPLER_PENALTY_REPEAT, SAMPLER_TEMPERATURE,
+                            static_cast<float>(SAMPLER_FIXED_SEED)};
+    hash = util::HashBytes(params, sizeof(params), hash);
+  }
+  return hash;
+}
+
+void ModelLoader::SetDeterminism(DeterminismMode mode) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  determinism_ = mode;
+  if (model_) {
+    BuildSampler();
+  }
+}
+
+bool ModelLoader::CreateContext() {
+  const ExecutionPolicy &policy = ExecutionPolicy::Get();
+  int n_threads = policy.ClampThreads(tune_settings_.n_threads);
+  int n_threads_batch = policy.ClampThreads(tune_settings_.n_threads_batch);
+
+  llama_context_params ctx_params = llama_context_default_params();
+  ctx_params.n_ctx = n_ctx_;
+  ctx_params.n_batch = tune_settings_.n_batch;
+  ctx_params.n_ubatch = tune_settings_.n_ubatch;
+  ctx_params.n_threads = n_threads;
+  ctx_params.n_threads_batch = n_threads_batch;
+  ctx_params.type_k = ToGgmlType(options_.type_k);
+  ctx_params.type_v = ToGgmlType(options_.type_v);
+  ctx_params.flash_attn_type = options_.flash_attn ? LLAMA_FLASH_ATTN_TYPE_ENABLED
+                                                   : LLAMA_FLASH_ATTN_TYPE_DISABLED;
+  if (options_.n_parallel > 1) {
+    // Sequence 0 holds the shared prompt, one more per candidate. A unified
+    // cache lets them share the prompt's cells instead of splitting n_ctx.
+    ctx_params.n_seq_max = static_cast<uint32_t>(options_.n_parallel) + 1;
+    ctx_params.kv_unified = true;
+  }
+  if (options_.embeddings) {
+    // Pooling needs the whole input in a single micro-batch
+    ctx_params.embeddings = true;
+    ctx_params.n_batch = n_ctx_;
+    ctx_params.n_ubatch = n_ctx_;
+  }
+
+  ctx_ = llama_init_from_model(model_, ctx_params);
+  cached_tokens_.clear();
+  if (!ctx_) {
+    return false;
+  }
+  n_ctx_ = static_cast<int>(llama_n_ctx(ctx_)); // llama.cpp may round up
+
+  // Keep llama's workers off the UI core and below its priority. If the
+  // pools can't be created llama falls back to its own default threads.
+  threadpool_ = policy.CreateThreadPool(n_threads);
+  threadpool_batch_ = n_threads_batch == n_threads
+                          ? nullptr
+                          : policy.CreateThreadPool(n_threads_batch);
+  if (threadpool_) {
+    llama_attach_threadpool(ctx_, threadpool_,
+                            threadpool_batch_ ? threadpool_batch_ : threadpool_);
+  }
   return true;
 }
 
+void ModelLoader::FreeContext() {
+  if (ctx_) {
+    llama_free(ctx_);
+    ctx_ = nullptr;
+  }
+
+  // Pools must outlive the context that uses them
+  if (threadpool_batch_) {
+    ggml_threadpool_free(threadpool_batch_);
+    threadpool_batch_ = nullptr;
+  }
+  if (threadpool_) {
+    ggml_threadpool_free(threadpool_);
+    threadpool_ = nullptr;
+  }
+}
+
+bool ModelLoader::EnsureContextCapacity(size_t n_tokens) {
+  if (n_tokens <= static_cast<size_t>(n_ctx_)) {
+    return true;
+  }
+  if (n_tokens > static_cast<size_t>(options_.n_ctx_max)) {
+    return false;
+  }
+
+  // Geometric growth keeps the number of migrations logarithmic
+  size_t new_n_ctx = static_cast<size_t>(n_ctx_);
+  while (new_n_ctx < n_tokens) {
+    new_n_ctx *= 2;
+  }
+  new_n_ctx = std::min(new_n_ctx, static_cast<size_t>(options_.n_ctx_max));
+  return ResizeContext(static_cast<int>(new_n_ctx));
+}
+
+bool ModelLoader::ResizeContext(int new_n_ctx) {
+  // Snapshot sequence 0 so the new context starts with the same cells
+  std::vector<uint8_t> state(llama_state_seq_get_size(ctx_, 0));
+  size_t state_size = llama_state_seq_get_data(ctx_, state.data(), state.size(), 0);
+  std::vector<llama_token> tokens = cached_tokens_;
+
+  int old_n_ctx = n_ctx_;
+  FreeContext();
+  n_ctx_ = new_n_ctx;
+  if (!CreateContext()) {
+    // Fall back to the previous size rather than losing the model
+    n_ctx_ = old_n_ctx;
+    if (!CreateContext()) {
+      return false;
+    }
+  }
+
+  if (state_size > 0 &&
+      llama_state_seq_set_data(ctx_, state.data(), state_size, 0) == state_size) {
+    cached_tokens_ = std::move(tokens);
+  } else {
+    // State didn't transfer: start from an empty cache, next prompt re-decodes
+    llama_memory_clear(llama_get_memory(ctx_), true);
+  }
+  return n_ctx_ >= new_n_ctx;
+}
+
+void ModelLoader::ShrinkContext() {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  if (!ctx_ || n_ctx_ <= options_.n_ctx) {
+    return;
+  }
+
+  // Keep what fits (usually the system prompt), drop the rest
+  size_t keep = std::min(cached_tokens_.size(),
+                         static_cast<size_t>(options_.n_ctx) - 1);
+  llama_memory_seq_rm(llama_get_memory(ctx_), 0, static_cast<llama_pos>(keep), -1);
+  cached_tokens_.resize(keep);
+
+  ResizeContext(options_.n_ctx);
+}
+
+std::string ModelLoader::Retune() {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  if (!model_) {
+    return "model not loaded";
+  }
+
+  tune_settings_ = Autotuner::Tune(model_path_, model_);
+
+  // Batch sizes are fixed at context creation, so rebuild it
+  FreeContext();
+  if (!CreateContext()) {
+    return "failed to recreate context";
+  }
+  return Autotuner::Describe(tune_settings_);
+}
+
+size_t ModelLoader::GetKvCacheBytes(KvCacheType type_k, KvCacheType type_v) {
+  if (!model_) {
+    return 0;
+  }
+
+  // Per layer and cell: one K row and one V row per KV head. Head sizes
+  // come from the metadata: many models (Qwen3 among them) use heads
+  // wider than n_embd / n_head.
+  const int64_t n_layer = llama_model_n_layer(model_);
+  const int64_t n_head = std::max(1, llama_model_n_head(model_));
+  const int64_t n_head_kv = llama_model_n_head_kv(model_);
+  const int64_t head_default = llama_model_n_embd(model_) / n_head;
+  int64_t head_k = ArchMetadata(model_, "attention.key_length");
+  int64_t head_v = ArchMetadata(model_, "attention.value_length");
+  if (head_k <= 0) {
+    head_k = head_default;
+  }
+  if (head_v <= 0) {
+    head_v = head_default;
+  }
+
+  size_t row_bytes = ggml_row_size(ToGgmlType(type_k), head_k * n_head_kv) +
+                     ggml_row_size(ToGgmlType(type_v), head_v * n_head_kv);
+  return row_bytes * static_cast<size_t>(n_layer) * static_cast<size_t>(n_ctx_);
+}
+
+std::string ModelLoader::Describe() {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  if (!model_ || !ctx_) {
+    return "not loaded";
+  }
+
+  size_t kv_bytes = GetKvCacheBytes(options_.type_k, options_.type_v);
+  size_t f16_bytes = GetKvCacheBytes(KvCacheType::F16, KvCacheType::F16);
+
+  std::string report = "ctx " + std::to_string(n_ctx_);
+  if (options_.n_ctx_max > n_ctx_) {
+    report += " (grows to " + std::to_string(options_.n_ctx_max) + ")";
+  }
+  report += ", KV " + FormatMiB(kv_bytes) + " (" +
+            KvCacheTypeName(options_.type_k) + "/" +
+            KvCacheTypeName(options_.type_v) + ")";
+  if (kv_bytes != f16_bytes) {
+    report += " vs " + FormatMiB(f16_bytes) + " f16";
+  }
+  report += options_.flash_attn ? ", flash attention" : ", default attention";
+  return report;
+}
+
+const char *ModelLoader::KvCacheTypeName(KvCacheType type) {
+  switch (type) {
+  case KvCacheType::Q8_0:
+    return "q8_0";
+  case KvCacheType::Q4_0:
+    return "q4_0";
+  default:
+    return "f16";
+  }
+}
+
 void ModelLoader::Unload() {
   // Don't unload if resident
   if (is_resident_) {
     return;
   }
 
+  std::lock_guard<std::mutex> lock(mutex_);
+  FreeModel();
+}
+
+void ModelLoader::FreeModel() {
   if (sampler_) {
     llama_sampler_free(sampler_);
     sampler_ = nullptr;
   }
 
-  if (ctx_) {
-    llama_free(ctx_);
-    ctx_ = nullptr;
+  FreeContext();
+
+  if (model_) {
+    llama_model_free(model_);
+    model_ = nullptr;
   }
+
+  cached_tokens_.clear();
 }
+
 std::string ModelLoader::Infer(const std::string &prompt,
                                const std::string &grammar, int max_tokens,
                                std::function<void(const std::string &)> stream_callback,
                                std::atomic<bool>* interrupt_flag) {
+  std::lock_guard<std::mutex> lock(mutex_);
+
   if (!model_ || !ctx_) {
     return "[Error: Model not loaded]";
   }
 
   return RunInference(prompt, grammar, max_tokens, stream_callback, interrupt_flag);
 }
+
+bool ModelLoader::Prefill(const std::string &prefix,
+                          std::atomic<bool>* interrupt_flag,
+                          size_t* n_reused) {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  if (!model_ || !ctx_) {
+    return false;
+  }
+
+  std::vector<llama_token> tokens = Tokenize(prefix);
+  if (tokens.empty()) {
+    return false;
+  }
+  return DecodePrompt(tokens, interrupt_flag, n_reused);
+}
+
+bool ModelLoader::PrefillSnapshot(const std::string &prefix,
+                                  std::atomic<bool>* interrupt_flag,
+                                  PrefixPrefill* prefill) {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  if (!model_ || !ctx_) {
+    return false;
+  }
+
+  std::vector<llama_token> tokens = Tokenize(prefix);
+  if (tokens.empty() || !EnsureContextCapacity(tokens.size())) {
+    return false;
+  }
+  PrefixPrefill result;
+  result.n_tokens = tokens.size();
+
+  size_t n_shared = 0;
+  while (n_shared < cached_tokens_.size() && n_shared < tokens.size() &&
+         cached_tokens_[n_shared] == tokens[n_shared]) {
+    n_shared++;
+  }
+
+  if (n_shared < tokens.size()) {
+    KvSnapshotStore &store = KvSnapshotStore::Instance();
+    const uint64_t layout = util::HashCombine(static_cast<uint64_t>(options_.type_k),
+                                              static_cast<uint64_t>(options_.type_v));
+    const uint64_t key = KvSnapshotStore::MakeKey(tokens, model_hash_, layout);
+    const std::string path = store.PathFor(key);
+
+    if (tokens.size() - n_shared >= MIN_RESTORED_TOKENS && store.Contains(key) &&
+        RestoreSnapshot(path, tokens)) {
+      store.Touch(key);
+      result.restored = true;
+    } else {
+      size_t n_reused = 0;
+      if (!DecodePrompt(tokens, interrupt_flag, &n_reused)) {
+        return false;
+      }
+      result.n_decoded = tokens.size() - n_reused;
+
+      // Sequence 0 now holds exactly the prefix
+      if (llama_state_seq_save_file(ctx_, path.c_str(), 0, tokens.data(), tokens.size()) > 0) {
+        store.Prune();
+      }
+    }
+  }
+
+  if (prefill) {
+    *prefill = result;
+  }
+  return true;
+}
+
+bool ModelLoader::RestoreSnapshot(const std::string &path,
+                                  const std::vector<llama_token> &tokens) {
+  llama_memory_t mem = llama_get_memory(ctx_);
+  llama_memory_seq_rm(mem, 0, -1, -1);
+  cached_tokens_.clear();
+
+  std::vector<llama_token> stored(tokens.size());
+  size_t n_stored = 0;
+  if (llama_state_seq_load_file(ctx_, path.c_str(), 0, stored.data(), stored.size(),
+                                &n_stored) == 0 ||
+      n_stored != tokens.size() || stored != tokens) {
+    llama_memory_seq_rm(mem, 0, -1, -1);
+    return false;
+  }
+  cached_tokens_ = tokens;
+  return true;
+}
+
+bool ModelLoader::Embed(const std::string &text, std::vector<float> &embedding) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!model_ || !ctx_ || !options_.embeddings) {
+    return false;
+  }
+
+  std::vector<llama_token> tokens = Tokenize(text);
+  if (tokens.empty()) {
+    return false;
+  }
+  tokens.resize(std::min(tokens.size(), static_cast<size_t>(n_ctx_)));
+
+  // Each embedding is computed from scratch
+  if (llama_memory_t mem = llama_get_memory(ctx_)) {
+    llama_memory_clear(mem, true);
+  }
+  cached_tokens_.clear();
+
+  llama_batch batch =
+      llama_batch_get_one(tokens.data(), static_cast<int32_t>(tokens.size()));
+  if (llama_decode(ctx_, batch) != 0) {
+    return false;
+  }
+
+  // Models without a pooling head: use the last token's embedding
+  const float *values = llama_get_embeddings_seq(ctx_, 0);
+  if (!values) {
+    values = llama_get_embeddings_ith(ctx_, -1);
+  }
+  if (!values) {
+    return false;
+  }
+
+  const int n_embd = llama_model_n_embd(model_);
+  embedding.assign(values, values + n_embd);
+
+  double norm = 0.0;
+  for (float v : embedding) {
+    norm += static_cast<double>(v) * v;
+  }
+  if (norm <= 0.0) {
+    return false;
+  }
+  const float scale = static_cast<float>(1.0 / std::sqrt(norm));
+  for (float &v : embedding) {
+    v *= scale;
+  }
+  return true;
+}
+
+size_t ModelLoader::CountTokens(const std::string &text) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!model_ || text.empty()) {
+    return 0;
+  }
+  return Tokenize(text, false).size();
+}
+
+void ModelLoader::TruncateCache(size_t n_tokens) {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  if (!ctx_ || n_tokens >= cached_tokens_.size()) {
+    return;
+  }
+  llama_memory_seq_rm(llama_get_memory(ctx_), 0,
+                      static_cast<llama_pos>(n_tokens), -1);
+  cached_tokens_.resize(n_tokens);
+}
+
+void ModelLoader::LoadVocabInfo() {
+  const llama_vocab *vocab = llama_model_get_vocab(model_);
+  const enum llama_vocab_type type = llama_vocab_type(vocab);
+
+  // Token texts, attributes and scores stand in for the whole vocabulary
+  // (merges aren't exposed); models sharing one share cached tokens
+  uint64_t hash = util::HashCombine(util::HASH_SEED, static_cast<uint64_t>(type));
+  hash = util::HashCombine(hash, llama_vocab_get_add_bos(vocab) ? 1 : 0);
+  special_tokens_.assign(256, {});
+  max_special_length_ = 0;
+  const llama_token n_vocab = llama_vocab_n_tokens(vocab);
+  for (llama_token id = 0; id < n_vocab; ++id) {
+    const char *text = llama_vocab_get_text(vocab, id);
+    const std::string piece = text ? text : "";
+    const int attr = llama_vocab_get_attr(vocab, id);
+    const float score = llama_vocab_get_score(vocab, id);
+    hash = util::HashCombine(hash, piece.size());
+    hash = util::HashString(piece, hash);
+    hash = util::HashCombine(hash, static_cast<uint64_t>(attr));
+    hash = util::HashBytes(&score, sizeof(score), hash);
+
+    // The tokens llama.cpp splits text around before tokenizing the rest
+    const int special = LLAMA_TOKEN_ATTR_CONTROL | LLAMA_TOKEN_ATTR_USER_DEFINED |
+                        LLAMA_TOKEN_ATTR_UNKNOWN;
+    if ((attr & special) && !piece.empty()) {
+      special_tokens_[static_cast<unsigned char>(piece[0])].push_back(
+          {piece, (attr & LLAMA_TOKEN_ATTR_LSTRIP) == 0});
+      max_special_length_ = std::max(max_special_length_, piece.size());
+    }
+  }
+  for (auto &bucket : special_tokens_) {
+    std::stable_sort(bucket.begin(), bucket.end(),
+                     [](const SpecialToken &a, const SpecialToken &b) {
+                       return a.text.size() > b.text.size();
+                     });
+  }
+  vocab_hash_ = hash;
+
+  // Tokenizers that add tokens at the end, or around every input, don't
+  // tokenize a segment the way they tokenize the same text mid-prompt
+  segmentable_ = !llama_vocab_get_add_eos(vocab) &&
+                 (type == LLAMA_VOCAB_TYPE_BPE || type == LLAMA_VOCAB_TYPE_SPM);
+}
+
+size_t ModelLoader::CutAt(const std::string &text, size_t pos) const {
+  // Longest special token at pos (llama.cpp tries longer ones first)
+  auto match = [&](size_t at) -> const SpecialToken * {
+    for (const auto &token : special_tokens_[static_cast<unsigned char>(text[at])]) {
+      if (text.compare(at, token.text.size(), token.text) == 0) {
+        return &token;
+      }
+    }
+    return nullptr;
+  };
+  const SpecialToken *token = match(pos);
+  if (!token || !token->cut) {
+    return 0;
+  }
+
+  // Any other special token overlapping this one could win it instead
+  const size_t end = pos + token->text.size();
+  const size_t from = pos >= max_special_length_ ? pos - max_special_length_ + 1 : 0;
+  for (size_t at = from; at < end; ++at) {
+    if (at == pos) {
+      continue;
+    }
+    for (const auto &other : special_tokens_[static_cast<unsigned char>(text[at])]) {
+      if ((at > pos || at + other.text.size() > pos) &&
+          text.compare(at, other.text.size(), other.text) == 0) {
+        return 0;
+      }
+    }
+  }
+  return token->text.size();
+}
+
+std::vector<size_t> ModelLoader::SegmentText(const std::string &text) const {
+  std::vector<size_t> starts{0};
+  if (!segmentable_) {
+    return starts;
+  }
+  for (size_t pos = 1; pos < text.size(); ++pos) {
+    if (special_tokens_[static_cast<unsigned char>(text[pos])].empty()) {
+      continue;
+    }
+    if (size_t length = CutAt(text, pos)) {
+      starts.push_back(pos);
+      pos += length - 1;
+    }
+  }
+  return starts;
+}
+
+std::vector<llama_token> ModelLoader::Tokenize(const std::string &text, bool add_special) {
+  const llama_vocab *vocab = llama_model_get_vocab(model_);
+
+  // Only the first segment gets the leading special tokens (BOS)
+  struct Segment {
+    size_t begin = 0;
+    size_t end = 0;
+    bool cacheable = false;
+    uint64_t key = 0;
+    bool cached = false;
+    std::vector<llama_token> tokens;
+  };
+  std::vector<Segment> segments;
+  const std::vector<size_t> starts = SegmentText(text);
+  segments.resize(starts.size());
+  for (size_t i = 0; i < starts.size(); ++i) {
+    segments[i].begin = starts[i];
+    segments[i].end = i + 1 < starts.size() ? starts[i + 1] : text.size();
+  }
+
+  TokenCache &cache = TokenCache::Instance();
+  std::vector<size_t> misses;
+  size_t miss_bytes = 0;
+  for (size_t i = 0; i < segments.size(); ++i) {
+    Segment &segment = segments[i];
+    const size_t size = segment.end - segment.begin;
+    segment.cacheable = size >= MIN_CACHED_SEGMENT_BYTES;
+    if (segment.cacheable) {
+      segment.key = TokenCache::MakeKey(text.substr(segment.begin, size), vocab_hash_,
+                                        add_special && i == 0);
+      segment.cached = cache.Lookup(segment.key, segment.tokens);
+    }
+    if (!segment.cached) {
+      misses.push_back(i);
+      miss_bytes += size;
+    }
+  }
+
+  auto tokenize = [&](size_t i) {
+    Segment &segment = segments[i];
+    segment.tokens = TokenizeText(vocab, text.data() + segment.begin,
+                                  segment.end - segment.begin, add_special && i == 0);
+  };
+  if (misses.size() > 1 && miss_bytes >= PARALLEL_TOKENIZE_BYTES) {
+    std::vector<std::future<void>> pending;
+    for (size_t i : misses) {
+      pending.push_back(TokenizerPool().Submit([&tokenize, i]() { tokenize(i); }));
+    }
+    for (auto &future : pending) {
+      future.get();
+    }
+  } else {
+    for (size_t i : misses) {
+      tokenize(i);
+    }
+  }
+
+  std::vector<llama_token> tokens;
+  for (auto &segment : segments) {
+    if (segment.cacheable && !segment.cached) {
+      cache.Store(segment.key, segment.tokens);
+    }
+    tokens.insert(tokens.end(), segment.tokens.begin(), segment.tokens.end());
+  }
+  return tokens;
+}
+
+bool ModelLoader::DecodePrompt(const std::vector<llama_token> &tokens,
+                               std::atomic<bool>* interrupt_flag,
+                               size_t* n_reused) {
+  llama_memory_t mem = llama_get_memory(ctx_);
+
+  // Reuse the longest prefix already in the KV cache, but always decode at
+  // least one token so the sampler sees logits for this prompt
+  size_t max_reuse = tokens.empty() ? 0 : tokens.size() - 1;
+  size_t n_past = 0;
+  while (n_past < cached_tokens_.size() && n_past < max_reuse &&
+         cached_tokens_[n_past] == tokens[n_past]) {
+    n_past++;
+  }
+
+  llama_memory_seq_rm(mem, 0, static_cast<llama_pos>(n_past), -1);
+  cached_tokens_.resize(n_past);
+  if (n_reused) {
+    *n_reused = n_past;
+  }
+
+  // Grow an elastic context before decoding (may recreate ctx_)
+  if (!EnsureContextCapacity(tokens.size())) {
+    return false;
+  }
+
+  // Decode the remainder in n_batch sized chunks
+  mem = llama_get_memory(ctx_);
+  const size_t n_batch = llama_n_batch(ctx_);
+  for (size_t i = n_past; i < tokens.size(); i += n_batch) {
+    if (interrupt_flag && interrupt_flag->load()) {
+      return false;
+    }
+
+    size_t n = std::min(n_batch, tokens.size() - i);
+    llama_batch batch = llama_batch_get_one(
+        const_cast<llama_token *>(tokens.data() + i), static_cast<int32_t>(n));
+    if (llama_decode(ctx_, batch) != 0) {
+      // Drop the partially decoded chunk so the cache stays consistent
+      llama_memory_seq_rm(mem, 0, static_cast<llama_pos>(cached_tokens_.size()), -1);
+      return false;
+    }
+    cached_tokens_.insert(cached_tokens_.end(), tokens.begin() + i,
+                          tokens.begin() + i + n);
+  }
+  return true;
+}
+
 std::string ModelLoader::RunInference(const std::string &prompt,
                                       const std::string &grammar,
                                       int max_tokens,
                                       std::function<void(const std::string &)> stream_callback,
                                       std::atomic<bool>* interrupt_flag) {
   // Tokenize
-  std::vector<llama_token> tokens;
-  tokens.resize(prompt.size() + 16);
   const llama_vocab *vocab = llama_model_get_vocab(model_);
-  int n_tokens = llama_tokenize(vocab, prompt.c_str(), prompt.size(),
-                                tokens.data(), tokens.size(), true, true); // parse_special = true
-  if (n_tokens < 0)
+  std::vector<llama_token> tokens = Tokenize(prompt);
+  if (tokens.empty())
     return "[Error: Tokenization failed]";
-  tokens.resize(n_tokens);
 
-  // Evaluate
-  llama_batch batch = llama_batch_get_one(tokens.data(), n_tokens);
-  if (llama_decode(ctx_, batch) != 0)
+  // Deterministic requests are a pure function of the prompt tokens, so a
+  // stored answer can be replayed instead of generated
+  const bool cacheable = determinism_ != DeterminismMode::Off;
+  uint64_t cache_key = 0;
+  if (cacheable) {
+    cache_key = ResponseCache::MakeKey(tokens, model_hash_, SamplerHash(),
+                                       grammar, max_tokens);
+    std::string cached;
+    if (ResponseCache::Instance().Lookup(cache_key, cached)) {
+      if (stream_callback) {
+        for (const auto &piece : SplitForReplay(cached)) {
+          stream_callback(piece);
+        }
+      }
+      return cached;
+    }
+
+    // Same seed, fresh penalty history: reproducible from this prompt alone
+    llama_sampler_reset(sampler_);
+  }
+
+  // Evaluate (only the part not already in the KV cache)
+  if (!DecodePrompt(tokens))
     return "[Error: Decode failed]";
 
-  // Generate tokens with streaming display
+  // Generate tokens, streamed as they come. The text is the model's own:
+  // code and prompts built from it must not gain line breaks, so display
+  // wrapping is left to the chat view.
   std::string result;
-  int line_length = 0;
-  const int MAX_LINE_LENGTH = 80;
+  bool complete = false; // Ended by EOG or max_tokens rather than cut short
 
   for (int i = 0; i < max_tokens; ++i) {
     // Check if interrupted
@@ -142,39 +904,16 @@ std::string ModelLoader::RunInference(const std::string &prompt,
     }
 
     llama_token tok = llama_sampler_sample(sampler_, ctx_, -1);
-    if (llama_token_is_eog(vocab, tok))
+    if (llama_token_is_eog(vocab, tok)) {
+      complete = true;
       break;
+    }
 
     char buf[256];
     int n = llama_token_to_piece(vocab, tok, buf, sizeof(buf), 0, false);
     if (n > 0) {
       std::string token_str(buf, n);
-
-      // Word wrap: insert newline if line gets too long
-      if (line_length + token_str.length() > MAX_LINE_LENGTH) {
-        bool wrapped = false;
-        // If token starts with space, replace it with newline
-        if (!token_str.empty() && token_str[0] == ' ') {
-          token_str[0] = '\n';
-          line_length = 0;
-          wrapped = true;
-        }
-        // Otherwise if it's a long word or we can't find a space, force wrap
-        else if (line_length > 0) {
-          if (stream_callback) stream_callback("\n");
-          result += "\n";
-          line_length = 0;
-          wrapped = true;
-        }
-      }
-
       result += token_str;
-      line_length += token_str.length();
-
-      // Reset line counter on newlines
-      if (token_str.find('\n') != std::string::npos) {
-        line_length = 0;
-      }
 
       // Stream to console for immediate feedback (optional)
       // std::cout << token_str << std::flush;
@@ -184,11 +923,154 @@ std::string ModelLoader::RunInference(const std::string &prompt,
       }
     }
 
-    batch = llama_batch_get_one(&tok, 1);
+    // The last allowed token finishes the answer, whatever the decode below
+    // does
+    complete = i + 1 == max_tokens;
+
+    // Grow the context as the answer gets longer; stop at the cap
+    if (!EnsureContextCapacity(cached_tokens_.size() + 1))
+      break;
+
+    llama_batch batch = llama_batch_get_one(&tok, 1);
     if (llama_decode(ctx_, batch) != 0)
       break;
+    cached_tokens_.push_back(tok);
+  }
+
+  // Only complete answers are worth replaying: not interrupted ones, nor
+  // ones cut short by the context cap or a failed decode
+  if (cacheable && complete) {
+    ResponseCache::Instance().Store(cache_key, result);
   }
   return result;
 }
+std::vector<std::string> ModelLoader::InferCandidates(
+    const std::string &prompt, int n_candidates, int max_tokens,
+    std::function<bool(int, const std::string &)> on_piece,
+    std::function<void(int, const std::string &)> on_finished,
+    std::atomic<bool>* interrupt_flag) {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  if (!model_ || !ctx_) {
+    return {};
+  }
+
+  // Greedy candidates would all be the same answer
+  int n = std::min(n_candidates, options_.n_parallel);
+  if (determinism_ == DeterminismMode::Greedy) {
+    n = 1;
+  }
+  if (n <= 1) {
+    // One candidate: the ordinary path, stopped through a local flag
+    std::atomic<bool> stop{false};
+    std::string text = RunInference(prompt, "", max_tokens,
+                                     [&](const std::string &piece) {
+                                       if ((interrupt_flag && interrupt_flag->load()) ||
+                                           (on_piece && !on_piece(0, piece))) {
+                                         stop = true;
+                                       }
+                                     },
+                                     &stop);
+    if (!stop && on_finished) {
+      on_finished(0, text);
+    }
+    return {text};
+  }
+
+  const llama_vocab *vocab = llama_model_get_vocab(model_);
+  std::vector<llama_token> tokens = Tokenize(prompt);
+  if (tokens.empty() || !DecodePrompt(tokens, interrupt_flag)) {
+    return {};
+  }
+
+  // Reserve every candidate's cells now: a resize mid-generation only
+  // carries sequence 0 across
+  const size_t n_prompt = cached_tokens_.size();
+  const size_t room = static_cast<size_t>(options_.n_ctx_max) - std::min(
+      n_prompt, static_cast<size_t>(options_.n_ctx_max));
+  max_tokens = static_cast<int>(std::min(static_cast<size_t>(std::max(max_tokens, 0)),
+                                         room / static_cast<size_t>(n)));
+  if (max_tokens <= 0 || !EnsureContextCapacity(n_prompt + static_cast<size_t>(n * max_tokens))) {
+    return {};
+  }
+
+  struct Candidate {
+    llama_sampler *sampler = nullptr;
+    std::string text;
+    int32_t logits_index = -1; // Row of its logits in the last batch
+    bool active = true;
+  };
+  std::vector<Candidate> candidates(static_cast<size_t>(n));
+  llama_memory_t mem = llama_get_memory(ctx_);
+  for (int i = 0; i < n; ++i) {
+    // Distinct seeds, or every candidate would draw the same tokens
+    candidates[i].sampler = NewSampler(determinism_ == DeterminismMode::FixedSeed
+                                           ? SAMPLER_FIXED_SEED + static_cast<uint32_t>(i)
+                                           : LLAMA_DEFAULT_SEED);
+    llama_memory_seq_cp(mem, 0, i + 1, -1, -1);
+  }
+
+  llama_batch batch = llama_batch_init(n, 0, 1);
+  for (int step = 0; step < max_tokens; ++step) {
+    if (interrupt_flag && interrupt_flag->load()) {
+      break;
+    }
+
+    batch.n_tokens = 0;
+    for (int i = 0; i < n; ++i) {
+      Candidate &candidate = candidates[i];
+      if (!candidate.active) {
+        continue;
+      }
+      llama_token tok = llama_sampler_sample(candidate.sampler, ctx_, candidate.logits_index);
+      if (llama_token_is_eog(vocab, tok)) {
+        candidate.active = false;
+        if (on_finished) {
+          on_finished(i, candidate.text);
+        }
+        continue;
+      }
+
+      char buf[256];
+      int n_chars = llama_token_to_piece(vocab, tok, buf, sizeof(buf), 0, false);
+      if (n_chars > 0) {
+        std::string piece(buf, n_chars);
+        candidate.text += piece;
+        if (on_piece && !on_piece(i, piece)) {
+          candidate.active = false;
+          continue;
+        }
+      }
+
+      const int32_t k = batch.n_tokens++;
+      batch.token[k] = tok;
+      batch.pos[k] = static_cast<llama_pos>(n_prompt) + step;
+      batch.n_seq_id[k] = 1;
+      batch.seq_id[k][0] = i + 1;
+      batch.logits[k] = true;
+      candidate.logits_index = k;
+    }
+
+    // The last step's tokens are never sampled from, so skip their decode
+    if (batch.n_tokens == 0 || step + 1 == max_tokens || llama_decode(ctx_, batch) != 0) {
+      break;
+    }
+  }
+  llama_batch_free(batch);
+
+  // Candidates cut off by max_tokens (or a failed decode) end here
+  const bool interrupted = interrupt_flag && interrupt_flag->load();
+  std::vector<std::string> texts;
+  for (int i = 0; i < n; ++i) {
+    if (candidates[i].active && !interrupted && on_finished) {
+      on_finished(i, candidates[i].text);
+    }
+    llama_sampler_free(candidates[i].sampler);
+    llama_memory_seq_rm(mem, i + 1, -1, -1);
+    texts.push_back(std::move(candidates[i].text));
+  }
+  return texts;
+}
+
 } // namespace models
 } // namespace zweek
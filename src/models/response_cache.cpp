@@ -0,0 +1,152 @@
+#include "models/response_cache.hpp"
+#include "util/file_lock.hpp"
+#include "util/hash.hpp"
+#include "util/paths.hpp"
+#include <filesystem>
+#include <fstream>
+
+namespace zweek {
+namespace models {
+
+namespace {
+constexpr uint32_t RECORD_MAGIC = 0x32435a5a; // "ZZC2" (answers are stored unwrapped)
+constexpr uint32_t MAX_RESPONSE_BYTES = 1 << 24;
+constexpr size_t HEADER_BYTES = sizeof(uint32_t) + sizeof(uint64_t) + sizeof(uint32_t);
+} // namespace
+
+ResponseCache::ResponseCache(const std::string &path) : path_(path) {
+  LoadIndex();
+}
+
+ResponseCache &ResponseCache::Instance() {
+  static ResponseCache cache(
+      (std::filesystem::path(util::GetZweekSubdirectory("cache")) / "responses.log")
+          .string());
+  return cache;
+}
+
+uint64_t ResponseCache::MakeKey(const std::vector<int32_t> &tokens,
+                                uint64_t model_hash, uint64_t sampler_hash,
+                                const std::string &grammar, int max_tokens) {
+  uint64_t key = util::HashBytes(tokens.data(), tokens.size() * sizeof(int32_t));
+  key = util::HashCombine(key, model_hash);
+  key = util::HashCombine(key, sampler_hash);
+  key = util::HashCombine(key, util::HashString(grammar));
+  return util::HashCombine(key, static_cast<uint64_t>(max_tokens));
+}
+
+void ResponseCache::LoadIndex() {
+  std::error_code ec;
+  uint64_t file_size = std::filesystem::file_size(path_, ec);
+  if (ec || file_size < end_offset_) {
+    // Removed or replaced: index it again from the start
+    index_.clear();
+    end_offset_ = 0;
+  }
+  std::ifstream in(path_, std::ios::binary);
+  if (ec || !in) {
+    return;
+  }
+
+  uint64_t offset = end_offset_;
+  while (offset + HEADER_BYTES <= file_size) {
+    uint32_t magic = 0, length = 0;
+    uint64_t key = 0;
+    in.seekg(static_cast<std::streamoff>(offset));
+    in.read(reinterpret_cast<char *>(&magic), sizeof(magic));
+    in.read(reinterpret_cast<char *>(&key), sizeof(key));
+    in.read(reinterpret_cast<char *>(&length), sizeof(length));
+    if (!in || magic != RECORD_MAGIC || length > MAX_RESPONSE_BYTES) {
+      break;
+    }
+
+    // A torn record (crash mid-append) ends before its declared length
+    if (offset + HEADER_BYTES + length > file_size) {
+      break;
+    }
+
+    // Later records win, so a re-stored key replaces the old answer
+    index_[key] = {offset + HEADER_BYTES, length};
+    offset += HEADER_BYTES + length;
+  }
+  end_offset_ = offset;
+}
+
+bool ResponseCache::Lookup(uint64_t key, std::string &response) {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  auto it = index_.find(key);
+  if (it == index_.end()) {
+    return false;
+  }
+
+  std::ifstream in(path_, std::ios::binary);
+  if (!in) {
+    return false;
+  }
+
+  // The log is shared with other instances: make sure the record is still
+  // the one indexed before trusting its bytes
+  uint32_t magic = 0, length = 0;
+  uint64_t stored_key = 0;
+  in.seekg(static_cast<std::streamoff>(it->second.offset - HEADER_BYTES));
+  in.read(reinterpret_cast<char *>(&magic), sizeof(magic));
+  in.read(reinterpret_cast<char *>(&stored_key), sizeof(stored_key));
+  in.read(reinterpret_cast<char *>(&length), sizeof(length));
+  if (!in || magic != RECORD_MAGIC || stored_key != key || length != it->second.length) {
+    index_.erase(it);
+    return false;
+  }
+  response.resize(it->second.length);
+  in.read(&response[0], it->second.length);
+  return static_cast<bool>(in);
+}
+
+void ResponseCache::Store(uint64_t key, const std::string &response) {
+  if (response.size() > MAX_RESPONSE_BYTES) {
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  // Other instances append to the same log. Under the file lock, index what
+  // they added first; whatever is left past the last complete record is
+  // then a torn tail (no live writer leaves one while the lock is held),
+  // dropped before appending so the log stays parseable.
+  util::FileLock file_lock(path_ + ".lock");
+  if (!file_lock.IsLocked()) {
+    return;
+  }
+  LoadIndex();
+  std::error_code ec;
+  if (std::filesystem::exists(path_, ec) &&
+      std::filesystem::file_size(path_, ec) != end_offset_) {
+    std::filesystem::resize_file(path_, end_offset_, ec);
+  }
+
+  std::ofstream out(path_, std::ios::binary | std::ios::app);
+  if (!out) {
+    return;
+  }
+
+  uint32_t length = static_cast<uint32_t>(response.size());
+  out.write(reinterpret_cast<const char *>(&RECORD_MAGIC), sizeof(RECORD_MAGIC));
+  out.write(reinterpret_cast<const char *>(&key), sizeof(key));
+  out.write(reinterpret_cast<const char *>(&length), sizeof(length));
+  out.write(response.data(), response.size());
+  out.flush();
+  if (!out) {
+    return;
+  }
+
+  index_[key] = {end_offset_ + HEADER_BYTES, length};
+  end_offset_ += HEADER_BYTES + length;
+}
+
+size_t ResponseCache::Size() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return index_.size();
+}
+
+} // namespace models
+} // namespace zweek
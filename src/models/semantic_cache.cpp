@@ -0,0 +1,427 @@
+#include "models/semantic_cache.hpp"
+#include "util/hash.hpp"
+#include "util/paths.hpp"
+#include <algorithm>
+#include <cctype>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <ggml.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define ZWEEK_SIMD_AVX2 1
+#define ZWEEK_TARGET_AVX2 __attribute__((target("avx2,fma,f16c")))
+#elif defined(_MSC_VER) && defined(__AVX2__)
+#include <immintrin.h>
+#define ZWEEK_SIMD_AVX2 1
+#define ZWEEK_TARGET_AVX2
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define ZWEEK_SIMD_NEON 1
+#endif
+
+namespace zweek {
+namespace models {
+
+namespace {
+constexpr const char *EMBEDDING_MODEL_PATH = "models/bge-small-en-v1.5-q8_0.gguf";
+constexpr int EMBEDDING_CTX = 512;
+
+constexpr uint32_t FILE_MAGIC = 0x31435353;   // "SSC1"
+constexpr uint32_t RECORD_MAGIC = 0x52435353; // "SSCR"
+constexpr size_t HEADER_BYTES = sizeof(uint32_t) * 2 + sizeof(uint64_t);
+constexpr uint32_t MAX_ANSWER_BYTES = 1 << 20;
+constexpr uint32_t MAX_FILES = 64;
+constexpr uint32_t MAX_PATH_BYTES = 4096;
+
+// Cosine similarity needed for a hit. Unrelated questions about code still
+// score ~0.7-0.8 with small embedding models; rephrasings score above 0.95.
+constexpr float SIMILARITY_THRESHOLD = 0.95f;
+
+// One- and two-word follow-ups ("why?", "and tests?") depend on the
+// conversation, not just the words, so they never hit
+constexpr size_t MIN_QUESTION_WORDS = 4;
+
+// Oldest half is dropped when the cache reaches this size
+constexpr size_t MAX_ENTRIES = 2048;
+
+float DotScalar(const float *query, const uint16_t *row, size_t dim) {
+  float sum = 0.0f;
+  for (size_t i = 0; i < dim; ++i) {
+    sum += query[i] * ggml_fp16_to_fp32(row[i]);
+  }
+  return sum;
+}
+
+#if defined(ZWEEK_SIMD_AVX2)
+ZWEEK_TARGET_AVX2
+float DotAvx2(const float *query, const uint16_t *row, size_t dim) {
+  __m256 acc0 = _mm256_setzero_ps();
+  __m256 acc1 = _mm256_setzero_ps();
+  size_t i = 0;
+  for (; i + 16 <= dim; i += 16) {
+    __m256 r0 = _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i *>(row + i)));
+    __m256 r1 = _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i *>(row + i + 8)));
+    acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(query + i), r0, acc0);
+    acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(query + i + 8), r1, acc1);
+  }
+  for (; i + 8 <= dim; i += 8) {
+    __m256 r = _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i *>(row + i)));
+    acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(query + i), r, acc0);
+  }
+
+  __m256 acc = _mm256_add_ps(acc0, acc1);
+  __m128 sum = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+  sum = _mm_hadd_ps(sum, sum);
+  sum = _mm_hadd_ps(sum, sum);
+  return _mm_cvtss_f32(sum) + DotScalar(query + i, row + i, dim - i);
+}
+
+bool HasAvx2() {
+#if defined(__GNUC__)
+  static const bool supported = __builtin_cpu_supports("avx2") &&
+                                __builtin_cpu_supports("fma") &&
+                                __builtin_cpu_supports("f16c");
+  return supported;
+#else
+  return true; // Compiled with /arch:AVX2
+#endif
+}
+#endif
+
+#if defined(ZWEEK_SIMD_NEON)
+float DotNeon(const float *query, const uint16_t *row, size_t dim) {
+  float32x4_t acc0 = vdupq_n_f32(0.0f);
+  float32x4_t acc1 = vdupq_n_f32(0.0f);
+  size_t i = 0;
+  for (; i + 8 <= dim; i += 8) {
+    float32x4_t r0 = vcvt_f32_f16(vreinterpret_f16_u16(vld1_u16(row + i)));
+    float32x4_t r1 = vcvt_f32_f16(vreinterpret_f16_u16(vld1_u16(row + i + 4)));
+    acc0 = vfmaq_f32(acc0, vld1q_f32(query + i), r0);
+    acc1 = vfmaq_f32(acc1, vld1q_f32(query + i + 4), r1);
+  }
+  return vaddvq_f32(vaddq_f32(acc0, acc1)) + DotScalar(query + i, row + i, dim - i);
+}
+#endif
+
+size_t CountWords(const std::string &text) {
+  size_t words = 0;
+  bool in_word = false;
+  for (char c : text) {
+    bool space = std::isspace(static_cast<unsigned char>(c)) != 0;
+    if (!space && !in_word) {
+      ++words;
+    }
+    in_word = !space;
+  }
+  return words;
+}
+
+template <typename T> void WritePod(std::ostream &out, const T &value) {
+  out.write(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+template <typename T> bool ReadPod(std::istream &in, T &value) {
+  return static_cast<bool>(in.read(reinterpret_cast<char *>(&value), sizeof(value)));
+}
+
+void WriteHeader(std::ostream &out, uint32_t dim, uint64_t model_hash) {
+  WritePod(out, FILE_MAGIC);
+  WritePod(out, dim);
+  WritePod(out, model_hash);
+}
+
+} // namespace
+
+std::string SemanticCache::EncodeRecord(const std::vector<uint16_t> &row,
+                                        const Entry &entry) {
+  std::ostringstream record;
+  WritePod(record, RECORD_MAGIC);
+  WritePod(record, static_cast<uint32_t>(entry.files.size()));
+  WritePod(record, static_cast<uint32_t>(entry.answer.size()));
+  record.write(reinterpret_cast<const char *>(row.data()), row.size() * sizeof(uint16_t));
+  for (const auto &stamp : entry.files) {
+    WritePod(record, static_cast<uint32_t>(stamp.path.size()));
+    record.write(stamp.path.data(), stamp.path.size());
+    WritePod(record, stamp.hash);
+  }
+  record.write(entry.answer.data(), entry.answer.size());
+  return record.str();
+}
+
+SemanticCache::SemanticCache()
+    : path_((std::filesystem::path(util::GetZweekSubdirectory("cache")) /
+             "semantic.bin")
+                .string()) {}
+
+bool SemanticCache::EnsureLoaded() {
+  std::lock_guard<std::mutex> load_lock(load_mutex_);
+  if (load_attempted_) {
+    return available_;
+  }
+  load_attempted_ = true;
+
+  std::error_code ec;
+  if (!std::filesystem::exists(EMBEDDING_MODEL_PATH, ec)) {
+    return false; // Optional model: no semantic cache without it
+  }
+
+  ContextOptions options;
+  options.n_ctx = EMBEDDING_CTX;
+  options.embeddings = true;
+  if (!embedder_.Load(EMBEDDING_MODEL_PATH, options)) {
+    return false;
+  }
+
+  // Probe the embedding size; it must match the stored matrix
+  std::vector<float> probe;
+  if (!embedder_.Embed("probe", probe) || probe.empty()) {
+    embedder_.Unload();
+    return false;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  dim_ = probe.size();
+  model_hash_ = util::HashFileSampled(EMBEDDING_MODEL_PATH);
+  LoadEntries();
+  available_ = true;
+  return true;
+}
+
+bool SemanticCache::EmbedQuestion(const std::string &question,
+                                  std::vector<float> &embedding) {
+  if (CountWords(question) < MIN_QUESTION_WORDS || !EnsureLoaded()) {
+    return false;
+  }
+  return embedder_.Embed(question, embedding) && embedding.size() == dim_;
+}
+
+void SemanticCache::Similarities(const float *query, const uint16_t *rows,
+                                 size_t n_rows, size_t dim, float *scores) {
+#if defined(ZWEEK_SIMD_AVX2)
+  if (HasAvx2()) {
+    for (size_t r = 0; r < n_rows; ++r) {
+      scores[r] = DotAvx2(query, rows + r * dim, dim);
+    }
+    return;
+  }
+#elif defined(ZWEEK_SIMD_NEON)
+  for (size_t r = 0; r < n_rows; ++r) {
+    scores[r] = DotNeon(query, rows + r * dim, dim);
+  }
+  return;
+#endif
+  for (size_t r = 0; r < n_rows; ++r) {
+    scores[r] = DotScalar(query, rows + r * dim, dim);
+  }
+}
+
+bool SemanticCache::Lookup(const std::string &question,
+                           const std::vector<std::string> &files,
+                           std::string &answer) {
+  std::vector<float> query;
+  if (!EmbedQuestion(question, query)) {
+    return false;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (entries_.empty()) {
+    return false;
+  }
+
+  std::vector<float> scores(entries_.size());
+  Similarities(query.data(), matrix_.data(), entries_.size(), dim_, scores.data());
+
+  // Best candidates first; stop at the first whose files are unchanged
+  std::vector<size_t> candidates;
+  for (size_t i = 0; i < scores.size(); ++i) {
+    if (scores[i] >= SIMILARITY_THRESHOLD) {
+      candidates.push_back(i);
+    }
+  }
+  std::sort(candidates.begin(), candidates.end(),
+            [&](size_t a, size_t b) { return scores[a] > scores[b]; });
+
+  for (size_t i : candidates) {
+    const Entry &entry = entries_[i];
+
+    // The answer must have been about the same files
+    if (entry.files.size() != files.size()) {
+      continue;
+    }
+    bool unchanged = true;
+    for (const auto &stamp : entry.files) {
+      if (std::find(files.begin(), files.end(), stamp.path) == files.end() ||
+          util::HashFile(stamp.path) != stamp.hash) {
+        unchanged = false;
+        break;
+      }
+    }
+    if (unchanged) {
+      answer = entry.answer;
+      return true;
+    }
+  }
+  return false;
+}
+
+void SemanticCache::Store(const std::string &question,
+                          const std::vector<std::string> &files,
+                          const std::string &answer) {
+  if (answer.size() > MAX_ANSWER_BYTES || files.size() > MAX_FILES) {
+    return;
+  }
+
+  std::vector<float> embedding;
+  if (!EmbedQuestion(question, embedding)) {
+    return;
+  }
+
+  Entry entry;
+  entry.answer = answer;
+  for (const auto &path : files) {
+    if (path.size() > MAX_PATH_BYTES) {
+      return;
+    }
+    entry.files.push_back({path, util::HashFile(path)});
+  }
+
+  std::vector<uint16_t> row(dim_);
+  ggml_fp32_to_fp16_row(embedding.data(), reinterpret_cast<ggml_fp16_t *>(row.data()),
+                        static_cast<int64_t>(dim_));
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (entries_.size() >= MAX_ENTRIES) {
+    Compact();
+  }
+  if (!AppendRecord(row, entry)) {
+    return;
+  }
+  matrix_.insert(matrix_.end(), row.begin(), row.end());
+  entries_.push_back(std::move(entry));
+}
+
+size_t SemanticCache::Size() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return entries_.size();
+}
+
+void SemanticCache::LoadEntries() {
+  matrix_.clear();
+  entries_.clear();
+  end_offset_ = 0;
+
+  std::ifstream in(path_, std::ios::binary);
+  if (!in) {
+    return;
+  }
+
+  // A different embedding model makes the stored vectors meaningless
+  uint32_t magic = 0, dim = 0;
+  uint64_t model_hash = 0;
+  if (!ReadPod(in, magic) || !ReadPod(in, dim) || !ReadPod(in, model_hash) ||
+      magic != FILE_MAGIC || dim != dim_ || model_hash != model_hash_) {
+    return;
+  }
+
+  uint64_t offset = HEADER_BYTES;
+  std::vector<uint16_t> row(dim_);
+  while (true) {
+    uint32_t record_magic = 0, n_files = 0, answer_len = 0;
+    if (!ReadPod(in, record_magic) || !ReadPod(in, n_files) ||
+        !ReadPod(in, answer_len) || record_magic != RECORD_MAGIC ||
+        n_files > MAX_FILES || answer_len > MAX_ANSWER_BYTES) {
+      break;
+    }
+    if (!in.read(reinterpret_cast<char *>(row.data()), dim_ * sizeof(uint16_t))) {
+      break;
+    }
+
+    Entry entry;
+    bool complete = true;
+    for (uint32_t f = 0; f < n_files && complete; ++f) {
+      uint32_t path_len = 0;
+      FileStamp stamp;
+      complete = ReadPod(in, path_len) && path_len <= MAX_PATH_BYTES;
+      if (complete) {
+        stamp.path.resize(path_len);
+        complete = in.read(&stamp.path[0], path_len) && ReadPod(in, stamp.hash);
+      }
+      entry.files.push_back(std::move(stamp));
+    }
+    entry.answer.resize(answer_len);
+    if (!complete || !in.read(&entry.answer[0], answer_len)) {
+      break; // Torn record from a crash mid-append
+    }
+
+    matrix_.insert(matrix_.end(), row.begin(), row.end());
+    entries_.push_back(std::move(entry));
+    offset = static_cast<uint64_t>(in.tellg());
+  }
+  end_offset_ = offset;
+}
+
+bool SemanticCache::AppendRecord(const std::vector<uint16_t> &row,
+                                 const Entry &entry) {
+  const std::string bytes = EncodeRecord(row, entry);
+
+  // Start a new file, or drop a torn tail before appending
+  std::error_code ec;
+  if (end_offset_ == 0) {
+    std::ofstream out(path_, std::ios::binary | std::ios::trunc);
+    WriteHeader(out, static_cast<uint32_t>(dim_), model_hash_);
+    if (!out) {
+      return false;
+    }
+    end_offset_ = HEADER_BYTES;
+  } else if (std::filesystem::file_size(path_, ec) != end_offset_) {
+    std::filesystem::resize_file(path_, end_offset_, ec);
+  }
+
+  std::ofstream out(path_, std::ios::binary | std::ios::app);
+  out.write(bytes.data(), bytes.size());
+  out.flush();
+  if (!out) {
+    return false;
+  }
+  end_offset_ += bytes.size();
+  return true;
+}
+
+void SemanticCache::Compact() {
+  // Keep the newest half
+  size_t keep_from = entries_.size() / 2;
+
+  // Atomic rewrite: write to temp file, then rename
+  std::string temp_path = path_ + ".tmp";
+  uint64_t size = HEADER_BYTES;
+  {
+    std::ofstream out(temp_path, std::ios::binary | std::ios::trunc);
+    WriteHeader(out, static_cast<uint32_t>(dim_), model_hash_);
+    std::vector<uint16_t> row(dim_);
+    for (size_t i = keep_from; i < entries_.size(); ++i) {
+      std::copy(matrix_.begin() + i * dim_, matrix_.begin() + (i + 1) * dim_,
+                row.begin());
+      std::string bytes = EncodeRecord(row, entries_[i]);
+      out.write(bytes.data(), bytes.size());
+      size += bytes.size();
+    }
+    if (!out) {
+      return; // Keep appending to the old file
+    }
+  }
+
+  std::error_code ec;
+  std::filesystem::rename(temp_path, path_, ec);
+  if (ec) {
+    return;
+  }
+
+  entries_.erase(entries_.begin(), entries_.begin() + keep_from);
+  matrix_.erase(matrix_.begin(), matrix_.begin() + keep_from * dim_);
+  end_offset_ = size;
+}
+
+} // namespace models
+} // namespace zweek
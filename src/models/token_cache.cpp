@@ -0,0 +1,223 @@
+#include "models/token_cache.hpp"
+#include "util/file_lock.hpp"
+#include "util/hash.hpp"
+#include "util/paths.hpp"
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <random>
+
+namespace zweek {
+namespace models {
+
+namespace {
+constexpr uint32_t LOG_MAGIC = 0x31545a5a;    // "ZZT1"
+constexpr uint32_t RECORD_MAGIC = 0x32435a5a; // "ZZC2"
+constexpr uint32_t MAX_RECORD_TOKENS = 1 << 22;
+constexpr uint64_t MAX_LOG_BYTES = 256ULL << 20;
+constexpr size_t LOG_HEADER_BYTES = sizeof(uint32_t) + sizeof(uint64_t);
+constexpr size_t HEADER_BYTES = sizeof(uint32_t) + sizeof(uint64_t) + sizeof(uint32_t);
+
+// Identifies one incarnation of the log, so instances notice a restart
+uint64_t NewGeneration() {
+  std::random_device random;
+  uint64_t generation = util::HashCombine(
+      util::HASH_SEED,
+      static_cast<uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count()));
+  generation = util::HashCombine(generation, (uint64_t{random()} << 32) | random());
+  return generation == 0 ? 1 : generation;
+}
+} // namespace
+
+TokenCache::TokenCache(const std::string &path) : path_(path) {
+  LoadIndex();
+}
+
+TokenCache &TokenCache::Instance() {
+  static TokenCache cache(
+      (std::filesystem::path(util::GetZweekSubdirectory("cache")) / "tokens.log").string());
+  return cache;
+}
+
+uint64_t TokenCache::MakeKey(const std::string &text, uint64_t vocab_hash, bool add_special) {
+  uint64_t key = util::HashString(text);
+  key = util::HashCombine(key, vocab_hash);
+  return util::HashCombine(key, add_special ? 1 : 0);
+}
+
+void TokenCache::LoadIndex() {
+  if (!mapping_.Open(path_) || mapping_.Size() < LOG_HEADER_BYTES) {
+    index_.clear();
+    generation_ = 0;
+    end_offset_ = 0;
+    return;
+  }
+
+  const char *data = mapping_.Data();
+  const uint64_t file_size = mapping_.Size();
+  uint32_t log_magic = 0;
+  uint64_t generation = 0;
+  std::memcpy(&log_magic, data, sizeof(log_magic));
+  std::memcpy(&generation, data + sizeof(log_magic), sizeof(generation));
+  if (log_magic != LOG_MAGIC) {
+    index_.clear();
+    generation_ = 0;
+    end_offset_ = 0;
+    return;
+  }
+  if (generation != generation_ || file_size < end_offset_) {
+    // Another log than the one indexed: start from its first record
+    index_.clear();
+    generation_ = generation;
+    end_offset_ = LOG_HEADER_BYTES;
+  }
+
+  uint64_t offset = end_offset_;
+  while (offset + HEADER_BYTES <= file_size) {
+    uint32_t magic = 0, count = 0;
+    uint64_t key = 0;
+    std::memcpy(&magic, data + offset, sizeof(magic));
+    std::memcpy(&key, data + offset + sizeof(magic), sizeof(key));
+    std::memcpy(&count, data + offset + sizeof(magic) + sizeof(key), sizeof(count));
+    if (magic != RECORD_MAGIC || count > MAX_RECORD_TOKENS) {
+      break;
+    }
+
+    // A torn record (crash mid-append) ends before its declared length
+    const uint64_t record_bytes = HEADER_BYTES + uint64_t{count} * sizeof(int32_t);
+    if (offset + record_bytes > file_size) {
+      break;
+    }
+
+    index_[key] = {offset + HEADER_BYTES, count};
+    offset += record_bytes;
+  }
+  end_offset_ = offset;
+}
+
+bool TokenCache::StartLog() {
+  // A new file renamed into place, never a truncation: other instances
+  // may still have the old log mapped, and pages cut from under a mapping
+  // fault when touched
+  mapping_.Close();
+  const uint64_t generation = NewGeneration();
+  const std::string temp_path = path_ + ".new";
+  {
+    std::ofstream out(temp_path, std::ios::binary | std::ios::trunc);
+    out.write(reinterpret_cast<const char *>(&LOG_MAGIC), sizeof(LOG_MAGIC));
+    out.write(reinterpret_cast<const char *>(&generation), sizeof(generation));
+    out.flush();
+    if (!out) {
+      return false;
+    }
+  }
+  std::error_code ec;
+  std::filesystem::rename(temp_path, path_, ec);
+  if (ec) {
+    std::filesystem::remove(temp_path, ec);
+    return false;
+  }
+  index_.clear();
+  generation_ = generation;
+  end_offset_ = LOG_HEADER_BYTES;
+  return true;
+}
+
+bool TokenCache::Lookup(uint64_t key, std::vector<int32_t> &tokens) {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  auto it = index_.find(key);
+  if (it == index_.end()) {
+    return false;
+  }
+
+  // Records appended since the log was mapped need a fresh mapping
+  const uint64_t begin = it->second.offset - HEADER_BYTES;
+  const uint64_t end = it->second.offset + uint64_t{it->second.count} * sizeof(int32_t);
+  if (end > mapping_.Size() && (!mapping_.Open(path_) || end > mapping_.Size())) {
+    index_.erase(it);
+    return false;
+  }
+
+  // The log is shared with other instances: make sure the record is still
+  // the one indexed before decoding its tokens into a prompt
+  uint32_t magic = 0, count = 0;
+  uint64_t stored_key = 0;
+  const char *record = mapping_.Data() + begin;
+  std::memcpy(&magic, record, sizeof(magic));
+  std::memcpy(&stored_key, record + sizeof(magic), sizeof(stored_key));
+  std::memcpy(&count, record + sizeof(magic) + sizeof(stored_key), sizeof(count));
+  if (magic != RECORD_MAGIC || stored_key != key || count != it->second.count) {
+    index_.erase(it);
+    return false;
+  }
+
+  tokens.resize(count);
+  if (!tokens.empty()) {
+    std::memcpy(tokens.data(), mapping_.Data() + it->second.offset,
+                tokens.size() * sizeof(int32_t));
+  }
+  return true;
+}
+
+void TokenCache::Store(uint64_t key, const std::vector<int32_t> &tokens) {
+  if (tokens.size() > MAX_RECORD_TOKENS) {
+    return;
+  }
+  const uint64_t record_bytes = HEADER_BYTES + tokens.size() * sizeof(int32_t);
+
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  // Under the file lock, index what other instances appended first; what
+  // is left past the last complete record is then a torn tail
+  util::FileLock file_lock(path_ + ".lock");
+  if (!file_lock.IsLocked()) {
+    return;
+  }
+  LoadIndex();
+  if (index_.count(key)) {
+    return;
+  }
+
+  // Start over when there is no valid log yet or it is full
+  if (generation_ == 0 || end_offset_ + record_bytes > MAX_LOG_BYTES) {
+    if (!StartLog()) {
+      return;
+    }
+  }
+  std::error_code ec;
+  if (std::filesystem::file_size(path_, ec) != end_offset_ && !ec) {
+    // Only the torn tail goes, so no indexed record leaves any mapping.
+    // Our own mapping can't stay open across it on Windows.
+    mapping_.Close();
+    std::filesystem::resize_file(path_, end_offset_, ec);
+  }
+
+  std::ofstream out(path_, std::ios::binary | std::ios::app);
+  if (!out) {
+    return;
+  }
+
+  uint32_t count = static_cast<uint32_t>(tokens.size());
+  out.write(reinterpret_cast<const char *>(&RECORD_MAGIC), sizeof(RECORD_MAGIC));
+  out.write(reinterpret_cast<const char *>(&key), sizeof(key));
+  out.write(reinterpret_cast<const char *>(&count), sizeof(count));
+  out.write(reinterpret_cast<const char *>(tokens.data()),
+            static_cast<std::streamsize>(tokens.size() * sizeof(int32_t)));
+  out.flush();
+  if (!out) {
+    return;
+  }
+
+  index_[key] = {end_offset_ + HEADER_BYTES, count};
+  end_offset_ += record_bytes;
+}
+
+size_t TokenCache::Size() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return index_.size();
+}
+
+} // namespace models
+} // namespace zweek
@@ -1,9 +1,97 @@
 #include "pipeline/orchestrator.hpp"
 #include "commands/command_handler.hpp"
+#include "models/execution_policy.hpp"
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <future>
+#include <unordered_map>
 
 namespace zweek {
 namespace pipeline {
 
+namespace {
+// Workspace code included with each chat turn (estimated tokens)
+constexpr size_t CHAT_CONTEXT_TOKENS = 1536;
+
+// Search output kept readable: lines streamed while searching, lines shown
+// by /grep, and ranked files listed in the TOOL answer
+constexpr size_t MAX_STREAMED_MATCHES = 200;
+constexpr size_t MAX_GREP_MATCHES = 300;
+constexpr size_t MAX_RANKED_FILES = 10;
+
+// Files handed to the coder, which trims them to its token budget
+constexpr size_t MAX_CODER_FILES = 6;
+
+// How often a user cancel is relayed to the speculative chat prefill
+constexpr std::chrono::milliseconds SPECULATION_POLL{10};
+
+// Compiler output kept per rejected candidate or broken unit
+constexpr size_t MAX_REPORTED_ERROR_CHARS = 800;
+
+// Word wrap for chat answers on screen. Models' output stays unwrapped
+// everywhere else, since code or a continuation prompt built from it
+// must not gain line breaks.
+class LineWrapper {
+public:
+  static constexpr size_t MAX_LINE_LENGTH = 80;
+
+  // Next streamed piece: a leading space that would overflow the line
+  // becomes the break, otherwise the break goes before the piece
+  std::string Feed(std::string piece) {
+    if (line_length_ + piece.size() > MAX_LINE_LENGTH) {
+      if (!piece.empty() && piece[0] == ' ') {
+        piece[0] = '\n';
+      } else if (line_length_ > 0) {
+        piece.insert(0, "\n");
+      }
+      line_length_ = 0;
+    }
+    size_t newline = piece.rfind('\n');
+    line_length_ = newline == std::string::npos ? line_length_ + piece.size()
+                                                : piece.size() - newline - 1;
+    return piece;
+  }
+
+  // A whole answer, fed word by word
+  std::string FeedText(const std::string &text) {
+    std::string out;
+    size_t start = 0;
+    while (start < text.size()) {
+      size_t end = std::min(text.find(' ', start + 1), text.size());
+      out += Feed(text.substr(start, end - start));
+      start = end;
+    }
+    return out;
+  }
+
+private:
+  size_t line_length_ = 0;
+};
+
+bool HasExtension(const std::string &path, std::initializer_list<const char *> extensions) {
+  std::string ext = std::filesystem::path(path).extension().string();
+  for (const char *candidate : extensions) {
+    if (ext == candidate) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool IsCppHeader(const std::string &path) {
+  return HasExtension(path, {".h", ".hh", ".hpp", ".hxx", ".inl", ".ipp", ".tpp"});
+}
+
+bool IsCppFile(const std::string &path) {
+  return IsCppHeader(path) || HasExtension(path, {".cpp", ".cc", ".cxx", ".c++"});
+}
+
+std::string Truncate(const std::string &text, size_t max_chars) {
+  return text.size() <= max_chars ? text : text.substr(0, max_chars) + "\n...";
+}
+} // namespace
+
 Orchestrator::Orchestrator() : command_handler_() {
   // Initialize history manager
   history_manager_.Init("");
@@ -15,11 +103,82 @@ Orchestrator::Orchestrator() : command_handler_() {
   command_handler_.SetHistoryManager(&history_manager_);
   command_handler_.SetChatMode(&chat_mode_);
   
-  // Wire tool executor to command handler
+  // Wire tool executor to command handler, chat and coder
   command_handler_.SetToolExecutor(&tool_executor_);
+  chat_mode_.SetToolExecutor(&tool_executor_);
+  coder_.SetToolExecutor(&tool_executor_);
+  
+  // Keep what every file write replaces, so edits can be restored
+  tool_executor_.SetSnapshotCallback([this](const std::string &path,
+                                            const std::string &original) {
+    history_manager_.LogOperation("file_write", path);
+    history_manager_.SnapshotFile(path, original);
+  });
   
+  // Wire /tune to re-benchmark every model
+  command_handler_.SetTuneCallback([this]() {
+    std::string report = "Autotuner results (" +
+                         models::Autotuner::GetCpuModel() + "):\n";
+    report += "  Router: " + router_.Retune() + "\n";
+    report += "  Chat: " + chat_mode_.Retune() + "\n";
+    report += "  Inference threads: " + models::ExecutionPolicy::Get().Describe();
+    return report;
+  });
+
+  // Wire /models to report context and KV cache memory
+  command_handler_.SetModelsCallback([this]() {
+    return "Models:\n  Router: " + router_.DescribeModel() +
+           "\n  Chat: " + chat_mode_.DescribeModel();
+  });
+
+  // Keep the workspace index, file cache, include graph and pinned files
+  // current as files change
+  file_watcher_.Subscribe([this](const tools::ChangeBatch &batch) {
+    workspace_index_.ApplyChanges(batch);
+    tool_executor_.GetFileCache().ApplyChanges(batch);
+    compiler_check_.ApplyChanges(batch);
+
+    // Pinned files follow edits; the chat prefix is rebuilt on the next turn
+    for (const auto &path : chat_mode_.GetPinnedFiles()) {
+      if (batch.overflow ||
+          std::find(batch.modified.begin(), batch.modified.end(), path) != batch.modified.end()) {
+        std::string content = tool_executor_.ReadFile(path);
+        if (!content.empty()) {
+          std::string report = chat_mode_.UpdatePinned(path, content);
+          if (!report.empty() && status_callback_) {
+            status_callback_(report);
+          }
+        }
+      }
+    }
+  });
+
+  // Wire /grep to the search engine
+  command_handler_.SetSearchCallback([this](const std::string &pattern, bool regex,
+                                            bool ignore_case) {
+    tools::SearchOptions options;
+    options.regex = regex;
+    options.ignore_case = ignore_case;
+    tools::SearchResult result = search_engine_.Search(
+        tool_executor_.GetWorkingDirectory(), pattern, options);
+
+    std::string output;
+    size_t shown = 0;
+    for (const auto &file : result.files) {
+      if (shown >= MAX_GREP_MATCHES) {
+        break;
+      }
+      output += tools::SearchEngine::FormatMatches(file);
+      shown += file.lines.size();
+    }
+    return output + tools::SearchEngine::Summary(result);
+  });
+
   // Wire directory change callback
   command_handler_.SetDirectoryChangeCallback([this](const std::string& path) {
+    workspace_index_.SetRoot(path);
+    compiler_check_.LoadCompileDatabase(path);
+    file_watcher_.Start(path);
     if (directory_update_callback_) {
       directory_update_callback_(path);
     }
@@ -32,12 +191,44 @@ Orchestrator::~Orchestrator() {
 
 void Orchestrator::SetWorkingDirectory(const std::string &path) {
   tool_executor_.SetWorkingDirectory(path);
+  workspace_index_.SetRoot(tool_executor_.GetWorkingDirectory());
+  compiler_check_.LoadCompileDatabase(tool_executor_.GetWorkingDirectory());
+  file_watcher_.Start(tool_executor_.GetWorkingDirectory());
   if (directory_update_callback_) {
       directory_update_callback_(path);
   }
 }
 
-void Orchestrator::ProcessRequest(const std::string &user_request) {
+void Orchestrator::StartWarmup() {
+  constexpr int WARMUP_TASKS = 2;
+  warmup_done_ = 0;
+
+  if (status_callback_) {
+    status_callback_("Warming up models (0/" + std::to_string(WARMUP_TASKS) + ")");
+  }
+
+  auto report = [this](const std::string &name, bool ok) {
+    int done = ++warmup_done_;
+    if (!status_callback_) {
+      return;
+    }
+    if (!ok) {
+      status_callback_(name + " model unavailable");
+    } else if (done == WARMUP_TASKS) {
+      status_callback_("Models ready");
+    } else {
+      status_callback_("Warming up models (" + std::to_string(done) + "/" +
+                       std::to_string(WARMUP_TASKS) + "): " + name + " ready");
+    }
+  };
+
+  // Fire and forget: ClassifyIntent/Chat synchronize on the loaders
+  thread_pool_.Submit([this, report]() { report("Router", router_.Warmup()); });
+  thread_pool_.Submit([this, report]() { report("Chat", chat_mode_.Warmup()); });
+}
+
+void Orchestrator::ProcessRequest(const std::string &user_request,
+                                  std::atomic<bool>* cancel_flag) {
   // Check if it's a command first
   auto cmd_result = command_handler_.HandleCommand(user_request);
   if (cmd_result.handled) {
@@ -51,31 +242,59 @@ void Orchestrator::ProcessRequest(const std::string &user_request) {
     progress_callback_("Classifying intent...");
   }
 
+  // Retrieval takes milliseconds, so it runs up front: the speculative
+  // prefill below needs the exact prompt the chat turn will use
+  std::vector<tools::Snippet> context =
+      workspace_index_.Search(user_request, CHAT_CONTEXT_TOKENS);
+
+  // Chat is the dominant intent: start prefilling the chat turn while the
+  // router classifies, so routing latency is hidden on that path
+  std::atomic<bool> cancel_speculation{false};
+  auto speculation = thread_pool_.Submit([this, &user_request, &context,
+                                          &cancel_speculation]() {
+    return chat_mode_.PrefillTurn(user_request, context, &cancel_speculation);
+  });
+
   // Step 1: Classify intent
   Intent intent = router_.ClassifyIntent(user_request);
   WorkflowType workflow = router_.GetWorkflow(intent);
 
+  // Keep the speculative prefill only if the turn really is a chat. The
+  // prefill polls its own flag, so a user cancel is relayed to it until it
+  // returns.
+  if (workflow != WorkflowType::ChatMode) {
+    cancel_speculation = true;
+  }
+  while (speculation.wait_for(SPECULATION_POLL) != std::future_status::ready) {
+    if (cancel_flag && cancel_flag->load()) {
+      cancel_speculation = true;
+    }
+  }
+  if (workflow != WorkflowType::ChatMode) {
+    chat_mode_.DiscardPrefill();
+  }
+
   // Step 2: Execute appropriate workflow
   switch (workflow) {
   case WorkflowType::CodePipeline:
     if (progress_callback_) {
       progress_callback_("Starting code generation pipeline...");
     }
-    RunCodePipeline(user_request);
+    RunCodePipeline(user_request, context, cancel_flag);
     break;
 
   case WorkflowType::ChatMode:
     if (progress_callback_) {
       progress_callback_("Entering chat mode...");
     }
-    RunChatMode(user_request);
+    RunChatMode(user_request, context, cancel_flag);
     break;
 
   case WorkflowType::ToolMode:
     if (progress_callback_) {
       progress_callback_("Running tools...");
     }
-    RunToolMode(user_request);
+    RunToolMode(user_request, cancel_flag);
     break;
   }
 }
@@ -100,38 +319,278 @@ void Orchestrator::SetDirectoryUpdateCallback(
   directory_update_callback_ = callback;
 }
 
-void Orchestrator::RunCodePipeline(const std::string &request) {
-  // TODO: Implement 5-model pipeline
-  // For now, just mock it
+void Orchestrator::SetStatusCallback(
+    std::function<void(const std::string &)> callback) {
+  status_callback_ = callback;
+  workspace_index_.SetStatusCallback(callback);
+}
+
+void Orchestrator::RunCodePipeline(const std::string &request,
+                                   const std::vector<tools::Snippet> &context,
+                                   std::atomic<bool>* cancel_flag) {
+  const int n_candidates = coder::TinyCoder::MAX_CANDIDATES;
   if (progress_callback_) {
-    progress_callback_("[PLAN] Analyzing request...");
+    progress_callback_("[CODE] Sampling " + std::to_string(n_candidates) + " candidates...");
+  }
+
+  // Files the request most likely touches, best match (the target) first
+  std::vector<std::string> files;
+  for (const auto &snippet : context) {
+    if (std::find(files.begin(), files.end(), snippet.path) == files.end() &&
+        files.size() < MAX_CODER_FILES) {
+      files.push_back(snippet.path);
+    }
+  }
+
+  // Candidates are checked on the pool as they finish, while the rest are
+  // still generating; the first to pass stops the others
+  std::vector<CandidateCheck> checks(n_candidates);
+  std::vector<std::future<void>> pending;
+  std::atomic<bool> stop{false};
+  std::atomic<int> winner{-1};
+  int n_generated = coder_.GenerateCandidates(
+      request, files, n_candidates,
+      [&](int index, std::vector<coder::CodeEdit> edits) {
+        if (progress_callback_) {
+          progress_callback_("[CHECK] Candidate " + std::to_string(index + 1) + " finished");
+        }
+        pending.push_back(thread_pool_.Submit([this, &checks, &stop, &winner, index, edits]() {
+          if (stop) {
+            return; // Another candidate already passed
+          }
+          checks[index] = CheckCandidate(edits);
+          int none = -1;
+          if (checks[index].ok && winner.compare_exchange_strong(none, index)) {
+            stop = true;
+          }
+        }));
+      },
+      cancel_flag, &stop);
+  for (auto &check : pending) {
+    check.wait();
+  }
+
+  if (cancel_flag && cancel_flag->load()) {
+    if (response_callback_) {
+      response_callback_("[interrupted]");
+    }
+    return;
+  }
+
+  const int index = winner;
+  if (index < 0) {
+    std::string report = "No candidate edit passed validation";
+    if (n_generated == 0) {
+      report += ": " + coder_.GetLastError();
+    }
+    for (int i = 0; i < n_candidates; ++i) {
+      if (!checks[i].error.empty()) {
+        report += "\n\nCandidate " + std::to_string(i + 1) + ": " + checks[i].error;
+      }
+    }
+    if (response_callback_) {
+      response_callback_(report);
+    }
+    return;
+  }
+
+  const CandidateCheck &chosen = checks[index];
+  std::string diff;
+  for (const auto &file : chosen.files) {
+    diff += tool_executor_.GetDiff(file.first, file.second);
+  }
+  std::string report = "Candidate " + std::to_string(index + 1) + " of " +
+                       std::to_string(n_candidates) + " passed:\n" + diff;
+  {
+    std::lock_guard<std::mutex> lock(pending_mutex_);
+    pending_edits_.clear();
+    for (const auto &file : chosen.files) {
+      pending_edits_.emplace_back(ResolvePath(file.first), file.second);
+    }
+  }
+  if (auto_apply_) {
+    report += "\n" + AcceptPendingEdits();
+  } else {
+    report += "\nPress y to apply the changes or n to discard them.";
   }
 
   if (response_callback_) {
-    response_callback_("Code generation coming in Phase 2!");
+    response_callback_(report);
   }
 }
 
-void Orchestrator::RunChatMode(const std::string &request) {
-  // Use ChatMode to respond
-  std::vector<std::string> context; // TODO: Get relevant files
-  
+Orchestrator::CandidateCheck
+Orchestrator::CheckCandidate(const std::vector<coder::CodeEdit> &edits) {
+  CandidateCheck check;
+
+  // Edits grouped by file, files in first-mentioned order
+  std::vector<std::string> paths;
+  std::unordered_map<std::string, std::vector<tools::SnippetEdit>> by_file;
+  for (const auto &edit : edits) {
+    auto &file_edits = by_file[edit.file_path];
+    if (file_edits.empty()) {
+      paths.push_back(edit.file_path);
+    }
+    file_edits.push_back({edit.original_snippet, edit.new_content});
+  }
+
+  // Every file's new text first, so each check sees the whole candidate
+  // rather than the other files' old versions on disk
+  tools::StagedFiles staged;
+  for (const auto &path : paths) {
+    const auto &file_edits = by_file[path];
+    std::string updated;
+    tools::FileHandle file = tool_executor_.ReadFileShared(path);
+    if (!file) {
+      // A new file: only edits that replace nothing make sense
+      for (const auto &edit : file_edits) {
+        if (edit.original_snippet.find_first_not_of(" \t\r\n") != std::string::npos) {
+          check.error = path + ": file not found";
+          return check;
+        }
+        updated += edit.new_content;
+      }
+    } else {
+      tools::PatchResult patch = tools::PatchApplier::Apply(file->Text(), file_edits);
+      for (size_t i = 0; i < patch.outcomes.size(); ++i) {
+        tools::PatchStatus status = patch.outcomes[i].status;
+        if (status != tools::PatchStatus::Applied && status != tools::PatchStatus::AppliedFuzzy) {
+          check.error = path + ": edit " + std::to_string(i + 1) + " " +
+                        tools::PatchApplier::StatusName(status);
+          return check;
+        }
+      }
+      updated = std::move(patch.text);
+    }
+    staged.emplace_back(ResolvePath(path), updated);
+    check.files.emplace_back(path, std::move(updated));
+  }
+
+  for (size_t i = 0; i < paths.size() && compiler_check_.HasCompiler(); ++i) {
+    const std::string &path = paths[i];
+    if (!IsCppFile(path)) {
+      continue;
+    }
+
+    // The project's own flags when the database knows the file
+    const std::string &full_path = staged[i].first;
+    tools::CompileCommand command;
+    if (!compiler_check_.GetCompileDatabase().Find(full_path, command)) {
+      auto units = compiler_check_.GetCompileDatabase().AffectedUnits(full_path);
+      if (!units.empty()) {
+        command = std::move(units.front());
+      }
+    }
+    tools::CheckResult result =
+        compiler_check_.Check(staged[i].second, command.flags,
+                              std::filesystem::path(full_path).parent_path().string(), staged);
+    if (!result.ok) {
+      check.error = path + " does not compile:\n" +
+                    Truncate(result.errors, MAX_REPORTED_ERROR_CHARS);
+      return check;
+    }
+
+    // A header must also keep every unit that includes it compiling
+    if (IsCppHeader(path)) {
+      for (const auto &unit : compiler_check_.CheckAffected(full_path, staged)) {
+        if (!unit.second.ok) {
+          check.error = unit.first + " no longer compiles with " + path + ":\n" +
+                        Truncate(unit.second.errors, MAX_REPORTED_ERROR_CHARS);
+          return check;
+        }
+      }
+    }
+  }
+  check.ok = !check.files.empty();
+  return check;
+}
+
+std::string Orchestrator::AcceptPendingEdits() {
+  std::vector<std::pair<std::string, std::string>> files;
+  {
+    std::lock_guard<std::mutex> lock(pending_mutex_);
+    files.swap(pending_edits_);
+  }
+  if (files.empty()) {
+    return "";
+  }
+  std::string error;
+  if (!tool_executor_.WriteFiles(files, &error)) {
+    return "Failed to write the changes: " + error;
+  }
+  return "Applied changes to " + std::to_string(files.size()) +
+         (files.size() == 1 ? " file" : " files");
+}
+
+std::string Orchestrator::RejectPendingEdits() {
+  std::lock_guard<std::mutex> lock(pending_mutex_);
+  if (pending_edits_.empty()) {
+    return "";
+  }
+  pending_edits_.clear();
+  return "Discarded the changes";
+}
+
+std::string Orchestrator::ResolvePath(const std::string &path) const {
+  std::filesystem::path p(path);
+  if (!p.is_absolute()) {
+    p = std::filesystem::path(tool_executor_.GetWorkingDirectory()) / p;
+  }
+  return p.lexically_normal().string();
+}
+
+void Orchestrator::RunChatMode(const std::string &request,
+                               const std::vector<tools::Snippet> &context,
+                               std::atomic<bool>* cancel_flag) {
+  // Use ChatMode to respond, wrapped for the screen
+  LineWrapper stream_wrapper;
   std::string response = chat_mode_.Chat(request, context, [&](const std::string& chunk) {
     if (stream_callback_) {
-      stream_callback_(chunk);
+      stream_callback_(stream_wrapper.Feed(chunk));
     }
-  }, interrupt_flag_);
+  }, cancel_flag);
 
   // Mark as complete after streaming finishes
   if (response_callback_) {
-    response_callback_(response);
+    response_callback_(LineWrapper().FeedText(response));
   }
 }
 
-void Orchestrator::RunToolMode(const std::string &request) {
-  // TODO: Implement deterministic tools (grep, git, etc.)
+void Orchestrator::RunToolMode(const std::string &request,
+                               std::atomic<bool>* cancel_flag) {
+  tools::SearchOptions options;
+  std::string pattern = tools::SearchEngine::PatternFromRequest(request, options);
+  if (pattern.empty()) {
+    if (response_callback_) {
+      response_callback_("Nothing to search for. Quote the text to find, e.g. find \"TODO\"");
+    }
+    return;
+  }
+
+  if (progress_callback_) {
+    progress_callback_("Searching for " +
+                       (options.regex ? "/" + pattern + "/" : "\"" + pattern + "\""));
+  }
+
+  // Matches are shown as each file finishes; the answer then ranks the files
+  size_t streamed = 0;
+  tools::SearchResult result = search_engine_.Search(
+      tool_executor_.GetWorkingDirectory(), pattern, options,
+      [&](const tools::FileMatches &file) {
+        if (progress_callback_ && streamed < MAX_STREAMED_MATCHES) {
+          progress_callback_(tools::SearchEngine::FormatMatches(file));
+          streamed += file.lines.size();
+        }
+      },
+      cancel_flag);
+
+  std::string answer = tools::SearchEngine::Summary(result);
+  for (size_t i = 0; i < result.files.size() && i < MAX_RANKED_FILES; ++i) {
+    const auto &file = result.files[i];
+    answer += "\n  " + file.path + " (" + std::to_string(file.lines.size()) + ")";
+  }
   if (response_callback_) {
-    response_callback_("Tool mode coming in Phase 2!");
+    response_callback_(answer);
   }
 }
 
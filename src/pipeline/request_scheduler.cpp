@@ -0,0 +1,107 @@
+#include "pipeline/request_scheduler.hpp"
+
+namespace zweek {
+namespace pipeline {
+
+RequestScheduler::RequestScheduler(Handler handler, size_t max_queued)
+    : handler_(std::move(handler)), max_queued_(max_queued) {
+  worker_ = std::thread([this]() { WorkerLoop(); });
+}
+
+RequestScheduler::~RequestScheduler() { Shutdown(); }
+
+bool RequestScheduler::Submit(const std::string &request,
+                              RequestPriority priority) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (stopping_ || queue_.size() >= max_queued_) {
+      return false;
+    }
+    queue_.push({request, priority, next_sequence_++,
+                 std::make_shared<std::atomic<bool>>(false)});
+  }
+  cv_.notify_one();
+  return true;
+}
+
+void RequestScheduler::CancelCurrent() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (current_cancel_) {
+    current_cancel_->store(true);
+  }
+}
+
+void RequestScheduler::CancelAll() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (current_cancel_) {
+    current_cancel_->store(true);
+  }
+  while (!queue_.empty()) {
+    queue_.pop();
+  }
+}
+
+void RequestScheduler::Shutdown() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (stopping_) {
+      return;
+    }
+    stopping_ = true;
+    if (current_cancel_) {
+      current_cancel_->store(true);
+    }
+    while (!queue_.empty()) {
+      queue_.pop();
+    }
+  }
+  cv_.notify_all();
+
+  if (worker_.joinable()) {
+    worker_.join();
+  }
+}
+
+size_t RequestScheduler::QueuedCount() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return queue_.size();
+}
+
+RequestPriority RequestScheduler::PriorityFor(const std::string &request) {
+  if (!request.empty() && request[0] == '/') {
+    return RequestPriority::High;
+  }
+  return RequestPriority::Normal;
+}
+
+void RequestScheduler::WorkerLoop() {
+  while (true) {
+    Job job;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      cv_.wait(lock, [this]() { return stopping_ || !queue_.empty(); });
+      if (stopping_) {
+        return;
+      }
+
+      job = queue_.top();
+      queue_.pop();
+      current_cancel_ = job.cancel;
+      busy_ = true;
+    }
+
+    // Cancelled while still queued: skip without running
+    if (!job.cancel->load() && handler_) {
+      handler_(job.request, job.cancel.get());
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      current_cancel_.reset();
+      busy_ = false;
+    }
+  }
+}
+
+} // namespace pipeline
+} // namespace zweek
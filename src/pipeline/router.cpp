@@ -5,6 +5,14 @@
 namespace zweek {
 namespace pipeline {
 
+namespace {
+constexpr const char *ROUTER_MODEL_PATH = "models/smollm-135m-router.gguf";
+
+// Every classification prompt starts with this text
+constexpr const char *ROUTER_PROMPT_PREFIX =
+    "Classify this request as CODE, CHAT, or TOOL:\n";
+} // namespace
+
 Router::Router() {
   // Constructor
 }
@@ -12,14 +20,11 @@ Router::Router() {
 Router::~Router() { UnloadModel(); }
 
 Intent Router::ClassifyIntent(const std::string &user_input) {
-  // Load model if not loaded (resident)
-  if (!model_loaded_) {
-    LoadModel("models/smollm-135m-router.gguf");
-  }
+  // Load model if not loaded (resident); waits for a running warm-up
+  EnsureModelLoaded();
 
   // Use GBNF grammar for guaranteed valid output
-  std::string prompt = "Classify this request as CODE, CHAT, or TOOL:\n" +
-                       user_input + "\nClassification:";
+  std::string prompt = ROUTER_PROMPT_PREFIX + user_input + "\nClassification:";
 
   std::string result =
       model_loader_.Infer(prompt, grammars::ROUTER_GRAMMAR, 10,
@@ -57,12 +62,40 @@ WorkflowType Router::GetWorkflow(Intent intent) {
 }
 
 bool Router::LoadModel(const std::string &model_path) {
-  // Load as resident - never unloads
-  model_loaded_ = model_loader_.LoadResident(model_path, 256);
+  // Load as resident - never unloads. Classification prompts are short, so
+  // start at 128 cells and only grow for unusually long requests.
+  models::ContextOptions options;
+  options.n_ctx = 128;
+  options.n_ctx_max = 1024;
+  model_loaded_ = model_loader_.LoadResident(model_path, options);
+  return model_loaded_;
+}
+
+bool Router::EnsureModelLoaded() {
+  std::lock_guard<std::mutex> lock(load_mutex_);
+  if (!model_loaded_) {
+    LoadModel(ROUTER_MODEL_PATH);
+  }
   return model_loaded_;
 }
 
+bool Router::Warmup() {
+  if (!EnsureModelLoaded()) {
+    return false;
+  }
+  return model_loader_.Prefill(ROUTER_PROMPT_PREFIX);
+}
+
+std::string Router::Retune() {
+  if (!EnsureModelLoaded()) {
+    return "model not available";
+  }
+  return model_loader_.Retune();
+}
+
 void Router::UnloadModel() {
+  std::lock_guard<std::mutex> lock(load_mutex_);
+
   // Resident models don't unload, but call it anyway
   model_loader_.Unload();
   model_loaded_ = false;
@@ -0,0 +1,393 @@
+#include "tools/compile_database.hpp"
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <nlohmann/json.hpp>
+#include <sstream>
+#include <unordered_set>
+
+namespace zweek {
+namespace tools {
+
+namespace fs = std::filesystem;
+using json = nlohmann::json;
+
+namespace {
+
+const char *const DATABASE_NAMES[] = {"compile_commands.json", "build/compile_commands.json"};
+
+// Options that only matter to a real build
+const char *const DROPPED_FLAGS[] = {"-c", "-M", "-MM", "-MD", "-MMD", "-MP", "-MG"};
+const char *const DROPPED_WITH_VALUE[] = {"-o", "-MF", "-MT", "-MQ"};
+
+// Options whose value is a path, separate ("-I dir") or joined ("-Idir")
+const char *const PATH_FLAGS[] = {"-I", "-isystem", "-iquote", "-idirafter", "-include",
+                                  "-imacros", "-include-pch", "-isysroot", "--sysroot"};
+
+// Extensions a new file must have to affect include resolution
+const char *const SOURCE_EXTENSIONS[] = {".h", ".hh", ".hpp", ".hxx", ".inc", ".inl", ".ipp",
+                                         ".tpp", ".c", ".cc", ".cpp", ".cxx"};
+
+std::string Absolute(const std::string &directory, const std::string &path) {
+  fs::path p(path);
+  if (!p.is_absolute()) {
+    p = fs::path(directory) / p;
+  }
+  return p.lexically_normal().string();
+}
+
+bool Contains(const char *const *begin, const char *const *end, const std::string &value) {
+  return std::find_if(begin, end, [&](const char *item) { return value == item; }) != end;
+}
+
+std::vector<std::string> CleanFlags(const std::vector<std::string> &args,
+                                    const std::string &directory, const std::string &file) {
+  std::vector<std::string> flags;
+  for (size_t i = 1; i < args.size(); ++i) { // args[0] is the compiler
+    const std::string &arg = args[i];
+    if (Contains(std::begin(DROPPED_FLAGS), std::end(DROPPED_FLAGS), arg)) {
+      continue;
+    }
+    if (Contains(std::begin(DROPPED_WITH_VALUE), std::end(DROPPED_WITH_VALUE), arg)) {
+      ++i;
+      continue;
+    }
+    if (arg.empty() || (arg[0] != '-' && Absolute(directory, arg) == file)) {
+      continue; // The source file itself
+    }
+
+    bool handled = false;
+    for (const char *option : PATH_FLAGS) {
+      const std::string name(option);
+      if (arg == name && i + 1 < args.size()) {
+        flags.push_back(arg);
+        flags.push_back(Absolute(directory, args[++i]));
+        handled = true;
+      } else if (arg.size() > name.size() && arg.compare(0, name.size(), name) == 0 &&
+                 (name == "-I" || name == "-isystem" || name == "-iquote")) {
+        flags.push_back(name + Absolute(directory, arg.substr(name.size())));
+        handled = true;
+      }
+      if (handled) {
+        break;
+      }
+    }
+    if (!handled) {
+      flags.push_back(arg);
+    }
+  }
+  return flags;
+}
+
+bool HasSourceExtension(const std::string &path) {
+  std::string ext = fs::path(path).extension().string();
+  std::transform(ext.begin(), ext.end(), ext.begin(),
+                 [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+  return Contains(std::begin(SOURCE_EXTENSIONS), std::end(SOURCE_EXTENSIONS), ext);
+}
+
+} // namespace
+
+char CompileDatabase::ParseIncludeLine(const std::string &line, std::string &name) {
+  size_t i = line.find_first_not_of(" \t");
+  if (i == std::string::npos || line[i] != '#') {
+    return 0;
+  }
+  i = line.find_first_not_of(" \t", i + 1);
+  if (i == std::string::npos || line.compare(i, 7, "include") != 0) {
+    return 0;
+  }
+  i = line.find_first_not_of(" \t", i + 7);
+  if (i == std::string::npos || (line[i] != '<' && line[i] != '"')) {
+    return 0;
+  }
+  char close = line[i] == '<' ? '>' : '"';
+  size_t end = line.find(close, i + 1);
+  if (end == std::string::npos) {
+    return 0;
+  }
+  name = line.substr(i + 1, end - i - 1);
+  return line[i];
+}
+
+std::vector<std::string> CompileDatabase::SplitCommand(const std::string &command) {
+  std::vector<std::string> args;
+  std::string current;
+  bool in_arg = false;
+  char quote = 0;
+  for (size_t i = 0; i < command.size(); ++i) {
+    char c = command[i];
+    if (quote) {
+      if (c == quote) {
+        quote = 0;
+      } else if (c == '\\' && quote == '"' && i + 1 < command.size() &&
+                 (command[i + 1] == '"' || command[i + 1] == '\\')) {
+        current += command[++i];
+      } else {
+        current += c;
+      }
+    } else if (c == '"' || c == '\'') {
+      quote = c;
+      in_arg = true;
+    } else if (c == '\\' && i + 1 < command.size()) {
+      current += command[++i];
+      in_arg = true;
+    } else if (c == ' ' || c == '\t' || c == '\n') {
+      if (in_arg) {
+        args.push_back(std::move(current));
+        current.clear();
+        in_arg = false;
+      }
+    } else {
+      current += c;
+      in_arg = true;
+    }
+  }
+  if (in_arg) {
+    args.push_back(std::move(current));
+  }
+  return args;
+}
+
+bool CompileDatabase::Load(const std::string &project_dir) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return LoadLocked(project_dir);
+}
+
+bool CompileDatabase::LoadLocked(const std::string &project_dir) {
+  std::error_code ec;
+  fs::path root = fs::absolute(project_dir, ec);
+  project_dir_ = root.lexically_normal().string();
+  database_path_.clear();
+  units_.clear();
+  unit_index_.clear();
+  parsed_.clear();
+  resolved_.clear();
+  includers_.clear();
+  graph_valid_ = false;
+
+  for (const char *name : DATABASE_NAMES) {
+    fs::path candidate = root / name;
+    if (!fs::is_regular_file(candidate, ec)) {
+      continue;
+    }
+    std::ifstream in(candidate);
+    json entries;
+    try {
+      entries = json::parse(in);
+    } catch (const std::exception &) {
+      continue;
+    }
+    if (!entries.is_array()) {
+      continue;
+    }
+
+    for (const auto &entry : entries) {
+      if (!entry.is_object() || !entry.contains("file") || !entry["file"].is_string()) {
+        continue;
+      }
+      std::string directory = entry.value("directory", project_dir_);
+      CompileCommand command;
+      command.file = Absolute(directory, entry["file"].get<std::string>());
+
+      std::vector<std::string> args;
+      if (entry.contains("arguments") && entry["arguments"].is_array()) {
+        for (const auto &arg : entry["arguments"]) {
+          if (arg.is_string()) {
+            args.push_back(arg.get<std::string>());
+          }
+        }
+      } else if (entry.contains("command") && entry["command"].is_string()) {
+        args = SplitCommand(entry["command"].get<std::string>());
+      }
+      command.flags = CleanFlags(args, directory, command.file);
+
+      // A file listed twice (several configurations) keeps its first entry
+      if (unit_index_.emplace(command.file, units_.size()).second) {
+        units_.push_back(std::move(command));
+      }
+    }
+    database_path_ = candidate.lexically_normal().string();
+    return true;
+  }
+  return false;
+}
+
+bool CompileDatabase::IsLoaded() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return !database_path_.empty();
+}
+
+size_t CompileDatabase::Size() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return units_.size();
+}
+
+bool CompileDatabase::Find(const std::string &file, CompileCommand &out) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = unit_index_.find(Absolute(project_dir_, file));
+  if (it == unit_index_.end()) {
+    return false;
+  }
+  out = units_[it->second];
+  return true;
+}
+
+const std::vector<CompileDatabase::Include> &CompileDatabase::IncludesOf(const std::string &file) {
+  auto it = parsed_.find(file);
+  if (it != parsed_.end()) {
+    return it->second;
+  }
+  std::vector<Include> includes;
+  std::ifstream in(file);
+  std::string line;
+  while (std::getline(in, line)) {
+    std::string name;
+    char kind = ParseIncludeLine(line, name);
+    if (kind) {
+      includes.push_back({name, kind == '<'});
+    }
+  }
+  return parsed_.emplace(file, std::move(includes)).first->second;
+}
+
+std::string CompileDatabase::Resolve(const std::string &includer, const Include &include,
+                                     const std::vector<std::string> &quote_dirs,
+                                     const std::vector<std::string> &dirs) {
+  std::string includer_dir = fs::path(includer).parent_path().string();
+  std::string key = includer_dir + '\n' + (include.system ? '<' : '"') + include.name;
+  for (const auto &dir : quote_dirs) {
+    key += '\n' + dir;
+  }
+  key += '\n';
+  for (const auto &dir : dirs) {
+    key += '\n' + dir;
+  }
+  auto it = resolved_.find(key);
+  if (it != resolved_.end()) {
+    return it->second;
+  }
+
+  std::vector<const std::string *> search;
+  if (!include.system) {
+    search.push_back(&includer_dir);
+    for (const auto &dir : quote_dirs) {
+      search.push_back(&dir);
+    }
+  }
+  for (const auto &dir : dirs) {
+    search.push_back(&dir);
+  }
+  std::string found;
+  for (const std::string *dir : search) {
+    fs::path candidate = fs::path(*dir) / include.name;
+    std::error_code ec;
+    if (fs::is_regular_file(candidate, ec)) {
+      found = candidate.lexically_normal().string();
+      break;
+    }
+  }
+  resolved_[key] = found;
+  return found;
+}
+
+void CompileDatabase::BuildGraphLocked() {
+  includers_.clear();
+  for (size_t u = 0; u < units_.size(); ++u) {
+    std::vector<std::string> quote_dirs, dirs;
+    const auto &flags = units_[u].flags;
+    for (size_t i = 0; i < flags.size(); ++i) {
+      if (flags[i] == "-iquote" && i + 1 < flags.size()) {
+        quote_dirs.push_back(flags[++i]);
+      } else if (flags[i] == "-I" && i + 1 < flags.size()) {
+        dirs.push_back(flags[++i]);
+      } else if (flags[i].compare(0, 7, "-iquote") == 0 && flags[i].size() > 7) {
+        quote_dirs.push_back(flags[i].substr(7));
+      } else if (flags[i].compare(0, 2, "-I") == 0 && flags[i].size() > 2) {
+        dirs.push_back(flags[i].substr(2));
+      }
+    }
+
+    std::unordered_set<std::string> visited{units_[u].file};
+    std::vector<std::string> stack{units_[u].file};
+    while (!stack.empty()) {
+      std::string file = std::move(stack.back());
+      stack.pop_back();
+      for (const auto &include : IncludesOf(file)) {
+        std::string header = Resolve(file, include, quote_dirs, dirs);
+        if (!header.empty() && visited.insert(header).second) {
+          includers_[header].push_back(u);
+          stack.push_back(std::move(header));
+        }
+      }
+    }
+  }
+  graph_valid_ = true;
+}
+
+std::vector<CompileCommand> CompileDatabase::AffectedUnits(const std::string &path) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::vector<CompileCommand> units;
+  std::string file = Absolute(project_dir_, path);
+
+  auto unit = unit_index_.find(file);
+  if (unit != unit_index_.end()) {
+    units.push_back(units_[unit->second]);
+  }
+  if (!graph_valid_) {
+    BuildGraphLocked();
+  }
+  auto it = includers_.find(file);
+  if (it != includers_.end()) {
+    for (size_t u : it->second) {
+      if (units_[u].file != file) {
+        units.push_back(units_[u]);
+      }
+    }
+  }
+  return units;
+}
+
+void CompileDatabase::ApplyChanges(const ChangeBatch &batch) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (database_path_.empty() && project_dir_.empty()) {
+    return;
+  }
+  if (batch.overflow) {
+    LoadLocked(project_dir_);
+    return;
+  }
+  for (const auto &path : batch.modified) {
+    if (path == database_path_ ||
+        (database_path_.empty() && fs::path(path).filename() == "compile_commands.json")) {
+      LoadLocked(project_dir_);
+      return;
+    }
+  }
+
+  for (const auto &path : batch.modified) {
+    if (parsed_.erase(path) > 0) {
+      graph_valid_ = false; // Its includes may have changed
+    } else if (HasSourceExtension(path)) {
+      resolved_.clear(); // A new header can change what an include resolves to
+      graph_valid_ = false;
+    }
+  }
+  if (!batch.removed.empty()) {
+    for (const auto &path : batch.removed) {
+      std::string prefix = path + static_cast<char>(fs::path::preferred_separator);
+      for (auto it = parsed_.begin(); it != parsed_.end();) {
+        if (it->first == path || it->first.compare(0, prefix.size(), prefix) == 0) {
+          it = parsed_.erase(it);
+        } else {
+          ++it;
+        }
+      }
+    }
+    resolved_.clear();
+    graph_valid_ = false;
+  }
+}
+
+} // namespace tools
+} // namespace zweek
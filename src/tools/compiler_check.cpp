@@ -1,67 +1,697 @@
 #include "tools/compiler_check.hpp"
+#include "util/hash.hpp"
+#include <algorithm>
+#include <cerrno>
 #include <cstdlib>
+#include <filesystem>
 #include <fstream>
+#include <sstream>
+#include <unordered_set>
 
+#ifdef _WIN32
+#include <process.h>
+#else
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+extern char **environ;
+#endif
 
 namespace zweek {
 namespace tools {
 
+namespace fs = std::filesystem;
+
+namespace {
+
+constexpr size_t MAX_CHECK_THREADS = 4;
+constexpr size_t MAX_CACHED_RESULTS = 512;
+constexpr size_t MAX_DIAGNOSTIC_BYTES = 16 * 1024;
+constexpr int MAX_INCLUDE_DEPTH = 16;
+constexpr int PCH_MIN_USES = 2; // A one-off include set isn't worth precompiling
+const char *const SNIPPET_NAME = "check.cpp";
+const char *const STAGING_NAME = "staged"; // Work dir subdirectory mirroring staged paths
+
+#ifdef _WIN32
+constexpr char PATH_SEPARATOR = ';';
+#else
+constexpr char PATH_SEPARATOR = ':';
+#endif
+
+std::string FindInPath(const std::string &name) {
+  if (name.find('/') != std::string::npos || name.find('\\') != std::string::npos) {
+    std::error_code ec;
+    return fs::is_regular_file(name, ec) ? name : "";
+  }
+  const char *path = std::getenv("PATH");
+  if (!path) {
+    return "";
+  }
+  std::stringstream dirs(path);
+  std::string dir;
+  while (std::getline(dirs, dir, PATH_SEPARATOR)) {
+    if (dir.empty()) {
+      continue;
+    }
+    fs::path candidate = fs::path(dir) / name;
+    std::error_code ec;
+    if (fs::is_regular_file(candidate, ec)) {
+#ifndef _WIN32
+      if (access(candidate.c_str(), X_OK) != 0) {
+        continue;
+      }
+#endif
+      return candidate.string();
+    }
+  }
+  return "";
+}
+
+bool ReadText(const std::string &path, std::string &out) {
+  std::ifstream in(path, std::ios::binary);
+  if (!in.is_open()) {
+    return false;
+  }
+  std::stringstream buffer;
+  buffer << in.rdbuf();
+  out = buffer.str();
+  return true;
+}
+
+// Leading block of system includes (only blank lines and // comments
+// between them), which can be precompiled without changing meaning
+std::vector<std::string> LeadingSystemIncludes(const std::string &text) {
+  std::vector<std::string> includes;
+  std::stringstream lines(text);
+  std::string line;
+  while (std::getline(lines, line)) {
+    size_t i = line.find_first_not_of(" \t\r");
+    if (i == std::string::npos || line.compare(i, 2, "//") == 0) {
+      continue;
+    }
+    std::string name;
+    if (CompileDatabase::ParseIncludeLine(line, name) != '<') {
+      break;
+    }
+    includes.push_back(name);
+  }
+  return includes;
+}
+
+// Directories named by -I / -iquote flags (joined or separate form)
+std::vector<std::string> IncludeDirs(const std::vector<std::string> &flags) {
+  std::vector<std::string> dirs;
+  for (size_t i = 0; i < flags.size(); ++i) {
+    for (const char *prefix : {"-I", "-iquote", "/I"}) {
+      const std::string p(prefix);
+      if (flags[i].compare(0, p.size(), p) != 0) {
+        continue;
+      }
+      if (flags[i].size() > p.size()) {
+        dirs.push_back(flags[i].substr(p.size()));
+      } else if (i + 1 < flags.size()) {
+        dirs.push_back(flags[++i]);
+      }
+      break;
+    }
+  }
+  return dirs;
+}
+
+// Fold the contents of every project header text reaches (quoted includes,
+// and <> includes found under -I) into the hash, so editing a header
+// invalidates the checks that include it
+void HashProjectIncludes(const std::string &text, const std::string &dir,
+                        const std::vector<std::string> &include_dirs,
+                        std::unordered_set<std::string> &visited, int depth, uint64_t &hash) {
+  if (depth > MAX_INCLUDE_DEPTH) {
+    return;
+  }
+  std::stringstream lines(text);
+  std::string line;
+  while (std::getline(lines, line)) {
+    std::string name;
+    char kind = CompileDatabase::ParseIncludeLine(line, name);
+    if (!kind) {
+      continue;
+    }
+    std::vector<std::string> search;
+    if (kind == '"') {
+      search.push_back(dir);
+    }
+    search.insert(search.end(), include_dirs.begin(), include_dirs.end());
+    for (const auto &base : search) {
+      fs::path candidate = fs::path(base) / name;
+      std::error_code ec;
+      if (!fs::is_regular_file(candidate, ec)) {
+        continue;
+      }
+      std::string key = candidate.lexically_normal().string();
+      if (visited.insert(key).second) {
+        std::string header;
+        ReadText(key, header);
+        hash = util::HashBytes(header.data(), header.size(), util::HashString(key, hash));
+        HashProjectIncludes(header, candidate.parent_path().string(), include_dirs, visited,
+                            depth + 1, hash);
+      }
+      break;
+    }
+  }
+}
+
+// Run a program with stdout and stderr captured; exit code, or -1 if it
+// couldn't be started
+int RunProcess(const std::vector<std::string> &args, const std::string &work_dir,
+               std::string &output) {
+  output.clear();
+#ifdef _WIN32
+  std::string command;
+  for (const auto &arg : args) {
+    command += "\"" + arg + "\" ";
+  }
+  std::string log = (fs::path(work_dir) / "output.txt").string();
+  command += "> \"" + log + "\" 2>&1";
+  int status = std::system(("\"" + command + "\"").c_str());
+  ReadText(log, output);
+  if (output.size() > MAX_DIAGNOSTIC_BYTES) {
+    output.resize(MAX_DIAGNOSTIC_BYTES);
+  }
+  return status;
+#else
+  (void)work_dir;
+  // Both ends close-on-exec, so children spawned by concurrent checks
+  // don't hold this pipe open (the dup2'd copies are inherited as usual)
+  int fds[2];
+#ifdef __linux__
+  if (pipe2(fds, O_CLOEXEC) != 0) {
+    return -1;
+  }
+#else
+  if (pipe(fds) != 0) {
+    return -1;
+  }
+  fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+  fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+#endif
+
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+  posix_spawn_file_actions_adddup2(&actions, fds[1], 1);
+  posix_spawn_file_actions_adddup2(&actions, fds[1], 2);
+  posix_spawn_file_actions_addclose(&actions, fds[1]);
+
+  std::vector<char *> argv;
+  for (const auto &arg : args) {
+    argv.push_back(const_cast<char *>(arg.c_str()));
+  }
+  argv.push_back(nullptr);
+
+  // posix_spawn avoids fork's page-table copy of a process holding models
+  pid_t pid = 0;
+  int spawned = posix_spawn(&pid, args[0].c_str(), &actions, nullptr, argv.data(), environ);
+  posix_spawn_file_actions_destroy(&actions);
+  close(fds[1]);
+  if (spawned != 0) {
+    close(fds[0]);
+    return -1;
+  }
+
+  char buffer[4096];
+  ssize_t n;
+  while ((n = read(fds[0], buffer, sizeof(buffer))) != 0) {
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+    if (output.size() < MAX_DIAGNOSTIC_BYTES) {
+      output.append(buffer, std::min(static_cast<size_t>(n), MAX_DIAGNOSTIC_BYTES - output.size()));
+    }
+  }
+  close(fds[0]);
+
+  int status = 0;
+  while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {
+  }
+  return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+#endif
+}
+
+const std::string *FindStaged(const StagedFiles &staged, const std::string &path) {
+  for (const auto &file : staged) {
+    if (file.first == path) {
+      return &file.second;
+    }
+  }
+  return nullptr;
+}
+
+void ReplaceAll(std::string &text, const std::string &from, const std::string &to) {
+  if (from.empty()) {
+    return;
+  }
+  for (size_t pos = text.find(from); pos != std::string::npos; pos = text.find(from, pos + to.size())) {
+    text.replace(pos, from.size(), to);
+  }
+}
+
+} // namespace
+
 CompilerCheck::CompilerCheck() {
-  // Constructor
+  std::vector<std::string> candidates;
+  if (const char *cxx = std::getenv("CXX")) {
+    candidates.push_back(cxx);
+  }
+#ifdef _WIN32
+  candidates.push_back("cl.exe");
+#endif
+  for (const char *name : {"clang++", "g++", "c++"}) {
+    candidates.push_back(name);
+  }
+  for (const auto &name : candidates) {
+    compiler_ = FindInPath(name);
+    if (!compiler_.empty()) {
+      break;
+    }
+  }
+
+  if (!compiler_.empty()) {
+    std::error_code ec;
+    fs::path resolved = fs::canonical(compiler_, ec);
+    std::string name = (ec ? fs::path(compiler_) : resolved).filename().string();
+    if (name == "cl.exe" || name == "cl") {
+      kind_ = Kind::Msvc;
+    } else if (name.find("clang") != std::string::npos) {
+      kind_ = Kind::Clang;
+    }
+    uint64_t id = util::HashString(resolved.string());
+    id = util::HashCombine(id, static_cast<uint64_t>(fs::file_size(resolved, ec)));
+    id = util::HashCombine(
+        id, static_cast<uint64_t>(fs::last_write_time(resolved, ec).time_since_epoch().count()));
+    compiler_id_ = id;
+  }
+
+#ifdef _WIN32
+  fs::path root = fs::temp_directory_path() /
+                  ("zweek-check-" + std::to_string(_getpid()));
+  std::error_code ec;
+  fs::create_directories(root, ec);
+  root_dir_ = root.string();
+#else
+  std::string root = (fs::temp_directory_path() / "zweek-check-XXXXXX").string();
+  if (mkdtemp(&root[0])) {
+    root_dir_ = root;
+  }
+#endif
+
+  size_t n_threads = std::max<size_t>(1, std::min<size_t>(std::thread::hardware_concurrency(),
+                                                          MAX_CHECK_THREADS));
+  pool_ = std::make_unique<util::ThreadPool>(n_threads);
 }
 
 CompilerCheck::~CompilerCheck() {
-  // Destructor
+  pool_.reset(); // Finish queued checks first
+  if (!root_dir_.empty()) {
+    std::error_code ec;
+    fs::remove_all(root_dir_, ec);
+  }
 }
 
 bool CompilerCheck::IsValidCpp(const std::string &code) {
-  // Write code to temporary file
-  std::string temp_file = "zweek_temp_check.cpp";
-  std::ofstream out(temp_file);
-  if (!out) {
-    errors_ = "Failed to create temp file";
-    return false;
+  CheckResult result = Check(code);
+  errors_ = result.errors;
+  return result.ok;
+}
+
+bool CompilerCheck::CheckFile(const std::string &filepath) {
+  CheckResult result = CheckPath(filepath);
+  errors_ = result.errors;
+  return result.ok;
+}
+
+CheckResult CompilerCheck::Check(const std::string &code, const std::vector<std::string> &flags,
+                                 const std::string &include_dir, const StagedFiles &staged) {
+  return Run({"", code, flags, include_dir, staged});
+}
+
+CheckResult CompilerCheck::CheckPath(const std::string &filepath,
+                                     const std::vector<std::string> &flags) {
+  std::error_code ec;
+  fs::path absolute = fs::absolute(filepath, ec);
+  std::string source = (ec ? fs::path(filepath) : absolute).lexically_normal().string();
+  CompileCommand command;
+  if (flags.empty() && database_.Find(source, command)) {
+    return Run(
+        {source, "", std::move(command.flags), fs::path(source).parent_path().string(), {}});
+  }
+  return Run({source, "", flags, fs::path(source).parent_path().string(), {}});
+}
+
+bool CompilerCheck::LoadCompileDatabase(const std::string &project_dir) {
+  return database_.Load(project_dir);
+}
+
+std::vector<std::pair<std::string, CheckResult>>
+CompilerCheck::CheckAffected(const std::string &path, const StagedFiles &staged) {
+  std::error_code ec;
+  fs::path absolute = fs::absolute(path, ec);
+  std::string file = (ec ? fs::path(path) : absolute).lexically_normal().string();
+
+  std::vector<CompileCommand> units = database_.AffectedUnits(file);
+  if (units.empty()) {
+    std::string ext = fs::path(file).extension().string();
+    if (ext == ".cpp" || ext == ".cc" || ext == ".cxx" || ext == ".c++") {
+      units.push_back({file, {}});
+    }
+  }
+
+  std::vector<std::future<CheckResult>> futures;
+  for (auto &unit : units) {
+    Job job{unit.file, "", std::move(unit.flags), fs::path(unit.file).parent_path().string(),
+            staged};
+    futures.push_back(pool_->Submit([this, job]() { return Run(job); }));
+  }
+  std::vector<std::pair<std::string, CheckResult>> results;
+  for (size_t i = 0; i < units.size(); ++i) {
+    results.emplace_back(units[i].file, futures[i].get());
+  }
+  return results;
+}
+
+std::future<CheckResult> CompilerCheck::CheckAsync(std::string code, std::vector<std::string> flags,
+                                                   std::string include_dir) {
+  Job job{"", std::move(code), std::move(flags), std::move(include_dir), {}};
+  return pool_->Submit([this, job]() { return Run(job); });
+}
+
+std::vector<CheckResult> CompilerCheck::CheckAll(const std::vector<std::string> &codes,
+                                                 const std::vector<std::string> &flags) {
+  std::vector<std::future<CheckResult>> futures;
+  for (const auto &code : codes) {
+    futures.push_back(CheckAsync(code, flags));
+  }
+  std::vector<CheckResult> results;
+  for (auto &future : futures) {
+    results.push_back(future.get());
+  }
+  return results;
+}
+
+std::vector<std::string> CompilerCheck::BaseArgs(const std::vector<std::string> &flags) const {
+  std::vector<std::string> args;
+  bool has_std = false;
+  for (const auto &flag : flags) {
+    has_std |= flag.rfind("-std=", 0) == 0 || flag.rfind("/std:", 0) == 0;
+  }
+  if (kind_ == Kind::Msvc) {
+    args = {"/nologo", "/Zs", "/EHsc"};
+    if (!has_std) {
+      args.push_back("/std:c++17");
+    }
+  } else {
+    args = {"-fsyntax-only", "-fdiagnostics-color=never"};
+    if (!has_std) {
+      args.push_back("-std=c++17");
+    }
+  }
+  args.insert(args.end(), flags.begin(), flags.end());
+  return args;
+}
+
+uint64_t CompilerCheck::Fingerprint(const Job &job, const std::string &text) const {
+  uint64_t hash = util::HashCombine(util::HashString(text), compiler_id_);
+  hash = util::HashString(job.source, hash);
+  for (const auto &flag : job.flags) {
+    hash = util::HashString(flag, util::HashCombine(hash, flag.size()));
+  }
+  for (const auto &file : job.staged) {
+    hash = util::HashBytes(file.second.data(), file.second.size(),
+                           util::HashString(file.first, hash));
+  }
+  std::unordered_set<std::string> visited;
+  HashProjectIncludes(text, job.include_dir, IncludeDirs(job.flags), visited, 0, hash);
+  return hash;
+}
+
+CheckResult CompilerCheck::Run(Job job) {
+  CheckResult result;
+  std::string text = job.code;
+  if (!job.source.empty()) {
+    if (const std::string *contents = FindStaged(job.staged, job.source)) {
+      text = *contents;
+    } else if (!ReadText(job.source, text)) {
+      result.errors = "Cannot read " + job.source;
+      return result;
+    }
+  }
+  if (compiler_.empty() || root_dir_.empty()) {
+    result.errors = "No C++ compiler found (install clang++ or g++, or set CXX)";
+    return result;
+  }
+
+  // Served from the cache, or shared with an identical check in progress
+  const uint64_t key = Fingerprint(job, text);
+  std::promise<CheckResult> promise;
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    auto cached = results_.find(key);
+    if (cached != results_.end()) {
+      result = cached->second;
+      result.cached = true;
+      return result;
+    }
+    auto running = in_flight_.find(key);
+    if (running != in_flight_.end()) {
+      std::shared_future<CheckResult> pending = running->second;
+      lock.unlock();
+      result = pending.get();
+      result.cached = true;
+      return result;
+    }
+    in_flight_[key] = promise.get_future().share();
   }
 
-  out << code;
-  out.close();
+  if (job.source.empty() || !job.staged.empty()) {
+    job.code = std::move(text);
+  }
+  std::string work_dir = AcquireWorkDir();
+  result = Compile(job, work_dir);
+  ReleaseWorkDir(std::move(work_dir));
 
-  // Run syntax check
-  bool result = RunSyntaxCheck(temp_file);
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    results_[key] = result;
+    result_order_.push_back(key);
+    while (result_order_.size() > MAX_CACHED_RESULTS) {
+      results_.erase(result_order_.front());
+      result_order_.pop_front();
+    }
+    in_flight_.erase(key);
+  }
+  promise.set_value(result);
+  return result;
+}
 
-  // Clean up
-  std::remove(temp_file.c_str());
-  std::remove("zweek_errors.txt");
+CheckResult CompilerCheck::Compile(const Job &job, const std::string &work_dir) {
+  CheckResult result;
+  // With files staged, a unit is compiled from a copy as well: from its
+  // own directory, its quoted includes would find the old headers first
+  const bool from_code = job.source.empty() || !job.staged.empty();
+  std::string source = job.source;
+  std::string text;
+  if (from_code) {
+    const std::string name =
+        job.source.empty() ? SNIPPET_NAME : fs::path(job.source).filename().string();
+    source = (fs::path(work_dir) / name).string();
+    std::ofstream out(source, std::ios::binary | std::ios::trunc);
+    out << job.code;
+    if (!out) {
+      result.errors = "Failed to create temp file";
+      return result;
+    }
+    text = job.code;
+  } else {
+    ReadText(source, text);
+  }
 
+  std::vector<std::string> args{compiler_};
+  if (!StageFiles(job, work_dir, args)) {
+    result.errors = "Failed to stage the edited files";
+    return result;
+  }
+  std::vector<std::string> base = BaseArgs(job.flags);
+  args.insert(args.end(), base.begin(), base.end());
+  if (from_code) {
+    // The code's quoted includes resolve as if it lived there
+    if (kind_ == Kind::Msvc) {
+      args.push_back("/I" + job.include_dir);
+    } else {
+      args.push_back("-iquote");
+      args.push_back(job.include_dir);
+    }
+  }
+  std::string pch = PrecompiledHeaderFor(text, job.flags);
+  if (!pch.empty()) {
+    if (kind_ == Kind::Clang) {
+      args.push_back("-include-pch");
+      args.push_back(pch + ".pch");
+    } else {
+      args.push_back("-include"); // g++ picks up the .gch beside it
+      args.push_back(pch);
+    }
+  }
+  args.push_back(source);
+
+  std::string output;
+  int status = RunProcess(args, work_dir, output);
+  if (status < 0) {
+    result.errors = "Failed to run " + compiler_;
+    return result;
+  }
+  if (from_code) {
+    ReplaceAll(output, source, job.source.empty() ? "input.cpp" : job.source);
+  }
+  result.ok = status == 0;
+  result.errors = output;
   return result;
 }
 
-bool CompilerCheck::CheckFile(const std::string &filepath) {
-  return RunSyntaxCheck(filepath);
+bool CompilerCheck::StageFiles(const Job &job, const std::string &work_dir,
+                               std::vector<std::string> &args) const {
+  if (job.staged.empty()) {
+    return true;
+  }
+  const fs::path root = fs::path(work_dir) / STAGING_NAME;
+  std::error_code ec;
+  fs::remove_all(root, ec); // Left by an earlier check in this work dir
+  for (const auto &file : job.staged) {
+    fs::path target = root / fs::path(file.first).relative_path();
+    fs::create_directories(target.parent_path(), ec);
+    std::ofstream out(target, std::ios::binary | std::ios::trunc);
+    out << file.second;
+    if (!out) {
+      return false;
+    }
+  }
+
+  // Each include directory holding staged files gets its mirror searched
+  // first: -iquote ahead of every -I, and -I ahead of the project's own
+  std::vector<std::string> dirs = IncludeDirs(job.flags);
+  dirs.insert(dirs.begin(), job.include_dir);
+  for (const auto &dir : dirs) {
+    fs::path absolute = fs::absolute(dir, ec);
+    fs::path mirror = root / (ec ? fs::path(dir) : absolute).lexically_normal().relative_path();
+    if (!fs::is_directory(mirror, ec)) {
+      continue;
+    }
+    if (kind_ == Kind::Msvc) {
+      args.push_back("/I" + mirror.string());
+    } else {
+      args.insert(args.end(), {"-iquote", mirror.string(), "-I", mirror.string()});
+    }
+  }
+  return true;
 }
 
-bool CompilerCheck::RunSyntaxCheck(const std::string &filepath) {
-  // Run MSVC syntax-only check
-  // /Zs = syntax check only (no code generation)
-  // /EHsc = enable C++ exceptions
-  // Redirect stderr to file
-  std::string command =
-      "cl.exe /Zs /EHsc /std:c++17 \"" + filepath + "\" 2> zweek_errors.txt";
+std::string CompilerCheck::PrecompiledHeaderFor(const std::string &text,
+                                                const std::vector<std::string> &flags) {
+  if (kind_ == Kind::Msvc) {
+    return "";
+  }
+  // A <> include found under the project's -I / -iquote dirs is a project
+  // header that can be edited: the key doesn't cover its contents, so only
+  // headers from outside the project are precompiled
+  std::vector<std::string> includes = LeadingSystemIncludes(text);
+  const std::vector<std::string> project_dirs = IncludeDirs(flags);
+  includes.erase(std::remove_if(includes.begin(), includes.end(),
+                                [&](const std::string &name) {
+                                  for (const auto &dir : project_dirs) {
+                                    std::error_code ec;
+                                    if (fs::is_regular_file(fs::path(dir) / name, ec)) {
+                                      return true;
+                                    }
+                                  }
+                                  return false;
+                                }),
+                 includes.end());
+  if (includes.empty()) {
+    return "";
+  }
+  std::sort(includes.begin(), includes.end());
+  includes.erase(std::unique(includes.begin(), includes.end()), includes.end());
+
+  uint64_t key = compiler_id_;
+  for (const auto &name : includes) {
+    key = util::HashString(name, key);
+  }
+  for (const auto &flag : flags) {
+    key = util::HashString(flag, key);
+  }
+
+  std::string header;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    PchState &state = pch_[key];
+    if (state.ready) {
+      return state.header;
+    }
+    if (state.building || state.failed || ++state.seen < PCH_MIN_USES) {
+      return "";
+    }
+    state.building = true;
+    header = (fs::path(root_dir_) / ("pch-" + util::ToHex(key) + ".hpp")).string();
+  }
 
-  int result = std::system(command.c_str());
+  // Built in the background; this check goes ahead without it
+  std::vector<std::string> args{compiler_, "-x", "c++-header"};
+  for (const auto &arg : BaseArgs(flags)) {
+    if (arg != "-fsyntax-only") {
+      args.push_back(arg);
+    }
+  }
+  args.push_back(header);
+  args.push_back("-o");
+  args.push_back(header + (kind_ == Kind::Clang ? ".pch" : ".gch"));
 
-  // Read errors if any
-  std::ifstream error_file("zweek_errors.txt");
-  if (error_file) {
-    std::string line;
-    errors_.clear();
-    while (std::getline(error_file, line)) {
-      errors_ += line + "\n";
+  pool_->Submit([this, key, header, includes, args]() {
+    bool ok = false;
+    {
+      std::ofstream out(header, std::ios::binary | std::ios::trunc);
+      for (const auto &name : includes) {
+        out << "#include <" << name << ">\n";
+      }
+      ok = static_cast<bool>(out);
     }
+    std::string output;
+    ok = ok && RunProcess(args, root_dir_, output) == 0;
+    std::lock_guard<std::mutex> lock(mutex_);
+    PchState &state = pch_[key];
+    state.building = false;
+    state.ready = ok;
+    state.failed = !ok;
+    state.header = header;
+  });
+  return "";
+}
+
+std::string CompilerCheck::AcquireWorkDir() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!free_work_dirs_.empty()) {
+    std::string dir = std::move(free_work_dirs_.back());
+    free_work_dirs_.pop_back();
+    return dir;
   }
+  fs::path dir = fs::path(root_dir_) / ("work-" + std::to_string(n_work_dirs_++));
+  std::error_code ec;
+  fs::create_directories(dir, ec);
+  return dir.string();
+}
 
-  // Return true if no errors
-  return (result == 0);
+void CompilerCheck::ReleaseWorkDir(std::string dir) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  free_work_dirs_.push_back(std::move(dir));
 }
 
 } // namespace tools
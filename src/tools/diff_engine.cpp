@@ -0,0 +1,450 @@
+#include "tools/diff_engine.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+namespace zweek {
+namespace tools {
+
+namespace {
+
+constexpr uint32_t NONE = UINT32_MAX;
+constexpr uint32_t MAX_CHAIN_LENGTH = 64; // Lines more common than this never anchor
+constexpr int MAX_MYERS_COST = 4096;      // Edit distance at which Myers gives up on a region
+const char *const NO_NEWLINE = "\\ No newline at end of file";
+
+// Word-at-a-time multiply/rotate hash; eight bytes per step instead of
+// FNV's one, which is what dominates interning long files
+uint64_t HashLine(std::string_view line) {
+  constexpr uint64_t K = 0x9e3779b97f4a7c15ULL;
+  uint64_t h = line.size() * K;
+  const char *p = line.data();
+  size_t n = line.size();
+  for (; n >= 8; p += 8, n -= 8) {
+    uint64_t word;
+    std::memcpy(&word, p, 8);
+    h = (h ^ word) * K;
+    h ^= h >> 29;
+  }
+  if (n > 0) {
+    uint64_t word = 0;
+    std::memcpy(&word, p, n);
+    h = (h ^ word) * K;
+  }
+  return h ^ (h >> 32);
+}
+
+// Assigns equal lines equal ids (open addressing on the line hash)
+class LineInterner {
+public:
+  explicit LineInterner(size_t n_lines) {
+    size_t capacity = 16;
+    while (capacity < n_lines * 2) {
+      capacity <<= 1;
+    }
+    slots_.assign(capacity, {0, NONE});
+  }
+
+  uint32_t Intern(std::string_view line) {
+    uint64_t hash = HashLine(line);
+    size_t mask = slots_.size() - 1;
+    for (size_t i = static_cast<size_t>(hash) & mask;; i = (i + 1) & mask) {
+      Slot &slot = slots_[i];
+      if (slot.id == NONE) {
+        slot = {hash, static_cast<uint32_t>(lines_.size())};
+        lines_.push_back(line);
+        return slot.id;
+      }
+      if (slot.hash == hash && lines_[slot.id] == line) {
+        return slot.id;
+      }
+    }
+  }
+
+  uint32_t Count() const { return static_cast<uint32_t>(lines_.size()); }
+
+private:
+  struct Slot {
+    uint64_t hash;
+    uint32_t id;
+  };
+  std::vector<Slot> slots_;
+  std::vector<std::string_view> lines_; // By id
+};
+
+// Lines keep their '\n', so a last line without one differs from the same
+// text with it
+std::vector<std::string_view> SplitLines(std::string_view text) {
+  std::vector<std::string_view> lines;
+  size_t begin = 0;
+  while (begin < text.size()) {
+    size_t newline = text.find('\n', begin);
+    size_t end = newline == std::string_view::npos ? text.size() : newline + 1;
+    lines.push_back(text.substr(begin, end - begin));
+    begin = end;
+  }
+  return lines;
+}
+
+// Marks the lines to delete from a and insert from b
+class LineDiff {
+public:
+  LineDiff(const std::vector<uint32_t> &a, const std::vector<uint32_t> &b, uint32_t n_ids)
+      : a_(a), b_(b), deleted_(a.size(), 0), inserted_(b.size(), 0),
+        count_(n_ids, 0), head_(n_ids, NONE), next_(a.size(), NONE) {}
+
+  void Run() {
+    regions_.push_back({0, a_.size(), 0, b_.size()});
+    while (!regions_.empty()) {
+      Region r = regions_.back();
+      regions_.pop_back();
+      Histogram(r);
+    }
+  }
+
+  const std::vector<char> &Deleted() const { return deleted_; }
+  const std::vector<char> &Inserted() const { return inserted_; }
+
+private:
+  struct Region {
+    size_t a_lo, a_hi, b_lo, b_hi;
+  };
+
+  // Strip the common prefix and suffix; true if something is left on both sides
+  bool Trim(Region &r) {
+    while (r.a_lo < r.a_hi && r.b_lo < r.b_hi && a_[r.a_lo] == b_[r.b_lo]) {
+      ++r.a_lo;
+      ++r.b_lo;
+    }
+    while (r.a_lo < r.a_hi && r.b_lo < r.b_hi && a_[r.a_hi - 1] == b_[r.b_hi - 1]) {
+      --r.a_hi;
+      --r.b_hi;
+    }
+    if (r.a_lo == r.a_hi || r.b_lo == r.b_hi) {
+      MarkChanged(r);
+      return false;
+    }
+    return true;
+  }
+
+  void MarkChanged(const Region &r) {
+    std::fill(deleted_.begin() + r.a_lo, deleted_.begin() + r.a_hi, 1);
+    std::fill(inserted_.begin() + r.b_lo, inserted_.begin() + r.b_hi, 1);
+  }
+
+  void Histogram(Region r) {
+    if (!Trim(r)) {
+      return;
+    }
+
+    // Occurrence counts and position chains of the old side
+    std::vector<uint32_t> touched;
+    for (size_t i = r.a_hi; i-- > r.a_lo;) {
+      uint32_t id = a_[i];
+      if (count_[id] == 0) {
+        touched.push_back(id);
+      }
+      ++count_[id];
+      next_[i] = head_[id];
+      head_[id] = static_cast<uint32_t>(i);
+    }
+
+    // The anchor is the longest common run through the rarest shared line
+    bool any_common = false;
+    uint32_t best_count = MAX_CHAIN_LENGTH + 1;
+    Region best{0, 0, 0, 0};
+    for (size_t j = r.b_lo; j < r.b_hi;) {
+      uint32_t c = count_[b_[j]];
+      size_t next_j = j + 1;
+      if (c > 0) {
+        any_common = true;
+      }
+      if (c == 0 || c > best_count) {
+        j = next_j;
+        continue;
+      }
+      for (uint32_t i = head_[b_[j]]; i != NONE; i = next_[i]) {
+        size_t as = i, bs = j, ae = i + 1, be = j + 1;
+        while (as > r.a_lo && bs > r.b_lo && a_[as - 1] == b_[bs - 1]) {
+          --as;
+          --bs;
+        }
+        while (ae < r.a_hi && be < r.b_hi && a_[ae] == b_[be]) {
+          ++ae;
+          ++be;
+        }
+        if (c < best_count || ae - as > best.a_hi - best.a_lo) {
+          best_count = c;
+          best = {as, ae, bs, be};
+        }
+        next_j = std::max(next_j, be);
+      }
+      j = next_j;
+    }
+
+    for (uint32_t id : touched) {
+      count_[id] = 0;
+      head_[id] = NONE;
+    }
+
+    if (best_count <= MAX_CHAIN_LENGTH) {
+      regions_.push_back({r.a_lo, best.a_lo, r.b_lo, best.b_lo});
+      regions_.push_back({best.a_hi, r.a_hi, best.b_hi, r.b_hi});
+    } else if (any_common) {
+      Myers(r); // Only very common lines are shared
+    } else {
+      MarkChanged(r);
+    }
+  }
+
+  // Linear-space Myers: split each region at the middle snake of its
+  // shortest edit script until only pure insertions/deletions are left
+  void Myers(Region start) {
+    std::vector<Region> stack{start};
+    std::vector<int> forward, backward;
+    while (!stack.empty()) {
+      Region r = stack.back();
+      stack.pop_back();
+      if (!Trim(r)) {
+        continue;
+      }
+      size_t x = 0, y = 0;
+      if (!MiddleSnake(r, forward, backward, x, y)) {
+        MarkChanged(r); // Too far apart to be worth an exact answer
+        continue;
+      }
+      stack.push_back({r.a_lo, x, r.b_lo, y});
+      stack.push_back({x, r.a_hi, y, r.b_hi});
+    }
+  }
+
+  bool MiddleSnake(const Region &r, std::vector<int> &v1, std::vector<int> &v2,
+                   size_t &split_x, size_t &split_y) {
+    const uint32_t *a = a_.data() + r.a_lo;
+    const uint32_t *b = b_.data() + r.b_lo;
+    const int n = static_cast<int>(r.a_hi - r.a_lo);
+    const int m = static_cast<int>(r.b_hi - r.b_lo);
+    const int max_d = std::min((n + m + 1) / 2, MAX_MYERS_COST);
+    const int offset = max_d + 1;
+    const int length = 2 * offset + 1;
+    v1.assign(length, -1);
+    v2.assign(length, -1);
+    v1[offset + 1] = 0;
+    v2[offset + 1] = 0;
+    const int delta = n - m;
+    const bool front = (delta % 2) != 0; // Which pass can detect the overlap
+
+    int k1_start = 0, k1_end = 0, k2_start = 0, k2_end = 0;
+    for (int d = 0; d < max_d; ++d) {
+      for (int k1 = -d + k1_start; k1 <= d - k1_end; k1 += 2) {
+        int k1_offset = offset + k1;
+        int x1 = (k1 == -d || (k1 != d && v1[k1_offset - 1] < v1[k1_offset + 1]))
+                     ? v1[k1_offset + 1]
+                     : v1[k1_offset - 1] + 1;
+        int y1 = x1 - k1;
+        while (x1 < n && y1 < m && a[x1] == b[y1]) {
+          ++x1;
+          ++y1;
+        }
+        v1[k1_offset] = x1;
+        if (x1 > n) {
+          k1_end += 2; // Ran off the right
+        } else if (y1 > m) {
+          k1_start += 2; // Ran off the bottom
+        } else if (front) {
+          int k2_offset = offset + delta - k1;
+          if (k2_offset >= 0 && k2_offset < length && v2[k2_offset] != -1 &&
+              x1 >= n - v2[k2_offset]) {
+            split_x = r.a_lo + x1;
+            split_y = r.b_lo + y1;
+            return true;
+          }
+        }
+      }
+
+      for (int k2 = -d + k2_start; k2 <= d - k2_end; k2 += 2) {
+        int k2_offset = offset + k2;
+        int x2 = (k2 == -d || (k2 != d && v2[k2_offset - 1] < v2[k2_offset + 1]))
+                     ? v2[k2_offset + 1]
+                     : v2[k2_offset - 1] + 1;
+        int y2 = x2 - k2;
+        while (x2 < n && y2 < m && a[n - x2 - 1] == b[m - y2 - 1]) {
+          ++x2;
+          ++y2;
+        }
+        v2[k2_offset] = x2;
+        if (x2 > n) {
+          k2_end += 2;
+        } else if (y2 > m) {
+          k2_start += 2;
+        } else if (!front) {
+          int k1_offset = offset + delta - k2;
+          if (k1_offset >= 0 && k1_offset < length && v1[k1_offset] != -1) {
+            int x1 = v1[k1_offset];
+            int y1 = offset + x1 - k1_offset;
+            if (x1 >= n - x2) {
+              split_x = r.a_lo + x1;
+              split_y = r.b_lo + y1;
+              return true;
+            }
+          }
+        }
+      }
+    }
+    return false;
+  }
+
+  const std::vector<uint32_t> &a_;
+  const std::vector<uint32_t> &b_;
+  std::vector<char> deleted_;
+  std::vector<char> inserted_;
+
+  // Histogram scratch, indexed by line id (count_, head_) or old line (next_)
+  std::vector<uint32_t> count_;
+  std::vector<uint32_t> head_;
+  std::vector<uint32_t> next_;
+  std::vector<Region> regions_;
+};
+
+struct Edit {
+  char kind; // ' ', '-' or '+'
+  size_t a;  // Old line index (the insertion point for '+')
+  size_t b;  // New line index (the deletion point for '-')
+};
+
+void AppendLine(DiffHunk &hunk, char kind, std::string_view line) {
+  bool has_newline = !line.empty() && line.back() == '\n';
+  std::string text(1, kind);
+  text.append(line.data(), line.size() - (has_newline ? 1 : 0));
+  hunk.lines.push_back(std::move(text));
+  if (!has_newline) {
+    hunk.lines.push_back(NO_NEWLINE);
+  }
+}
+
+} // namespace
+
+std::vector<DiffHunk> DiffEngine::Diff(std::string_view old_text, std::string_view new_text,
+                                       size_t context) {
+  std::vector<DiffHunk> hunks;
+  if (old_text == new_text) {
+    return hunks;
+  }
+
+  std::vector<std::string_view> old_lines = SplitLines(old_text);
+  std::vector<std::string_view> new_lines = SplitLines(new_text);
+
+  // Common leading and trailing lines never reach the diff; the rest is
+  // interned so equality is one integer compare
+  size_t prefix = 0;
+  while (prefix < old_lines.size() && prefix < new_lines.size() &&
+         old_lines[prefix] == new_lines[prefix]) {
+    ++prefix;
+  }
+  size_t suffix = 0;
+  while (suffix < old_lines.size() - prefix && suffix < new_lines.size() - prefix &&
+         old_lines[old_lines.size() - 1 - suffix] == new_lines[new_lines.size() - 1 - suffix]) {
+    ++suffix;
+  }
+  const size_t old_end = old_lines.size() - suffix;
+  const size_t new_end = new_lines.size() - suffix;
+
+  LineInterner interner(old_end - prefix + new_end - prefix);
+  std::vector<uint32_t> a, b;
+  a.reserve(old_end - prefix);
+  b.reserve(new_end - prefix);
+  for (size_t i = prefix; i < old_end; ++i) {
+    a.push_back(interner.Intern(old_lines[i]));
+  }
+  for (size_t j = prefix; j < new_end; ++j) {
+    b.push_back(interner.Intern(new_lines[j]));
+  }
+
+  LineDiff diff(a, b, interner.Count());
+  diff.Run();
+  const std::vector<char> &deleted = diff.Deleted();
+  const std::vector<char> &inserted = diff.Inserted();
+
+  // Flatten into an edit script, deletions before insertions in each change
+  std::vector<Edit> edits;
+  edits.reserve(old_lines.size() + b.size());
+  for (size_t i = 0, j = 0; i < old_lines.size() || j < new_lines.size();) {
+    bool middle_i = i >= prefix && i < old_end;
+    bool middle_j = j >= prefix && j < new_end;
+    if (middle_i && deleted[i - prefix]) {
+      edits.push_back({'-', i++, j});
+    } else if (middle_j && inserted[j - prefix]) {
+      edits.push_back({'+', i, j++});
+    } else {
+      edits.push_back({' ', i++, j++});
+    }
+  }
+
+  // Group changes into hunks, merging those separated by at most 2 * context
+  // unchanged lines
+  size_t k = 0;
+  while (k < edits.size()) {
+    size_t change = k;
+    while (change < edits.size() && edits[change].kind == ' ') {
+      ++change;
+    }
+    if (change == edits.size()) {
+      break;
+    }
+    size_t begin = change - std::min(context, change - k);
+    size_t last_change = change;
+    size_t e = change;
+    for (; e < edits.size(); ++e) {
+      if (edits[e].kind != ' ') {
+        last_change = e;
+      } else if (e - last_change > 2 * context) {
+        break;
+      }
+    }
+    size_t end = std::min(edits.size(), last_change + context + 1);
+
+    DiffHunk hunk;
+    for (size_t h = begin; h < end; ++h) {
+      const Edit &edit = edits[h];
+      if (edit.kind != '+') {
+        ++hunk.old_count;
+      }
+      if (edit.kind != '-') {
+        ++hunk.new_count;
+      }
+      AppendLine(hunk, edit.kind, edit.kind == '+' ? new_lines[edit.b] : old_lines[edit.a]);
+    }
+    hunk.old_start = edits[begin].a + (hunk.old_count > 0 ? 1 : 0);
+    hunk.new_start = edits[begin].b + (hunk.new_count > 0 ? 1 : 0);
+    hunks.push_back(std::move(hunk));
+    k = end;
+  }
+  return hunks;
+}
+
+std::string DiffEngine::Unified(const std::string &old_label, const std::string &new_label,
+                                std::string_view old_text, std::string_view new_text,
+                                size_t context) {
+  std::vector<DiffHunk> hunks = Diff(old_text, new_text, context);
+  if (hunks.empty()) {
+    return "";
+  }
+
+  auto range = [](size_t start, size_t count) {
+    return count == 1 ? std::to_string(start)
+                      : std::to_string(start) + "," + std::to_string(count);
+  };
+  std::string out = "--- " + old_label + "\n+++ " + new_label + "\n";
+  for (const auto &hunk : hunks) {
+    out += "@@ -" + range(hunk.old_start, hunk.old_count) + " +" +
+           range(hunk.new_start, hunk.new_count) + " @@\n";
+    for (const auto &line : hunk.lines) {
+      out += line;
+      out += '\n';
+    }
+  }
+  return out;
+}
+
+} // namespace tools
+} // namespace zweek
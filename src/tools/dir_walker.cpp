@@ -0,0 +1,639 @@
+#include "tools/dir_walker.hpp"
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <string_view>
+#include <thread>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace zweek {
+namespace tools {
+
+namespace fs = std::filesystem;
+
+namespace {
+
+constexpr size_t MAX_WALK_THREADS = 8; // Beyond this the walk is bound by the filesystem
+constexpr size_t BINARY_PROBE_BYTES = 1024;
+constexpr int IDLE_WAIT_MS = 1;
+
+const char *SKIPPED_DIRECTORIES[] = {"node_modules", "build", "dist", "out",
+                                     "target", "__pycache__"};
+
+constexpr std::string_view BINARY_EXTENSIONS[] = {
+    "a",    "bin",  "bmp",  "bz2",  "class", "db",    "dll",   "dylib", "exe",
+    "gguf", "gif",  "gz",   "ico",  "idx",   "jar",   "jpeg",  "jpg",   "lib",
+    "mp3",  "mp4",  "o",    "obj",  "otf",   "pdb",   "pdf",   "png",   "pyc",
+    "so",   "sqlite", "tar", "tgz", "ttf",   "wav",   "webp",  "woff",  "woff2",
+    "xz",   "zip",  "zst",  "7z"};
+
+// One line of an ignore file
+struct IgnoreRule {
+  std::string pattern;
+  bool negate = false;
+  bool dir_only = false; // Trailing '/'
+  bool anchored = false; // Contains '/': matched against the relative path, not the name
+};
+
+// gitignore glob: '*' and '?' stop at '/', '**' crosses directories,
+// '[...]' classes, '\' escapes
+bool GlobMatch(std::string_view p, std::string_view s) {
+  size_t pi = 0;
+  size_t si = 0;
+  while (pi < p.size()) {
+    char c = p[pi];
+    if (c == '*') {
+      if (pi + 1 < p.size() && p[pi + 1] == '*') {
+        if (pi + 2 < p.size() && p[pi + 2] == '/') {
+          // "**/": zero or more leading directories
+          std::string_view tail = p.substr(pi + 3);
+          if (GlobMatch(tail, s.substr(si))) {
+            return true;
+          }
+          for (size_t k = si; k < s.size(); ++k) {
+            if (s[k] == '/' && GlobMatch(tail, s.substr(k + 1))) {
+              return true;
+            }
+          }
+          return false;
+        }
+        std::string_view tail = p.substr(pi + 2);
+        for (size_t k = si; k <= s.size(); ++k) {
+          if (GlobMatch(tail, s.substr(k))) {
+            return true;
+          }
+        }
+        return false;
+      }
+
+      std::string_view tail = p.substr(pi + 1);
+      for (size_t k = si; k <= s.size(); ++k) {
+        if (GlobMatch(tail, s.substr(k))) {
+          return true;
+        }
+        if (k < s.size() && s[k] == '/') {
+          break;
+        }
+      }
+      return false;
+    }
+
+    if (si >= s.size()) {
+      return false;
+    }
+    if (c == '?') {
+      if (s[si] == '/') {
+        return false;
+      }
+      ++pi;
+      ++si;
+      continue;
+    }
+    if (c == '[') {
+      size_t end = p.find(']', pi + 2);
+      if (end != std::string_view::npos) {
+        size_t k = pi + 1;
+        bool negate = p[k] == '!' || p[k] == '^';
+        if (negate) {
+          ++k;
+        }
+        bool matched = false;
+        for (; k < end; ++k) {
+          if (k + 2 < end && p[k + 1] == '-') {
+            matched |= s[si] >= p[k] && s[si] <= p[k + 2];
+            k += 2;
+          } else {
+            matched |= s[si] == p[k];
+          }
+        }
+        if (matched == negate || s[si] == '/') {
+          return false;
+        }
+        pi = end + 1;
+        ++si;
+        continue;
+      }
+    }
+    if (c == '\\' && pi + 1 < p.size()) {
+      c = p[++pi];
+    }
+    if (c != s[si]) {
+      return false;
+    }
+    ++pi;
+    ++si;
+  }
+  return si == s.size();
+}
+
+void ParseIgnoreFile(const std::string &path, std::vector<IgnoreRule> &rules) {
+  std::ifstream in(path);
+  std::string line;
+  while (std::getline(in, line)) {
+    while (!line.empty() && (line.back() == '\r' || line.back() == ' ' || line.back() == '\t')) {
+      line.pop_back();
+    }
+    if (line.empty() || line[0] == '#') {
+      continue;
+    }
+
+    IgnoreRule rule;
+    if (line[0] == '!') {
+      rule.negate = true;
+      line.erase(0, 1);
+    } else if (line[0] == '\\') {
+      line.erase(0, 1); // "\#" and "\!" are literal
+    }
+    if (!line.empty() && line.back() == '/') {
+      rule.dir_only = true;
+      line.pop_back();
+    }
+    if (!line.empty() && line[0] == '/') {
+      rule.anchored = true;
+      line.erase(0, 1);
+    }
+    if (line.find('/') != std::string::npos) {
+      rule.anchored = true;
+    }
+    if (line.empty()) {
+      continue;
+    }
+    rule.pattern = std::move(line);
+    rules.push_back(std::move(rule));
+  }
+}
+
+int64_t MTime(const fs::path &path, std::error_code &ec) {
+  return static_cast<int64_t>(fs::last_write_time(path, ec).time_since_epoch().count());
+}
+
+// Open directory for fstatat, so per-file stats skip resolving the full path
+class DirHandle {
+public:
+  explicit DirHandle(const std::string &dir) {
+#ifdef __linux__
+    fd_ = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+#endif
+    (void)dir;
+  }
+  ~DirHandle() {
+#ifdef __linux__
+    if (fd_ >= 0) {
+      close(fd_);
+    }
+#endif
+  }
+  DirHandle(const DirHandle &) = delete;
+  DirHandle &operator=(const DirHandle &) = delete;
+
+  // Size and mtime (as MTime reports it) of an entry, in one stat where
+  // possible
+  bool Stat(const std::string &dir, const std::string &name, uint64_t &size,
+            int64_t &mtime) const {
+#ifdef __linux__
+    struct stat st;
+    if (fd_ >= 0) {
+      if (fstatat(fd_, name.c_str(), &st, 0) != 0) {
+        return false;
+      }
+      size = static_cast<uint64_t>(st.st_size);
+      mtime = FileClockOffset() +
+              std::chrono::duration_cast<fs::file_time_type::duration>(
+                  std::chrono::seconds(st.st_mtim.tv_sec) +
+                  std::chrono::nanoseconds(st.st_mtim.tv_nsec))
+                  .count();
+      return true;
+    }
+#endif
+    fs::path path = fs::path(dir) / name;
+    std::error_code ec;
+    size = fs::file_size(path, ec);
+    if (ec) {
+      return false;
+    }
+    mtime = MTime(path, ec);
+    return !ec;
+  }
+
+private:
+#ifdef __linux__
+  // file_time_type's epoch is implementation-defined; measure it once
+  // against the Unix epoch using the same file
+  static int64_t FileClockOffset() {
+    static const int64_t offset = []() {
+      struct stat st;
+      std::error_code ec;
+      int64_t file_clock = MTime("/", ec);
+      if (ec || stat("/", &st) != 0) {
+        return int64_t{0};
+      }
+      return file_clock - std::chrono::duration_cast<fs::file_time_type::duration>(
+                              std::chrono::seconds(st.st_mtim.tv_sec) +
+                              std::chrono::nanoseconds(st.st_mtim.tv_nsec))
+                              .count();
+    }();
+    return offset;
+  }
+#endif
+
+  int fd_ = -1;
+};
+
+bool ProbeBinary(const std::string &path) {
+  std::FILE *file = std::fopen(path.c_str(), "rb");
+  if (!file) {
+    return true; // Unreadable: nothing a consumer could use
+  }
+  char buffer[BINARY_PROBE_BYTES];
+  size_t n = std::fread(buffer, 1, sizeof(buffer), file);
+  std::fclose(file);
+  return std::memchr(buffer, '\0', n) != nullptr;
+}
+
+} // namespace
+
+// Rules of one directory's ignore files, chained to those of its parents
+struct DirWalker::IgnoreRules {
+  std::shared_ptr<const std::vector<IgnoreRule>> rules;
+  std::string base; // Directory the rules apply to, relative to the walk root
+  std::shared_ptr<const IgnoreRules> parent;
+
+  // Deeper files win over shallower ones, later lines over earlier ones
+  bool IsIgnored(const std::string &relative, bool is_directory) const {
+    for (const IgnoreRules *node = this; node; node = node->parent.get()) {
+      std::string_view path(relative);
+      if (!node->base.empty()) {
+        if (path.size() <= node->base.size() || path.compare(0, node->base.size(), node->base) != 0 ||
+            path[node->base.size()] != '/') {
+          continue;
+        }
+        path.remove_prefix(node->base.size() + 1);
+      }
+      std::string_view name = path.substr(path.rfind('/') + 1);
+
+      for (auto rule = node->rules->rbegin(); rule != node->rules->rend(); ++rule) {
+        if (rule->dir_only && !is_directory) {
+          continue;
+        }
+        if (GlobMatch(rule->pattern, rule->anchored ? path : name)) {
+          return !rule->negate;
+        }
+      }
+    }
+    return false;
+  }
+};
+
+// Directory contents as of mtime
+struct DirWalker::Listing {
+  struct Entry {
+    std::string name;
+    bool is_directory = false;
+    bool is_file = false;
+    bool is_symlink = false;
+  };
+
+  int64_t mtime = 0;
+  std::vector<Entry> entries;
+  std::shared_ptr<const std::vector<IgnoreRule>> ignore; // Null without ignore files
+  std::vector<std::pair<std::string, int64_t>> ignore_files; // Path, mtime
+
+  // Binary probe verdicts per entry, valid for the recorded size and mtime
+  struct Probe {
+    uint64_t size = 0;
+    int64_t mtime = 0;
+    int8_t binary = -1; // Not probed yet
+  };
+  mutable std::vector<Probe> probes; // Parallel to entries
+  mutable std::mutex probes_mutex;
+
+  // Caller holds probes_mutex
+  bool IsBinary(const std::string &dir, size_t index, uint64_t size, int64_t file_mtime) const {
+    Probe &probe = probes[index];
+    if (probe.binary < 0 || probe.size != size || probe.mtime != file_mtime) {
+      bool binary = ProbeBinary((fs::path(dir) / entries[index].name).string());
+      probe = {size, file_mtime, static_cast<int8_t>(binary)};
+    }
+    return probe.binary != 0;
+  }
+};
+
+struct DirWalker::Task {
+  std::string dir; // Absolute
+  std::string relative;
+  std::shared_ptr<const IgnoreRules> ignore;
+};
+
+// Per-worker stacks of pending directories. A worker pops its own newest
+// task (depth-first, cache-friendly) and steals the oldest task of another
+// worker, which tends to be the largest remaining subtree.
+class DirWalker::Queues {
+public:
+  explicit Queues(size_t n_workers) : stacks_(n_workers) {}
+
+  void Push(size_t worker, Task task) {
+    ++pending_;
+    {
+      std::lock_guard<std::mutex> lock(stacks_[worker].mutex);
+      stacks_[worker].tasks.push_back(std::move(task));
+    }
+    idle_cv_.notify_one();
+  }
+
+  bool Pop(size_t worker, Task &task) {
+    {
+      Stack &own = stacks_[worker];
+      std::lock_guard<std::mutex> lock(own.mutex);
+      if (!own.tasks.empty()) {
+        task = std::move(own.tasks.back());
+        own.tasks.pop_back();
+        return true;
+      }
+    }
+    for (size_t i = 1; i < stacks_.size(); ++i) {
+      Stack &victim = stacks_[(worker + i) % stacks_.size()];
+      std::lock_guard<std::mutex> lock(victim.mutex);
+      if (!victim.tasks.empty()) {
+        task = std::move(victim.tasks.front());
+        victim.tasks.pop_front();
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // A popped task was fully processed (its subdirectories are queued)
+  void Done() {
+    if (--pending_ == 0) {
+      idle_cv_.notify_all();
+    }
+  }
+
+  bool Finished() const { return pending_ == 0; }
+
+  void WaitForWork() {
+    std::unique_lock<std::mutex> lock(idle_mutex_);
+    idle_cv_.wait_for(lock, std::chrono::milliseconds(IDLE_WAIT_MS));
+  }
+
+private:
+  struct Stack {
+    std::mutex mutex;
+    std::deque<Task> tasks;
+  };
+
+  std::vector<Stack> stacks_;
+  std::atomic<size_t> pending_{0};
+  std::mutex idle_mutex_;
+  std::condition_variable idle_cv_;
+};
+
+DirWalker::DirWalker(WalkOptions options) : options_(options) {}
+
+DirWalker::~DirWalker() = default;
+
+bool DirWalker::IsSkippedDirectory(const std::string &path) {
+  std::string name = fs::path(path).filename().string();
+  if (name.size() > 1 && name[0] == '.') {
+    return true;
+  }
+  if (name.rfind("cmake-build", 0) == 0) {
+    return true;
+  }
+  for (const char *skipped : SKIPPED_DIRECTORIES) {
+    if (name == skipped) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool DirWalker::HasBinaryExtension(const std::string &path) {
+  size_t dot = path.rfind('.');
+  if (dot == std::string::npos || path.find('/', dot) != std::string::npos) {
+    return false;
+  }
+  std::string_view extension(path.data() + dot + 1, path.size() - dot - 1);
+  for (std::string_view binary : BINARY_EXTENSIONS) {
+    if (extension.size() == binary.size() &&
+        std::equal(extension.begin(), extension.end(), binary.begin(), [](char a, char b) {
+          return std::tolower(static_cast<unsigned char>(a)) == b;
+        })) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void DirWalker::ClearCache() {
+  std::lock_guard<std::mutex> lock(cache_mutex_);
+  cache_.clear();
+}
+
+std::shared_ptr<const DirWalker::Listing> DirWalker::GetListing(const std::string &dir) {
+  std::error_code ec;
+  int64_t mtime = MTime(dir, ec);
+
+  {
+    std::lock_guard<std::mutex> lock(cache_mutex_);
+    auto it = cache_.find(dir);
+    if (!ec && it != cache_.end() && it->second->mtime == mtime) {
+      // Editing an ignore file in place doesn't touch the directory mtime
+      bool fresh = std::all_of(
+          it->second->ignore_files.begin(), it->second->ignore_files.end(),
+          [](const std::pair<std::string, int64_t> &file) {
+            std::error_code file_ec;
+            return MTime(file.first, file_ec) == file.second && !file_ec;
+          });
+      if (fresh) {
+        return it->second;
+      }
+    }
+  }
+
+  auto listing = std::make_shared<Listing>();
+  listing->mtime = mtime;
+  std::string gitignore;
+  std::string dotignore;
+  for (fs::directory_iterator it(dir, fs::directory_options::skip_permission_denied, ec), end;
+       it != end && !ec; it.increment(ec)) {
+    std::error_code entry_ec;
+    Listing::Entry entry;
+    entry.name = it->path().filename().string();
+    entry.is_symlink = it->is_symlink(entry_ec);
+    entry.is_directory = it->is_directory(entry_ec);
+    entry.is_file = !entry.is_directory && it->is_regular_file(entry_ec);
+
+    if (entry.is_file && entry.name == ".gitignore") {
+      gitignore = it->path().string();
+    } else if (entry.is_file && entry.name == ".ignore") {
+      dotignore = it->path().string();
+    }
+    listing->entries.push_back(std::move(entry));
+  }
+
+  listing->probes.resize(listing->entries.size());
+
+  // .ignore comes last so it can override .gitignore
+  std::vector<IgnoreRule> rules;
+  for (const std::string *file : {&gitignore, &dotignore}) {
+    if (!file->empty()) {
+      std::error_code file_ec;
+      listing->ignore_files.emplace_back(*file, MTime(*file, file_ec));
+      ParseIgnoreFile(*file, rules);
+    }
+  }
+  if (!rules.empty()) {
+    listing->ignore = std::make_shared<const std::vector<IgnoreRule>>(std::move(rules));
+  }
+
+  std::lock_guard<std::mutex> lock(cache_mutex_);
+  cache_[dir] = listing;
+  return listing;
+}
+
+bool DirWalker::VisitDirectory(const Task &task, Queues &queues, size_t worker,
+                               const Visitor &visitor, std::mutex &visitor_mutex) {
+  std::shared_ptr<const Listing> listing = GetListing(task.dir);
+
+  std::shared_ptr<const IgnoreRules> ignore = task.ignore;
+  if (options_.respect_ignore_files && listing->ignore) {
+    ignore = std::make_shared<const IgnoreRules>(
+        IgnoreRules{listing->ignore, task.relative, task.ignore});
+  }
+
+  DirHandle handle(task.dir);
+  std::unique_lock<std::mutex> probes_lock(listing->probes_mutex); // Only contended by concurrent walks
+  std::vector<WalkEntry> found;
+  for (size_t i = 0; i < listing->entries.size(); ++i) {
+    const Listing::Entry &entry = listing->entries[i];
+    std::string relative = task.relative.empty() ? entry.name : task.relative + "/" + entry.name;
+
+    if (entry.is_directory) {
+      if (entry.is_symlink || IsSkippedDirectory(entry.name) ||
+          (ignore && ignore->IsIgnored(relative, true))) {
+        continue;
+      }
+      if (options_.include_directories) {
+        WalkEntry dir;
+        dir.path = relative;
+        dir.is_directory = true;
+        found.push_back(std::move(dir));
+      }
+      if (options_.recursive) {
+        queues.Push(worker, {(fs::path(task.dir) / entry.name).string(), relative, ignore});
+      }
+      continue;
+    }
+
+    if (!entry.is_file || (ignore && ignore->IsIgnored(relative, false)) ||
+        (options_.skip_binary && HasBinaryExtension(entry.name))) {
+      continue;
+    }
+
+    WalkEntry file;
+    file.path = std::move(relative);
+    if (!handle.Stat(task.dir, entry.name, file.size, file.mtime) ||
+        (options_.max_file_bytes > 0 && file.size > options_.max_file_bytes)) {
+      continue;
+    }
+    if (options_.skip_binary && file.size > 0 &&
+        listing->IsBinary(task.dir, i, file.size, file.mtime)) {
+      continue;
+    }
+    found.push_back(std::move(file));
+  }
+  probes_lock.unlock();
+
+  std::lock_guard<std::mutex> lock(visitor_mutex);
+  for (const auto &entry : found) {
+    if (!visitor(entry)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void DirWalker::Walk(const std::string &root, const Visitor &visitor,
+                     const std::atomic<bool> *cancel) {
+  std::error_code ec;
+  if (!fs::is_directory(root, ec)) {
+    return;
+  }
+
+  size_t n_threads = options_.n_threads;
+  if (n_threads == 0) {
+    n_threads = std::min<size_t>(std::max(1u, std::thread::hardware_concurrency()), MAX_WALK_THREADS);
+  }
+  if (!options_.recursive) {
+    n_threads = 1;
+  }
+
+  // Repository-local excludes apply like a root .gitignore with lower precedence
+  std::shared_ptr<const IgnoreRules> root_ignore;
+  if (options_.respect_ignore_files) {
+    std::vector<IgnoreRule> rules;
+    ParseIgnoreFile((fs::path(root) / ".git" / "info" / "exclude").string(), rules);
+    if (!rules.empty()) {
+      root_ignore = std::make_shared<const IgnoreRules>(
+          IgnoreRules{std::make_shared<const std::vector<IgnoreRule>>(std::move(rules)), "", nullptr});
+    }
+  }
+
+  Queues queues(n_threads);
+  queues.Push(0, {root, "", root_ignore});
+
+  std::mutex visitor_mutex;
+  std::atomic<bool> stop{false};
+  auto work = [&](size_t worker) {
+    Task task;
+    while (!stop && !(cancel && *cancel)) {
+      if (queues.Pop(worker, task)) {
+        if (!VisitDirectory(task, queues, worker, visitor, visitor_mutex)) {
+          stop = true;
+        }
+        queues.Done();
+        continue;
+      }
+      if (queues.Finished()) {
+        break;
+      }
+      queues.WaitForWork();
+    }
+  };
+
+  std::vector<std::thread> helpers;
+  for (size_t i = 1; i < n_threads; ++i) {
+    helpers.emplace_back(work, i);
+  }
+  work(0);
+  for (auto &helper : helpers) {
+    helper.join();
+  }
+}
+
+std::vector<WalkEntry> DirWalker::Collect(const std::string &root,
+                                          const std::atomic<bool> *cancel) {
+  std::vector<WalkEntry> entries;
+  Walk(root, [&](const WalkEntry &entry) {
+    entries.push_back(entry);
+    return true;
+  }, cancel);
+  std::sort(entries.begin(), entries.end(),
+            [](const WalkEntry &a, const WalkEntry &b) { return a.path < b.path; });
+  return entries;
+}
+
+} // namespace tools
+} // namespace zweek
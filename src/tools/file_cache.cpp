@@ -0,0 +1,191 @@
+#include "tools/file_cache.hpp"
+#include <filesystem>
+#include <fstream>
+
+#ifndef _WIN32
+#include <sys/stat.h>
+#endif
+
+namespace zweek {
+namespace tools {
+
+namespace fs = std::filesystem;
+
+namespace {
+
+constexpr size_t MAP_MIN_BYTES = 64 * 1024; // Smaller files are cheaper to copy than to map
+constexpr size_t MAX_ENTRY_SHARE = 4;       // One file may use at most budget / 4
+
+struct FileStat {
+  uint64_t device = 0;
+  uint64_t inode = 0;
+  uint64_t size = 0;
+  int64_t mtime = 0;
+};
+
+bool StatFile(const std::string &path, FileStat &stat_out) {
+#ifdef _WIN32
+  std::error_code ec;
+  if (!fs::is_regular_file(path, ec)) {
+    return false;
+  }
+  stat_out.size = fs::file_size(path, ec);
+  stat_out.mtime = static_cast<int64_t>(fs::last_write_time(path, ec).time_since_epoch().count());
+  return !ec;
+#else
+  struct stat st;
+  if (stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) {
+    return false;
+  }
+#ifdef __APPLE__
+  const struct timespec &mtime = st.st_mtimespec;
+#else
+  const struct timespec &mtime = st.st_mtim;
+#endif
+  stat_out.device = static_cast<uint64_t>(st.st_dev);
+  stat_out.inode = static_cast<uint64_t>(st.st_ino);
+  stat_out.size = static_cast<uint64_t>(st.st_size);
+  stat_out.mtime = static_cast<int64_t>(mtime.tv_sec) * 1000000000 + mtime.tv_nsec;
+  return true;
+#endif
+}
+
+} // namespace
+
+FileCache::FileCache(size_t byte_budget) : byte_budget_(byte_budget) {}
+
+std::string FileCache::Key(const std::string &path) {
+  std::error_code ec;
+  fs::path absolute = fs::absolute(path, ec);
+  return (ec ? fs::path(path) : absolute).lexically_normal().string();
+}
+
+std::shared_ptr<CachedFile> FileCache::Load(const std::string &path, uint64_t size) {
+  auto file = std::make_shared<CachedFile>();
+  if (size >= MAP_MIN_BYTES) {
+    if (!file->mapping_.Open(path)) {
+      return nullptr;
+    }
+    if (file->mapping_.Data()) {
+      file->text_ = std::string_view(file->mapping_.Data(), file->mapping_.Size());
+    }
+    return file;
+  }
+
+  std::ifstream in(path, std::ios::binary);
+  if (!in.is_open()) {
+    return nullptr;
+  }
+  file->copy_.resize(static_cast<size_t>(size));
+  in.read(&file->copy_[0], static_cast<std::streamsize>(size));
+  file->copy_.resize(static_cast<size_t>(in.gcount())); // Shrunk since the stat
+  file->text_ = file->copy_;
+  return file;
+}
+
+FileHandle FileCache::Get(const std::string &path) {
+  std::string key = Key(path);
+  FileStat st;
+  if (!StatFile(key, st)) {
+    Invalidate(key);
+    return nullptr;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = entries_.find(key);
+    if (it != entries_.end()) {
+      const CachedFile &cached = *it->second.file;
+      if (cached.device_ == st.device && cached.inode_ == st.inode &&
+          cached.mtime_ == st.mtime && cached.Size() == st.size) {
+        lru_.splice(lru_.begin(), lru_, it->second.lru);
+        return it->second.file;
+      }
+      EraseLocked(it);
+    }
+  }
+
+  // Read outside the lock. The identity is from before the read, so a write
+  // racing with it makes the next Get reload rather than serve stale data.
+  std::shared_ptr<CachedFile> file = Load(key, st.size);
+  if (!file) {
+    return nullptr;
+  }
+  file->device_ = st.device;
+  file->inode_ = st.inode;
+  file->mtime_ = st.mtime;
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto existing = entries_.find(key);
+  if (existing != entries_.end()) {
+    EraseLocked(existing);
+  }
+  if (file->Size() <= byte_budget_ / MAX_ENTRY_SHARE) {
+    lru_.push_front(key);
+    entries_[key] = {file, lru_.begin()};
+    bytes_ += file->Size();
+    while (bytes_ > byte_budget_ && lru_.size() > 1) {
+      EraseLocked(entries_.find(lru_.back()));
+    }
+  }
+  return file;
+}
+
+void FileCache::EraseLocked(std::unordered_map<std::string, Entry>::iterator it) {
+  bytes_ -= it->second.file->Size();
+  lru_.erase(it->second.lru);
+  entries_.erase(it); // Outstanding handles keep the contents alive
+}
+
+void FileCache::Invalidate(const std::string &path) {
+  std::string key = Key(path);
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = entries_.find(key);
+  if (it != entries_.end()) {
+    EraseLocked(it);
+  }
+}
+
+void FileCache::Clear() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  entries_.clear();
+  lru_.clear();
+  bytes_ = 0;
+}
+
+void FileCache::ApplyChanges(const ChangeBatch &batch) {
+  if (batch.overflow) {
+    Clear();
+    return;
+  }
+  for (const auto &path : batch.modified) {
+    Invalidate(path);
+  }
+
+  // A removed path may be a directory: drop everything below it
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (const auto &path : batch.removed) {
+    std::string key = Key(path);
+    std::string prefix = key + static_cast<char>(fs::path::preferred_separator);
+    for (auto it = entries_.begin(); it != entries_.end();) {
+      auto next = std::next(it);
+      if (it->first == key || it->first.compare(0, prefix.size(), prefix) == 0) {
+        EraseLocked(it);
+      }
+      it = next;
+    }
+  }
+}
+
+size_t FileCache::Bytes() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return bytes_;
+}
+
+size_t FileCache::Count() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return entries_.size();
+}
+
+} // namespace tools
+} // namespace zweek
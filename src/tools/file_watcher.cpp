@@ -0,0 +1,352 @@
+#include "tools/file_watcher.hpp"
+#include "tools/dir_walker.hpp"
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <unordered_map>
+
+#ifdef __linux__
+#include <cerrno>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+namespace zweek {
+namespace tools {
+
+namespace fs = std::filesystem;
+
+namespace {
+
+// Editors and git write in bursts; wait for a quiet period, but never hold
+// a batch longer than the max delay
+constexpr int DEBOUNCE_MS = 150;
+constexpr int MAX_BATCH_DELAY_MS = 1000;
+constexpr int SCAN_INTERVAL_MS = 2000;
+
+using Clock = std::chrono::steady_clock;
+
+int MillisecondsSince(Clock::time_point start) {
+  return static_cast<int>(
+      std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - start).count());
+}
+
+// Pending changes keyed by path; the latest event for a path wins
+class PendingChanges {
+public:
+  void Add(const std::string &path, bool removed) {
+    if (changes_.empty()) {
+      first_ = Clock::now();
+    }
+    last_ = Clock::now();
+    changes_[path] = removed;
+  }
+
+  void SetOverflow() {
+    Add("", false);
+    overflow_ = true;
+  }
+
+  bool Empty() const { return changes_.empty(); }
+
+  // Milliseconds until the batch should be flushed (0 = now)
+  int MillisecondsUntilFlush() const {
+    int quiet = DEBOUNCE_MS - MillisecondsSince(last_);
+    int age = MAX_BATCH_DELAY_MS - MillisecondsSince(first_);
+    return std::max(0, std::min(quiet, age));
+  }
+
+  ChangeBatch Take() {
+    ChangeBatch batch;
+    batch.overflow = overflow_;
+    for (const auto &change : changes_) {
+      if (change.first.empty()) {
+        continue;
+      }
+      (change.second ? batch.removed : batch.modified).push_back(change.first);
+    }
+    changes_.clear();
+    overflow_ = false;
+    return batch;
+  }
+
+private:
+  std::unordered_map<std::string, bool> changes_; // path -> removed
+  bool overflow_ = false;
+  Clock::time_point first_;
+  Clock::time_point last_;
+};
+
+} // namespace
+
+FileWatcher::FileWatcher() {
+#ifdef __linux__
+  wake_fd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+#endif
+}
+
+FileWatcher::~FileWatcher() {
+  Stop();
+#ifdef __linux__
+  if (wake_fd_ >= 0) {
+    close(wake_fd_);
+  }
+#endif
+}
+
+void FileWatcher::Start(const std::string &root) {
+  Stop();
+
+  std::error_code ec;
+  std::string canonical = fs::weakly_canonical(fs::absolute(root, ec), ec).string();
+  if (ec) {
+    return;
+  }
+
+  stopping_ = false;
+  thread_ = std::thread([this, canonical]() { Run(canonical); });
+}
+
+void FileWatcher::Stop() {
+  {
+    std::lock_guard<std::mutex> lock(stop_mutex_);
+    stopping_ = true;
+  }
+  stop_cv_.notify_all();
+#ifdef __linux__
+  if (wake_fd_ >= 0) {
+    uint64_t one = 1;
+    ssize_t written = write(wake_fd_, &one, sizeof(one));
+    (void)written;
+  }
+#endif
+
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+
+#ifdef __linux__
+  // Drain the wake-up so the next Start begins clean
+  if (wake_fd_ >= 0) {
+    uint64_t value;
+    ssize_t drained = read(wake_fd_, &value, sizeof(value));
+    (void)drained;
+  }
+#endif
+}
+
+size_t FileWatcher::Subscribe(Listener listener) {
+  std::lock_guard<std::mutex> lock(listeners_mutex_);
+  size_t id = next_listener_id_++;
+  listeners_[id] = std::move(listener);
+  return id;
+}
+
+void FileWatcher::Unsubscribe(size_t id) {
+  std::lock_guard<std::mutex> lock(listeners_mutex_);
+  listeners_.erase(id);
+}
+
+void FileWatcher::Publish(const ChangeBatch &batch) {
+  std::vector<Listener> listeners;
+  {
+    std::lock_guard<std::mutex> lock(listeners_mutex_);
+    for (const auto &entry : listeners_) {
+      listeners.push_back(entry.second);
+    }
+  }
+  for (const auto &listener : listeners) {
+    listener(batch);
+  }
+}
+
+bool FileWatcher::WaitForStop(int ms) {
+  std::unique_lock<std::mutex> lock(stop_mutex_);
+  return stop_cv_.wait_for(lock, std::chrono::milliseconds(ms),
+                           [this]() { return stopping_.load(); });
+}
+
+void FileWatcher::Run(const std::string &root) {
+  if (!RunInotify(root) && !stopping_) {
+    RunPolling(root);
+  }
+  native_ = false;
+}
+
+#ifdef __linux__
+bool FileWatcher::RunInotify(const std::string &root) {
+  int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (fd < 0 || wake_fd_ < 0) {
+    if (fd >= 0) close(fd);
+    return false;
+  }
+
+  constexpr uint32_t WATCH_MASK = IN_CREATE | IN_MODIFY | IN_CLOSE_WRITE | IN_DELETE |
+                                  IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF |
+                                  IN_ONLYDIR;
+  std::unordered_map<int, std::string> watch_paths;
+  PendingChanges pending;
+
+  // Watch dir and every directory below it. With report_files, files found
+  // are queued as modified (a directory that was created or moved in).
+  auto watch_tree = [&](const std::string &dir, bool report_files) {
+    std::vector<std::string> stack = {dir};
+    while (!stack.empty() && !stopping_) {
+      std::string current = stack.back();
+      stack.pop_back();
+
+      int wd = inotify_add_watch(fd, current.c_str(), WATCH_MASK);
+      if (wd < 0) {
+        if (errno == ENOSPC || errno == ENOMEM) {
+          return false; // Out of watches: the tree is too large for inotify
+        }
+        continue;
+      }
+      watch_paths[wd] = current;
+
+      std::error_code ec;
+      for (fs::directory_iterator it(current, fs::directory_options::skip_permission_denied, ec), end;
+           it != end && !ec; it.increment(ec)) {
+        std::error_code entry_ec;
+        if (it->is_directory(entry_ec) && !it->is_symlink(entry_ec)) {
+          if (!DirWalker::IsSkippedDirectory(it->path().string())) {
+            stack.push_back(it->path().string());
+          }
+        } else if (report_files && it->is_regular_file(entry_ec)) {
+          pending.Add(it->path().string(), false);
+        }
+      }
+    }
+    return true;
+  };
+
+  if (!watch_tree(root, false)) {
+    close(fd);
+    return false;
+  }
+  native_ = true;
+
+  alignas(struct inotify_event) char buffer[64 * 1024];
+  while (!stopping_) {
+    pollfd fds[2] = {{fd, POLLIN, 0}, {wake_fd_, POLLIN, 0}};
+    int timeout = pending.Empty() ? -1 : pending.MillisecondsUntilFlush();
+    int ready = poll(fds, 2, timeout);
+    if (stopping_) {
+      break;
+    }
+    if (ready < 0 && errno != EINTR) {
+      break;
+    }
+
+    if (ready > 0 && (fds[0].revents & POLLIN)) {
+      ssize_t length;
+      while ((length = read(fd, buffer, sizeof(buffer))) > 0) {
+        for (char *p = buffer; p < buffer + length;) {
+          const inotify_event *event = reinterpret_cast<const inotify_event *>(p);
+          p += sizeof(inotify_event) + event->len;
+
+          if (event->mask & IN_Q_OVERFLOW) {
+            pending.SetOverflow();
+            continue;
+          }
+          if (event->mask & (IN_DELETE_SELF | IN_IGNORED)) {
+            watch_paths.erase(event->wd);
+            continue;
+          }
+
+          auto dir = watch_paths.find(event->wd);
+          if (dir == watch_paths.end() || event->len == 0) {
+            continue;
+          }
+          std::string path = dir->second + "/" + event->name;
+          bool removed = (event->mask & (IN_DELETE | IN_MOVED_FROM)) != 0;
+
+          if (event->mask & IN_ISDIR) {
+            if (DirWalker::IsSkippedDirectory(path)) {
+              continue;
+            }
+            if (removed) {
+              pending.Add(path, true);
+            } else if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
+              if (!watch_tree(path, true)) {
+                pending.SetOverflow(); // Lost coverage; let the index resync
+              }
+            }
+            continue;
+          }
+          pending.Add(path, removed);
+        }
+      }
+    }
+
+    if (!pending.Empty() && pending.MillisecondsUntilFlush() == 0) {
+      Publish(pending.Take());
+    }
+  }
+
+  close(fd);
+  return true;
+}
+#else
+bool FileWatcher::RunInotify(const std::string &) { return false; }
+#endif
+
+void FileWatcher::RunPolling(const std::string &root) {
+  struct Stamp {
+    fs::file_time_type mtime;
+    uintmax_t size;
+  };
+
+  auto scan = [&](std::unordered_map<std::string, Stamp> &files) {
+    std::error_code ec;
+    for (fs::recursive_directory_iterator it(root, fs::directory_options::skip_permission_denied, ec), end;
+         it != end && !ec && !stopping_; it.increment(ec)) {
+      std::error_code entry_ec;
+      if (it->is_directory(entry_ec)) {
+        if (DirWalker::IsSkippedDirectory(it->path().string())) {
+          it.disable_recursion_pending();
+        }
+      } else if (it->is_regular_file(entry_ec)) {
+        Stamp stamp = {it->last_write_time(entry_ec), it->file_size(entry_ec)};
+        if (!entry_ec) {
+          files[it->path().string()] = stamp;
+        }
+      }
+    }
+  };
+
+  std::unordered_map<std::string, Stamp> known;
+  scan(known);
+
+  while (!WaitForStop(SCAN_INTERVAL_MS)) {
+    std::unordered_map<std::string, Stamp> current;
+    scan(current);
+    if (stopping_) {
+      break;
+    }
+
+    ChangeBatch batch;
+    for (const auto &entry : current) {
+      auto old = known.find(entry.first);
+      if (old == known.end() || old->second.mtime != entry.second.mtime ||
+          old->second.size != entry.second.size) {
+        batch.modified.push_back(entry.first);
+      }
+    }
+    for (const auto &entry : known) {
+      if (current.find(entry.first) == current.end()) {
+        batch.removed.push_back(entry.first);
+      }
+    }
+    known.swap(current);
+
+    if (!batch.modified.empty() || !batch.removed.empty()) {
+      Publish(batch);
+    }
+  }
+}
+
+} // namespace tools
+} // namespace zweek
@@ -0,0 +1,242 @@
+#include "tools/line_index.hpp"
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define ZWEEK_LINES_SSE2 1
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace zweek {
+namespace tools {
+
+namespace fs = std::filesystem;
+
+namespace {
+
+constexpr size_t BUILD_CHUNK_BYTES = 1u << 20; // Read buffer while indexing
+constexpr size_t SCAN_CHUNK_BYTES = 64 * 1024; // Read buffer for a line lookup
+
+#ifdef ZWEEK_LINES_SSE2
+unsigned PopCount(unsigned mask) {
+#ifdef _MSC_VER
+  return static_cast<unsigned>(__popcnt(mask));
+#else
+  return static_cast<unsigned>(__builtin_popcount(mask));
+#endif
+}
+
+unsigned CountTrailingZeros(unsigned mask) {
+#ifdef _MSC_VER
+  unsigned long index;
+  _BitScanForward(&index, mask);
+  return static_cast<unsigned>(index);
+#else
+  return static_cast<unsigned>(__builtin_ctz(mask));
+#endif
+}
+#endif
+
+// Records a checkpoint after every LINES_PER_CHECKPOINT-th newline
+struct CheckpointWriter {
+  std::vector<uint64_t> &checkpoints;
+  uint32_t since_checkpoint = 0;
+  uint64_t newlines = 0;
+
+  void Newline(uint64_t offset) {
+    ++newlines;
+    if (++since_checkpoint == LineIndex::LINES_PER_CHECKPOINT) {
+      checkpoints.push_back(offset + 1);
+      since_checkpoint = 0;
+    }
+  }
+
+  void Scan(const char *data, size_t size, uint64_t base) {
+    size_t i = 0;
+#ifdef ZWEEK_LINES_SSE2
+    const __m128i newline = _mm_set1_epi8('\n');
+    for (; i + 16 <= size; i += 16) {
+      __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+      unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(block, newline)));
+      if (!mask) {
+        continue;
+      }
+      unsigned count = PopCount(mask);
+      if (since_checkpoint + count < LineIndex::LINES_PER_CHECKPOINT) {
+        since_checkpoint += count; // No checkpoint in this block
+        newlines += count;
+        continue;
+      }
+      while (mask) {
+        Newline(base + i + CountTrailingZeros(mask));
+        mask &= mask - 1;
+      }
+    }
+#endif
+    for (; i < size; ++i) {
+      if (data[i] == '\n') {
+        Newline(base + i);
+      }
+    }
+  }
+};
+
+} // namespace
+
+size_t LineIndex::CountNewlines(const char *data, size_t size) {
+  size_t count = 0;
+  size_t i = 0;
+#ifdef ZWEEK_LINES_SSE2
+  // Per-byte counters (cmpeq gives -1 per hit) summed with SAD every 255
+  // blocks, before any of them can wrap
+  const __m128i newline = _mm_set1_epi8('\n');
+  const __m128i zero = _mm_setzero_si128();
+  while (i + 16 <= size) {
+    __m128i counters = _mm_setzero_si128();
+    size_t blocks = std::min<size_t>((size - i) / 16, 255);
+    for (size_t b = 0; b < blocks; ++b, i += 16) {
+      __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+      counters = _mm_sub_epi8(counters, _mm_cmpeq_epi8(block, newline));
+    }
+    __m128i sums = _mm_sad_epu8(counters, zero);
+    count += static_cast<size_t>(_mm_cvtsi128_si32(sums)) +
+             static_cast<size_t>(_mm_cvtsi128_si32(_mm_srli_si128(sums, 8)));
+  }
+#endif
+  return count + static_cast<size_t>(std::count(data + i, data + size, '\n'));
+}
+
+std::shared_ptr<const LineIndex> LineIndex::Build(const std::string &path) {
+  std::error_code ec;
+  auto mtime = fs::last_write_time(path, ec);
+  if (ec) {
+    return nullptr;
+  }
+  std::ifstream in(path, std::ios::binary);
+  if (!in.is_open()) {
+    return nullptr;
+  }
+
+  auto index = std::make_shared<LineIndex>();
+  index->mtime_ = static_cast<int64_t>(mtime.time_since_epoch().count());
+  index->checkpoints_.push_back(0);
+  CheckpointWriter writer{index->checkpoints_};
+
+  std::vector<char> buffer(BUILD_CHUNK_BYTES);
+  uint64_t offset = 0;
+  char last_byte = '\n';
+  while (in) {
+    in.read(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+    size_t got = static_cast<size_t>(in.gcount());
+    if (got == 0) {
+      break;
+    }
+    writer.Scan(buffer.data(), got, offset);
+    offset += got;
+    last_byte = buffer[got - 1];
+  }
+
+  index->size_ = offset;
+  // A final line without a newline still counts
+  index->line_count_ = writer.newlines + (last_byte != '\n' ? 1 : 0);
+  if (index->checkpoints_.back() == offset && offset > 0) {
+    index->checkpoints_.pop_back(); // Start of the empty line after the last newline
+  }
+  index->checkpoints_.shrink_to_fit();
+  return index;
+}
+
+bool LineIndex::LineRange(const std::string &path, uint32_t first, uint32_t last,
+                          uint64_t &begin, uint64_t &end) const {
+  first = std::max<uint32_t>(first, 1);
+  if (first > line_count_ || last < first) {
+    return false;
+  }
+  last = static_cast<uint32_t>(std::min<uint64_t>(last, line_count_));
+
+  const size_t block = (first - 1) / LINES_PER_CHECKPOINT;
+  uint64_t offset = checkpoints_[block];
+  uint64_t skip = (first - 1) % LINES_PER_CHECKPOINT; // Newlines before first
+  uint64_t need = skip + (last - first + 1);           // Newlines through last
+
+  std::ifstream in(path, std::ios::binary);
+  if (!in.is_open()) {
+    return false;
+  }
+  in.seekg(static_cast<std::streamoff>(offset));
+
+  begin = skip == 0 ? offset : size_;
+  end = size_;
+  uint64_t seen = 0;
+  std::vector<char> buffer(SCAN_CHUNK_BYTES);
+  while (seen < need && in) {
+    in.read(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+    size_t got = static_cast<size_t>(in.gcount());
+    if (got == 0) {
+      break;
+    }
+    const char *p = buffer.data();
+    const char *stop = p + got;
+    while (seen < need) {
+      const char *hit = static_cast<const char *>(std::memchr(p, '\n', stop - p));
+      if (!hit) {
+        break;
+      }
+      ++seen;
+      uint64_t after = offset + static_cast<uint64_t>(hit - buffer.data()) + 1;
+      if (seen == skip) {
+        begin = after;
+      }
+      if (seen == need) {
+        end = after;
+      }
+      p = hit + 1;
+    }
+    offset += got;
+  }
+  return begin <= end;
+}
+
+bool ReadFileRange(const std::string &path, uint64_t offset, size_t length,
+                   std::string &out) {
+  out.clear();
+  std::ifstream in(path, std::ios::binary | std::ios::ate);
+  if (!in.is_open()) {
+    return false;
+  }
+  uint64_t size = static_cast<uint64_t>(in.tellg());
+  if (offset >= size) {
+    return true;
+  }
+  length = static_cast<size_t>(std::min<uint64_t>(length, size - offset));
+  in.seekg(static_cast<std::streamoff>(offset));
+  out.resize(length);
+  in.read(&out[0], static_cast<std::streamsize>(length));
+  out.resize(static_cast<size_t>(in.gcount()));
+  return true;
+}
+
+bool ForEachFileChunk(const std::string &path, size_t chunk_bytes,
+                      const std::function<bool(std::string_view)> &visitor) {
+  std::ifstream in(path, std::ios::binary);
+  if (!in.is_open()) {
+    return false;
+  }
+  std::vector<char> buffer(std::max<size_t>(chunk_bytes, 1));
+  while (in) {
+    in.read(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+    size_t got = static_cast<size_t>(in.gcount());
+    if (got == 0 || !visitor(std::string_view(buffer.data(), got))) {
+      break;
+    }
+  }
+  return true;
+}
+
+} // namespace tools
+} // namespace zweek
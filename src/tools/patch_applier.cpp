@@ -0,0 +1,452 @@
+#include "tools/patch_applier.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <map>
+#include <unordered_map>
+
+namespace zweek {
+namespace tools {
+
+namespace {
+
+constexpr size_t MIN_HASHED_SNIPPET = 16; // Shorter snippets are searched for directly
+constexpr size_t MIN_ANCHOR_WIDTH = 4;
+constexpr size_t MAX_ANCHOR_WIDTH = 32;
+constexpr size_t ANCHORS_PER_SNIPPET = 5; // Spread evenly from start to end
+constexpr size_t MAX_ANCHOR_HITS = 16;    // A window seen more often is not selective
+constexpr uint64_t HASH_BASE = 1099511628211ULL;
+constexpr size_t BLOOM_BITS = 1u << 16;
+constexpr uint32_t INF = UINT32_MAX / 2;
+
+bool IsSpace(char c) {
+  return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f' || c == '\v';
+}
+
+// Text with every whitespace run collapsed to one space and the ends
+// trimmed, plus where each byte came from
+struct Collapsed {
+  std::string text;
+  std::vector<uint32_t> offsets; // Only for the target text
+};
+
+Collapsed Collapse(std::string_view s, bool with_offsets) {
+  Collapsed out;
+  out.text.reserve(s.size());
+  if (with_offsets) {
+    out.offsets.reserve(s.size());
+  }
+  bool pending_space = false;
+  size_t space_at = 0;
+  for (size_t i = 0; i < s.size(); ++i) {
+    if (IsSpace(s[i])) {
+      if (!out.text.empty() && !pending_space) {
+        pending_space = true;
+        space_at = i;
+      }
+      continue;
+    }
+    if (pending_space) {
+      out.text.push_back(' ');
+      if (with_offsets) {
+        out.offsets.push_back(static_cast<uint32_t>(space_at));
+      }
+      pending_space = false;
+    }
+    out.text.push_back(s[i]);
+    if (with_offsets) {
+      out.offsets.push_back(static_cast<uint32_t>(i));
+    }
+  }
+  return out;
+}
+
+uint64_t HashWindow(const char *p, size_t width) {
+  uint64_t h = 0;
+  for (size_t i = 0; i < width; ++i) {
+    h = h * HASH_BASE + static_cast<unsigned char>(p[i]);
+  }
+  return h;
+}
+
+struct Anchor {
+  size_t edit;
+  size_t offset; // Position of the window inside the snippet
+  size_t hits;
+};
+
+struct Match {
+  bool found = false;
+  bool ambiguous = false;
+  size_t begin = 0; // In collapsed text
+  size_t end = 0;
+  size_t distance = 0;
+};
+
+// Best semi-global alignment of pattern against text near start: the
+// whole pattern must be used, the text span is free to begin within
+// max_distance of start. Banded to |drift| <= max_distance, so the cost is
+// linear in the pattern length.
+bool BandedMatch(const std::string &text, size_t start, const std::string &pattern,
+                 size_t max_distance, Match &out) {
+  const size_t k = max_distance;
+  const size_t l = pattern.size();
+  const size_t ws = start > k ? start - k : 0;
+  const size_t we = std::min(text.size(), start + l + k);
+  if (we <= ws) {
+    return false;
+  }
+  const char *t = text.data() + ws;
+  const size_t m = we - ws;
+  const size_t d0 = start - ws; // Expected diagonal
+
+  std::vector<uint32_t> prev(m + 1, INF), cur(m + 1, INF);
+  std::vector<uint32_t> prev_origin(m + 1, 0), cur_origin(m + 1, 0);
+  auto band = [&](size_t i, size_t &lo, size_t &hi) {
+    lo = i + d0 > k ? i + d0 - k : 0;
+    hi = std::min(m, i + d0 + k);
+  };
+
+  size_t lo = 0, hi = 0;
+  band(0, lo, hi);
+  for (size_t j = lo; j <= hi; ++j) {
+    prev[j] = 0;
+    prev_origin[j] = static_cast<uint32_t>(j);
+  }
+  size_t prev_lo = lo, prev_hi = hi;
+  for (size_t i = 1; i <= l; ++i) {
+    band(i, lo, hi);
+    if (lo > hi) {
+      return false;
+    }
+    uint32_t row_min = INF;
+    for (size_t j = lo; j <= hi; ++j) {
+      uint32_t best = INF;
+      uint32_t origin = 0;
+      if (j >= 1 && j - 1 >= prev_lo && j - 1 <= prev_hi && prev[j - 1] < INF) {
+        best = prev[j - 1] + (pattern[i - 1] != t[j - 1] ? 1 : 0);
+        origin = prev_origin[j - 1];
+      }
+      if (j >= prev_lo && j <= prev_hi && prev[j] + 1 < best) {
+        best = prev[j] + 1; // Pattern character missing from the text
+        origin = prev_origin[j];
+      }
+      if (j > lo && cur[j - 1] + 1 < best) {
+        best = cur[j - 1] + 1; // Extra text character
+        origin = cur_origin[j - 1];
+      }
+      cur[j] = best;
+      cur_origin[j] = origin;
+      row_min = std::min(row_min, best);
+    }
+    if (row_min > k) {
+      return false;
+    }
+    for (size_t j = prev_lo; j <= prev_hi; ++j) {
+      prev[j] = INF;
+    }
+    std::swap(prev, cur);
+    std::swap(prev_origin, cur_origin);
+    prev_lo = lo;
+    prev_hi = hi;
+  }
+
+  uint32_t best = INF;
+  size_t best_j = 0;
+  for (size_t j = prev_lo; j <= prev_hi; ++j) {
+    if (prev[j] < best && j > prev_origin[j]) {
+      best = prev[j];
+      best_j = j;
+    }
+  }
+  if (best > k) {
+    return false;
+  }
+  out.found = true;
+  out.begin = ws + prev_origin[best_j];
+  out.end = ws + best_j;
+  out.distance = best;
+  return true;
+}
+
+// Leading whitespace of the first non-blank line
+std::string_view FirstIndent(std::string_view s) {
+  size_t line = 0;
+  while (line < s.size()) {
+    size_t i = line;
+    while (i < s.size() && (s[i] == ' ' || s[i] == '\t')) {
+      ++i;
+    }
+    if (i < s.size() && s[i] != '\n' && s[i] != '\r') {
+      return s.substr(line, i - line);
+    }
+    size_t newline = s.find('\n', line);
+    if (newline == std::string_view::npos) {
+      break;
+    }
+    line = newline + 1;
+  }
+  return {};
+}
+
+// new_content re-indented from the snippet's indentation to the file's,
+// without the surrounding whitespace the match itself excludes
+std::string BuildReplacement(const SnippetEdit &edit, std::string_view file_indent,
+                             bool reindent) {
+  std::string_view content = edit.new_content;
+  std::string out;
+  std::string_view snippet_indent = FirstIndent(edit.original_snippet);
+  if (reindent && snippet_indent != file_indent) {
+    size_t line = 0;
+    while (line <= content.size()) {
+      size_t newline = content.find('\n', line);
+      size_t end = newline == std::string_view::npos ? content.size() : newline + 1;
+      std::string_view text = content.substr(line, end - line);
+      if (text.substr(0, snippet_indent.size()) == snippet_indent) {
+        out.append(file_indent);
+        text.remove_prefix(snippet_indent.size());
+      }
+      out.append(text);
+      if (newline == std::string_view::npos) {
+        break;
+      }
+      line = end;
+    }
+  } else {
+    out.assign(content);
+  }
+
+  size_t first = 0;
+  while (first < out.size() && IsSpace(out[first])) {
+    ++first;
+  }
+  size_t last = out.size();
+  while (last > first && IsSpace(out[last - 1])) {
+    --last;
+  }
+  return out.substr(first, last - first);
+}
+
+} // namespace
+
+const char *PatchApplier::StatusName(PatchStatus status) {
+  switch (status) {
+  case PatchStatus::Applied:
+    return "applied";
+  case PatchStatus::AppliedFuzzy:
+    return "applied (fuzzy)";
+  case PatchStatus::NotFound:
+    return "snippet not found";
+  case PatchStatus::Ambiguous:
+    return "snippet matches more than one place";
+  case PatchStatus::Conflict:
+    return "overlaps an earlier edit";
+  }
+  return "";
+}
+
+PatchResult PatchApplier::Apply(std::string_view text, const std::vector<SnippetEdit> &edits,
+                                const PatchOptions &options) {
+  PatchResult result;
+  result.outcomes.resize(edits.size());
+
+  Collapsed target = Collapse(text, true);
+  std::vector<std::string> snippets;
+  snippets.reserve(edits.size());
+  // Windows a quarter of the shortest snippet wide, so one typo spoils at
+  // most two of the five anchors
+  size_t width = MAX_ANCHOR_WIDTH;
+  for (const auto &edit : edits) {
+    snippets.push_back(Collapse(edit.original_snippet, false).text);
+    if (snippets.back().size() >= MIN_HASHED_SNIPPET) {
+      width = std::min(width, std::max(MIN_ANCHOR_WIDTH, snippets.back().size() / 4));
+    }
+  }
+
+  // Anchor windows of every snippet, behind a bloom filter so most text
+  // positions cost one bit test
+  std::unordered_map<uint64_t, std::vector<Anchor>> anchors;
+  std::vector<uint64_t> bloom(BLOOM_BITS / 64, 0);
+  for (size_t e = 0; e < snippets.size(); ++e) {
+    const std::string &snippet = snippets[e];
+    if (snippet.size() < MIN_HASHED_SNIPPET) {
+      continue;
+    }
+    size_t span = snippet.size() - width;
+    size_t last_offset = SIZE_MAX;
+    for (size_t a = 0; a < ANCHORS_PER_SNIPPET; ++a) {
+      size_t offset = span * a / (ANCHORS_PER_SNIPPET - 1);
+      if (offset == last_offset) {
+        continue;
+      }
+      last_offset = offset;
+      uint64_t h = HashWindow(snippet.data() + offset, width);
+      anchors[h].push_back({e, offset, 0});
+      size_t bit = static_cast<size_t>(h >> 48) % BLOOM_BITS;
+      bloom[bit / 64] |= 1ULL << (bit % 64);
+    }
+  }
+
+  // One rolling-hash pass collects candidate start positions for all edits
+  std::vector<std::vector<size_t>> candidates(edits.size());
+  const std::string &haystack = target.text;
+  if (!anchors.empty() && haystack.size() >= width) {
+    uint64_t power = 1;
+    for (size_t i = 1; i < width; ++i) {
+      power *= HASH_BASE;
+    }
+    uint64_t h = HashWindow(haystack.data(), width);
+    for (size_t i = 0;; ++i) {
+      size_t bit = static_cast<size_t>(h >> 48) % BLOOM_BITS;
+      if (bloom[bit / 64] & (1ULL << (bit % 64))) {
+        auto it = anchors.find(h);
+        if (it != anchors.end()) {
+          for (Anchor &anchor : it->second) {
+            if (++anchor.hits <= MAX_ANCHOR_HITS) {
+              candidates[anchor.edit].push_back(i > anchor.offset ? i - anchor.offset : 0);
+            }
+          }
+        }
+      }
+      if (i + width >= haystack.size()) {
+        break;
+      }
+      h = (h - static_cast<unsigned char>(haystack[i]) * power) * HASH_BASE +
+          static_cast<unsigned char>(haystack[i + width]);
+    }
+  }
+
+  // Verify: exact first, then the banded edit distance
+  std::map<size_t, size_t> taken; // Accepted byte ranges, begin -> end
+  std::vector<std::string> replacements(edits.size());
+  for (size_t e = 0; e < edits.size(); ++e) {
+    PatchOutcome &outcome = result.outcomes[e];
+    const std::string &snippet = snippets[e];
+    auto &starts = candidates[e];
+    if (!snippet.empty() && snippet.size() < MIN_HASHED_SNIPPET) {
+      // Too short to anchor or to match fuzzily; the first two hits tell
+      // unique from ambiguous
+      size_t first = haystack.find(snippet);
+      if (first != std::string::npos) {
+        starts.push_back(first);
+        size_t second = haystack.find(snippet, first + 1);
+        if (second != std::string::npos) {
+          starts.push_back(second);
+        }
+      }
+    }
+    std::sort(starts.begin(), starts.end());
+    starts.erase(std::unique(starts.begin(), starts.end()), starts.end());
+    if (snippet.empty() || starts.empty()) {
+      continue;
+    }
+
+    Match match;
+    for (size_t start : starts) {
+      if (haystack.compare(start, snippet.size(), snippet) == 0) {
+        if (match.found && start != match.begin) {
+          match.ambiguous = true;
+          break;
+        }
+        match = {true, false, start, start + snippet.size(), 0};
+      }
+    }
+    if (!match.found && snippet.size() >= MIN_HASHED_SNIPPET) {
+      size_t max_distance = std::min(
+          options.max_distance,
+          std::max<size_t>(1, static_cast<size_t>(snippet.size() * options.max_error_rate)));
+      for (size_t start : starts) {
+        Match candidate;
+        if (!BandedMatch(haystack, start, snippet, max_distance, candidate)) {
+          continue;
+        }
+        if (!match.found || candidate.distance < match.distance) {
+          match = candidate;
+        } else if (candidate.distance == match.distance &&
+                   (candidate.end <= match.begin || candidate.begin >= match.end)) {
+          match.ambiguous = true; // Same score somewhere else
+        }
+      }
+    }
+    if (match.ambiguous) {
+      outcome.status = PatchStatus::Ambiguous;
+      continue;
+    }
+    if (!match.found) {
+      continue;
+    }
+
+    // Back to byte offsets, dropping collapsed spaces at the edges
+    size_t cb = match.begin, ce = match.end;
+    while (cb < ce && haystack[cb] == ' ') {
+      ++cb;
+    }
+    while (ce > cb && haystack[ce - 1] == ' ') {
+      --ce;
+    }
+    if (cb == ce) {
+      continue;
+    }
+    size_t begin = target.offsets[cb];
+    size_t end = target.offsets[ce - 1] + 1;
+
+    size_t line_start = text.rfind('\n', begin == 0 ? 0 : begin - 1);
+    line_start = (line_start == std::string_view::npos || begin == 0) ? 0 : line_start + 1;
+    std::string_view lead = text.substr(line_start, begin - line_start);
+    bool starts_line = lead.find_first_not_of(" \t") == std::string_view::npos;
+    // Mid-line, the snippet's first line carries no indentation to map
+    // from, so its lines are left as written
+    std::string replacement =
+        BuildReplacement(edits[e], lead, options.reindent && starts_line);
+
+    // A deletion of whole lines takes the lines with it
+    if (replacement.empty() && starts_line) {
+      size_t after = end;
+      while (after < text.size() && (text[after] == ' ' || text[after] == '\t' || text[after] == '\r')) {
+        ++after;
+      }
+      if (after == text.size() || text[after] == '\n') {
+        begin = line_start;
+        end = after < text.size() ? after + 1 : after;
+      }
+    }
+
+    auto next = taken.lower_bound(begin);
+    bool overlaps = (next != taken.end() && next->first < end) ||
+                    (next != taken.begin() && std::prev(next)->second > begin);
+    if (overlaps) {
+      outcome.status = PatchStatus::Conflict;
+      continue;
+    }
+    taken[begin] = end;
+    outcome.status = match.distance == 0 ? PatchStatus::Applied : PatchStatus::AppliedFuzzy;
+    outcome.begin = begin;
+    outcome.end = end;
+    outcome.distance = match.distance;
+    replacements[e] = std::move(replacement);
+    ++result.n_applied;
+  }
+
+  // Splice everything in one pass, in text order
+  std::vector<size_t> order;
+  for (size_t e = 0; e < edits.size(); ++e) {
+    PatchStatus status = result.outcomes[e].status;
+    if (status == PatchStatus::Applied || status == PatchStatus::AppliedFuzzy) {
+      order.push_back(e);
+    }
+  }
+  std::sort(order.begin(), order.end(), [&](size_t x, size_t y) {
+    return result.outcomes[x].begin < result.outcomes[y].begin;
+  });
+  size_t cursor = 0;
+  result.text.reserve(text.size());
+  for (size_t e : order) {
+    result.text.append(text.substr(cursor, result.outcomes[e].begin - cursor));
+    result.text.append(replacements[e]);
+    cursor = result.outcomes[e].end;
+  }
+  result.text.append(text.substr(cursor));
+  return result;
+}
+
+} // namespace tools
+} // namespace zweek
@@ -0,0 +1,551 @@
+#include "tools/search_engine.hpp"
+#include "util/mapped_file.hpp"
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <regex>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define ZWEEK_SEARCH_SSE2 1
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace zweek {
+namespace tools {
+
+namespace fs = std::filesystem;
+
+namespace {
+
+constexpr uintmax_t MAX_SEARCH_FILE_BYTES = 64ull << 20;
+constexpr size_t MMAP_MIN_BYTES = 64 * 1024; // Below this a plain read beats mapping
+constexpr size_t MAX_LINE_DISPLAY = 200;
+constexpr size_t MIN_REQUIRED_LITERAL = 2;
+constexpr size_t FILES_PER_TASK = 64;
+
+// Filler words of search requests ("find all usages of X in the code")
+const char *REQUEST_STOPWORDS[] = {
+    "a",        "all",        "an",         "and",       "any",        "are",
+    "at",       "by",         "call",       "called",    "calls",      "can",
+    "code",     "codebase",   "contain",    "containing", "contains",  "define",
+    "defined",  "do",         "does",       "each",      "every",      "file",
+    "files",    "find",       "for",        "from",      "get",        "give",
+    "grep",     "here",       "how",        "i",         "in",         "instance",
+    "instances", "is",        "it",         "its",       "line",       "lines",
+    "list",     "locate",     "look",       "me",        "mention",    "mentions",
+    "my",       "occurrence", "occurrences", "of",       "on",         "or",
+    "our",      "please",     "project",    "reference", "references", "repo",
+    "repository", "search",   "show",       "that",      "the",        "there",
+    "this",     "to",         "usage",      "usages",    "use",        "used",
+    "uses",     "was",        "we",         "what",      "where",      "which",
+    "with",     "you"};
+
+char Lower(char c) { return static_cast<char>(std::tolower(static_cast<unsigned char>(c))); }
+char Upper(char c) { return static_cast<char>(std::toupper(static_cast<unsigned char>(c))); }
+
+std::string ToLower(std::string text) {
+  std::transform(text.begin(), text.end(), text.begin(), Lower);
+  return text;
+}
+
+bool HasUpper(const std::string &text) {
+  return std::any_of(text.begin(), text.end(),
+                     [](unsigned char c) { return std::isupper(c) != 0; });
+}
+
+// needle is lowercase when ignore_case
+bool Equal(const char *p, const std::string &needle, bool ignore_case) {
+  if (!ignore_case) {
+    return std::memcmp(p, needle.data(), needle.size()) == 0;
+  }
+  for (size_t i = 0; i < needle.size(); ++i) {
+    if (Lower(p[i]) != needle[i]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+#ifdef ZWEEK_SEARCH_SSE2
+unsigned CountTrailingZeros(unsigned mask) {
+#ifdef _MSC_VER
+  unsigned long index;
+  _BitScanForward(&index, mask);
+  return static_cast<unsigned>(index);
+#else
+  return static_cast<unsigned>(__builtin_ctz(mask));
+#endif
+}
+#endif
+
+// First occurrence of needle in [begin, end), or null
+const char *FindLiteral(const char *begin, const char *end, const std::string &needle,
+                        bool ignore_case) {
+  const size_t n = needle.size();
+  if (n == 0) {
+    return begin;
+  }
+  if (static_cast<size_t>(end - begin) < n) {
+    return nullptr;
+  }
+
+  const char *p = begin;
+#ifdef ZWEEK_SEARCH_SSE2
+  // Test 16 candidate positions at once on the needle's first and last
+  // bytes (both cases); only positions where both agree are compared fully
+  const char first = needle[0];
+  const char last = needle[n - 1];
+  const __m128i first_a = _mm_set1_epi8(first);
+  const __m128i first_b = _mm_set1_epi8(ignore_case ? Upper(first) : first);
+  const __m128i last_a = _mm_set1_epi8(last);
+  const __m128i last_b = _mm_set1_epi8(ignore_case ? Upper(last) : last);
+  for (; p + n - 1 + 16 <= end; p += 16) {
+    __m128i head = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+    __m128i tail = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + n - 1));
+    __m128i hits = _mm_and_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(head, first_a), _mm_cmpeq_epi8(head, first_b)),
+        _mm_or_si128(_mm_cmpeq_epi8(tail, last_a), _mm_cmpeq_epi8(tail, last_b)));
+    unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(hits));
+    while (mask) {
+      const char *candidate = p + CountTrailingZeros(mask);
+      if (Equal(candidate, needle, ignore_case)) {
+        return candidate;
+      }
+      mask &= mask - 1;
+    }
+  }
+#endif
+
+  const char *last_start = end - n;
+  if (!ignore_case) {
+    while (p <= last_start) {
+      p = static_cast<const char *>(std::memchr(p, needle[0], static_cast<size_t>(last_start - p) + 1));
+      if (!p) {
+        return nullptr;
+      }
+      if (std::memcmp(p, needle.data(), n) == 0) {
+        return p;
+      }
+      ++p;
+    }
+    return nullptr;
+  }
+  for (; p <= last_start; ++p) {
+    if (Equal(p, needle, true)) {
+      return p;
+    }
+  }
+  return nullptr;
+}
+
+// What a file is matched against
+struct Matcher {
+  std::string literal; // The pattern, or the regex's required literal
+  bool ignore_case = false;
+  bool use_regex = false;
+  std::regex regex;
+};
+
+// Matching lines of a buffer, at most max_lines
+void SearchBuffer(const char *data, size_t size, const Matcher &matcher, size_t max_lines,
+                  std::vector<LineMatch> &out) {
+  const char *end = data + size;
+  const char *p = data; // Always at a line start
+  const char *counted = data;
+  uint32_t line = 1;
+
+  while (p < end && out.size() < max_lines) {
+    const char *line_start = p;
+    const char *line_end;
+    if (!matcher.literal.empty()) {
+      // Jump straight to the next line with the literal
+      const char *hit = FindLiteral(p, end, matcher.literal, matcher.ignore_case);
+      if (!hit) {
+        break;
+      }
+      line_start = hit;
+      while (line_start > p && line_start[-1] != '\n') {
+        --line_start;
+      }
+      line_end = static_cast<const char *>(std::memchr(hit, '\n', static_cast<size_t>(end - hit)));
+    } else {
+      line_end = static_cast<const char *>(std::memchr(p, '\n', static_cast<size_t>(end - p)));
+    }
+    if (!line_end) {
+      line_end = end;
+    }
+
+    if (!matcher.use_regex || std::regex_search(line_start, line_end, matcher.regex)) {
+      line += static_cast<uint32_t>(std::count(counted, line_start, '\n'));
+      counted = line_start;
+
+      const char *text_end = line_end;
+      if (text_end > line_start && text_end[-1] == '\r') {
+        --text_end;
+      }
+      size_t length = std::min(static_cast<size_t>(text_end - line_start), MAX_LINE_DISPLAY);
+      out.push_back({line, std::string(line_start, length)});
+    }
+    p = line_end + 1;
+  }
+}
+
+void SearchFile(const std::string &path, uint64_t size, const Matcher &matcher,
+                size_t max_lines, std::vector<LineMatch> &out) {
+  if (size >= MMAP_MIN_BYTES) {
+    util::MappedFile file;
+    if (file.Open(path) && file.Data()) {
+      SearchBuffer(file.Data(), file.Size(), matcher, max_lines, out);
+    }
+    return;
+  }
+
+  thread_local std::string buffer;
+  buffer.resize(static_cast<size_t>(size));
+#ifdef _WIN32
+  std::FILE *file = std::fopen(path.c_str(), "rb");
+  if (!file) {
+    return;
+  }
+  size_t n = std::fread(&buffer[0], 1, buffer.size(), file);
+  std::fclose(file);
+#else
+  // Unbuffered: one read for the whole file, no stdio buffer to allocate
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return;
+  }
+  ssize_t got = read(fd, &buffer[0], buffer.size());
+  close(fd);
+  size_t n = got > 0 ? static_cast<size_t>(got) : 0;
+#endif
+  SearchBuffer(buffer.data(), n, matcher, max_lines, out);
+}
+
+WalkOptions SearchWalkOptions() {
+  WalkOptions options;
+  options.max_file_bytes = MAX_SEARCH_FILE_BYTES;
+  return options;
+}
+
+} // namespace
+
+SearchEngine::SearchEngine() : walker_(SearchWalkOptions()) {}
+
+SearchResult SearchEngine::Search(const std::string &root, const std::string &pattern,
+                                  const SearchOptions &options, const FileCallback &on_file,
+                                  const std::atomic<bool> *cancel) {
+  auto start = std::chrono::steady_clock::now();
+  SearchResult result;
+  if (pattern.empty() || options.max_matches == 0) {
+    return result;
+  }
+
+  auto matcher = std::make_shared<Matcher>();
+  matcher->ignore_case = options.ignore_case;
+  if (options.regex) {
+    auto flags = std::regex::ECMAScript | std::regex::optimize;
+    if (options.ignore_case) {
+      flags |= std::regex::icase;
+    }
+    try {
+      matcher->regex = std::regex(pattern, flags);
+    } catch (const std::regex_error &e) {
+      result.error = std::string("Invalid regex: ") + e.what();
+      return result;
+    }
+    matcher->use_regex = true;
+    matcher->literal = RequiredLiteral(pattern);
+  } else {
+    matcher->literal = pattern;
+  }
+  if (options.ignore_case) {
+    matcher->literal = ToLower(matcher->literal);
+  }
+
+  // Files are searched on the pool while the walk is still producing them,
+  // in batches so the hand-off cost is paid per batch rather than per file
+  std::atomic<bool> stop{false};
+  std::mutex results_mutex;
+  std::vector<std::future<void>> pending;
+  auto search_batch = [&](const std::vector<WalkEntry> &batch) {
+    for (const auto &entry : batch) {
+      if (stop || (cancel && *cancel)) {
+        return;
+      }
+      FileMatches file;
+      file.path = entry.path;
+      file.mtime = entry.mtime;
+      SearchFile((fs::path(root) / entry.path).string(), entry.size, *matcher,
+                 options.max_matches, file.lines);
+      if (file.lines.empty()) {
+        continue;
+      }
+
+      std::lock_guard<std::mutex> lock(results_mutex);
+      size_t remaining = options.max_matches - result.n_matches;
+      if (file.lines.size() >= remaining) {
+        file.lines.resize(remaining);
+        result.truncated = true;
+        stop = true;
+      }
+      if (file.lines.empty()) {
+        return;
+      }
+      result.n_matches += file.lines.size();
+      if (on_file) {
+        on_file(file);
+      }
+      result.files.push_back(std::move(file));
+    }
+  };
+
+  auto batch = std::make_shared<std::vector<WalkEntry>>();
+  walker_.Walk(root, [&](const WalkEntry &entry) {
+    if (stop) {
+      return false;
+    }
+    ++result.n_files_searched;
+    batch->push_back(entry);
+    if (batch->size() == FILES_PER_TASK) {
+      pending.push_back(pool_.Submit([&search_batch, batch]() { search_batch(*batch); }));
+      batch = std::make_shared<std::vector<WalkEntry>>();
+    }
+    return true;
+  }, cancel);
+  search_batch(*batch); // The remainder runs here
+  for (auto &task : pending) {
+    task.wait();
+  }
+
+  // Files whose path contains the pattern first, then the most recently
+  // edited (likely what the user is working on)
+  std::string path_needle = ToLower(matcher->literal);
+  auto path_hit = [&](const FileMatches &file) {
+    return !path_needle.empty() && ToLower(file.path).find(path_needle) != std::string::npos;
+  };
+  std::sort(result.files.begin(), result.files.end(),
+            [&](const FileMatches &a, const FileMatches &b) {
+              bool a_hit = path_hit(a);
+              bool b_hit = path_hit(b);
+              if (a_hit != b_hit) {
+                return a_hit;
+              }
+              if (a.mtime != b.mtime) {
+                return a.mtime > b.mtime;
+              }
+              return a.path < b.path;
+            });
+
+  result.elapsed_ms = std::chrono::duration<double, std::milli>(
+                          std::chrono::steady_clock::now() - start)
+                          .count();
+  return result;
+}
+
+std::string SearchEngine::RequiredLiteral(const std::string &regex) {
+  if (regex.find('|') != std::string::npos) {
+    return ""; // Alternatives share no single required literal
+  }
+
+  std::string best;
+  std::string current;
+  auto flush = [&]() {
+    if (current.size() > best.size()) {
+      best = current;
+    }
+    current.clear();
+  };
+
+  int depth = 0;
+  for (size_t i = 0; i < regex.size(); ++i) {
+    char c = regex[i];
+    if (c == '\\') {
+      if (i + 1 >= regex.size() || std::isalnum(static_cast<unsigned char>(regex[i + 1]))) {
+        flush(); // \w, \d, \b, \n...
+        ++i;
+        // Operands are not literal either: \xHH, \uHHHH, \cX, \0 and \1 (octal
+        // or backreference digits)
+        const char escape = i < regex.size() ? regex[i] : '\0';
+        if (std::isdigit(static_cast<unsigned char>(escape))) {
+          while (i + 1 < regex.size() && std::isdigit(static_cast<unsigned char>(regex[i + 1]))) {
+            ++i;
+          }
+        } else {
+          const size_t operand = escape == 'x' ? 2 : escape == 'u' ? 4 : escape == 'c' ? 1 : 0;
+          i = std::min(i + operand, regex.size());
+        }
+        continue;
+      }
+      c = regex[++i]; // Escaped punctuation is literal
+    } else if (c == '[') {
+      // Skip the class, allowing ']' as its first member
+      size_t j = i + 1;
+      if (j < regex.size() && regex[j] == '^') {
+        ++j;
+      }
+      if (j < regex.size() && regex[j] == ']') {
+        ++j;
+      }
+      while (j < regex.size() && regex[j] != ']') {
+        j += regex[j] == '\\' ? 2 : 1;
+      }
+      i = j;
+      flush();
+      continue;
+    } else if (c == '(' || c == ')') {
+      depth += c == '(' ? 1 : -1;
+      flush();
+      continue;
+    } else if (c == '{') {
+      size_t close = regex.find('}', i);
+      i = close == std::string::npos ? regex.size() : close;
+      flush();
+      continue;
+    } else if (std::strchr(".^$*+?", c)) {
+      flush();
+      continue;
+    }
+
+    // Group contents may be optional or repeated: not collected
+    char next = i + 1 < regex.size() ? regex[i + 1] : '\0';
+    if (depth > 0 || next == '*' || next == '?' || next == '{') {
+      flush();
+      continue;
+    }
+    current += c;
+    if (next == '+') {
+      flush();
+    }
+  }
+  flush();
+  return best.size() >= MIN_REQUIRED_LITERAL ? best : "";
+}
+
+std::string SearchEngine::FormatMatches(const FileMatches &file) {
+  std::string text = file.path + "\n";
+  for (const auto &match : file.lines) {
+    text += "  " + std::to_string(match.line) + ": " + match.text + "\n";
+  }
+  return text;
+}
+
+std::string SearchEngine::Summary(const SearchResult &result) {
+  if (!result.error.empty()) {
+    return result.error;
+  }
+  char elapsed[32];
+  std::snprintf(elapsed, sizeof(elapsed), "%.0f ms", result.elapsed_ms);
+  std::string summary = std::to_string(result.n_matches) +
+                        (result.n_matches == 1 ? " match in " : " matches in ") +
+                        std::to_string(result.files.size()) +
+                        (result.files.size() == 1 ? " file" : " files") + " (" +
+                        std::to_string(result.n_files_searched) + " searched, " + elapsed + ")";
+  if (result.truncated) {
+    summary += "; stopped at the match limit";
+  }
+  return summary;
+}
+
+std::string SearchEngine::PatternFromRequest(const std::string &request,
+                                             SearchOptions &options) {
+  auto finish = [&](const std::string &pattern, bool regex) {
+    options.regex = regex;
+    options.ignore_case = !HasUpper(pattern);
+    return pattern;
+  };
+
+  // Quoted text is taken as is; single quotes only around one word, since
+  // they double as apostrophes
+  for (char quote : {'`', '"', '\''}) {
+    size_t open = request.find(quote);
+    size_t close = open == std::string::npos ? open : request.find(quote, open + 1);
+    if (close != std::string::npos && close > open + 1) {
+      std::string quoted = request.substr(open + 1, close - open - 1);
+      if (quote != '\'' || quoted.find(' ') == std::string::npos) {
+        return finish(quoted, false);
+      }
+    }
+  }
+
+  // /regex/ (must use regex syntax, so paths aren't mistaken for one)
+  size_t open = request.find('/');
+  size_t close = request.rfind('/');
+  if (open != std::string::npos && close > open + 1) {
+    std::string body = request.substr(open + 1, close - open - 1);
+    if (body.find_first_of(".*+?[](){}|\\^$") != std::string::npos) {
+      return finish(body, true);
+    }
+  }
+
+  // Keywords, with plurals reduced to a prefix that matches both forms.
+  // Paths ("in src/tools") say where to look, not what to look for.
+  std::string keywords;
+  size_t token_start = 0;
+  while (token_start < request.size()) {
+    size_t token_end = request.find(' ', token_start);
+    if (token_end == std::string::npos) {
+      token_end = request.size();
+    }
+    std::string token = request.substr(token_start, token_end - token_start);
+    if (token.find('/') == std::string::npos) {
+      keywords += token + " ";
+    }
+    token_start = token_end + 1;
+  }
+
+  std::vector<std::string> words;
+  std::string word;
+  for (size_t i = 0; i <= keywords.size(); ++i) {
+    char c = i < keywords.size() ? keywords[i] : ' ';
+    if (std::isalnum(static_cast<unsigned char>(c)) || c == '_') {
+      word += c;
+      continue;
+    }
+    if (word.empty()) {
+      continue;
+    }
+    std::string lower = ToLower(word);
+    bool stopword = std::any_of(std::begin(REQUEST_STOPWORDS), std::end(REQUEST_STOPWORDS),
+                                [&](const char *stop) { return lower == stop; });
+    if (!stopword) {
+      if (word.size() > 4 && lower.compare(lower.size() - 3, 3, "ies") == 0) {
+        word.resize(word.size() - 3);
+      } else if (word.size() > 3 && lower.back() == 's' && lower[lower.size() - 2] != 's') {
+        word.pop_back();
+      }
+      if (std::find(words.begin(), words.end(), word) == words.end()) {
+        words.push_back(word);
+      }
+    }
+    word.clear();
+  }
+
+  if (words.empty()) {
+    return "";
+  }
+  if (words.size() == 1) {
+    return finish(words[0], false);
+  }
+  std::string alternatives;
+  for (const auto &w : words) {
+    alternatives += (alternatives.empty() ? "" : "|") + w;
+  }
+  return finish(alternatives, true);
+}
+
+} // namespace tools
+} // namespace zweek
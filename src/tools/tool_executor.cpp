@@ -1,15 +1,45 @@
 #include "tools/tool_executor.hpp"
+#include "tools/diff_engine.hpp"
 #include <filesystem>
-#include <fstream>
-#include <sstream>
 #include <iostream>
 #include <algorithm>
+#include <cstring>
 
 namespace zweek {
 namespace tools {
 
 namespace fs = std::filesystem;
 
+namespace {
+
+constexpr uint64_t LINE_INDEX_MIN_BYTES = 1u << 20; // Smaller files are scanned in memory
+constexpr size_t MAX_LINE_INDEXES = 32;
+
+// Lines first..last of an in-memory text, same clamping as LineIndex
+std::string_view LineWindow(std::string_view text, uint32_t first, uint32_t last) {
+  first = std::max<uint32_t>(first, 1);
+  if (last < first) {
+    return {};
+  }
+  size_t begin = 0;
+  for (uint32_t line = 1; line < first; ++line) {
+    size_t newline = text.find('\n', begin);
+    if (newline == std::string_view::npos) {
+      return {};
+    }
+    begin = newline + 1;
+  }
+  size_t end = begin;
+  for (uint32_t line = first; line <= last && end < text.size(); ++line) {
+    const void *newline = std::memchr(text.data() + end, '\n', text.size() - end);
+    end = newline ? static_cast<size_t>(static_cast<const char *>(newline) - text.data()) + 1
+                  : text.size();
+  }
+  return text.substr(begin, end - begin);
+}
+
+} // namespace
+
 ToolExecutor::ToolExecutor() {}
 
 ToolExecutor::~ToolExecutor() {}
@@ -32,27 +62,143 @@ std::string ToolExecutor::ResolvePath(const std::string &path) {
 }
 
 std::string ToolExecutor::ReadFile(const std::string &path) {
-  std::string full_path = ResolvePath(path);
-  std::ifstream file(full_path);
-  if (!file.is_open()) {
+  FileHandle file = ReadFileShared(path);
+  if (!file) {
     return ""; // Or throw exception / return error code
   }
-  std::stringstream buffer;
-  buffer << file.rdbuf();
-  return buffer.str();
+  return std::string(file->Text());
+}
+
+FileHandle ToolExecutor::ReadFileShared(const std::string &path) {
+  return file_cache_.Get(ResolvePath(path));
 }
 
 bool ToolExecutor::WriteFile(const std::string &path, const std::string &content) {
+  return WriteFiles({{path, content}});
+}
+
+bool ToolExecutor::WriteFiles(const std::vector<std::pair<std::string, std::string>> &files,
+                              std::string *error) {
+  WriteTransaction transaction;
+  for (const auto &file : files) {
+    transaction.Stage(ResolvePath(file.first), file.second);
+  }
+  std::vector<std::string> paths = transaction.Paths();
+  bool ok = transaction.Commit(snapshot_callback_);
+
+  // Readers must see the new contents (or re-read the restored ones)
+  for (const auto &full_path : paths) {
+    file_cache_.Invalidate(full_path);
+    std::lock_guard<std::mutex> lock(line_index_mutex_);
+    line_indexes_.erase(full_path);
+  }
+  if (!ok && error) {
+    *error = transaction.Error();
+  }
+  return ok;
+}
+
+std::shared_ptr<const LineIndex> ToolExecutor::GetLineIndex(const std::string &full_path) {
+  std::error_code ec;
+  uint64_t size = fs::file_size(full_path, ec);
+  auto mtime = fs::last_write_time(full_path, ec);
+  if (ec) {
+    return nullptr;
+  }
+  int64_t mtime_ticks = static_cast<int64_t>(mtime.time_since_epoch().count());
+  {
+    std::lock_guard<std::mutex> lock(line_index_mutex_);
+    auto it = line_indexes_.find(full_path);
+    if (it != line_indexes_.end()) {
+      if (it->second->FileSize() == size && it->second->FileMTime() == mtime_ticks) {
+        return it->second;
+      }
+      line_indexes_.erase(it);
+    }
+  }
+
+  // Built outside the lock; an index is a few bytes per hundred lines, so
+  // the bounded map only matters for sessions touching many huge files
+  auto index = LineIndex::Build(full_path);
+  if (!index) {
+    return nullptr;
+  }
+  std::lock_guard<std::mutex> lock(line_index_mutex_);
+  if (line_indexes_.size() >= MAX_LINE_INDEXES) {
+    line_indexes_.erase(line_indexes_.begin());
+  }
+  line_indexes_[full_path] = index;
+  return index;
+}
+
+std::string ToolExecutor::ReadLines(const std::string &path, uint32_t first, uint32_t last) {
   std::string full_path = ResolvePath(path);
-  // Ensure directory exists
-  fs::create_directories(fs::path(full_path).parent_path());
-  
-  std::ofstream file(full_path);
-  if (!file.is_open()) {
-    return false;
+  std::error_code ec;
+  uint64_t size = fs::file_size(full_path, ec);
+  if (ec) {
+    return "";
   }
-  file << content;
-  return true;
+  if (size < LINE_INDEX_MIN_BYTES) {
+    FileHandle file = file_cache_.Get(full_path);
+    return file ? std::string(LineWindow(file->Text(), first, last)) : "";
+  }
+
+  auto index = GetLineIndex(full_path);
+  uint64_t begin = 0;
+  uint64_t end = 0;
+  if (!index || !index->LineRange(full_path, first, last, begin, end)) {
+    return "";
+  }
+  std::string out;
+  ReadFileRange(full_path, begin, static_cast<size_t>(std::min<uint64_t>(end - begin, MAX_RANGE_BYTES)), out);
+  return out;
+}
+
+std::string ToolExecutor::ReadBytes(const std::string &path, uint64_t offset, size_t length) {
+  std::string out;
+  ReadFileRange(ResolvePath(path), offset, std::min(length, MAX_RANGE_BYTES), out);
+  return out;
+}
+
+uint64_t ToolExecutor::CountLines(const std::string &path) {
+  std::string full_path = ResolvePath(path);
+  std::error_code ec;
+  uint64_t size = fs::file_size(full_path, ec);
+  if (ec) {
+    return 0;
+  }
+  if (size < LINE_INDEX_MIN_BYTES) {
+    FileHandle file = file_cache_.Get(full_path);
+    if (!file || file->Size() == 0) {
+      return 0;
+    }
+    std::string_view text = file->Text();
+    return LineIndex::CountNewlines(text.data(), text.size()) + (text.back() != '\n' ? 1 : 0);
+  }
+  auto index = GetLineIndex(full_path);
+  return index ? index->LineCount() : 0;
+}
+
+bool ToolExecutor::StreamFile(const std::string &path,
+                              const std::function<bool(std::string_view)> &visitor) {
+  return ForEachFileChunk(ResolvePath(path), STREAM_CHUNK_BYTES, visitor);
+}
+
+PatchResult ToolExecutor::ApplyEdits(const std::string &path, const std::vector<SnippetEdit> &edits) {
+  FileHandle file = ReadFileShared(path);
+  if (!file) {
+    PatchResult result;
+    result.outcomes.resize(edits.size());
+    return result;
+  }
+  PatchResult result = PatchApplier::Apply(file->Text(), edits);
+  if (result.n_applied > 0 && !WriteFile(path, result.text)) {
+    result.n_applied = 0;
+    for (auto &outcome : result.outcomes) {
+      outcome.status = PatchStatus::NotFound;
+    }
+  }
+  return result;
 }
 
 std::vector<std::string> ToolExecutor::ListDir(const std::string &path) {
@@ -69,28 +215,18 @@ std::vector<std::string> ToolExecutor::ListDir(const std::string &path) {
   return files;
 }
 
-std::string ToolExecutor::GetDiff(const std::string &path, const std::string &new_content) {
-  std::string original = ReadFile(path);
-  
-  // Simple line-based diff (very basic implementation)
-  // In a real scenario, use a diff library or git
-  
-  std::stringstream ss_orig(original);
-  std::stringstream ss_new(new_content);
-  std::string line_orig, line_new;
-  
-  std::string diff_output;
-  
-  // This is a placeholder for a real diff algorithm
-  // For now, we just show that it's different
-  if (original != new_content) {
-    diff_output = "--- " + path + "\n+++ " + path + "\n";
-    diff_output += "@@ -1 +1 @@\n";
-    diff_output += "- " + original.substr(0, std::min((size_t)50, original.length())) + "...\n";
-    diff_output += "+ " + new_content.substr(0, std::min((size_t)50, new_content.length())) + "...\n";
+std::vector<std::string> ToolExecutor::ListDirRecursive(const std::string &path) {
+  std::vector<std::string> files;
+  for (auto &entry : walker_.Collect(ResolvePath(path))) {
+    files.push_back(std::move(entry.path));
   }
-  
-  return diff_output;
+  return files;
+}
+
+std::string ToolExecutor::GetDiff(const std::string &path, const std::string &new_content) {
+  FileHandle file = ReadFileShared(path);
+  std::string_view original = file ? file->Text() : std::string_view();
+  return DiffEngine::Unified(path, path, original, new_content);
 }
 
 } // namespace tools
@@ -0,0 +1,1137 @@
+#include "tools/workspace_index.hpp"
+#include "util/hash.hpp"
+#include "util/paths.hpp"
+#include "util/thread_pool.hpp"
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <string_view>
+#include <type_traits>
+#include <unordered_map>
+
+namespace zweek {
+namespace tools {
+
+namespace fs = std::filesystem;
+
+namespace {
+
+constexpr uint32_t INDEX_MAGIC = 0x5849575a; // "ZWIX"
+constexpr uint32_t INDEX_VERSION = 1;
+
+// Chunking and limits
+constexpr uint32_t CHUNK_LINES = 40;
+constexpr uintmax_t MAX_FILE_BYTES = 512 * 1024; // Larger files are rarely hand-written
+constexpr size_t BINARY_PROBE_BYTES = 8192;
+constexpr size_t BUILD_BATCH_FILES = 256;
+constexpr size_t MAX_TERM_LENGTH = 64;
+
+// Ranking
+constexpr float BM25_K1 = 1.2f;
+constexpr float BM25_B = 0.75f;
+constexpr float EXPANSION_WEIGHT = 0.5f; // Partial identifier matches count half
+constexpr size_t MIN_EXPANSION_LENGTH = 4;
+constexpr size_t MAX_EXPANSIONS = 8;
+constexpr size_t MAX_CANDIDATES = 64;
+constexpr size_t BYTES_PER_TOKEN = 4; // Rough estimate for code
+
+// Beyond this many changed files a full rebuild is cheaper than the overlay
+constexpr size_t OVERLAY_MAX_FILES = 1024;
+
+// Natural-language filler in questions (and keywords in code) that would
+// otherwise dominate the postings
+const char *STOPWORDS[] = {"a",    "an",   "and",  "are",   "as",   "at",
+                           "be",   "by",   "can",  "do",    "does", "for",
+                           "from", "how",  "if",   "in",    "is",   "it",
+                           "me",   "my",   "of",   "on",    "or",   "the",
+                           "this", "that", "to",   "what",  "when", "where",
+                           "which", "why", "with", "you",   "your"};
+
+// On-disk layout. All sections start 8-byte aligned; sizes are fixed so
+// the mapped file can be used in place.
+struct IndexHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t root_hash;
+  uint32_t n_files;
+  uint32_t n_chunks;
+  uint32_t n_terms;
+  uint32_t n_trigrams;
+  float avg_chunk_terms;
+  uint32_t reserved;
+  uint64_t files_offset;
+  uint64_t chunks_offset;
+  uint64_t terms_offset;
+  uint64_t postings_offset;
+  uint64_t n_postings;
+  uint64_t trigrams_offset;
+  uint64_t trigram_terms_offset;
+  uint64_t n_trigram_terms;
+  uint64_t strings_offset;
+  uint64_t total_size;
+};
+
+struct FileRecord {
+  uint64_t path_offset; // Relative path in the string blob
+  uint32_t path_length;
+  uint32_t reserved;
+  int64_t mtime;
+  uint64_t size;
+};
+
+struct ChunkRecord {
+  uint32_t file;
+  uint32_t start_line;
+  uint32_t end_line;
+  uint32_t n_terms; // BM25 document length
+  uint32_t offset;  // Byte range in the file
+  uint32_t bytes;
+};
+
+// Sorted by (hash, text)
+struct TermRecord {
+  uint64_t hash;
+  uint64_t text_offset;
+  uint64_t postings_first;
+  uint32_t text_length;
+  uint32_t df;
+};
+
+struct Posting {
+  uint32_t chunk;
+  uint32_t tf;
+};
+
+// Sorted by code; lists the terms (ascending index) containing the trigram
+struct TrigramRecord {
+  uint32_t code;
+  uint32_t count;
+  uint64_t first;
+};
+
+static_assert(std::is_trivially_copyable<IndexHeader>::value, "mapped in place");
+
+bool IsStopword(const std::string &term) {
+  for (const char *stopword : STOPWORDS) {
+    if (term == stopword) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool IsIdentifierChar(char c) {
+  return std::isalnum(static_cast<unsigned char>(c)) || c == '_';
+}
+
+// Calls emit(term) for every indexable term in text
+template <typename Emit> void ForEachTerm(const std::string &text, Emit emit) {
+  auto emit_lower = [&](std::string term) {
+    std::transform(term.begin(), term.end(), term.begin(),
+                   [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+    if (term.size() >= 2 && !IsStopword(term)) {
+      emit(term);
+    }
+  };
+
+  size_t i = 0;
+  while (i < text.size()) {
+    if (!IsIdentifierChar(text[i])) {
+      ++i;
+      continue;
+    }
+    size_t start = i;
+    while (i < text.size() && IsIdentifierChar(text[i])) {
+      ++i;
+    }
+
+    std::string word = text.substr(start, i - start);
+    bool numeric = std::all_of(word.begin(), word.end(), [](unsigned char c) {
+      return std::isdigit(c) || c == '_';
+    });
+    if (numeric || word.size() > MAX_TERM_LENGTH) {
+      continue;
+    }
+    emit_lower(word);
+
+    // Parts split at '_', lower->Upper, letter<->digit and the end of an
+    // acronym ("HTTPServer" -> "HTTP", "Server")
+    std::vector<std::string> parts;
+    std::string part;
+    for (size_t k = 0; k < word.size(); ++k) {
+      unsigned char c = static_cast<unsigned char>(word[k]);
+      if (c == '_') {
+        if (!part.empty()) parts.push_back(part);
+        part.clear();
+        continue;
+      }
+      if (!part.empty()) {
+        unsigned char prev = static_cast<unsigned char>(part.back());
+        bool next_lower = k + 1 < word.size() &&
+                          std::islower(static_cast<unsigned char>(word[k + 1]));
+        bool boundary = (std::islower(prev) && std::isupper(c)) ||
+                        (std::isdigit(prev) != 0) != (std::isdigit(c) != 0) ||
+                        (std::isupper(prev) && std::isupper(c) && next_lower);
+        if (boundary) {
+          parts.push_back(part);
+          part.clear();
+        }
+      }
+      part += static_cast<char>(c);
+    }
+    if (!part.empty()) {
+      parts.push_back(part);
+    }
+    if (parts.size() > 1) {
+      for (const auto &p : parts) {
+        emit_lower(p);
+      }
+    }
+  }
+}
+
+uint32_t TrigramCode(const char *p) {
+  return (static_cast<uint32_t>(static_cast<unsigned char>(p[0])) << 16) |
+         (static_cast<uint32_t>(static_cast<unsigned char>(p[1])) << 8) |
+         static_cast<uint32_t>(static_cast<unsigned char>(p[2]));
+}
+
+int64_t FileMTime(const fs::path &path, std::error_code &ec) {
+  return static_cast<int64_t>(fs::last_write_time(path, ec).time_since_epoch().count());
+}
+
+// Per-file build output
+struct ChunkTerms {
+  ChunkRecord record;
+  std::vector<std::pair<std::string, uint32_t>> terms;
+};
+
+struct FileResult {
+  bool ok = false;
+  int64_t mtime = 0;
+  uint64_t size = 0;
+  std::vector<ChunkTerms> chunks;
+};
+
+FileResult IndexFile(const fs::path &path) {
+  FileResult result;
+  std::error_code ec;
+  result.mtime = FileMTime(path, ec);
+  if (ec) {
+    return result;
+  }
+
+  std::ifstream in(path, std::ios::binary);
+  std::string content((std::istreambuf_iterator<char>(in)),
+                      std::istreambuf_iterator<char>());
+  if (!in.eof() && in.fail()) {
+    return result;
+  }
+  if (std::memchr(content.data(), '\0', std::min(content.size(), BINARY_PROBE_BYTES))) {
+    return result; // Binary
+  }
+  result.size = content.size();
+
+  uint32_t line = 1;
+  size_t pos = 0;
+  while (pos < content.size()) {
+    size_t end = pos;
+    uint32_t lines = 0;
+    while (end < content.size() && lines < CHUNK_LINES) {
+      const char *nl = static_cast<const char *>(
+          std::memchr(content.data() + end, '\n', content.size() - end));
+      end = nl ? static_cast<size_t>(nl - content.data()) + 1 : content.size();
+      ++lines;
+    }
+
+    ChunkTerms chunk;
+    chunk.record = {0, line, line + lines - 1, 0, static_cast<uint32_t>(pos),
+                    static_cast<uint32_t>(end - pos)};
+    std::unordered_map<std::string, uint32_t> counts;
+    ForEachTerm(content.substr(pos, end - pos),
+                [&](const std::string &term) { ++counts[term]; });
+    for (auto &entry : counts) {
+      chunk.record.n_terms += entry.second;
+      chunk.terms.emplace_back(entry.first, entry.second);
+    }
+    if (!chunk.terms.empty()) {
+      result.chunks.push_back(std::move(chunk));
+    }
+
+    line += lines;
+    pos = end;
+  }
+  result.ok = true;
+  return result;
+}
+
+// Text files within the size limit, outside ignored directories
+WalkOptions IndexWalkOptions() {
+  WalkOptions options;
+  options.max_file_bytes = MAX_FILE_BYTES;
+  return options;
+}
+
+// Indexable files under root, sorted by path
+std::vector<WalkEntry> CollectFiles(DirWalker &walker, const std::string &root,
+                                    const std::atomic<bool> &cancel) {
+  std::vector<WalkEntry> files = walker.Collect(root, &cancel);
+  files.erase(std::remove_if(files.begin(), files.end(),
+                             [](const WalkEntry &file) { return file.size == 0; }),
+              files.end());
+  return files;
+}
+
+// A file re-indexed after the build. removed = tombstone only.
+struct OverlayFile {
+  bool removed = false;
+  uint64_t generation = 0;
+  int64_t mtime = 0;
+  uint64_t size = 0;
+  std::vector<ChunkTerms> chunks;
+};
+
+void PadTo8(std::ofstream &out, uint64_t &offset) {
+  static const char ZEROS[8] = {};
+  size_t pad = static_cast<size_t>((8 - offset % 8) % 8);
+  out.write(ZEROS, pad);
+  offset += pad;
+}
+
+template <typename T>
+void WriteSection(std::ofstream &out, uint64_t &offset, const std::vector<T> &items) {
+  out.write(reinterpret_cast<const char *>(items.data()), items.size() * sizeof(T));
+  offset += items.size() * sizeof(T);
+}
+
+uint64_t RootHash(const std::string &root) { return util::HashString(root); }
+
+} // namespace
+
+// A mapped index file with typed views of its sections
+struct WorkspaceIndex::Snapshot {
+  util::MappedFile file;
+  std::string root;
+  const IndexHeader *header = nullptr;
+  const FileRecord *files = nullptr;
+  const ChunkRecord *chunks = nullptr;
+  const TermRecord *terms = nullptr;
+  const Posting *postings = nullptr;
+  const TrigramRecord *trigrams = nullptr;
+  const uint32_t *trigram_terms = nullptr;
+  const char *strings = nullptr;
+
+  std::string_view Text(uint64_t offset, uint32_t length) const {
+    return std::string_view(strings + offset, length);
+  }
+
+  const TermRecord *FindTerm(const std::string &term) const {
+    uint64_t hash = util::HashString(term);
+    const TermRecord *end = terms + header->n_terms;
+    const TermRecord *it = std::lower_bound(
+        terms, end, hash, [](const TermRecord &t, uint64_t h) { return t.hash < h; });
+    for (; it != end && it->hash == hash; ++it) {
+      if (Text(it->text_offset, it->text_length) == term) {
+        return it;
+      }
+    }
+    return nullptr;
+  }
+
+  // Relative path -> file id, built on first use
+  const std::unordered_map<std::string_view, uint32_t> &FileIds() const {
+    std::call_once(file_ids_once, [this]() {
+      file_ids.reserve(header->n_files);
+      for (uint32_t i = 0; i < header->n_files; ++i) {
+        file_ids.emplace(Text(files[i].path_offset, files[i].path_length), i);
+      }
+    });
+    return file_ids;
+  }
+
+  const TrigramRecord *FindTrigram(uint32_t code) const {
+    const TrigramRecord *end = trigrams + header->n_trigrams;
+    const TrigramRecord *it = std::lower_bound(
+        trigrams, end, code, [](const TrigramRecord &t, uint32_t c) { return t.code < c; });
+    return it != end && it->code == code ? it : nullptr;
+  }
+
+  mutable std::once_flag file_ids_once;
+  mutable std::unordered_map<std::string_view, uint32_t> file_ids;
+};
+
+// Files changed since the snapshot, keyed by relative path
+struct WorkspaceIndex::Overlay {
+  std::unordered_map<std::string, std::shared_ptr<const OverlayFile>> files;
+};
+
+WorkspaceIndex::WorkspaceIndex()
+    : overlay_(std::make_shared<Overlay>()), walker_(IndexWalkOptions()) {}
+
+WorkspaceIndex::~WorkspaceIndex() { StopBuild(); }
+
+std::vector<std::string> WorkspaceIndex::Tokenize(const std::string &text) {
+  std::vector<std::string> terms;
+  ForEachTerm(text, [&](const std::string &term) { terms.push_back(term); });
+  return terms;
+}
+
+std::string WorkspaceIndex::IndexPathFor(const std::string &root) const {
+  return (fs::path(util::GetZweekSubdirectory("index")) /
+          (util::ToHex(RootHash(root)) + ".idx"))
+      .string();
+}
+
+void WorkspaceIndex::SetStatusCallback(
+    std::function<void(const std::string &)> callback) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  status_callback_ = callback;
+}
+
+void WorkspaceIndex::SetRoot(const std::string &root) {
+  std::error_code ec;
+  std::string canonical = fs::weakly_canonical(fs::absolute(root, ec), ec).string();
+  if (ec) {
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (canonical == root_) {
+      return;
+    }
+  }
+
+  StopBuild();
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    root_ = canonical;
+    index_path_ = IndexPathFor(canonical);
+    snapshot_.reset();
+    overlay_ = std::make_shared<Overlay>();
+  }
+  rebuild_pending_ = false;
+
+  // Reopening only maps the index; edits made while zweek wasn't running
+  // are picked up by a background stat pass
+  StartBuild(!OpenSnapshot());
+}
+
+bool WorkspaceIndex::OpenSnapshot(uint64_t prune_generation) {
+  std::string root, path;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    root = root_;
+    path = index_path_;
+  }
+
+  auto snapshot = std::make_shared<Snapshot>();
+  if (root.empty() || !snapshot->file.Open(path)) {
+    return false;
+  }
+
+  // Validate before trusting any offset in the mapped file
+  const char *data = snapshot->file.Data();
+  const uint64_t size = snapshot->file.Size();
+  if (size < sizeof(IndexHeader)) {
+    return false;
+  }
+  const IndexHeader *header = reinterpret_cast<const IndexHeader *>(data);
+  auto fits = [&](uint64_t offset, uint64_t count, size_t item) {
+    return offset % 8 == 0 && offset <= size && count <= (size - offset) / item;
+  };
+  if (header->magic != INDEX_MAGIC || header->version != INDEX_VERSION ||
+      header->root_hash != RootHash(root) || header->total_size != size ||
+      !fits(header->files_offset, header->n_files, sizeof(FileRecord)) ||
+      !fits(header->chunks_offset, header->n_chunks, sizeof(ChunkRecord)) ||
+      !fits(header->terms_offset, header->n_terms, sizeof(TermRecord)) ||
+      !fits(header->postings_offset, header->n_postings, sizeof(Posting)) ||
+      !fits(header->trigrams_offset, header->n_trigrams, sizeof(TrigramRecord)) ||
+      !fits(header->trigram_terms_offset, header->n_trigram_terms, sizeof(uint32_t)) ||
+      header->strings_offset > size) {
+    return false;
+  }
+
+  snapshot->root = root;
+  snapshot->header = header;
+  snapshot->files = reinterpret_cast<const FileRecord *>(data + header->files_offset);
+  snapshot->chunks = reinterpret_cast<const ChunkRecord *>(data + header->chunks_offset);
+  snapshot->terms = reinterpret_cast<const TermRecord *>(data + header->terms_offset);
+  snapshot->postings = reinterpret_cast<const Posting *>(data + header->postings_offset);
+  snapshot->trigrams = reinterpret_cast<const TrigramRecord *>(data + header->trigrams_offset);
+  snapshot->trigram_terms =
+      reinterpret_cast<const uint32_t *>(data + header->trigram_terms_offset);
+  snapshot->strings = data + header->strings_offset;
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (root != root_) {
+    return false; // Workspace changed meanwhile
+  }
+  snapshot_ = std::move(snapshot);
+
+  // Changes applied before the build started are in the new index
+  if (prune_generation > 0) {
+    auto overlay = std::make_shared<Overlay>();
+    for (const auto &entry : overlay_->files) {
+      if (entry.second->generation > prune_generation) {
+        overlay->files.insert(entry);
+      }
+    }
+    overlay_ = std::move(overlay);
+  }
+  return true;
+}
+
+void WorkspaceIndex::StartBuild(bool full) {
+  std::lock_guard<std::mutex> build_lock(build_mutex_);
+  if (building_.exchange(true)) {
+    if (full) {
+      rebuild_pending_ = true; // Run again once the current pass finishes
+    }
+    return;
+  }
+
+  // A previous build has finished (building_ was false); reap its thread
+  if (build_thread_.joinable()) {
+    build_thread_.join();
+  }
+
+  std::string root, path;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    root = root_;
+    path = index_path_;
+  }
+  if (root.empty()) {
+    building_ = false;
+    return;
+  }
+  cancel_build_ = false;
+  build_thread_ = std::thread([this, root, path, full]() {
+    if (full) {
+      BuildIndex(root, path);
+    } else {
+      Reconcile(root);
+    }
+    while (rebuild_pending_.exchange(false) && !cancel_build_) {
+      BuildIndex(root, path);
+    }
+    building_ = false;
+  });
+}
+
+void WorkspaceIndex::StopBuild() {
+  std::lock_guard<std::mutex> build_lock(build_mutex_);
+  cancel_build_ = true;
+  if (build_thread_.joinable()) {
+    build_thread_.join();
+  }
+  building_ = false;
+}
+
+void WorkspaceIndex::Rebuild() { StartBuild(); }
+
+void WorkspaceIndex::BuildIndex(const std::string &root,
+                                const std::string &index_path) {
+  std::function<void(const std::string &)> status;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    status = status_callback_;
+  }
+  if (status) {
+    status("Indexing workspace...");
+  }
+
+  // Overlay entries up to here will be covered by this build
+  uint64_t start_generation;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    start_generation = generation_;
+  }
+
+  // 1. Collect candidate files
+  std::vector<WalkEntry> paths = CollectFiles(walker_, root, cancel_build_);
+  if (cancel_build_) {
+    return;
+  }
+
+  // 2. Chunk and count terms in parallel, merging one batch at a time so
+  //    only a batch of per-file results is held in memory
+  std::vector<FileRecord> files;
+  std::vector<ChunkRecord> chunks;
+  std::string strings;
+  std::unordered_map<std::string, uint32_t> term_ids;
+  std::vector<std::string> term_texts;
+  std::vector<std::vector<Posting>> term_postings;
+  uint64_t total_terms = 0;
+
+  util::ThreadPool pool(std::max<size_t>(1, std::thread::hardware_concurrency() / 2));
+  for (size_t batch = 0; batch < paths.size(); batch += BUILD_BATCH_FILES) {
+    if (cancel_build_) {
+      return;
+    }
+
+    size_t batch_end = std::min(paths.size(), batch + BUILD_BATCH_FILES);
+    std::vector<std::future<FileResult>> results;
+    for (size_t i = batch; i < batch_end; ++i) {
+      fs::path path = fs::path(root) / paths[i].path;
+      results.push_back(pool.Submit([path]() { return IndexFile(path); }));
+    }
+
+    for (size_t i = batch; i < batch_end; ++i) {
+      FileResult result = results[i - batch].get();
+      if (!result.ok || result.chunks.empty()) {
+        continue;
+      }
+
+      const std::string &relative = paths[i].path;
+      uint32_t file_id = static_cast<uint32_t>(files.size());
+      files.push_back({strings.size(), static_cast<uint32_t>(relative.size()), 0,
+                       result.mtime, result.size});
+      strings += relative;
+
+      for (auto &chunk : result.chunks) {
+        uint32_t chunk_id = static_cast<uint32_t>(chunks.size());
+        chunk.record.file = file_id;
+        chunks.push_back(chunk.record);
+        total_terms += chunk.record.n_terms;
+
+        for (auto &term : chunk.terms) {
+          auto inserted = term_ids.emplace(term.first, static_cast<uint32_t>(term_texts.size()));
+          if (inserted.second) {
+            term_texts.push_back(term.first);
+            term_postings.emplace_back();
+          }
+          term_postings[inserted.first->second].push_back({chunk_id, term.second});
+        }
+      }
+    }
+  }
+
+  // 3. Term table sorted by hash for binary search in the mapped file
+  std::vector<uint32_t> order(term_texts.size());
+  std::vector<uint64_t> hashes(term_texts.size());
+  for (uint32_t i = 0; i < order.size(); ++i) {
+    order[i] = i;
+    hashes[i] = util::HashString(term_texts[i]);
+  }
+  std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+    return hashes[a] != hashes[b] ? hashes[a] < hashes[b] : term_texts[a] < term_texts[b];
+  });
+
+  std::vector<TermRecord> terms;
+  std::vector<Posting> postings;
+  terms.reserve(order.size());
+  for (uint32_t id : order) {
+    const auto &list = term_postings[id];
+    terms.push_back({hashes[id], strings.size(), postings.size(),
+                     static_cast<uint32_t>(term_texts[id].size()),
+                     static_cast<uint32_t>(list.size())});
+    strings += term_texts[id];
+    postings.insert(postings.end(), list.begin(), list.end());
+  }
+  term_postings.clear();
+  term_ids.clear();
+
+  // 4. Trigram -> terms table for partial identifier matches
+  std::unordered_map<uint32_t, std::vector<uint32_t>> trigram_lists;
+  for (uint32_t t = 0; t < order.size(); ++t) {
+    const std::string &text = term_texts[order[t]];
+    for (size_t k = 0; k + 3 <= text.size(); ++k) {
+      auto &list = trigram_lists[TrigramCode(text.data() + k)];
+      if (list.empty() || list.back() != t) {
+        list.push_back(t);
+      }
+    }
+  }
+  std::vector<uint32_t> codes;
+  codes.reserve(trigram_lists.size());
+  for (const auto &entry : trigram_lists) {
+    codes.push_back(entry.first);
+  }
+  std::sort(codes.begin(), codes.end());
+
+  std::vector<TrigramRecord> trigrams;
+  std::vector<uint32_t> trigram_terms;
+  for (uint32_t code : codes) {
+    const auto &list = trigram_lists[code];
+    trigrams.push_back({code, static_cast<uint32_t>(list.size()), trigram_terms.size()});
+    trigram_terms.insert(trigram_terms.end(), list.begin(), list.end());
+  }
+  trigram_lists.clear();
+
+  if (cancel_build_) {
+    return;
+  }
+
+  // 5. Write to a temp file, then rename so readers never see a torn index
+  IndexHeader header = {};
+  header.magic = INDEX_MAGIC;
+  header.version = INDEX_VERSION;
+  header.root_hash = RootHash(root);
+  header.n_files = static_cast<uint32_t>(files.size());
+  header.n_chunks = static_cast<uint32_t>(chunks.size());
+  header.n_terms = static_cast<uint32_t>(terms.size());
+  header.n_trigrams = static_cast<uint32_t>(trigrams.size());
+  header.avg_chunk_terms =
+      chunks.empty() ? 1.0f : static_cast<float>(total_terms) / chunks.size();
+  header.n_postings = postings.size();
+  header.n_trigram_terms = trigram_terms.size();
+
+  std::string temp_path = index_path + ".tmp";
+  {
+    std::ofstream out(temp_path, std::ios::binary | std::ios::trunc);
+    uint64_t offset = sizeof(IndexHeader);
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+
+    PadTo8(out, offset);
+    header.files_offset = offset;
+    WriteSection(out, offset, files);
+    PadTo8(out, offset);
+    header.chunks_offset = offset;
+    WriteSection(out, offset, chunks);
+    PadTo8(out, offset);
+    header.terms_offset = offset;
+    WriteSection(out, offset, terms);
+    PadTo8(out, offset);
+    header.postings_offset = offset;
+    WriteSection(out, offset, postings);
+    PadTo8(out, offset);
+    header.trigrams_offset = offset;
+    WriteSection(out, offset, trigrams);
+    PadTo8(out, offset);
+    header.trigram_terms_offset = offset;
+    WriteSection(out, offset, trigram_terms);
+    header.strings_offset = offset;
+    out.write(strings.data(), strings.size());
+    offset += strings.size();
+    header.total_size = offset;
+
+    // Header last, now that the offsets are known
+    out.seekp(0);
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    if (!out) {
+      return;
+    }
+  }
+
+  std::error_code ec;
+  fs::rename(temp_path, index_path, ec);
+  if (ec) {
+    return;
+  }
+
+  OpenSnapshot(start_generation);
+  if (status) {
+    status("Indexed " + std::to_string(files.size()) + " files");
+  }
+}
+
+void WorkspaceIndex::Reconcile(const std::string &root) {
+  std::shared_ptr<const Snapshot> snap;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    snap = snapshot_;
+  }
+  if (!snap) {
+    return;
+  }
+
+  std::vector<WalkEntry> files = CollectFiles(walker_, root, cancel_build_);
+  if (cancel_build_) {
+    return;
+  }
+
+  // The walk already stat'ed everything; contents are read just for files
+  // that differ
+  const auto &ids = snap->FileIds();
+  std::vector<uint8_t> seen(snap->header->n_files, 0);
+  ChangeBatch batch;
+  for (const auto &file : files) {
+    auto it = ids.find(file.path);
+    if (it != ids.end()) {
+      seen[it->second] = 1;
+      const FileRecord &record = snap->files[it->second];
+      if (record.size == file.size && record.mtime == file.mtime) {
+        continue;
+      }
+    }
+    batch.modified.push_back((fs::path(root) / file.path).string());
+  }
+  for (uint32_t i = 0; i < seen.size(); ++i) {
+    if (!seen[i]) {
+      const FileRecord &file = snap->files[i];
+      batch.removed.push_back(
+          (fs::path(root) / std::string(snap->Text(file.path_offset, file.path_length))).string());
+    }
+  }
+
+  if (!batch.modified.empty() || !batch.removed.empty()) {
+    ApplyChanges(batch);
+  }
+}
+
+void WorkspaceIndex::ApplyChanges(const ChangeBatch &batch) {
+  if (batch.overflow) {
+    Rebuild();
+    return;
+  }
+
+  std::string root;
+  std::shared_ptr<const Snapshot> snap;
+  std::shared_ptr<const Overlay> overlay;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    root = root_;
+    snap = snapshot_;
+    overlay = overlay_;
+  }
+  if (root.empty()) {
+    return;
+  }
+  if (!snap) {
+    Rebuild(); // First build still running: queue another pass
+    return;
+  }
+
+  // Path relative to the root, unless outside it or in a skipped directory
+  auto to_relative = [&](const std::string &path, std::string &relative) {
+    fs::path rel = fs::path(path).lexically_relative(root);
+    if (rel.empty() || *rel.begin() == "..") {
+      return false;
+    }
+    for (const auto &part : rel.parent_path()) {
+      if (DirWalker::IsSkippedDirectory(part.string())) {
+        return false;
+      }
+    }
+    relative = rel.generic_string();
+    return true;
+  };
+  auto is_known = [&](const std::string &relative) {
+    return snap->FileIds().count(relative) > 0 || overlay->files.count(relative) > 0;
+  };
+
+  std::vector<std::pair<std::string, bool>> changes; // Relative path, removed
+  std::string relative;
+  for (const auto &path : batch.modified) {
+    if (to_relative(path, relative)) {
+      changes.emplace_back(relative, false);
+    }
+  }
+
+  constexpr size_t MAX_DIRECTORY_SCANS = 16;
+  size_t directory_scans = 0;
+  for (const auto &path : batch.removed) {
+    if (!to_relative(path, relative)) {
+      continue;
+    }
+    if (is_known(relative)) {
+      changes.emplace_back(relative, true);
+      continue;
+    }
+
+    // Probably a directory: everything indexed below it goes too
+    if (++directory_scans > MAX_DIRECTORY_SCANS) {
+      Rebuild();
+      return;
+    }
+    std::string prefix = relative + "/";
+    for (const auto &entry : snap->FileIds()) {
+      if (entry.first.compare(0, prefix.size(), prefix) == 0) {
+        changes.emplace_back(std::string(entry.first), true);
+      }
+    }
+    for (const auto &entry : overlay->files) {
+      if (entry.first.compare(0, prefix.size(), prefix) == 0) {
+        changes.emplace_back(entry.first, true);
+      }
+    }
+  }
+
+  if (changes.empty()) {
+    return;
+  }
+  if (changes.size() + overlay->files.size() > OVERLAY_MAX_FILES) {
+    Rebuild();
+    return;
+  }
+
+  // Re-index just the changed files, outside the lock
+  std::vector<std::pair<std::string, std::shared_ptr<OverlayFile>>> updates;
+  for (const auto &change : changes) {
+    auto file = std::make_shared<OverlayFile>();
+    file->removed = true;
+    if (!change.second) {
+      fs::path path = fs::path(root) / change.first;
+      std::error_code ec;
+      uintmax_t size = fs::file_size(path, ec);
+      if (!ec && size > 0 && size <= MAX_FILE_BYTES) {
+        FileResult result = IndexFile(path);
+        if (result.ok) {
+          file->removed = false;
+          file->mtime = result.mtime;
+          file->size = result.size;
+          file->chunks = std::move(result.chunks);
+        }
+      }
+    }
+
+    // Nothing to hide for a file the index never had
+    if (file->removed && !is_known(change.first)) {
+      continue;
+    }
+    updates.emplace_back(change.first, std::move(file));
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (root != root_ || updates.empty()) {
+    return;
+  }
+  auto next = std::make_shared<Overlay>(*overlay_);
+  ++generation_;
+  for (auto &update : updates) {
+    update.second->generation = generation_;
+    next->files[update.first] = std::move(update.second);
+  }
+  overlay_ = std::move(next);
+}
+
+std::vector<Snippet> WorkspaceIndex::Search(const std::string &query,
+                                            size_t token_budget) {
+  std::shared_ptr<const Snapshot> snap;
+  std::shared_ptr<const Overlay> overlay;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    snap = snapshot_;
+    overlay = overlay_;
+  }
+  std::vector<Snippet> snippets;
+  if (!snap) {
+    return snippets;
+  }
+
+  const IndexHeader &header = *snap->header;
+  const float n_chunks = static_cast<float>(std::max<uint32_t>(header.n_chunks, 1));
+  auto idf = [&](uint32_t df) {
+    return std::log(1.0f + (n_chunks - df + 0.5f) / (df + 0.5f));
+  };
+  auto bm25 = [&](float tf, uint32_t n_terms) {
+    const float length = n_terms / header.avg_chunk_terms;
+    return tf * (BM25_K1 + 1.0f) / (tf + BM25_K1 * (1.0f - BM25_B + BM25_B * length));
+  };
+
+  // Indexed files that were changed or deleted since the build
+  std::vector<uint8_t> tombstoned;
+  if (!overlay->files.empty()) {
+    tombstoned.assign(header.n_files, 0);
+    const auto &ids = snap->FileIds();
+    for (const auto &entry : overlay->files) {
+      auto it = ids.find(entry.first);
+      if (it != ids.end()) {
+        tombstoned[it->second] = 1;
+      }
+    }
+  }
+
+  std::vector<float> scores(header.n_chunks, 0.0f);
+  std::vector<uint32_t> touched;
+
+  auto accumulate = [&](const TermRecord &term, float weight) {
+    if (term.postings_first + term.df > header.n_postings) {
+      return;
+    }
+    const float term_idf = idf(term.df);
+    const Posting *posting = snap->postings + term.postings_first;
+    for (uint32_t p = 0; p < term.df; ++p, ++posting) {
+      if (posting->chunk >= header.n_chunks) {
+        continue;
+      }
+      const ChunkRecord &chunk = snap->chunks[posting->chunk];
+      if (!tombstoned.empty() && chunk.file < tombstoned.size() && tombstoned[chunk.file]) {
+        continue;
+      }
+      if (scores[posting->chunk] == 0.0f) {
+        touched.push_back(posting->chunk);
+      }
+      scores[posting->chunk] += weight * term_idf * bm25(static_cast<float>(posting->tf), chunk.n_terms);
+    }
+  };
+
+  std::vector<std::string> terms = Tokenize(query);
+  std::sort(terms.begin(), terms.end());
+  terms.erase(std::unique(terms.begin(), terms.end()), terms.end());
+
+  for (const auto &term : terms) {
+    if (const TermRecord *record = snap->FindTerm(term)) {
+      accumulate(*record, 1.0f);
+    }
+    if (term.size() < MIN_EXPANSION_LENGTH) {
+      continue;
+    }
+
+    // Terms containing every trigram of the query term: walk the shortest
+    // list and binary-search the others, then confirm the substring
+    std::vector<const TrigramRecord *> lists;
+    for (size_t k = 0; k + 3 <= term.size(); ++k) {
+      const TrigramRecord *trigram = snap->FindTrigram(TrigramCode(term.data() + k));
+      if (!trigram || trigram->first + trigram->count > header.n_trigram_terms) {
+        lists.clear();
+        break;
+      }
+      lists.push_back(trigram);
+    }
+    if (lists.empty()) {
+      continue;
+    }
+    std::sort(lists.begin(), lists.end(),
+              [](const TrigramRecord *a, const TrigramRecord *b) { return a->count < b->count; });
+
+    size_t expansions = 0;
+    const uint32_t *shortest = snap->trigram_terms + lists[0]->first;
+    for (uint32_t c = 0; c < lists[0]->count && expansions < MAX_EXPANSIONS; ++c) {
+      uint32_t candidate = shortest[c];
+      bool in_all = std::all_of(lists.begin() + 1, lists.end(), [&](const TrigramRecord *list) {
+        const uint32_t *begin = snap->trigram_terms + list->first;
+        return std::binary_search(begin, begin + list->count, candidate);
+      });
+      if (!in_all || candidate >= header.n_terms) {
+        continue;
+      }
+      const TermRecord &record = snap->terms[candidate];
+      std::string_view text = snap->Text(record.text_offset, record.text_length);
+      if (text.size() > term.size() && text.find(term) != std::string_view::npos) {
+        accumulate(record, EXPANSION_WEIGHT);
+        ++expansions;
+      }
+    }
+  }
+
+  struct Candidate {
+    float score;
+    ChunkRecord chunk;
+    std::string relative;
+    int64_t mtime;
+    uint64_t size;
+  };
+  std::vector<Candidate> candidates;
+
+  // Best chunks of the mapped index
+  size_t n_base = std::min(touched.size(), MAX_CANDIDATES);
+  std::partial_sort(touched.begin(), touched.begin() + n_base, touched.end(),
+                    [&](uint32_t a, uint32_t b) { return scores[a] > scores[b]; });
+  for (size_t c = 0; c < n_base; ++c) {
+    const ChunkRecord &chunk = snap->chunks[touched[c]];
+    if (chunk.file >= header.n_files) {
+      continue;
+    }
+    const FileRecord &file = snap->files[chunk.file];
+    candidates.push_back({scores[touched[c]], chunk,
+                          std::string(snap->Text(file.path_offset, file.path_length)),
+                          file.mtime, file.size});
+  }
+
+  // Overlay chunks are few; score them directly
+  for (const auto &entry : overlay->files) {
+    const OverlayFile &file = *entry.second;
+    if (file.removed) {
+      continue;
+    }
+    for (const auto &chunk : file.chunks) {
+      float score = 0.0f;
+      for (const auto &term : chunk.terms) {
+        float weight = 0.0f;
+        if (std::binary_search(terms.begin(), terms.end(), term.first)) {
+          weight = 1.0f;
+        } else {
+          for (const auto &q : terms) {
+            if (q.size() >= MIN_EXPANSION_LENGTH && term.first.size() > q.size() &&
+                term.first.find(q) != std::string::npos) {
+              weight = EXPANSION_WEIGHT;
+              break;
+            }
+          }
+        }
+        if (weight > 0.0f) {
+          const TermRecord *record = snap->FindTerm(term.first);
+          score += weight * idf(record ? record->df : 1) *
+                   bm25(static_cast<float>(term.second), chunk.record.n_terms);
+        }
+      }
+      if (score > 0.0f) {
+        candidates.push_back({score, chunk.record, entry.first, file.mtime, file.size});
+      }
+    }
+  }
+  std::sort(candidates.begin(), candidates.end(),
+            [](const Candidate &a, const Candidate &b) { return a.score > b.score; });
+
+  // Read the winning chunks, skipping files changed since they were indexed
+  std::unordered_map<std::string, bool> file_fresh;
+  ChangeBatch stale;
+  size_t used_tokens = 0;
+  for (const auto &candidate : candidates) {
+    fs::path path = fs::path(snap->root) / candidate.relative;
+
+    auto fresh = file_fresh.find(candidate.relative);
+    if (fresh == file_fresh.end()) {
+      std::error_code ec;
+      bool unchanged = fs::file_size(path, ec) == candidate.size && !ec &&
+                       FileMTime(path, ec) == candidate.mtime && !ec;
+      fresh = file_fresh.emplace(candidate.relative, unchanged).first;
+      if (!unchanged) {
+        stale.modified.push_back(path.string());
+      }
+    }
+    if (!fresh->second) {
+      continue;
+    }
+
+    const ChunkRecord &chunk = candidate.chunk;
+    size_t tokens = chunk.bytes / BYTES_PER_TOKEN + 1;
+    if (used_tokens + tokens > token_budget) {
+      continue; // A smaller chunk further down may still fit
+    }
+
+    Snippet snippet;
+    snippet.text.resize(chunk.bytes);
+    std::ifstream in(path, std::ios::binary);
+    in.seekg(chunk.offset);
+    if (!in.read(&snippet.text[0], chunk.bytes)) {
+      continue;
+    }
+    snippet.path = path.string();
+    snippet.start_line = chunk.start_line;
+    snippet.end_line = chunk.end_line;
+    snippet.score = candidate.score;
+    snippets.push_back(std::move(snippet));
+    used_tokens += tokens;
+  }
+
+  // A change the watcher missed: re-index those files for next time
+  if (!stale.modified.empty()) {
+    ApplyChanges(stale);
+  }
+  return snippets;
+}
+
+bool WorkspaceIndex::IsReady() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return snapshot_ != nullptr;
+}
+
+size_t WorkspaceIndex::FileCount() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return snapshot_ ? snapshot_->header->n_files : 0;
+}
+
+size_t WorkspaceIndex::ChunkCount() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return snapshot_ ? snapshot_->header->n_chunks : 0;
+}
+
+} // namespace tools
+} // namespace zweek
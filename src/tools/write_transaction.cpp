@@ -0,0 +1,295 @@
+#include "tools/write_transaction.hpp"
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <set>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace zweek {
+namespace tools {
+
+namespace fs = std::filesystem;
+
+namespace {
+
+std::string ErrnoText() { return std::strerror(errno); }
+
+#ifndef _WIN32
+// The process umask. umask(2) can only be read by setting it, which races
+// with other threads creating files, so it is taken from /proc where
+// available and otherwise read once during static initialization, before
+// any threads exist.
+mode_t ReadUmask() {
+  std::ifstream status("/proc/self/status");
+  std::string line;
+  while (std::getline(status, line)) {
+    if (line.compare(0, 6, "Umask:") == 0) {
+      return static_cast<mode_t>(std::strtoul(line.c_str() + 6, nullptr, 8));
+    }
+  }
+  mode_t mask = umask(0);
+  umask(mask);
+  return mask;
+}
+
+// Permission bits for a new file: what open(2) would give it
+const unsigned DEFAULT_MODE = static_cast<unsigned>(0666 & ~ReadUmask());
+
+unsigned DefaultMode() { return DEFAULT_MODE; }
+
+bool WriteAll(int fd, const std::string &content) {
+  const char *p = content.data();
+  size_t left = content.size();
+  while (left > 0) {
+    ssize_t n = write(fd, p, left);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    p += n;
+    left -= static_cast<size_t>(n);
+  }
+  return true;
+}
+
+// Make renames in a directory durable
+void SyncDirectory(const std::string &dir) {
+  int fd = open(dir.empty() ? "." : dir.c_str(), O_RDONLY | O_DIRECTORY);
+  if (fd >= 0) {
+    fsync(fd);
+    close(fd);
+  }
+}
+#endif
+
+} // namespace
+
+void WriteTransaction::Stage(const std::string &path, std::string content) {
+  // Symlinks are written through: the temp file goes beside the file the
+  // link points to and replaces that, leaving the link in place
+  std::error_code ec;
+  fs::path target = fs::weakly_canonical(path, ec);
+  std::string target_path = ec ? path : target.string();
+
+  for (auto &file : files_) {
+    if (file.target == target_path) {
+      file.content = std::move(content);
+      return;
+    }
+  }
+  StagedFile file;
+  file.path = path;
+  file.target = target_path;
+  file.content = std::move(content);
+  files_.push_back(std::move(file));
+}
+
+std::vector<std::string> WriteTransaction::Paths() const {
+  std::vector<std::string> paths;
+  for (const auto &file : files_) {
+    paths.push_back(file.path);
+  }
+  return paths;
+}
+
+bool WriteTransaction::WriteTemp(StagedFile &file) {
+  fs::path target(file.target);
+  std::error_code ec;
+  if (target.has_parent_path()) {
+    fs::create_directories(target.parent_path(), ec);
+  }
+  std::string prefix =
+      (target.parent_path() / ("." + target.filename().string() + ".zweek-")).string();
+
+#ifdef _WIN32
+  file.temp_path = prefix + "tmp";
+  std::ofstream out(file.temp_path, std::ios::binary | std::ios::trunc);
+  if (!out || !out.write(file.content.data(), static_cast<std::streamsize>(file.content.size()))) {
+    error_ = "cannot write " + file.temp_path;
+    return false;
+  }
+  return true;
+#else
+  std::string temp = prefix + "XXXXXX";
+  file.fd = mkstemp(&temp[0]);
+  if (file.fd < 0) {
+    error_ = "cannot create temp file for " + file.path + ": " + ErrnoText();
+    return false;
+  }
+  file.temp_path = temp;
+  if (!WriteAll(file.fd, file.content) ||
+      fchmod(file.fd, static_cast<mode_t>(file.existed ? file.mode : DefaultMode())) != 0) {
+    error_ = "cannot write " + file.path + ": " + ErrnoText();
+    return false;
+  }
+#ifdef __linux__
+  // Start writeback now; the fdatasync pass below then waits on I/O that
+  // is already in flight for every file instead of one file at a time
+  sync_file_range(file.fd, 0, 0, SYNC_FILE_RANGE_WRITE);
+#endif
+  return true;
+#endif
+}
+
+void WriteTransaction::RollBack() {
+  for (auto &file : files_) {
+#ifndef _WIN32
+    if (file.fd >= 0) {
+      close(file.fd);
+      file.fd = -1;
+    }
+#endif
+    std::error_code ec;
+    if (!file.renamed) {
+      if (!file.temp_path.empty()) {
+        fs::remove(file.temp_path, ec);
+      }
+      continue;
+    }
+    if (!file.existed) {
+      fs::remove(file.target, ec);
+      continue;
+    }
+    // Put the original back the same way it was replaced
+    StagedFile restore;
+    restore.path = file.path;
+    restore.target = file.target;
+    restore.content = file.original;
+    restore.existed = true;
+    restore.mode = file.mode;
+    if (WriteTemp(restore)) {
+#ifndef _WIN32
+      fdatasync(restore.fd);
+      close(restore.fd);
+#endif
+      fs::rename(restore.temp_path, restore.target, ec);
+    }
+#ifndef _WIN32
+    else if (restore.fd >= 0) {
+      close(restore.fd);
+    }
+#endif
+    if (ec && !restore.temp_path.empty()) {
+      fs::remove(restore.temp_path, ec);
+    }
+  }
+}
+
+bool WriteTransaction::Commit(const SnapshotCallback &snapshot) {
+  error_.clear();
+  bool ok = true;
+
+  // Originals, for the history snapshot and for rolling back
+  for (auto &file : files_) {
+    std::error_code ec;
+    fs::file_status status = fs::status(file.target, ec);
+    if (!fs::exists(status)) {
+      continue;
+    }
+    if (!fs::is_regular_file(status)) {
+      error_ = file.path + " is not a regular file";
+      ok = false;
+      break;
+    }
+    // An original that can't be read could neither be snapshotted nor
+    // restored, so it is never replaced
+    std::ifstream in(file.target, std::ios::binary);
+    if (!in.is_open()) {
+      error_ = "cannot read " + file.path;
+      ok = false;
+      break;
+    }
+    file.existed = true;
+    file.original.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    if (in.bad()) {
+      error_ = "cannot read " + file.path;
+      ok = false;
+      break;
+    }
+#ifndef _WIN32
+    struct stat st;
+    file.mode = stat(file.target.c_str(), &st) == 0 ? static_cast<unsigned>(st.st_mode & 07777)
+                                                    : DefaultMode();
+#endif
+  }
+
+  for (auto &file : files_) {
+    if (!ok) {
+      break;
+    }
+    if (!WriteTemp(file)) {
+      ok = false;
+      break;
+    }
+  }
+
+#ifndef _WIN32
+  // One flush pass over all temp files
+  for (auto &file : files_) {
+    if (!ok) {
+      break;
+    }
+    if (fdatasync(file.fd) != 0) {
+      error_ = "cannot flush " + file.path + ": " + ErrnoText();
+      ok = false;
+    }
+  }
+  for (auto &file : files_) {
+    if (file.fd >= 0) {
+      close(file.fd);
+      file.fd = -1;
+    }
+  }
+#endif
+
+  std::set<std::string> directories;
+  for (auto &file : files_) {
+    if (!ok) {
+      break;
+    }
+    std::error_code ec;
+    fs::rename(file.temp_path, file.target, ec);
+    if (ec) {
+      error_ = "cannot replace " + file.path + ": " + ec.message();
+      ok = false;
+      break;
+    }
+    file.renamed = true;
+    directories.insert(fs::path(file.target).parent_path().string());
+  }
+
+  if (!ok) {
+    std::string error = error_;
+    RollBack();
+    error_ = error;
+    files_.clear();
+    return false;
+  }
+
+#ifndef _WIN32
+  for (const auto &dir : directories) {
+    SyncDirectory(dir);
+  }
+#endif
+  if (snapshot) {
+    for (const auto &file : files_) {
+      if (file.existed) {
+        snapshot(file.path, file.original);
+      }
+    }
+  }
+  files_.clear();
+  return true;
+}
+
+} // namespace tools
+} // namespace zweek
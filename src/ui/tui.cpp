@@ -233,6 +233,12 @@ void TUI::SetCurrentDirectory(const std::string &path) {
   screen_.PostEvent(Event::Custom);
 }
 
+void TUI::SetStatus(const std::string &status) {
+  // Apply on the UI thread; background workers report progress here
+  screen_.Post([this, status] { state_.status_message = status; });
+  screen_.PostEvent(Event::Custom);
+}
+
 void TUI::SetOnSubmit(std::function<void(const std::string &)> callback) {
   on_submit_ = callback;
 }
@@ -247,6 +253,10 @@ void TUI::SetOnModeSwitch(std::function<void(Mode)> callback) {
   on_mode_switch_ = callback;
 }
 
+void TUI::SetOnInterrupt(std::function<void()> callback) {
+  on_interrupt_ = callback;
+}
+
 Component TUI::CreateLayout() {
   auto terminal_view = CreateTerminalView();
   auto mode_selector = CreateModeSelector();
@@ -523,6 +533,7 @@ Component TUI::CreateModeSelector() {
 
     return hbox({text(mode_text) | color(Color::Cyan), separator(),
                  text(" " + state_.current_directory + " ") | color(Color::Yellow), separator(),
+                 text(" " + state_.status_message + " ") | color(Color::GrayLight), separator(),
                  text(help_text) | dim});
   });
 }
@@ -578,7 +589,9 @@ Component TUI::CreateInputLine() {
         state_.suggestion_index = -1;
         return true;
       }
-      state_.interrupt_inference_.store(true);
+      if (on_interrupt_) {
+        on_interrupt_();
+      }
       state_.conversation_history.push_back("[Interrupting...]");
       return true;
     }
@@ -0,0 +1,61 @@
+#define NOMINMAX
+#include "util/file_lock.hpp"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
+#endif
+
+namespace zweek {
+namespace util {
+
+#ifdef _WIN32
+FileLock::FileLock(const std::string &path) {
+  HANDLE file = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE,
+                            FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL,
+                            OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (file == INVALID_HANDLE_VALUE) {
+    return;
+  }
+  handle_ = file;
+  OVERLAPPED overlapped = {};
+  locked_ = LockFileEx(file, LOCKFILE_EXCLUSIVE_LOCK, 0, MAXDWORD, MAXDWORD, &overlapped) != 0;
+}
+
+FileLock::~FileLock() {
+  if (!handle_) {
+    return;
+  }
+  if (locked_) {
+    OVERLAPPED overlapped = {};
+    UnlockFileEx(handle_, 0, MAXDWORD, MAXDWORD, &overlapped);
+  }
+  CloseHandle(handle_);
+}
+#else
+FileLock::FileLock(const std::string &path) {
+  fd_ = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  if (fd_ < 0) {
+    return;
+  }
+  int rc;
+  do {
+    rc = flock(fd_, LOCK_EX);
+  } while (rc != 0 && errno == EINTR);
+  locked_ = rc == 0;
+}
+
+FileLock::~FileLock() {
+  // Closing the descriptor releases the lock
+  if (fd_ >= 0) {
+    close(fd_);
+  }
+}
+#endif
+
+} // namespace util
+} // namespace zweek
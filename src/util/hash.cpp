@@ -0,0 +1,70 @@
+#include "util/hash.hpp"
+#include <fstream>
+#include <vector>
+
+namespace zweek {
+namespace util {
+
+uint64_t HashBytes(const void *data, size_t size, uint64_t seed) {
+  constexpr uint64_t FNV_PRIME = 0x100000001b3ULL;
+
+  const unsigned char *bytes = static_cast<const unsigned char *>(data);
+  uint64_t hash = seed;
+  for (size_t i = 0; i < size; ++i) {
+    hash ^= bytes[i];
+    hash *= FNV_PRIME;
+  }
+  return hash;
+}
+
+uint64_t HashFileSampled(const std::string &path) {
+  constexpr std::streamoff SAMPLE_SIZE = 1 << 20;
+
+  std::ifstream file(path, std::ios::binary | std::ios::ate);
+  if (!file.is_open()) {
+    return 0;
+  }
+
+  const std::streamoff size = file.tellg();
+  uint64_t hash = HashCombine(HASH_SEED, static_cast<uint64_t>(size));
+
+  std::vector<char> buffer(SAMPLE_SIZE);
+  const std::streamoff offsets[] = {0, size / 2, size - SAMPLE_SIZE};
+  for (std::streamoff offset : offsets) {
+    if (offset < 0) {
+      offset = 0;
+    }
+    file.clear();
+    file.seekg(offset);
+    file.read(buffer.data(), SAMPLE_SIZE);
+    hash = HashBytes(buffer.data(), static_cast<size_t>(file.gcount()), hash);
+  }
+  return hash;
+}
+
+uint64_t HashFile(const std::string &path) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file.is_open()) {
+    return 0;
+  }
+
+  uint64_t hash = HASH_SEED;
+  std::vector<char> buffer(1 << 16);
+  while (file.read(buffer.data(), buffer.size()) || file.gcount() > 0) {
+    hash = HashBytes(buffer.data(), static_cast<size_t>(file.gcount()), hash);
+  }
+  return hash;
+}
+
+std::string ToHex(uint64_t value) {
+  static const char DIGITS[] = "0123456789abcdef";
+  std::string out(16, '0');
+  for (int i = 15; i >= 0; --i) {
+    out[i] = DIGITS[value & 0xf];
+    value >>= 4;
+  }
+  return out;
+}
+
+} // namespace util
+} // namespace zweek
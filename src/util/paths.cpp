@@ -0,0 +1,39 @@
+#define NOMINMAX
+#include "util/paths.hpp"
+#include <cstdlib>
+#include <filesystem>
+
+#ifdef _WIN32
+#include <shlobj.h>
+#endif
+
+namespace zweek {
+namespace util {
+
+#ifdef _WIN32
+std::string GetZweekDirectory() {
+  char path[MAX_PATH];
+  if (SUCCEEDED(SHGetFolderPathA(NULL, CSIDL_PROFILE, NULL, 0, path))) {
+    return std::string(path) + "\\.zweek";
+  }
+  return "."; // Fallback
+}
+#else
+std::string GetZweekDirectory() {
+  const char *home = getenv("HOME");
+  if (home) {
+    return std::string(home) + "/.zweek";
+  }
+  return "."; // Fallback
+}
+#endif
+
+std::string GetZweekSubdirectory(const std::string &name) {
+  std::filesystem::path dir = std::filesystem::path(GetZweekDirectory()) / name;
+  std::error_code ec;
+  std::filesystem::create_directories(dir, ec);
+  return dir.string();
+}
+
+} // namespace util
+} // namespace zweek
@@ -1,4 +1,8 @@
 #include "tools/tool_executor.hpp"
+#include "coder/stream_validator.hpp"
+#include "tools/compile_database.hpp"
+#include "tools/search_engine.hpp"
+#include <algorithm>
 #include <iostream>
 #include <cassert>
 #include <filesystem>
@@ -49,7 +53,384 @@ void TestFileOperations() {
   std::cout << "TestFileOperations passed!" << std::endl;
 }
 
+void TestListDirRecursive() {
+  ToolExecutor executor;
+  std::string test_dir = "test_walk_env";
+  
+  if (fs::exists(test_dir)) {
+    fs::remove_all(test_dir);
+  }
+  fs::create_directory(test_dir);
+  executor.SetWorkingDirectory(test_dir);
+  
+  executor.WriteFile(".gitignore", "*.log\n/generated/\n!keep.log\n");
+  executor.WriteFile("main.cpp", "int main() {}");
+  executor.WriteFile("debug.log", "ignored");
+  executor.WriteFile("keep.log", "re-included");
+  executor.WriteFile("generated/out.cpp", "ignored");
+  executor.WriteFile("src/util.cpp", "int util();");
+  executor.WriteFile("src/generated/ok.cpp", "only the root generated/ is ignored");
+  executor.WriteFile("src/.gitignore", "*.tmp\n");
+  executor.WriteFile("src/scratch.tmp", "ignored");
+  executor.WriteFile("build/app.cpp", "build output");
+  executor.WriteFile("logo.png", "binary by extension");
+  executor.WriteFile("blob.dat", std::string("a\0b", 3));
+  
+  std::vector<std::string> expected = {".gitignore", "keep.log", "main.cpp",
+                                       "src/.gitignore", "src/generated/ok.cpp",
+                                       "src/util.cpp"};
+  assert(executor.ListDirRecursive(".") == expected);
+  
+  // Second walk is served from the listing cache and must see new files
+  executor.WriteFile("src/new.cpp", "int added();");
+  auto files = executor.ListDirRecursive("src");
+  assert(std::find(files.begin(), files.end(), "new.cpp") != files.end());
+  
+  fs::remove_all(test_dir);
+  
+  std::cout << "TestListDirRecursive passed!" << std::endl;
+}
+
+void TestReadFileCache() {
+  ToolExecutor executor;
+  std::string test_dir = "test_cache_env";
+  
+  if (fs::exists(test_dir)) {
+    fs::remove_all(test_dir);
+  }
+  fs::create_directory(test_dir);
+  executor.SetWorkingDirectory(test_dir);
+  
+  executor.WriteFile("small.txt", "first");
+  std::string large(100 * 1024, 'x'); // Large enough to be memory-mapped
+  executor.WriteFile("large.txt", large);
+  
+  // Repeated reads share one cached copy
+  auto small = executor.ReadFileShared("small.txt");
+  assert(small && small->Text() == "first");
+  assert(executor.ReadFileShared("small.txt") == small);
+  assert(executor.ReadFile("large.txt") == large);
+  assert(executor.GetFileCache().Count() == 2);
+  
+  // Changed behind the executor's back: the stat check catches it, while
+  // the old handle stays valid
+  std::ofstream(fs::path(test_dir) / "small.txt") << "second, longer";
+  assert(executor.ReadFile("small.txt") == "second, longer");
+  assert(small->Text() == "first");
+  
+  // Replaced by rename (new inode), as editors save
+  std::ofstream(fs::path(test_dir) / "large.tmp") << "replaced";
+  fs::rename(fs::path(test_dir) / "large.tmp", fs::path(test_dir) / "large.txt");
+  assert(executor.ReadFile("large.txt") == "replaced");
+  
+  fs::remove(fs::path(test_dir) / "small.txt");
+  assert(!executor.ReadFileShared("small.txt"));
+  
+  fs::remove_all(test_dir);
+  
+  std::cout << "TestReadFileCache passed!" << std::endl;
+}
+
+void TestRangedReads() {
+  ToolExecutor executor;
+  std::string test_dir = "test_ranged_env";
+  
+  if (fs::exists(test_dir)) {
+    fs::remove_all(test_dir);
+  }
+  fs::create_directory(test_dir);
+  executor.SetWorkingDirectory(test_dir);
+  
+  // Big enough to go through the line index, with no trailing newline
+  std::string big;
+  const int n_lines = 100000;
+  for (int i = 1; i <= n_lines; ++i) {
+    big += "line " + std::to_string(i);
+    if (i < n_lines) {
+      big += "\n";
+    }
+  }
+  executor.WriteFile("big.txt", big);
+  executor.WriteFile("small.txt", "a\nb\nc\n");
+  
+  assert(executor.CountLines("big.txt") == n_lines);
+  assert(executor.ReadLines("big.txt", 1, 1) == "line 1\n");
+  assert(executor.ReadLines("big.txt", 128, 130) == "line 128\nline 129\nline 130\n");
+  assert(executor.ReadLines("big.txt", n_lines, n_lines + 5) == "line 100000");
+  assert(executor.ReadLines("big.txt", n_lines + 1, n_lines + 2).empty());
+  assert(executor.ReadBytes("big.txt", 7, 6) == "line 2");
+  
+  assert(executor.CountLines("small.txt") == 3);
+  assert(executor.ReadLines("small.txt", 2, 9) == "b\nc\n");
+  
+  // Streaming sees every byte in order
+  std::string streamed;
+  bool complete = executor.StreamFile("big.txt", [&](std::string_view chunk) {
+    streamed.append(chunk);
+    return true;
+  });
+  assert(complete);
+  assert(streamed == big);
+  
+  // Rewritten file: the cached index is rebuilt
+  executor.WriteFile("big.txt", "x\n" + big);
+  assert(executor.ReadLines("big.txt", 2, 2) == "line 1\n");
+  
+  fs::remove_all(test_dir);
+  
+  std::cout << "TestRangedReads passed!" << std::endl;
+}
+
+void TestGetDiff() {
+  ToolExecutor executor;
+  std::string test_dir = "test_diff_env";
+  
+  if (fs::exists(test_dir)) {
+    fs::remove_all(test_dir);
+  }
+  fs::create_directory(test_dir);
+  executor.SetWorkingDirectory(test_dir);
+  
+  std::string original;
+  for (int i = 1; i <= 20; ++i) {
+    original += "line " + std::to_string(i) + "\n";
+  }
+  executor.WriteFile("code.txt", original);
+  assert(executor.GetDiff("code.txt", original).empty());
+  
+  // One changed line, one insertion far away: two hunks with 3 lines of context
+  std::string changed = original;
+  changed.replace(changed.find("line 5\n"), 7, "line five\n");
+  changed += "line 21\n";
+  std::string expected =
+      "--- code.txt\n+++ code.txt\n"
+      "@@ -2,7 +2,7 @@\n line 2\n line 3\n line 4\n-line 5\n+line five\n line 6\n line 7\n line 8\n"
+      "@@ -18,3 +18,4 @@\n line 18\n line 19\n line 20\n+line 21\n";
+  assert(executor.GetDiff("code.txt", changed) == expected);
+  
+  // Missing final newline is reported
+  std::string trimmed = original.substr(0, original.size() - 1);
+  std::string diff = executor.GetDiff("code.txt", trimmed);
+  assert(diff.find("-line 20\n+line 20\n\\ No newline at end of file\n") != std::string::npos);
+  
+  fs::remove_all(test_dir);
+  
+  std::cout << "TestGetDiff passed!" << std::endl;
+}
+
+void TestApplyEdits() {
+  ToolExecutor executor;
+  std::string test_dir = "test_patch_env";
+  
+  if (fs::exists(test_dir)) {
+    fs::remove_all(test_dir);
+  }
+  fs::create_directory(test_dir);
+  executor.SetWorkingDirectory(test_dir);
+  
+  executor.WriteFile("main.cpp",
+                     "int main() {\n"
+                     "    int count = 1;\n"
+                     "    log(\"start\");\n"
+                     "    run(count, 2);\n"
+                     "    log(\"start\");\n"
+                     "    return 0;\n"
+                     "}\n");
+  
+  // Whitespace drift and unindented snippets still land, re-indented; a
+  // typo is matched fuzzily; a repeated snippet is refused
+  auto result = executor.ApplyEdits("main.cpp", {
+      {"int count = 1;\nlog(\"start\");", "int count = 3;\nlog(\"begin\");"},
+      {"run(count, 2);\n  log(\"start\");   return 0;", "run(count, 4);\nreturn count;"},
+      {"log(\"start\");", "log(\"again\");"},
+      {"retrun(count, 2);  // missing", "x"},
+  });
+  assert(result.outcomes[0].status == PatchStatus::Applied);
+  assert(result.outcomes[1].status == PatchStatus::Applied);
+  assert(result.outcomes[2].status == PatchStatus::Ambiguous);
+  assert(result.outcomes[3].status == PatchStatus::NotFound);
+  assert(result.n_applied == 2);
+  assert(executor.ReadFile("main.cpp") ==
+         "int main() {\n"
+         "    int count = 3;\n"
+         "    log(\"begin\");\n"
+         "    run(count, 4);\n"
+         "    return count;\n"
+         "}\n");
+  
+  result = executor.ApplyEdits("main.cpp", {{"int count = 3;\n    log(\"begn\");", "int count = 5;"}});
+  assert(result.outcomes[0].status == PatchStatus::AppliedFuzzy);
+  assert(executor.ReadFile("main.cpp").find("    int count = 5;\n    run(") != std::string::npos);
+  
+  // A match starting mid-line keeps the replacement's own indentation
+  executor.WriteFile("inline.cpp", "void f() { if (x) {\n    y();\n  } }\n");
+  result = executor.ApplyEdits("inline.cpp", {{"    if (x) {\n      y();\n    }",
+                                               "    if (x) {\n      z();\n    }"}});
+  assert(result.n_applied == 1);
+  assert(executor.ReadFile("inline.cpp") == "void f() { if (x) {\n      z();\n    } }\n");
+  
+  fs::remove_all(test_dir);
+  
+  std::cout << "TestApplyEdits passed!" << std::endl;
+}
+
+void TestWriteFiles() {
+  ToolExecutor executor;
+  std::string test_dir = "test_txn_env";
+  
+  if (fs::exists(test_dir)) {
+    fs::remove_all(test_dir);
+  }
+  fs::create_directory(test_dir);
+  executor.SetWorkingDirectory(test_dir);
+  
+  std::vector<std::pair<std::string, std::string>> snapshots;
+  executor.SetSnapshotCallback([&](const std::string &path, const std::string &original) {
+    snapshots.push_back({fs::path(path).filename().string(), original});
+  });
+  
+  executor.WriteFile("a.txt", "a1");
+  assert(snapshots.empty()); // New file: nothing replaced
+  
+  // Both land together; the replaced contents are reported
+  bool written = executor.WriteFiles({{"a.txt", "a2"}, {"src/b.txt", "b1"}});
+  assert(written);
+  assert(executor.ReadFile("a.txt") == "a2");
+  assert(executor.ReadFile("src/b.txt") == "b1");
+  assert(snapshots.size() == 1 && snapshots[0].first == "a.txt" && snapshots[0].second == "a1");
+  
+  // The second target can't be replaced, so neither file changes
+  fs::create_directories(fs::path(test_dir) / "blocked" / "inner");
+  std::string error;
+  written = executor.WriteFiles({{"a.txt", "a3"}, {"blocked", "x"}}, &error);
+  assert(!written);
+  assert(!error.empty());
+  assert(executor.ReadFile("a.txt") == "a2");
+  assert(snapshots.size() == 1);
+  
+#ifndef _WIN32
+  // A symlinked file is written through; the link stays a link
+  fs::create_symlink("a.txt", fs::path(test_dir) / "link.txt");
+  written = executor.WriteFiles({{"link.txt", "a4"}});
+  assert(written);
+  assert(fs::is_symlink(fs::path(test_dir) / "link.txt"));
+  assert(executor.ReadFile("a.txt") == "a4");
+#endif
+  
+  // No temp files left behind
+  bool clean = true;
+  for (const auto &entry : fs::recursive_directory_iterator(test_dir)) {
+    if (entry.path().filename().string().find(".zweek-") != std::string::npos) {
+      clean = false;
+    }
+  }
+  assert(clean);
+  
+  fs::remove_all(test_dir);
+  
+  std::cout << "TestWriteFiles passed!" << std::endl;
+}
+
+void TestStreamValidator() {
+  using zweek::coder::StreamValidator;
+  StreamValidator validator;
+  
+  // Brackets in comments and literals don't count, wherever the pieces split
+  bool ok = true;
+  for (const char *piece : {"int f(int a) {\n  // ) ] }\n  const char *s = \"(\\\"\";",
+                            "\n  char c = '}';\n  return a[0]; /* { */\n", "}\n"}) {
+    ok = validator.Feed(piece) && ok;
+  }
+  assert(ok);
+  assert(!validator.IsMalformed());
+  
+  // A closer that doesn't match the innermost opener
+  validator.Reset();
+  ok = validator.Feed("void g() { call(1;");
+  assert(ok);
+  ok = validator.Feed(" }");
+  assert(!ok);
+  assert(validator.Reason() == "'}' closes '('");
+  
+  // A string literal only runs past its line through a backslash
+  validator.Reset();
+  ok = validator.Feed("auto s = \"one \\\ntwo\";\n");
+  assert(ok);
+  ok = validator.Feed("auto t = \"three\nfour\";\n");
+  assert(!ok);
+  
+  // An edit may start inside a block, so a couple of stray closers pass
+  validator.Reset();
+  ok = validator.Feed("  x = 1;\n}\n}\n");
+  assert(ok);
+  ok = validator.Feed("}\n");
+  assert(!ok);
+  
+  // Raw strings are skipped, and prose between fenced blocks isn't lexed
+  validator.Reset();
+  ok = validator.Feed("```cpp\nauto r = R\"x(})\")x\";\n```\nThat's it (see above :)\n"
+                      "```cpp\nint y = (1 + 2);\n```\n");
+  assert(ok);
+  
+  // Output stuck in a loop
+  validator.Reset();
+  for (int i = 0; i < 100 && ok; ++i) {
+    ok = validator.Feed("x = x + 1;\n");
+  }
+  assert(!ok);
+  assert(validator.Reason() == "output is repeating itself");
+  
+  std::cout << "TestStreamValidator passed!" << std::endl;
+}
+
+void TestRequiredLiteral() {
+  assert(SearchEngine::RequiredLiteral("hello\\.world") == "hello.world");
+  assert(SearchEngine::RequiredLiteral("abc\\d+") == "abc");
+  assert(SearchEngine::RequiredLiteral("foo|bar").empty());
+  
+  // Escapes that stand for a character end the literal rather than being
+  // taken as the letter itself
+  assert(SearchEngine::RequiredLiteral("ab\\x41cd") == "ab");
+  assert(SearchEngine::RequiredLiteral("foo\\u0041bar") == "foo");
+  assert(SearchEngine::RequiredLiteral("xy\\cJzz") == "xy");
+  assert(SearchEngine::RequiredLiteral("ab\\012cd") == "ab");
+  assert(SearchEngine::RequiredLiteral("(ab)\\1cd") == "cd");
+  
+  std::cout << "TestRequiredLiteral passed!" << std::endl;
+}
+
+void TestCompileCommandParsing() {
+  std::vector<std::string> expected = {"g++", "-DNAME=\"a b\"", "-I/tmp/my dir",
+                                       "it's", "", "-c", "x.cpp"};
+  auto args = CompileDatabase::SplitCommand(
+      "g++  -DNAME=\"\\\"a b\\\"\"\t-I/tmp/my\\ dir \"it's\" '' -c   x.cpp ");
+  assert(args == expected);
+  assert(CompileDatabase::SplitCommand("  \t").empty());
+  
+  std::string name;
+  assert(CompileDatabase::ParseIncludeLine("#include <vector>", name) == '<');
+  assert(name == "vector");
+  assert(CompileDatabase::ParseIncludeLine("  #  include \"tools/x.hpp\" // c", name) == '"');
+  assert(name == "tools/x.hpp");
+  assert(CompileDatabase::ParseIncludeLine("#include MACRO", name) == 0);
+  assert(CompileDatabase::ParseIncludeLine("// #include <vector>", name) == 0);
+  assert(CompileDatabase::ParseIncludeLine("#include <vector", name) == 0);
+  assert(CompileDatabase::ParseIncludeLine("#import <vector>", name) == 0);
+  assert(name == "tools/x.hpp");
+  
+  std::cout << "TestCompileCommandParsing passed!" << std::endl;
+}
+
 int main() {
   TestFileOperations();
+  TestListDirRecursive();
+  TestReadFileCache();
+  TestRangedReads();
+  TestGetDiff();
+  TestApplyEdits();
+  TestWriteFiles();
+  TestStreamValidator();
+  TestRequiredLiteral();
+  TestCompileCommandParsing();
   return 0;
 }